@@ -11,6 +11,7 @@
 
 #include <iostream>
 #include <cstdint>
+#include <algorithm>
 #include "Configuration.h"
 
 
@@ -217,6 +218,21 @@ void Configuration::ParseSessionFile(const std::string &file)
                             meter.hdlc.addr_len = static_cast<unsigned int>(val.GetInteger());
                         }
 
+                        // Proposed in the SNRM, the meter may answer with smaller values
+                        val = hdlcObj.FindValue("max_info_field");
+                        if (val.IsInteger())
+                        {
+                            unsigned int size = std::min(static_cast<unsigned int>(val.GetInteger()), HDLC_MAX_INFO_SIZE);
+                            meter.hdlc.max_info_field_rx = size;
+                            meter.hdlc.max_info_field_tx = size;
+                        }
+
+                        val = hdlcObj.FindValue("window");
+                        if (val.IsInteger())
+                        {
+                            meter.hdlc.window_rx = std::min(static_cast<unsigned int>(val.GetInteger()), HDLC_MAX_WINDOW);
+                        }
+
                         val = hdlcObj.FindValue("test_addr");
                         if (val.IsBoolean())
                         {
@@ -260,6 +276,27 @@ void Configuration::ParseComFile(const std::string &file, Transport::Params &com
                 }
             }
         }
+
+        // Wrapper over UDP instead of the serial port
+        JsonValue ipObj = json.FindValue("ip");
+        if (ipObj.IsObject())
+        {
+            JsonValue val = ipObj.FindValue("transport");
+            if (val.IsString() && (val.GetString() == "udp"))
+            {
+                comm.type = Transport::UDP_IP;
+                val = ipObj.FindValue("address");
+                if (val.IsString())
+                {
+                    comm.address = val.GetString();
+                }
+                val = ipObj.FindValue("port");
+                if (val.IsInteger())
+                {
+                    comm.port = std::to_string(val.GetInteger());
+                }
+            }
+        }
     }
     else
     {
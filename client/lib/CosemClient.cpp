@@ -15,6 +15,7 @@
 #include <ctime>
 #include <cstring>
 #include <cstdlib>
+#include <algorithm>
 #include <fstream>
 
 
@@ -28,6 +29,7 @@
 #include "csm_services.h"
 #include "csm_axdr_codec.h"
 #include "csm_definitions.h"
+#include "csm_llc.h"
 #include "clock.h"
 
 
@@ -36,6 +38,7 @@ CosemClient::CosemClient()
     , mCosemState(CONNECT_HDLC)
     , mReadIndex(0U)
     , mMeterIndex(0U)
+    , mWrapper(false)
 {
 
 }
@@ -54,6 +57,9 @@ bool CosemClient::Initialize(const std::string &commFile, const std::string &obj
     mConf.ParseObjectsFile(objectsFile);
     mConf.ParseSessionFile(meterFile);
 
+    // The UDP server of the meter speaks the wrapper protocol, one WPDU per datagram
+    mWrapper = (params.type == Transport::UDP_IP);
+
     if (mConf.modem.useModem)
     {
         std::cout << "** Using Modem device" << std::endl;
@@ -100,7 +106,7 @@ bool CosemClient::HdlcProcess(Meter &meter, const std::string &send, std::string
 {
     bool retCode = false;
 
-    csm_array_init(&mRcvArray, (uint8_t*)&mRcvBuffer[0], cBufferSize, 0U, 0U);
+    hdlc_deframer_init(&mDeframer, (uint8_t*)&mRcvBuffer[0], cBufferSize);
 
     bool loop = true;
 
@@ -146,111 +152,87 @@ bool CosemClient::HdlcProcess(Meter &meter, const std::string &send, std::string
 
         if (mTransport.WaitForData(data, timeout))
         {
-            // We have something, add buffer
-            if (!csm_array_write_buff(&mRcvArray, (const uint8_t*)data.c_str(), data.size()))
-            {
-                loop = false;
-                retCode = false;
-            }
+            // The frames are cut as the bytes arrive, with their HCS and FCS checked
+            const uint8_t *chunk = (const uint8_t*)data.c_str();
+            uint32_t size = data.size();
 
-            if (loop)
+            while (loop && (size > 0U))
             {
-                uint8_t *ptr = csm_array_rd_current(&mRcvArray);
-                uint32_t size = csm_array_unread(&mRcvArray);
+                uint32_t used = 0U;
+                int frame = hdlc_deframer_push(&mDeframer, chunk, size, &used);
+                chunk += used;
+                size -= used;
 
+                // A partial frame waits for the next data
+                if (frame <= 0)
+                {
+                    continue;
+                }
 
-//                printf("Ptr: 0x%08X, Unread: %d\r\n", (unsigned long)ptr, size);
-//
-//                puts("Sent frame: ");
-//                print_hex(mSendCopy.c_str(), mSendCopy.size());
-//                puts("\r\n");
-
-                // the frame seems correct, check echo
-                if (dataSent.compare(0, dataSent.size(), (char*)ptr, size) == 0)
+                if ((dataSent.size() == (size_t)frame) && (memcmp(dataSent.data(), mDeframer.buffer, frame) == 0))
                 {
-                    // remove echo from the string
-                    csm_array_reader_advance(&mRcvArray, size);
-                    ptr = csm_array_rd_current(&mRcvArray);
-                    size = csm_array_unread(&mRcvArray);
                     std::cout << "Echo canceled!" << std::endl;
                 }
-
-//                puts("Decoding: ");
-//                print_hex((const char *)ptr, size);
-//                puts("\r\n");
-
-                do
+                else
                 {
                     hdlc.sender = HDLC_SERVER;
-                    int ret = hdlc_decode(&hdlc, ptr, size);
-                    if (ret == HDLC_OK)
+                    if (hdlc_decode(&hdlc, mDeframer.buffer, frame) != HDLC_OK)
                     {
+                        std::cout << "Frame not for us, dropped" << std::endl;
+                    }
+                    else if (hdlc.type == HDLC_PACKET_TYPE_RR)
+                    {
+                        // Send again the request
+                        puts("RR sync, send again\r\n");
+                        dataToSend = send;
+                    }
+                    else if ((hdlc.type == HDLC_PACKET_TYPE_I) && (hdlc.sss != meter.hdlc.rrr))
+                    {
+                        // A frame of the window has been lost: drop the next ones until the server sends them again
+                        std::cout << "Out of sequence packet " << (int)hdlc.sss << ", expected " << (int)meter.hdlc.rrr << std::endl;
 
-
-                        if (hdlc.type == HDLC_PACKET_TYPE_RR)
+                        if (hdlc.poll_final == 1U)
                         {
-                           // Send again the request
-                            puts("RR sync, send again\r\n");
-                           dataToSend = send;
-                           size = 0U;
+                            // End of the window: RR with the first frame missing
+                            uint32_t rr_size = hdlc_encode_rr(&meter.hdlc, (uint8_t*)&mSndBuffer[0], cBufferSize);
+                            dataToSend.assign(&mSndBuffer[0], rr_size);
                         }
-                        else
-                        {
-                            std::cout << "Data packet" << std::endl;
-                            // God packet! Copy to cosem data
-                            rcv.append((const char*)&ptr[hdlc.data_index], hdlc.data_size);
-
-                            // Continue with next one
-                            csm_array_reader_advance(&mRcvArray, hdlc.frame_size);
+                    }
+                    else
+                    {
+                        std::cout << "Data packet" << std::endl;
+                        // God packet! Copy to cosem data
+                        rcv.append((const char*)&mDeframer.buffer[hdlc.data_index], hdlc.data_size);
 
-                            if (hdlc.type == HDLC_PACKET_TYPE_I)
-                            {
-                                // ack last hdlc frame
-                                if (hdlc.sss == 7U)
-                                {
-                                    meter.hdlc.rrr = 0U;
-                                }
-                                else
-                                {
-                                    meter.hdlc.rrr = hdlc.sss + 1;
-                                }
-                            }
+                        if (hdlc.type == HDLC_PACKET_TYPE_I)
+                        {
+                            // ack last hdlc frame, the RR acknowledges the whole window
+                            meter.hdlc.rrr = (hdlc.sss + 1U) & 0x07U;
+                        }
 
-                            // Test if it is a last HDLC packet
-                            if ((hdlc.segmentation == 0U) &&
-                                (hdlc.poll_final == 1U))
-                            {
-                                puts("Final packet\r\n");
+                        // Test if it is a last HDLC packet
+                        if ((hdlc.segmentation == 0U) &&
+                            (hdlc.poll_final == 1U))
+                        {
+                            puts("Final packet\r\n");
 
-                                retCode = true; // good Cosem packet
-                                loop = false; // quit
-                            }
-                            else if (hdlc.segmentation == 1U)
+                            retCode = true; // good Cosem packet
+                            loop = false; // quit
+                        }
+                        else if (hdlc.segmentation == 1U)
+                        {
+                            puts("Segmentation packet: ");
+                            hdlc_print_result(&hdlc, HDLC_OK);
+                            // There are remaining frames to be received, the server waits at the end of its window
+                            if (hdlc.poll_final == 1U)
                             {
-                                puts("Segmentation packet: ");
-                                hdlc_print_result(&hdlc, HDLC_OK);
-                                // There are remaining frames to be received.
-                                if (hdlc.poll_final == 1U)
-                                {
-                                    // Send RR
-                                    hdlc.sender = HDLC_CLIENT;
-                                    size = hdlc_encode_rr(&meter.hdlc, (uint8_t*)&mSndBuffer[0], cBufferSize);
-                                    dataToSend.assign(&mSndBuffer[0], size);
-                                }
+                                // Send RR
+                                uint32_t rr_size = hdlc_encode_rr(&meter.hdlc, (uint8_t*)&mSndBuffer[0], cBufferSize);
+                                dataToSend.assign(&mSndBuffer[0], rr_size);
                             }
-
-                            // go to next frame, if any
-                            ptr = csm_array_rd_current(&mRcvArray);
-                            size = csm_array_unread(&mRcvArray);
                         }
                     }
-                    else
-                    {
-                        // Maybe a partial packet, re-try later
-                        size = 0U;
-                    }
                 }
-                while (size);
             }
         }
         else
@@ -265,7 +247,7 @@ bool CosemClient::HdlcProcess(Meter &meter, const std::string &send, std::string
             else
             {
                 puts("Try to resync\r\n");
-                csm_array_init(&mRcvArray, (uint8_t*)&mRcvBuffer[0], cBufferSize, 0U, 0U);
+                hdlc_deframer_init(&mDeframer, (uint8_t*)&mRcvBuffer[0], cBufferSize);
                 // try to re-sync with server, send RR frame
                 // Send RR
                 hdlc.sender = HDLC_CLIENT;
@@ -280,6 +262,93 @@ bool CosemClient::HdlcProcess(Meter &meter, const std::string &send, std::string
 }
 
 
+// Sends one WPDU and waits for the WPDU of the response, the request is sent again if lost
+bool CosemClient::WrapperProcess(Meter &meter, const std::string &send, std::string &rcv, int timeout, bool enableRetries)
+{
+    bool retCode = false;
+    bool loop = true;
+    bool sending = true;
+    uint32_t retries = enableRetries ? 0U : mConf.retries;
+
+    csm_array_init(&mRcvArray, (uint8_t*)&mRcvBuffer[0], cBufferSize, 0U, 0U);
+
+    do
+    {
+        if (sending && !mTransport.Send(send, PRINT_HEX))
+        {
+            loop = false;
+        }
+        sending = false;
+
+        std::string data;
+
+        if (!loop)
+        {
+            // Send error
+        }
+        else if (mTransport.WaitForData(data, timeout))
+        {
+            if (csm_array_write_buff(&mRcvArray, (const uint8_t*)data.c_str(), data.size()))
+            {
+                uint8_t *ptr = csm_array_rd_current(&mRcvArray);
+                uint32_t size = csm_array_unread(&mRcvArray);
+                int frame_size = csm_llc_wpdu_frame_size(ptr, size);
+
+                if (frame_size < 0)
+                {
+                    std::cout << "** Not a wrapper protocol data unit" << std::endl;
+                    loop = false;
+                }
+                else if ((frame_size > 0) && (size >= (uint32_t)frame_size))
+                {
+                    uint16_t source = 0U;
+                    uint16_t destination = 0U;
+                    int apdu_size = csm_llc_wpdu_decode(ptr, frame_size, &source, &destination);
+
+                    if ((apdu_size > 0) && (source == meter.cosem.logical_device) && (destination == meter.cosem.client))
+                    {
+                        rcv.append((const char*)&ptr[COSEM_WRAPPER_SIZE], apdu_size);
+                        retCode = true;
+                    }
+                    else
+                    {
+                        std::cout << "** Bad WPDU addresses" << std::endl;
+                    }
+                    loop = false;
+                }
+            }
+            else
+            {
+                loop = false;
+            }
+        }
+        else
+        {
+            retries++;
+            if (retries > mConf.retries)
+            {
+                loop = false;
+            }
+            else
+            {
+                // Datagram lost: send the request again
+                puts("Timeout, send again\r\n");
+                csm_array_init(&mRcvArray, (uint8_t*)&mRcvBuffer[0], cBufferSize, 0U, 0U);
+                sending = true;
+            }
+        }
+    }
+    while (loop);
+
+    return retCode;
+}
+
+bool CosemClient::Process(Meter &meter, const std::string &send, std::string &rcv, int timeout, bool enableRetries)
+{
+    return mWrapper ? WrapperProcess(meter, send, rcv, timeout, enableRetries) : HdlcProcess(meter, send, rcv, timeout, enableRetries);
+}
+
+
 bool CosemClient::SendModem(const std::string &command, const std::string &expected, std::string &modemReply, uint32_t timeout)
 {
     bool retCode = false;
@@ -325,6 +394,10 @@ int CosemClient::ConnectHdlc(Meter &meter)
 {
     int ret = -1;
 
+    // The server starts its numbering again
+    meter.hdlc.sss = 0U;
+    meter.hdlc.rrr = 0U;
+
     int size = hdlc_encode_snrm(&meter.hdlc, (uint8_t *)&mSndBuffer[0], cBufferSize);
 
     std::string snrmData(&mSndBuffer[0], size);
@@ -335,10 +408,21 @@ int CosemClient::ConnectHdlc(Meter &meter)
         ret = data.size();
         Transport::Printer(data.c_str(), data.size(), PRINT_HEX);
 
-        // Decode UA
-        ret = hdlc_decode_info_field(&meter.hdlc, (const uint8_t *)data.c_str(), data.size());
+        // Decode UA, the parameters absent keep their default value
+        hdlc_t ua = meter.hdlc;
+        ua.type = HDLC_PACKET_TYPE_UA;
+        ua.max_info_field_tx = HDLC_DEFAULT_INFO_SIZE;
+        ua.max_info_field_rx = HDLC_DEFAULT_INFO_SIZE;
+        ua.window_tx = 1U;
+        ua.window_rx = 1U;
+        ret = hdlc_decode_info_field(&ua, (const uint8_t *)data.c_str(), data.size());
         if (ret == HDLC_OK)
         {
+            // The server transmits what we receive, within our proposal
+            meter.hdlc.max_info_field_tx = std::min(meter.hdlc.max_info_field_tx, ua.max_info_field_rx);
+            meter.hdlc.max_info_field_rx = std::min(meter.hdlc.max_info_field_rx, ua.max_info_field_tx);
+            meter.hdlc.window_tx = std::min(meter.hdlc.window_tx, ua.window_rx);
+            meter.hdlc.window_rx = std::min(meter.hdlc.window_rx, ua.window_tx);
             hdlc_print_result(&meter.hdlc, ret);
             ret = 1U;
         }
@@ -471,7 +555,7 @@ Result CosemClient::Pass3And4(Meter &meter)
         csm_array_init(&request.db_request.additional_data.data, &mAppBuffer[0], cAppBufferSize, 0, 0);
         request.db_request.additional_data.enable = TRUE;
 
-        if (csm_axdr_wr_octetstring(&request.db_request.additional_data.data, &digest_stoc[0], digest_size))
+        if (csm_axdr_wr_octetstring(&request.db_request.additional_data.data, &digest_stoc[0], digest_size, AXDR_TAG_OCTETSTRING))
         {
             // Send Action, parse result (GET part)
             result = AccessObject(meter, obj, request, response, app_array);
@@ -579,19 +663,21 @@ Result CosemClient::ConnectAarq(Meter &meter)
     mAssoState.auth_level = meter.cosem.GetAuthLevelFromString();
     mAssoState.ref = LN_REF;
 
-    if (csm_asso_encoder(&mAssoState, &scratch_array, CSM_ASSO_AARQ))
+    // The AARQ is encoded in the tx array of the association
+    mAssoState.tx = scratch_array;
+    if (csm_asso_encoder(&mAssoState, CSM_ASSO_AARQ))
     {
-        std::string request_data = EncapsulateRequest(meter, &scratch_array);
+        std::string request_data = EncapsulateRequest(meter, &mAssoState.tx);
         std::string data;
 
-        if (HdlcProcess(meter, request_data, data, mConf.timeout_request, true))
+        if (Process(meter, request_data, data, mConf.timeout_request, true))
         {
             Transport::Printer(data.c_str(), data.size(), PRINT_HEX);
 
             csm_array_init(&scratch_array, &mScratch[0], cBufferSize, 0, 0);
             csm_array_write_buff(&scratch_array, (const uint8_t *)data.c_str(), data.size());
 
-            if (HasGoodLlc(&scratch_array))
+            if (mWrapper || HasGoodLlc(&scratch_array))
             {
                 // Good Cosem server packet
                 if (csm_asso_decoder(&mAssoState, &scratch_array, CSM_ASSO_AARE))
@@ -736,6 +822,15 @@ std::string CosemClient::EncapsulateRequest(Meter &meter, csm_array *request)
     {
         std::cout << "Cosem array must have room for LLC" << std::endl;
     }
+    else if (mWrapper)
+    {
+        // Wrapper from the client SAP to the logical device, then the APDU
+        uint32_t apdu_size = csm_array_written(request);
+        int llc_size = csm_llc_wpdu_encode((uint8_t *)&mSndBuffer[0], apdu_size, meter.cosem.logical_device, meter.cosem.client);
+        memcpy(&mSndBuffer[llc_size], csm_array_start(request), apdu_size);
+
+        request_data.assign((char *)&mSndBuffer[0], llc_size + apdu_size);
+    }
     else
     {
         // remove offset
@@ -746,7 +841,11 @@ std::string CosemClient::EncapsulateRequest(Meter &meter, csm_array *request)
         csm_array_set(request, 1U, 0xE6U);
         csm_array_set(request, 2U, 0x00U);
 
-        // Encode HDLC
+        // Encode HDLC, the requests are sent in one I frame
+        if (csm_array_written(request) > meter.hdlc.max_info_field_tx)
+        {
+            std::cout << "** Request larger than the information field negotiated: " << csm_array_written(request) << std::endl;
+        }
         meter.hdlc.sender = HDLC_CLIENT;
         int send_size = hdlc_encode_data(&meter.hdlc, (uint8_t *)&mSndBuffer[0], cBufferSize, request->buff, csm_array_written(request));
 
@@ -924,14 +1023,14 @@ Result CosemClient::AccessObject(Meter &meter, const Object &obj, csm_request &r
         {
             data.clear();
 
-            if (HdlcProcess(meter, request_data, data, mConf.timeout_request, true))
+            if (Process(meter, request_data, data, mConf.timeout_request, true))
             {
                 Transport::Printer(data.c_str(), data.size(), PRINT_HEX);
                 csm_array_init(&scratch_array, &mScratch[0], cBufferSize, 0, 0);
 
                 csm_array_write_buff(&scratch_array, (const uint8_t *)data.c_str(), data.size());
 
-                if (HasGoodLlc(&scratch_array))
+                if (mWrapper || HasGoodLlc(&scratch_array))
                 {
                     // Good Cosem server packet
                     if (csm_client_decode(&response, &scratch_array))
@@ -1134,6 +1233,13 @@ bool  CosemClient::PerformCosemRead(Meter &meter)
             {
                 Result result;
                 result.subject = "CONNECT HDLC";
+                if (mWrapper)
+                {
+                    // No data link to open, the wrapper carries the addresses of each APDU
+                    ret = true;
+                    mCosemState = ASSOCIATION_PENDING;
+                    break;
+                }
                 printf("** Sending HDLC SNRM (addr: %d)...\r\n", meter.hdlc.phy_address);
                 if (ConnectHdlc(meter) > 0)
                 {
@@ -80,6 +80,7 @@ private:
     char mSndBuffer[cBufferSize];
     char mRcvBuffer[cBufferSize];
     csm_array mRcvArray;
+    hdlc_deframer mDeframer; // Cuts the HDLC frames received in mRcvBuffer
 
     uint8_t mScratch[cBufferSize];
 
@@ -93,6 +94,7 @@ private:
     uint32_t mMeterIndex;
     Configuration mConf;
     Transport mTransport;
+    bool mWrapper; // Wrapper protocol (UDP): the APDUs are sent in WPDUs instead of HDLC frames
     csm_asso_state mAssoState;
 
     std::vector<Result> mResults;
@@ -101,6 +103,8 @@ private:
     Result Pass3And4(Meter &meter);
     int ConnectHdlc(Meter &meter);
     bool HdlcProcess(Meter &meter, const std::string &send, std::string &rcv, int timeout, bool enableRetries);
+    bool WrapperProcess(Meter &meter, const std::string &send, std::string &rcv, int timeout, bool enableRetries);
+    bool Process(Meter &meter, const std::string &send, std::string &rcv, int timeout, bool enableRetries);
     std::string EncapsulateRequest(Meter &meter, csm_array *request);
     bool PerformCosemRead(Meter &meter);
     Result ConnectAarq(Meter &meter);
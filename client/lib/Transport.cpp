@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include "Transport.h"
 #include "serial.h"
+#include "udp_client.h"
 #include "os_util.h"
 #include "Util.h"
 
@@ -20,6 +21,7 @@ Transport::Transport()
     : mStarted(false)
     , mUseTcpGateway(false)
     , mSerialHandle(0)
+    , mUdpSocket(-1)
     , mTerminate(false)
 {
 
@@ -50,6 +52,13 @@ bool Transport::Open(const Transport::Params &params)
 
     mConf = params;
 
+    if (mConf.type == UDP_IP)
+    {
+        std::cout << "** Opening UDP socket to " << mConf.address << ":" << mConf.port << std::endl;
+        mUdpSocket = udp_client_open(mConf.address.c_str(), mConf.port.c_str());
+        return (mUdpSocket >= 0);
+    }
+
     std::cout << "** Opening serial port " << mConf.port << " at " << mConf.baudrate << std::endl;
     mSerialHandle = serial_open(mConf.port.c_str());
 
@@ -74,7 +83,11 @@ int Transport::Send(const std::string &data, PrintFormat format)
     Printer(data.c_str(), data.size(), format);
     puts("\r\n");
 
-    if (mUseTcpGateway)
+    if (mConf.type == UDP_IP)
+    {
+        ret = udp_client_send(mUdpSocket, data.c_str(), data.size());
+    }
+    else if (mUseTcpGateway)
     {
         // TODO
       //  socket.write(data);
@@ -124,7 +137,17 @@ void Transport::Reader()
 
     while (!mTerminate)
     {
-        int ret = serial_read(mSerialHandle, &mRcvBuffer[0], cBufferSize, 10);
+        int ret;
+
+        if (mConf.type == UDP_IP)
+        {
+            // All the datagrams already received at once
+            ret = udp_client_read(mUdpSocket, &mRcvBuffer[0], cBufferSize, 10);
+        }
+        else
+        {
+            ret = serial_read(mSerialHandle, &mRcvBuffer[0], cBufferSize, 10);
+        }
 
         if (ret > 0)
         {
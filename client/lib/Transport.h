@@ -35,7 +35,8 @@ public:
     enum Type
     {
         SERIAL,
-        TCP_IP
+        TCP_IP,
+        UDP_IP
     };
 
     struct Params
@@ -72,6 +73,7 @@ private:
     Params mConf;
     bool mUseTcpGateway;
     int mSerialHandle;
+    int mUdpSocket;
     bool mTerminate;
     std::string mData;
 
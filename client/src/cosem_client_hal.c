@@ -1,6 +1,7 @@
 // Cosem library
 #include "csm_association.h"
 #include "csm_definitions.h"
+#include "csm_ic.h"
 
 // OS/System definitions
 #include "os_util.h"
@@ -42,21 +43,33 @@ void csm_sys_set_system_title(const uint8_t *buf)
 }
 
 
-typedef enum
+int csm_sys_get_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *value)
 {
-    CSM_SEC_IC_CLIENT,
-    CSM_SEC_IC_SERVER,
-} csm_sec_ic;
+    return csm_ic_next(sap, key_id, ic, value);
+}
 
+int csm_sys_check_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t value)
+{
+    return csm_ic_check(sap, key_id, ic, value);
+}
 
-// FIXME: create one pair IC per SAP
-static uint32_t gIc = 0U;
+// FIXME: store the invocation counters in the configuration file of the client
+int csm_sys_load_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *limit)
+{
+    (void) sap;
+    (void) key_id;
+    (void) ic;
+    (void) limit;
+    return FALSE;
+}
 
-uint32_t csm_sys_get_ic(uint8_t sap, csm_sec_ic ic)
+int csm_sys_store_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t limit)
 {
     (void) sap;
+    (void) key_id;
     (void) ic;
-    return gIc++;
+    (void) limit;
+    return TRUE;
 }
 
 const uint8_t *csm_sys_get_system_title()
@@ -119,7 +132,7 @@ uint8_t *csm_sys_get_key(uint8_t sap, csm_sec_key key_id)
 }
 
 
-int csm_sys_gcm_init(int8_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
+int csm_sys_gcm_init(int32_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
 {
     int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
     mbedtls_gcm_init(&chan_ctx[channel]);
@@ -128,19 +141,35 @@ int csm_sys_gcm_init(int8_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec
     return (res == 0) ? TRUE : FALSE;
 }
 
-int csm_sys_gcm_update(int8_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
+int csm_sys_gcm_update(int32_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
 {
     mbedtls_gcm_update(&chan_ctx[channel], plain_len, plain, crypt);
     return TRUE;
 }
 
 // Sizes are total sizes of plain and AAD
-int csm_sys_gcm_finish(int8_t channel_id, uint8_t *tag)
+int csm_sys_gcm_finish(int32_t channel_id, uint8_t *tag)
 {
     mbedtls_gcm_finish(&chan_ctx[channel], tag, 16);
     return TRUE;
 }
 
+// One packet after the other
+int csm_sys_gcm_batch(csm_sec_key key_id, csm_sec_mode mode, csm_sys_gcm_job *jobs, uint32_t nb_jobs)
+{
+    int valid = TRUE;
+
+    for (uint32_t i = 0U; i < nb_jobs; i++)
+    {
+        csm_sys_gcm_job *job = &jobs[i];
+        valid = valid && csm_sys_gcm_init(job->channel_id, job->sap, key_id, mode, job->iv, job->aad, job->aad_len);
+        valid = valid && csm_sys_gcm_update(job->channel_id, job->data, job->data_len, job->data);
+        valid = valid && csm_sys_gcm_finish(job->channel_id, job->tag);
+    }
+
+    return valid;
+}
+
 
 uint8_t csm_sys_get_mechanism_id(uint8_t sap)
 {
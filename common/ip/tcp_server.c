@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // accept4()
 #include "tcp_server.h"
 #include <stdio.h>
 #include <string.h>
@@ -10,10 +11,13 @@
 
 #ifdef __linux__
 
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <sys/ioctl.h>
 #include <netdb.h>
@@ -23,6 +27,12 @@
 #include <errno.h>
 #include <stdbool.h>
 
+#ifdef TCP_SERVER_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #include "csm_array.h"
 #include "transports.h"
 
@@ -37,28 +47,165 @@ typedef struct in_addr IN_ADDR;
 #endif
 
 #define CRLF		"\r\n"
-#define MAX_CLIENTS 10
 
 #ifndef TCP_BUF_SIZE
 #define TCP_BUF_SIZE    2048
 #endif
 
+// Events handled per epoll_wait() call
+#ifndef TCP_EPOLL_EVENTS
+#define TCP_EPOLL_EVENTS    64
+#endif
+
+// Channels served when the application does not give their number (tcp_server_set_channels())
+#ifndef TCP_DEFAULT_CHANNELS
+#define TCP_DEFAULT_CHANNELS    1024
+#endif
+
+// Event loop threads of the sharded server
+#ifndef TCP_MAX_LOOPS
+#define TCP_MAX_LOOPS       64
+#endif
+
+#ifdef TCP_SERVER_IO_URING
+
+// Submission queue entries of each ring
+#ifndef TCP_URING_ENTRIES
+#define TCP_URING_ENTRIES   256
+#endif
+
+// Reception buffers of TCP_BUF_SIZE bytes provided to each ring, power of two
+#ifndef TCP_URING_BUFFERS
+#define TCP_URING_BUFFERS   64
+#endif
+
+#endif
+
+// Bytes queued for a peer above which its requests are no longer read
+#ifndef TCP_SEND_HIGH_WATER
+#define TCP_SEND_HIGH_WATER (64U * 1024U)
+#endif
+
+// Queued blocks written per writev() call
+#ifndef TCP_FLUSH_IOV
+#define TCP_FLUSH_IOV       16
+#endif
+
+// Replies the kernel has not accepted yet
+typedef struct out_block
+{
+   struct out_block *next;
+   uint32_t size;
+   uint32_t sent;
+   uint32_t capacity;
+   uint8_t data[];
+} out_block;
+
 
 typedef struct
 {
-   SOCKET sock;
-   bool connected; // 0 = not connected
-   int8_t channel_id;
+   bool connected;
+   int32_t channel_id;
+
+   // Start of a packet not fully received, allocated on first use
+   uint8_t *partial;
+   uint32_t partial_size;
 
-   uint8_t buffer[TCP_BUF_SIZE];
-   
+   // Send queue, in order
+   out_block *out_head;
+   out_block *out_tail;
+   uint32_t out_bytes;
+   bool paused;            // reception stopped until the queue is back under the high-water mark
+   bool eof;               // the peer has shut down its side, closed once its queue is written
+
+#ifdef TCP_SERVER_IO_URING
+   uint32_t generation;    // tells the completions of a previous connection on the same descriptor
+   bool sending;           // the kernel is reading the queue
+   bool receiving;         // a multishot recv is armed
+#endif
 } peer;
 
-/* an array for all clients */
-static peer peers[MAX_CLIENTS];
+/* each event loop thread owns its peers, its reception buffer and a slice of the channels */
+typedef struct
+{
+   data_handler data_func;
+   chain_data_handler chain_func;
+   connection_handler connection_func;
+   disconnection_handler disconnection_func;
+   thread_handler thread_func;
+   int tcp_port;
+   int shard;
+   bool reuse_port;
+} loop_config;
+
+/* peers indexed by socket descriptor, the table grows with the highest descriptor */
+static __thread peer *peers = NULL;
+static __thread int peers_size = 0;
+
+/* channel ids given by the connection handler: 0 to nb_channels - 1 */
+static int32_t nb_channels = TCP_DEFAULT_CHANNELS;
+
+/* socket of each channel, for the sends outside of the reception; written by the thread owning the channel */
+static SOCKET *channels = NULL;
+
+/* the handlers of a thread are called one at a time: one reception buffer for all its peers */
+static __thread uint8_t rx_buffer[TCP_BUF_SIZE];
+
+/* optional notification of the replies sent */
+static sent_handler sent_callback = NULL;
+
+/* optional packet boundaries in the stream, otherwise one read is one packet */
+static frame_handler frame_callback = NULL;
+
+typedef struct
+{
+   int32_t channel_id;
+   int value;
+} post_item;
+
+/* values posted to each loop by the other threads, its eventfd wakes it up; one per channel at least */
+typedef struct
+{
+   pthread_mutex_t lock;
+   int efd;
+   uint32_t head;
+   uint32_t count;
+   uint32_t size;
+   post_item *items;
+} post_queue;
+
+static post_queue post_queues[TCP_MAX_LOOPS];
+
+/* loop serving each channel, written by this loop when the connection is accepted */
+static int *channel_loops = NULL;
+
+/* loop of the calling thread */
+static __thread int current_loop = 0;
+
+/* run by the loop for each value posted */
+static posted_handler posted_callback = NULL;
 
 static void init(void)
 {
+   channels = malloc((size_t)nb_channels * sizeof(SOCKET));
+   channel_loops = calloc((size_t)nb_channels, sizeof(int));
+   if ((channels == NULL) || (channel_loops == NULL))
+   {
+      puts("[TCP Server] Cannot allocate the channels");
+      exit(EXIT_FAILURE);
+   }
+
+   for (int32_t i = 0; i < nb_channels; i++)
+   {
+      channels[i] = INVALID_SOCKET;
+   }
+
+   for (int i = 0; i < TCP_MAX_LOOPS; i++)
+   {
+      pthread_mutex_init(&post_queues[i].lock, NULL);
+      post_queues[i].efd = -1;
+   }
+
 #ifdef WIN32
    WSADATA wsa;
    int err = WSAStartup(MAKEWORD(2, 2), &wsa);
@@ -72,37 +219,28 @@ static void init(void)
 
 static void end(void)
 {
+   for (int i = 0; i < TCP_MAX_LOOPS; i++)
+   {
+      free(post_queues[i].items);
+      post_queues[i].items = NULL;
+   }
+   free(channels);
+   free(channel_loops);
+   channels = NULL;
+   channel_loops = NULL;
+
 #ifdef WIN32
    WSACleanup();
 #endif
 }
 
-
-
-/*
-static void broadcast(peer *clients, peer sender, int actual, const char *buffer, char from_server)
+static int set_non_blocking(SOCKET sock)
 {
-   int i = 0;
-   char message[BUF_SIZE];
-   message[0] = 0;
-   for(i = 0; i < actual; i++)
-   {
-      // we don't send message to the sender
-      if(sender.sock != clients[i].sock)
-      {
-         if(from_server == 0)
-         {
-         //   strncpy(message, sender.name, BUF_SIZE - 1);
-        //    strncat(message, " : ", sizeof message - strlen(message) - 1);
-         }
-       //  strncat(message, buffer, sizeof message - strlen(message) - 1);
-      //   write_peer(clients[i].sock, message);
-      }
-   }
+   int flags = fcntl(sock, F_GETFL, 0);
+   return (flags < 0) ? -1 : fcntl(sock, F_SETFL, flags | O_NONBLOCK);
 }
-*/
 
-static int init_connection(int tcp_port)
+static int init_connection(int tcp_port, bool reuse_port)
 {
    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
    SOCKADDR_IN sin = { 0 };
@@ -113,6 +251,14 @@ static int init_connection(int tcp_port)
       exit(errno);
    }
 
+   // One listener per thread on the same port, the kernel balances the connections
+   int flag = 1;
+   if (reuse_port && (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) == SOCKET_ERROR))
+   {
+      perror("setsockopt()");
+      exit(errno);
+   }
+
    sin.sin_addr.s_addr = htonl(INADDR_ANY);
    sin.sin_port = htons(tcp_port);
    sin.sin_family = AF_INET;
@@ -123,12 +269,18 @@ static int init_connection(int tcp_port)
       exit(errno);
    }
 
-   if(listen(sock, MAX_CLIENTS) == SOCKET_ERROR)
+   if(listen(sock, SOMAXCONN) == SOCKET_ERROR)
    {
       perror("listen()");
       exit(errno);
    }
 
+   if (set_non_blocking(sock) < 0)
+   {
+      perror("fcntl()");
+      exit(errno);
+   }
+
    return sock;
 }
 
@@ -137,190 +289,1202 @@ static void end_connection(int sock)
    closesocket(sock);
 }
 
+static void free_queue(peer *p)
+{
+   while (p->out_head != NULL)
+   {
+      out_block *block = p->out_head;
+      p->out_head = block->next;
+      free(block);
+   }
+   p->out_tail = NULL;
+   p->out_bytes = 0U;
+}
+
+/**
+ * Copies the chain, from offset, at the end of the send queue: the segments are only
+ * valid until the next request. The replies are gathered in the last block while it
+ * has room; the bytes already given to the kernel are never moved.
+ */
+static bool queue_chain(peer *p, const csm_chain *chain, uint32_t offset)
+{
+   uint32_t size = chain->size - offset;
+   out_block *tail = p->out_tail;
+
+   if ((tail == NULL) || ((tail->capacity - tail->size) < size))
+   {
+      uint32_t capacity = (size > TCP_BUF_SIZE) ? size : TCP_BUF_SIZE;
+      out_block *block = malloc(sizeof(out_block) + capacity);
+      if (block == NULL)
+      {
+         perror("[TCP server] Cannot queue the reply");
+         return false;
+      }
+      block->next = NULL;
+      block->size = 0U;
+      block->sent = 0U;
+      block->capacity = capacity;
+      if (tail == NULL)
+      {
+         p->out_head = block;
+      }
+      else
+      {
+         tail->next = block;
+      }
+      p->out_tail = block;
+      tail = block;
+   }
+
+   for (uint32_t i = 0U; i < chain->nb_segments; i++)
+   {
+      const csm_segment *seg = &chain->seg[i];
+      if (offset >= seg->size)
+      {
+         offset -= seg->size;
+         continue;
+      }
+      memcpy(&tail->data[tail->size], &seg->data[offset], seg->size - offset);
+      tail->size += seg->size - offset;
+      offset = 0U;
+   }
+   p->out_bytes += size;
+   return true;
+}
 
-static void write_peer(SOCKET sock, const char *buffer, size_t size)
+// Removes the bytes written from the head of the queue
+static void consume_queue(peer *p, uint32_t size)
 {
-   if(send(sock, buffer, size, 0) < 0)
+   p->out_bytes -= size;
+
+   while (size > 0U)
    {
-      perror("send()");
-    //  exit(errno);
+      out_block *block = p->out_head;
+      uint32_t left = block->size - block->sent;
+      if (size < left)
+      {
+         block->sent += size;
+         break;
+      }
+      size -= left;
+      p->out_head = block->next;
+      if (p->out_head == NULL)
+      {
+         p->out_tail = NULL;
+      }
+      free(block);
    }
 }
 
-static int read_peer(SOCKET sock, char *buffer, int max_size)
+#ifdef TCP_SERVER_IO_URING
+
+/* the completions carry the operation, the generation of the peer and its descriptor */
+enum
+{
+   URING_ACCEPT = 1,
+   URING_RECV,
+   URING_SEND,
+   URING_CANCEL,
+   URING_POST
+};
+
+#define URING_DATA(op, gen, fd)  (((uint64_t)(op) << 56U) | ((uint64_t)((gen) & 0xFFFFFFU) << 32U) | (uint32_t)(fd))
+#define URING_OP(data)           ((int)((data) >> 56U))
+#define URING_GEN(data)          ((uint32_t)((data) >> 32U) & 0xFFFFFFU)
+#define URING_FD(data)           ((SOCKET)(uint32_t)(data))
+
+/* rings mapped from the kernel, with the buffer group of the multishot receptions */
+typedef struct
 {
-   int n = 0;
+   int fd;
+   unsigned *sq_head;
+   unsigned *sq_tail;
+   unsigned *sq_array;
+   unsigned sq_mask;
+   unsigned sq_entries;
+   unsigned to_submit;
+   struct io_uring_sqe *sqes;
+   unsigned *cq_head;
+   unsigned *cq_tail;
+   unsigned cq_mask;
+   struct io_uring_cqe *cqes;
+   struct io_uring_buf_ring *buf_ring;
+   uint8_t *buffers;
+} uring;
 
-   if((n = recv(sock, buffer, max_size, 0)) < 0)
+static __thread uring ring;
+
+static int uring_enter(unsigned to_submit, unsigned min_complete)
+{
+   int ret = (int)syscall(__NR_io_uring_enter, ring.fd, to_submit, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+   if (ret > 0)
    {
-      perror("recv()");
-      /* if recv error we disconnect the client */
-      n = 0;
+      ring.to_submit -= (unsigned)ret;
    }
-   return n;
+   return ret;
 }
 
-void tcp_server_send(int8_t channel_id, const char *buffer, size_t size)
+// Next free submission entry, the queue is submitted first if full
+static struct io_uring_sqe *uring_get_sqe(void)
 {
-   // look for peer by channel id
-   for (int i = 0; i < MAX_CLIENTS; i++)
+   unsigned tail = *ring.sq_tail;
+
+   while ((tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE)) >= ring.sq_entries)
    {
-       if (peers[i].connected && peers[i].channel_id == channel_id)
-       {
-           write_peer(peers[i].sock, buffer, size);
-           break;
-       }
+      (void) uring_enter(ring.to_submit, 0U);
    }
+
+   unsigned index = tail & ring.sq_mask;
+   struct io_uring_sqe *sqe = &ring.sqes[index];
+   memset(sqe, 0, sizeof(*sqe));
+   ring.sq_array[index] = index;
+   __atomic_store_n(ring.sq_tail, tail + 1U, __ATOMIC_RELEASE);
+   ring.to_submit++;
+   return sqe;
 }
 
-static void app(data_handler data_func, connection_handler connection_func, disconnection_handler disconnection_func, int tcp_port)
+// Gives a reception buffer back to the kernel
+static void uring_provide_buffer(uint16_t bid)
 {
-   SOCKET sock = init_connection(tcp_port);
+   uint16_t tail = ring.buf_ring->tail;
+   struct io_uring_buf *buf = &ring.buf_ring->bufs[tail & (TCP_URING_BUFFERS - 1U)];
 
+   buf->addr = (uint64_t)(uintptr_t)&ring.buffers[(size_t)bid * TCP_BUF_SIZE];
+   buf->len = TCP_BUF_SIZE;
+   buf->bid = bid;
+   __atomic_store_n(&ring.buf_ring->tail, (uint16_t)(tail + 1U), __ATOMIC_RELEASE);
+}
 
-   unsigned int max = sock;
+static int uring_init(void)
+{
+   struct io_uring_params params;
+   memset(&params, 0, sizeof(params));
+   params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
 
-   // Init properly
-   for (int i = 0; i < MAX_CLIENTS; i++)
+   ring.fd = (int)syscall(__NR_io_uring_setup, TCP_URING_ENTRIES, &params);
+   if ((ring.fd < 0) && (errno == EINVAL))
+   {
+      // Kernel older than 6.0: no setup hints
+      memset(&params, 0, sizeof(params));
+      ring.fd = (int)syscall(__NR_io_uring_setup, TCP_URING_ENTRIES, &params);
+   }
+   if ((ring.fd < 0) || !(params.features & IORING_FEAT_SINGLE_MMAP))
    {
-      peers[i].connected = false;
-      peers[i].channel_id = -1;
-      peers[i].sock = INVALID_SOCKET;
+      return -1;
    }
 
-   fd_set working_set;
-   fd_set master_set;
+   size_t sq_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+   size_t cq_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+   size_t size = (sq_size > cq_size) ? sq_size : cq_size;
 
-   FD_ZERO(&master_set);
+   uint8_t *rings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+   ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+   if ((rings == MAP_FAILED) || (ring.sqes == MAP_FAILED))
+   {
+      return -1;
+   }
 
-   /* add the connection socket */
-   FD_SET(sock, &master_set);
+   ring.sq_head = (unsigned *)(rings + params.sq_off.head);
+   ring.sq_tail = (unsigned *)(rings + params.sq_off.tail);
+   ring.sq_array = (unsigned *)(rings + params.sq_off.array);
+   ring.sq_mask = *(unsigned *)(rings + params.sq_off.ring_mask);
+   ring.sq_entries = params.sq_entries;
+   ring.cq_head = (unsigned *)(rings + params.cq_off.head);
+   ring.cq_tail = (unsigned *)(rings + params.cq_off.tail);
+   ring.cq_mask = *(unsigned *)(rings + params.cq_off.ring_mask);
+   ring.cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+   ring.to_submit = 0U;
 
-   printf("[TCP Server] TCP Server started on TCP port: %d\r\n", tcp_port);
+   // Buffer group 0: the kernel picks a buffer when data arrives, not when the recv is queued
+   ring.buf_ring = mmap(NULL, TCP_URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   ring.buffers = malloc((size_t)TCP_URING_BUFFERS * TCP_BUF_SIZE);
+   if ((ring.buf_ring == MAP_FAILED) || (ring.buffers == NULL))
+   {
+      return -1;
+   }
 
-   while(1)
+   struct io_uring_buf_reg reg;
+   memset(&reg, 0, sizeof(reg));
+   reg.ring_addr = (uint64_t)(uintptr_t)ring.buf_ring;
+   reg.ring_entries = TCP_URING_BUFFERS;
+   reg.bgid = 0U;
+   if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
    {
-        // update max
-        max = sock;
-        for (int i = 0; i < MAX_CLIENTS; i++)
-        {
-           if (peers[i].connected)
-           {
-               /* what is the new maximum fd ? */
-               max = peers[i].sock > max ? peers[i].sock : max;
-           }
-        }
-
-        memcpy(&working_set, &master_set, sizeof(master_set));
-
-        if(select(max + 1, &working_set, NULL, NULL, NULL) == -1)
-        {
-            perror("select()");
-            exit(errno);
-        }
-
-
-        if(FD_ISSET(sock, &working_set))
-        {
-            /* new client */
-            SOCKADDR_IN csin = { 0 };
-            int sinsize = sizeof csin;
-            SOCKET csock = accept(sock, (SOCKADDR *)&csin, &sinsize);
-
-            if(csock == INVALID_SOCKET)
-            {
-                perror("accept()");
-                continue;
-            }
+      return -1;
+   }
 
-            printf("[TCP] Accept socket %d\r\n", csock);
+   ring.buf_ring->tail = 0U;
+   for (uint16_t i = 0U; i < TCP_URING_BUFFERS; i++)
+   {
+      uring_provide_buffer(i);
+   }
+   return 0;
+}
 
-            // Grant access to the application layer
-            int8_t channel_id = connection_func();
-            if (channel_id >= 0)
-            {
-                FD_SET(csock, &master_set);
-                
-                for (int i = 0; i < MAX_CLIENTS; i++)
-                {
-                    if (!peers[i].connected)
-                    {
-                        peers[i].sock = csock;
-                        peers[i].connected = true;
-                        peers[i].channel_id = channel_id;
-                        puts("[TCP server] New connection!");
-                        break;
-                    }
-                }
-            }
-            else
-            {
-                // Reject connection
-                end_connection(csock);
-                puts("[TCP server] New connection rejected");
-            }
-        }
+// Sends the queue from its first block, one send in flight per peer keeps the order of the bytes
+static void start_send(SOCKET sock)
+{
+   peer *p = &peers[sock];
+   out_block *block = p->out_head;
 
-        for(int i = 0; i < MAX_CLIENTS; i++)
-        {
-            if (peers[i].connected)
-            {
-                /* a client is talking */
-                if(FD_ISSET(peers[i].sock, &working_set))
-                {
-                   int size = read_peer(peers[i].sock, &peers[i].buffer[0], sizeof(peers[i].buffer));
-                   /* client disconnected */
-                   if(size == 0)
-                   {
-                     FD_CLR(peers[i].sock, &master_set);
-                     end_connection(peers[i].sock);
-
-                     puts("Client disconnected !");
-                     disconnection_func(peers[i].channel_id);
-
-                     // Make sure structure elements are cleared
-                     peers[i].sock = INVALID_SOCKET;
-                     peers[i].connected = false;
-                     peers[i].channel_id = -1;
-                   }
-                   else
-                   {
-                       puts("[TCP server] New data received!");
-                       if (data_func != NULL)
-                       {
-                           int ret = data_func(peers[i].channel_id, &peers[i].buffer[0], size, sizeof(peers[i].buffer));
-                           if (ret > 0)
-                           {
-                              printf("[TCP] Send to seocket %d\r\n", peers[i].sock);
-                              write_peer(peers[i].sock, &peers[i].buffer[0], ret);
-                           }
-                       }
-
-                       //broadcast(peers, client, actual, buffer, 0);
-                   }
-                } 
-            }
-        }
+   if (!p->sending && (block != NULL))
+   {
+      struct io_uring_sqe *sqe = uring_get_sqe();
+      sqe->opcode = IORING_OP_SEND;
+      sqe->fd = sock;
+      sqe->addr = (uint64_t)(uintptr_t)&block->data[block->sent];
+      sqe->len = block->size - block->sent;
+      sqe->msg_flags = MSG_NOSIGNAL;
+      sqe->user_data = URING_DATA(URING_SEND, p->generation, sock);
+      p->sending = true;
    }
+}
 
-   // Clear peers
-   for(int i = 0; i < MAX_CLIENTS; i++)
+// The replies made while a send is in flight leave with the next one
+static void send_chain(SOCKET sock, const csm_chain *chain)
+{
+   if (queue_chain(&peers[sock], chain, 0U))
    {
-       if (peers[i].connected)
-       {
-            closesocket(peers[i].sock);
-       }
+      start_send(sock);
+   }
+   else
+   {
+      // End the connection rather than desynchronize the peer
+      (void) shutdown(sock, SHUT_RDWR);
    }
-   // End server
-   end_connection(sock);
 }
 
+#else
 
-int tcp_server_init(data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int tcp_port)
+// Writes the queue until it is empty or the socket is full, returns false if the peer is gone
+static bool flush_peer(SOCKET sock)
 {
-   init();
+   peer *p = &peers[sock];
+
+   while (p->out_head != NULL)
+   {
+      struct iovec iov[TCP_FLUSH_IOV];
+      int nb = 0;
+
+      for (out_block *block = p->out_head; (block != NULL) && (nb < TCP_FLUSH_IOV); block = block->next)
+      {
+         iov[nb].iov_base = &block->data[block->sent];
+         iov[nb].iov_len = block->size - block->sent;
+         nb++;
+      }
+
+      ssize_t sent = writev(sock, iov, nb);
+      if (sent < 0)
+      {
+         if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+         {
+            break; // EPOLLOUT continues
+         }
+         else if (errno != EINTR)
+         {
+            perror("writev()");
+            return false;
+         }
+      }
+      else
+      {
+         consume_queue(p, (uint32_t)sent);
+      }
+   }
+
+   return true;
+}
+
+/**
+ * Writes the reply without copy when nothing is queued before it; the bytes the
+ * kernel does not accept are queued and written on EPOLLOUT, in order.
+ */
+static void send_chain(SOCKET sock, const csm_chain *chain)
+{
+   peer *p = &peers[sock];
+   uint32_t offset = 0U;
+
+   if (p->out_head == NULL)
+   {
+      struct iovec iov[CSM_CHAIN_MAX_SEGMENTS];
+      ssize_t sent;
+
+      for (uint32_t i = 0U; i < chain->nb_segments; i++)
+      {
+         iov[i].iov_base = (void *)chain->seg[i].data;
+         iov[i].iov_len = chain->seg[i].size;
+      }
+
+      do
+      {
+         sent = writev(sock, iov, (int)chain->nb_segments);
+      }
+      while ((sent < 0) && (errno == EINTR));
+
+      if (sent >= 0)
+      {
+         offset = (uint32_t)sent;
+      }
+      else if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+      {
+         // The hang up is reported by epoll
+         perror("writev()");
+         return;
+      }
+   }
+
+   if ((offset < chain->size) && !queue_chain(p, chain, offset))
+   {
+      // End the connection rather than desynchronize the peer
+      (void) shutdown(sock, SHUT_RDWR);
+   }
+}
+
+#endif
+
+static void send_buffer(SOCKET sock, const uint8_t *buffer, size_t size)
+{
+   csm_chain chain;
+   csm_chain_init(&chain);
+   if (csm_chain_append(&chain, buffer, (uint32_t)size))
+   {
+      send_chain(sock, &chain);
+   }
+}
+
+static bool channel_valid(int32_t channel_id)
+{
+   return (channel_id >= 0) && (channel_id < nb_channels);
+}
+
+static SOCKET channel_socket(int32_t channel_id)
+{
+   return channel_valid(channel_id) ? channels[channel_id] : INVALID_SOCKET;
+}
+
+void tcp_server_set_channels(int32_t channels_count)
+{
+   nb_channels = (channels_count > 0) ? channels_count : TCP_DEFAULT_CHANNELS;
+}
+
+void tcp_server_send(int32_t channel_id, const char *buffer, size_t size)
+{
+   SOCKET sock = channel_socket(channel_id);
+   if (sock != INVALID_SOCKET)
+   {
+      send_buffer(sock, (const uint8_t *)buffer, size);
+   }
+}
+
+void tcp_server_set_sent_handler(sent_handler sent_func)
+{
+   sent_callback = sent_func;
+}
+
+void tcp_server_set_frame_handler(frame_handler frame_func)
+{
+   frame_callback = frame_func;
+}
+
+int tcp_server_send_chain(int32_t channel_id, const csm_chain *data)
+{
+   int ret = -1;
+   SOCKET sock = channel_socket(channel_id);
+   if (sock != INVALID_SOCKET)
+   {
+      send_chain(sock, data);
+      ret = (int)data->size;
+   }
+   return ret;
+}
+
+void tcp_server_set_posted_handler(posted_handler posted_func)
+{
+   posted_callback = posted_func;
+}
+
+int tcp_server_post(int32_t channel_id, int value)
+{
+   int ret = -1;
+
+   if (channel_valid(channel_id))
+   {
+      post_queue *q = &post_queues[__atomic_load_n(&channel_loops[channel_id], __ATOMIC_ACQUIRE)];
+
+      pthread_mutex_lock(&q->lock);
+      if (q->count < q->size)
+      {
+         q->items[(q->head + q->count) % q->size] = (post_item){ channel_id, value };
+         q->count++;
+         ret = 0;
+      }
+      pthread_mutex_unlock(&q->lock);
+
+      uint64_t one = 1U;
+      if ((ret == 0) && (write(q->efd, &one, sizeof(one)) < 0))
+      {
+         perror("[TCP server] Cannot wake up the loop");
+      }
+   }
+
+   return ret;
+}
+
+// Eventfd of the loop of the calling thread, the posted values are run by the loop
+static int open_posts(int shard)
+{
+   post_queue *q = &post_queues[shard];
+
+   current_loop = shard;
+   pthread_mutex_lock(&q->lock);
+   q->items = malloc((size_t)nb_channels * sizeof(post_item));
+   q->size = (q->items != NULL) ? (uint32_t)nb_channels : 0U;
+   pthread_mutex_unlock(&q->lock);
+   q->efd = (q->items != NULL) ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+   return q->efd;
+}
+
+// Runs the values posted to the loop, the queue is not locked during the handler
+static void run_posts(void)
+{
+   post_queue *q = &post_queues[current_loop];
+
+   while (1)
+   {
+      pthread_mutex_lock(&q->lock);
+      if (q->count == 0U)
+      {
+         pthread_mutex_unlock(&q->lock);
+         break;
+      }
+      post_item item = q->items[q->head];
+      q->head = (q->head + 1U) % q->size;
+      q->count--;
+      pthread_mutex_unlock(&q->lock);
+
+      if (posted_callback != NULL)
+      {
+         posted_callback(item.channel_id, item.value);
+      }
+   }
+}
+
+// Makes room in the peer table for the socket descriptor
+static int reserve_peer(SOCKET sock)
+{
+   if (sock >= peers_size)
+   {
+      int size = (peers_size > 0) ? peers_size : 64;
+      while (size <= sock)
+      {
+         size *= 2;
+      }
 
-   app(data_func, conn_func, discon_func, tcp_port);
+      peer *table = realloc(peers, size * sizeof(peer));
+      if (table == NULL)
+      {
+         return 0;
+      }
+      memset(&table[peers_size], 0, (size - peers_size) * sizeof(peer));
+      peers = table;
+      peers_size = size;
+   }
+   return 1;
+}
+
+static void close_peer(SOCKET sock, disconnection_handler disconnection_func)
+{
+   peer *p = &peers[sock];
+
+#ifdef TCP_SERVER_IO_URING
+   // Ends the requests in flight; the kernel may still read the reply being sent
+   (void) shutdown(sock, SHUT_RDWR);
+   if (!p->sending)
+   {
+      free_queue(p);
+      end_connection(sock);
+   }
+#else
+   // Closing the descriptor removes it from the epoll set, the replies not sent are lost with the peer
+   free_queue(p);
+   end_connection(sock);
+#endif
+
+   if (channel_socket(p->channel_id) == sock)
+   {
+      channels[p->channel_id] = INVALID_SOCKET;
+   }
+   disconnection_func(p->channel_id);
+
+   p->connected = false;
+   p->channel_id = -1;
+   free(p->partial);
+   p->partial = NULL;
+   p->partial_size = 0U;
+   p->paused = false;
+   p->eof = false;
+}
+
+// The connection is refused, the channel given by the application is released
+static void reject_peer(SOCKET csock, int32_t channel_id, disconnection_handler disconnection_func)
+{
+   if (channel_id >= 0)
+   {
+      printf("[TCP Server] Cannot register the connection of channel %d\r\n", (int)channel_id);
+      disconnection_func(channel_id);
+   }
+   end_connection(csock);
+}
+
+static void dispatch(SOCKET sock, int size, data_handler data_func, chain_data_handler chain_func)
+{
+   int32_t channel_id = peers[sock].channel_id;
+
+   if (chain_func != NULL)
+   {
+      csm_chain reply;
+      csm_chain_init(&reply);
+      int ret = chain_func(channel_id, rx_buffer, size, sizeof(rx_buffer), &reply);
+      if (ret > 0)
+      {
+         send_chain(sock, &reply);
+         if (sent_callback != NULL)
+         {
+            sent_callback(channel_id);
+         }
+      }
+   }
+   else if (data_func != NULL)
+   {
+      int ret = data_func(channel_id, rx_buffer, size, sizeof(rx_buffer));
+      if (ret > 0)
+      {
+         send_buffer(sock, rx_buffer, ret);
+      }
+   }
+}
+
+// Saves the bytes following the packets dispatched, until the next read
+static bool save_partial(peer *p, const uint8_t *data, uint32_t size)
+{
+   if ((size > 0U) && (p->partial == NULL))
+   {
+      p->partial = malloc(TCP_BUF_SIZE);
+      if (p->partial == NULL)
+      {
+         return false;
+      }
+   }
+   if (size > 0U)
+   {
+      memcpy(p->partial, data, size);
+   }
+   p->partial_size = size;
+   return true;
+}
+
+/**
+ * Dispatches the packets found in rx_buffer, the remaining bytes are moved to the
+ * start of the buffer. The handler may write its reply over the whole buffer: the
+ * packets pipelined after the current one are saved in the peer meanwhile.
+ */
+static bool dispatch_frames(SOCKET sock, uint32_t *used, data_handler data_func, chain_data_handler chain_func)
+{
+   peer *p = &peers[sock];
+
+   while (*used > 0U)
+   {
+      int frame = frame_callback(rx_buffer, *used);
+
+      if ((frame < 0) || (frame > (int)sizeof(rx_buffer)))
+      {
+         printf("[TCP server] Invalid packet on socket %d\r\n", sock);
+         return false;
+      }
+      if ((frame == 0) || ((uint32_t)frame > *used))
+      {
+         break; // wait for the end of the packet
+      }
+
+      uint32_t remaining = *used - frame;
+      if (!save_partial(p, &rx_buffer[frame], remaining))
+      {
+         return false;
+      }
+      dispatch(sock, frame, data_func, chain_func);
+      if (remaining > 0U)
+      {
+         memcpy(rx_buffer, p->partial, remaining);
+      }
+      *used = remaining;
+   }
+
+   return true;
+}
+
+#ifdef TCP_SERVER_IO_URING
+
+static void arm_accept(SOCKET sock)
+{
+   struct io_uring_sqe *sqe = uring_get_sqe();
+   sqe->opcode = IORING_OP_ACCEPT;
+   sqe->fd = sock;
+   sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+   sqe->user_data = URING_DATA(URING_ACCEPT, 0U, sock);
+}
+
+static void arm_recv(SOCKET sock)
+{
+   struct io_uring_sqe *sqe = uring_get_sqe();
+   sqe->opcode = IORING_OP_RECV;
+   sqe->fd = sock;
+   sqe->ioprio = IORING_RECV_MULTISHOT;
+   sqe->flags = IOSQE_BUFFER_SELECT;
+   sqe->buf_group = 0U;
+   sqe->user_data = URING_DATA(URING_RECV, peers[sock].generation, sock);
+   peers[sock].receiving = true;
+}
+
+// Waits for the eventfd of the values posted to the loop
+static __thread uint64_t post_count;
+
+static void arm_posts(int efd)
+{
+   struct io_uring_sqe *sqe = uring_get_sqe();
+   sqe->opcode = IORING_OP_READ;
+   sqe->fd = efd;
+   sqe->addr = (uint64_t)(uintptr_t)&post_count;
+   sqe->len = sizeof(post_count);
+   sqe->user_data = URING_DATA(URING_POST, 0U, efd);
+}
+
+// Stops the multishot recv of a peer, its last completion is -ECANCELED
+static void cancel_recv(SOCKET sock)
+{
+   struct io_uring_sqe *sqe = uring_get_sqe();
+   sqe->opcode = IORING_OP_ASYNC_CANCEL;
+   sqe->fd = -1;
+   sqe->addr = URING_DATA(URING_RECV, peers[sock].generation, sock);
+   sqe->user_data = URING_DATA(URING_CANCEL, peers[sock].generation, sock);
+}
+
+static void accept_peer(SOCKET csock, const loop_config *cfg)
+{
+   // Grant access to the application layer
+   int32_t channel_id = cfg->connection_func();
+
+   if (channel_valid(channel_id) && reserve_peer(csock))
+   {
+      int flag = 1;
+      (void) setsockopt(csock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+      peer *p = &peers[csock];
+      p->connected = true;
+      p->channel_id = channel_id;
+      p->generation++;
+      channels[channel_id] = csock;
+      __atomic_store_n(&channel_loops[channel_id], current_loop, __ATOMIC_RELEASE);
+      arm_recv(csock);
+   }
+   else
+   {
+      reject_peer(csock, channel_id, cfg->disconnection_func);
+   }
+}
+
+// The bytes received are copied out of the provided buffer, which goes back to the kernel
+static bool receive(SOCKET sock, const uint8_t *data, uint32_t size, data_handler data_func, chain_data_handler chain_func)
+{
+   peer *p = &peers[sock];
+
+   if (frame_callback == NULL)
+   {
+      memcpy(rx_buffer, data, size);
+      dispatch(sock, (int)size, data_func, chain_func);
+      return true;
+   }
+
+   // Restore the start of the packet received by the previous reads
+   uint32_t used = p->partial_size;
+   if (used > 0U)
+   {
+      memcpy(rx_buffer, p->partial, used);
+   }
+
+   while (size > 0U)
+   {
+      // A partial packet is always shorter than the buffer: each pass makes progress
+      uint32_t chunk = sizeof(rx_buffer) - used;
+      if (chunk > size)
+      {
+         chunk = size;
+      }
+      memcpy(&rx_buffer[used], data, chunk);
+      used += chunk;
+      data += chunk;
+      size -= chunk;
+
+      if (!dispatch_frames(sock, &used, data_func, chain_func))
+      {
+         return false;
+      }
+   }
+
+   return save_partial(p, rx_buffer, used);
+}
+
+static void complete_recv(const struct io_uring_cqe *cqe, const loop_config *cfg)
+{
+   SOCKET sock = URING_FD(cqe->user_data);
+   bool current = (sock < peers_size) && peers[sock].connected && (peers[sock].generation == URING_GEN(cqe->user_data));
+   bool alive = current;
+
+   if (current && !(cqe->flags & IORING_CQE_F_MORE))
+   {
+      peers[sock].receiving = false;
+   }
+
+   if (cqe->flags & IORING_CQE_F_BUFFER)
+   {
+      uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+      if (current && (cqe->res > 0))
+      {
+         alive = receive(sock, &ring.buffers[(size_t)bid * TCP_BUF_SIZE], (uint32_t)cqe->res, cfg->data_func, cfg->chain_func);
+      }
+      uring_provide_buffer(bid);
+   }
+   else if ((cqe->res == -ENOBUFS) || (cqe->res == -ECANCELED))
+   {
+      // All the buffers were in use or the peer is paused: the recv has ended
+   }
+   else if (cqe->res == 0)
+   {
+      // Hang up: the replies queued are still sent
+      if (current)
+      {
+         peers[sock].eof = true;
+      }
+   }
+   else
+   {
+      alive = false;
+   }
+
+   if (current && (!alive || (peers[sock].eof && (peers[sock].out_head == NULL))))
+   {
+      close_peer(sock, cfg->disconnection_func);
+   }
+   else if (alive && !peers[sock].eof)
+   {
+      peer *p = &peers[sock];
+      if (p->out_bytes >= TCP_SEND_HIGH_WATER)
+      {
+         // The data already received is still processed, the next is left in the socket
+         if (p->receiving && !p->paused)
+         {
+            cancel_recv(sock);
+         }
+         p->paused = true;
+      }
+      else if (!p->receiving)
+      {
+         p->paused = false;
+         arm_recv(sock);
+      }
+   }
+}
+
+static void complete_send(const struct io_uring_cqe *cqe, disconnection_handler disconnection_func)
+{
+   SOCKET sock = URING_FD(cqe->user_data);
+   peer *p = &peers[sock];
+
+   if (!p->sending || (p->generation != URING_GEN(cqe->user_data)))
+   {
+      return;
+   }
+   p->sending = false;
+
+   if (!p->connected)
+   {
+      // The peer was closed during the send: the kernel is done with the buffer now
+      free_queue(p);
+      end_connection(sock);
+   }
+   else if (cqe->res <= 0)
+   {
+      if (cqe->res < 0)
+      {
+         errno = -cqe->res;
+         perror("send()");
+      }
+      close_peer(sock, disconnection_func);
+   }
+   else
+   {
+      consume_queue(p, (uint32_t)cqe->res);
+      start_send(sock);
+
+      if (p->eof && (p->out_head == NULL))
+      {
+         close_peer(sock, disconnection_func);
+      }
+      else if (p->paused && (p->out_bytes < TCP_SEND_HIGH_WATER))
+      {
+         p->paused = false;
+         if (!p->receiving)
+         {
+            arm_recv(sock);
+         }
+      }
+   }
+}
+
+static void *app(void *arg)
+{
+   const loop_config *cfg = (const loop_config *)arg;
+   SOCKET sock = init_connection(cfg->tcp_port, cfg->reuse_port);
+
+   if (uring_init() < 0)
+   {
+      perror("io_uring()");
+      exit(EXIT_FAILURE);
+   }
+
+   if (cfg->thread_func != NULL)
+   {
+      cfg->thread_func(cfg->shard);
+   }
+
+   int efd = open_posts(cfg->shard);
+   if (efd < 0)
+   {
+      perror("eventfd()");
+      exit(EXIT_FAILURE);
+   }
+
+   arm_accept(sock);
+   arm_posts(efd);
+
+   printf("[TCP Server] TCP Server started on TCP port: %d (loop %d, io_uring)\r\n", cfg->tcp_port, cfg->shard);
+
+   while(1)
+   {
+      // One system call submits the requests of the previous completions and waits for the next ones
+      if ((uring_enter(ring.to_submit, 1U) < 0) && (errno != EINTR) && (errno != EBUSY))
+      {
+         perror("io_uring_enter()");
+         exit(errno);
+      }
+
+      unsigned head = *ring.cq_head;
+      unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+      while (head != tail)
+      {
+         const struct io_uring_cqe *cqe = &ring.cqes[head & ring.cq_mask];
+
+         switch (URING_OP(cqe->user_data))
+         {
+         case URING_ACCEPT:
+            if (cqe->res >= 0)
+            {
+               accept_peer(cqe->res, cfg);
+            }
+            else if (cqe->res != -EINTR)
+            {
+               errno = -cqe->res;
+               perror("accept()");
+            }
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+            {
+               arm_accept(sock);
+            }
+            break;
+         case URING_RECV:
+            complete_recv(cqe, cfg);
+            break;
+         case URING_SEND:
+            complete_send(cqe, cfg->disconnection_func);
+            break;
+         case URING_POST:
+            run_posts();
+            arm_posts(efd);
+            break;
+         default:
+            break;
+         }
+
+         head++;
+         // Release each entry at once: the handlers may submit and wait for room
+         __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+         tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+      }
+   }
+
+   close(efd);
+   close(ring.fd);
+   // End server
+   end_connection(sock);
+   return NULL;
+}
+
+#else
+
+static void accept_peers(int epfd, SOCKET sock, const loop_config *cfg)
+{
+   // Edge-triggered: accept all the pending connections
+   while (1)
+   {
+      SOCKADDR_IN csin = { 0 };
+      socklen_t sinsize = sizeof csin;
+      SOCKET csock = accept4(sock, (SOCKADDR *)&csin, &sinsize, SOCK_NONBLOCK);
+
+      if(csock == INVALID_SOCKET)
+      {
+         if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+         {
+            perror("accept()");
+         }
+         break;
+      }
+
+      // Grant access to the application layer
+      int32_t channel_id = cfg->connection_func();
+      // EPOLLOUT is only reported when a full socket has room again
+      struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.fd = csock };
+
+      if (channel_valid(channel_id) && reserve_peer(csock) && (epoll_ctl(epfd, EPOLL_CTL_ADD, csock, &ev) == 0))
+      {
+         int flag = 1;
+         (void) setsockopt(csock, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+         peers[csock].connected = true;
+         peers[csock].channel_id = channel_id;
+         channels[channel_id] = csock;
+         __atomic_store_n(&channel_loops[channel_id], current_loop, __ATOMIC_RELEASE);
+      }
+      else
+      {
+         reject_peer(csock, channel_id, cfg->disconnection_func);
+      }
+   }
+}
+
+/**
+ * Edge-triggered: read until the socket is drained, returns false if the peer is gone.
+ * The reading pauses while the replies queued for the peer are above the high-water
+ * mark: its next requests wait in the socket, and TCP slows the peer down.
+ */
+static bool read_peer(SOCKET sock, data_handler data_func, chain_data_handler chain_func)
+{
+   peer *p = &peers[sock];
+   // Restore the start of the packet received by the previous reads
+   uint32_t used = p->partial_size;
+   if (used > 0U)
+   {
+      memcpy(rx_buffer, p->partial, used);
+   }
+   p->paused = false;
+
+   while (1)
+   {
+      if (p->out_bytes >= TCP_SEND_HIGH_WATER)
+      {
+         p->paused = true;
+         return save_partial(p, rx_buffer, used);
+      }
+
+      ssize_t n = recv(sock, &rx_buffer[used], sizeof(rx_buffer) - used, 0);
+
+      if (n > 0)
+      {
+         if (frame_callback == NULL)
+         {
+            dispatch(sock, (int)n, data_func, chain_func);
+         }
+         else
+         {
+            used += (uint32_t)n;
+            if (!dispatch_frames(sock, &used, data_func, chain_func))
+            {
+               return false;
+            }
+         }
+      }
+      else if (n == 0)
+      {
+         // Hang up: the replies queued are still sent
+         p->eof = true;
+         return true;
+      }
+      else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      {
+         return save_partial(p, rx_buffer, used);
+      }
+      else if (errno == ECONNRESET)
+      {
+         return false;
+      }
+      else if (errno != EINTR)
+      {
+         perror("recv()");
+         /* if recv error we disconnect the client */
+         return false;
+      }
+   }
+}
+
+static void *app(void *arg)
+{
+   const loop_config *cfg = (const loop_config *)arg;
+   data_handler data_func = cfg->data_func;
+   chain_data_handler chain_func = cfg->chain_func;
+   disconnection_handler disconnection_func = cfg->disconnection_func;
+   SOCKET sock = init_connection(cfg->tcp_port, cfg->reuse_port);
+   int epfd = epoll_create1(0);
+   struct epoll_event events[TCP_EPOLL_EVENTS];
+
+   if (cfg->thread_func != NULL)
+   {
+      cfg->thread_func(cfg->shard);
+   }
+
+   /* add the connection socket and the eventfd of the values posted */
+   SOCKET efd = open_posts(cfg->shard);
+   struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.fd = sock };
+   struct epoll_event post_ev = { .events = EPOLLIN, .data.fd = efd };
+   if ((epfd < 0) || (efd < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &post_ev) < 0))
+   {
+      perror("epoll()");
+      exit(errno);
+   }
+
+   printf("[TCP Server] TCP Server started on TCP port: %d (loop %d)\r\n", cfg->tcp_port, cfg->shard);
+
+   while(1)
+   {
+      int nb = epoll_wait(epfd, events, TCP_EPOLL_EVENTS, -1);
+      if (nb < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         perror("epoll_wait()");
+         exit(errno);
+      }
+
+      for (int i = 0; i < nb; i++)
+      {
+         SOCKET fd = events[i].data.fd;
+
+         if (fd == sock)
+         {
+            accept_peers(epfd, sock, cfg);
+         }
+         else if (fd == efd)
+         {
+            uint64_t count;
+            if (read(efd, &count, sizeof(count)) > 0)
+            {
+               run_posts();
+            }
+         }
+         else if ((fd < peers_size) && peers[fd].connected)
+         {
+            peer *p = &peers[fd];
+            bool alive = true;
+            /* the socket has room again for the replies queued */
+            if (events[i].events & EPOLLOUT)
+            {
+               alive = flush_peer(fd);
+            }
+            /* a client is talking, read the data before the hang up; a paused peer is read again once its queue is under the mark */
+            if (alive && !p->eof && ((events[i].events & EPOLLIN) || (p->paused && (p->out_bytes < TCP_SEND_HIGH_WATER))))
+            {
+               alive = read_peer(fd, data_func, chain_func);
+            }
+            if (!alive || (events[i].events & (EPOLLHUP | EPOLLERR)) || (p->eof && (p->out_head == NULL)))
+            {
+               close_peer(fd, disconnection_func);
+            }
+         }
+      }
+   }
+
+   // Clear peers
+   for(int i = 0; i < peers_size; i++)
+   {
+       if (peers[i].connected)
+       {
+            closesocket(i);
+       }
+   }
+   free(peers);
+   close(efd);
+   close(epfd);
+   // End server
+   end_connection(sock);
+   return NULL;
+}
+
+
+#endif
+
+int tcp_server_init(data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int tcp_port)
+{
+   loop_config cfg = { data_func, NULL, conn_func, discon_func, NULL, tcp_port, 0, false };
+
+   init();
+
+   app(&cfg);
+
+   end();
+
+   return EXIT_SUCCESS;
+}
+
+int tcp_server_init_chain(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int tcp_port)
+{
+   loop_config cfg = { NULL, data_func, conn_func, discon_func, NULL, tcp_port, 0, false };
+
+   init();
+
+   app(&cfg);
+
+   end();
+
+   return EXIT_SUCCESS;
+}
+
+int tcp_server_init_sharded(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, thread_handler thread_func, int tcp_port, int nb_loops)
+{
+   pthread_t threads[TCP_MAX_LOOPS];
+   loop_config cfg[TCP_MAX_LOOPS];
+
+   if ((nb_loops < 1) || (nb_loops > TCP_MAX_LOOPS))
+   {
+      printf("[TCP Server] Invalid number of loops: %d\r\n", nb_loops);
+      return EXIT_FAILURE;
+   }
+
+   init();
+
+   for (int i = 0; i < nb_loops; i++)
+   {
+      cfg[i] = (loop_config){ NULL, data_func, conn_func, discon_func, thread_func, tcp_port, i, true };
+      if (pthread_create(&threads[i], NULL, app, &cfg[i]) != 0)
+      {
+         perror("pthread_create()");
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   for (int i = 0; i < nb_loops; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
 
    end();
 
@@ -4,7 +4,44 @@
 #include <stdlib.h>
 #include "transports.h"
 
-void tcp_server_send(int8_t channel_id, const char *buffer, size_t size);
+/**
+ * @brief Sends data outside of the reception handler, never blocks
+ *
+ * The bytes the socket does not accept at once are queued and written in order when it
+ * has room again. Must be called from the event loop thread that owns the channel.
+ */
+void tcp_server_send(int32_t channel_id, const char *buffer, size_t size);
+int tcp_server_send_chain(int32_t channel_id, const csm_chain *data);
+
+/**
+ * @brief Hands a value to the event loop thread that owns the channel, callable from any thread
+ *
+ * The value is queued and the loop is woken up by its eventfd; the loop then calls the posted
+ * handler with the channel and the value, where tcp_server_send_chain() can be used.
+ * Returns 0 if queued, -1 if the queue of the loop is full.
+ */
+int tcp_server_post(int32_t channel_id, int value);
+void tcp_server_set_posted_handler(posted_handler posted_func);
+
+/**
+ * @brief Number of channels, to call before the init: the connection handler gives ids from 0 to channels_count - 1
+ *
+ * The tables of the channels are allocated by the init, TCP_DEFAULT_CHANNELS by default.
+ */
+void tcp_server_set_channels(int32_t channels_count);
+void tcp_server_set_sent_handler(sent_handler sent_func);
+void tcp_server_set_frame_handler(frame_handler frame_func);
 int tcp_server_init(data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int tcp_port);
+int tcp_server_init_chain(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int tcp_port);
+
+/**
+ * @brief Runs nb_loops event loop threads, each one with its own listener (SO_REUSEPORT)
+ *
+ * The kernel spreads the connections over the listeners; a connection is then served
+ * by the same thread until it is closed. thread_func is called at the start of each
+ * thread with its loop index, so that the application can give it its own slice of
+ * channels: the handlers of different loops run concurrently.
+ */
+int tcp_server_init_sharded(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, thread_handler thread_func, int tcp_port, int nb_loops);
 
 #endif // TCP_SERVER_H
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE // recvmmsg()
+#include "udp_client.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define INVALID_SOCKET -1
+#define closesocket(s) close(s)
+typedef int SOCKET;
+
+#endif
+
+// Biggest datagram expected, each datagram of a batch is read in its own slot of the buffer
+#ifndef UDP_CLIENT_DATAGRAM
+#define UDP_CLIENT_DATAGRAM     2048
+#endif
+
+// Datagrams read per system call
+#ifndef UDP_CLIENT_BATCH
+#define UDP_CLIENT_BATCH        16
+#endif
+
+int udp_client_open(const char *host, const char *port)
+{
+   struct addrinfo hints;
+   struct addrinfo *res = NULL;
+   SOCKET sock = INVALID_SOCKET;
+
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_DGRAM;
+
+   int err = getaddrinfo(host, port, &hints, &res);
+   if (err != 0)
+   {
+      printf("[UDP client] Cannot resolve %s: %s\r\n", host, gai_strerror(err));
+      return INVALID_SOCKET;
+   }
+
+   for (struct addrinfo *ai = res; (ai != NULL) && (sock == INVALID_SOCKET); ai = ai->ai_next)
+   {
+      sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if ((sock != INVALID_SOCKET) && (connect(sock, ai->ai_addr, ai->ai_addrlen) < 0))
+      {
+         closesocket(sock);
+         sock = INVALID_SOCKET;
+      }
+   }
+   freeaddrinfo(res);
+
+   if (sock == INVALID_SOCKET)
+   {
+      perror("[UDP client] connect()");
+   }
+   return sock;
+}
+
+int udp_client_send(int sock, const char *buf, int size)
+{
+   ssize_t ret;
+
+   do
+   {
+      ret = send(sock, buf, size, 0);
+   }
+   while ((ret < 0) && (errno == EINTR));
+
+   if (ret < 0)
+   {
+      perror("[UDP client] send()");
+   }
+   return (int)ret;
+}
+
+/**
+ * @brief Reads the datagrams received, waits up to timeout seconds for the first one
+ * @return the number of bytes copied in buf, 0 on timeout, -1 on error
+ */
+int udp_client_read(int sock, char *buf, int size, int timeout)
+{
+   struct pollfd pfd = { .fd = sock, .events = POLLIN };
+   int ret = poll(&pfd, 1, timeout * 1000);
+
+   if (ret <= 0)
+   {
+      return ((ret < 0) && (errno != EINTR)) ? -1 : 0;
+   }
+
+   // Slots of one datagram, the datagrams are then packed at the start of buf
+   unsigned int nb = (unsigned int)size / UDP_CLIENT_DATAGRAM;
+   unsigned int slot = UDP_CLIENT_DATAGRAM;
+   if (nb == 0U)
+   {
+      nb = 1U;
+      slot = (unsigned int)size;
+   }
+   else if (nb > UDP_CLIENT_BATCH)
+   {
+      nb = UDP_CLIENT_BATCH;
+   }
+
+   struct iovec iov[UDP_CLIENT_BATCH];
+   struct mmsghdr msgs[UDP_CLIENT_BATCH];
+   memset(msgs, 0, sizeof(msgs));
+   for (unsigned int i = 0U; i < nb; i++)
+   {
+      iov[i].iov_base = &buf[i * slot];
+      iov[i].iov_len = slot;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+
+   ret = recvmmsg(sock, msgs, nb, MSG_DONTWAIT, NULL);
+   if (ret < 0)
+   {
+      // ECONNREFUSED: nobody listens on the meter side
+      perror("[UDP client] recvmmsg()");
+      return -1;
+   }
+
+   int total = 0;
+   for (int i = 0; i < ret; i++)
+   {
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+      {
+         printf("[UDP client] Datagram bigger than %u bytes, truncated\r\n", slot);
+      }
+      memmove(&buf[total], iov[i].iov_base, msgs[i].msg_len);
+      total += (int)msgs[i].msg_len;
+   }
+   return total;
+}
+
+void udp_client_close(int sock)
+{
+   closesocket(sock);
+}
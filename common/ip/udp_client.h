@@ -0,0 +1,24 @@
+#ifndef UDP_CLIENT_H
+#define UDP_CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Wrapper protocol over UDP, client side
+ *
+ * The socket is connected to the meter: only its datagrams are received. The read
+ * takes all the datagrams already there in one call (recvmmsg), such as the blocks of
+ * a general block transfer window, and returns them one after the other.
+ */
+int udp_client_open(const char *host, const char *port);
+int udp_client_send(int sock, const char *buf, int size);
+int udp_client_read(int sock, char *buf, int size, int timeout);
+void udp_client_close(int sock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UDP_CLIENT_H
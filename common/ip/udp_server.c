@@ -0,0 +1,398 @@
+#define _GNU_SOURCE // recvmmsg(), sendmmsg()
+#include "udp_server.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include "csm_array.h"
+#include "csm_llc.h"
+#include "transports.h"
+
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+#define closesocket(s) close(s)
+typedef int SOCKET;
+typedef struct sockaddr_in SOCKADDR_IN;
+typedef struct sockaddr SOCKADDR;
+
+#endif
+
+#ifndef UDP_BUF_SIZE
+#define UDP_BUF_SIZE        2048
+#endif
+
+// Datagrams received or sent per system call
+#ifndef UDP_BATCH
+#define UDP_BATCH           32
+#endif
+
+// Seconds without datagram before a channel is released
+#ifndef UDP_IDLE_TIMEOUT
+#define UDP_IDLE_TIMEOUT    120
+#endif
+
+// Clients served at the same time, each one has its channel
+#ifndef UDP_MAX_CHANNELS
+#define UDP_MAX_CHANNELS    128
+#endif
+
+typedef struct
+{
+   bool used;
+   bool pending;           // a reply of the current batch refers to the buffers of the channel
+   int32_t channel_id;
+   uint16_t wport;         // source wPort of the client
+   SOCKADDR_IN addr;
+   time_t last_seen;
+} udp_peer;
+
+/* at most one peer per channel, searched linearly */
+static udp_peer peers[UDP_MAX_CHANNELS];
+static SOCKET server_sock = INVALID_SOCKET;
+
+/* batch of datagrams received, the handlers may write their reply in place */
+static uint8_t rx_buffers[UDP_BATCH][UDP_BUF_SIZE];
+static struct iovec rx_iov[UDP_BATCH];
+static SOCKADDR_IN rx_addr[UDP_BATCH];
+static struct mmsghdr rx_msgs[UDP_BATCH];
+
+/* batch of replies, sent without copy from the buffers given by the handlers */
+static struct iovec tx_iov[UDP_BATCH][CSM_CHAIN_MAX_SEGMENTS];
+static struct mmsghdr tx_msgs[UDP_BATCH];
+static udp_peer *tx_peers[UDP_BATCH];
+static unsigned int tx_count = 0U;
+
+/* optional notification of the replies sent */
+static sent_handler sent_callback = NULL;
+
+static SOCKET init_connection(int udp_port)
+{
+   SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+   SOCKADDR_IN sin = { 0 };
+
+   if(sock == INVALID_SOCKET)
+   {
+      perror("socket()");
+      exit(errno);
+   }
+
+   sin.sin_addr.s_addr = htonl(INADDR_ANY);
+   sin.sin_port = htons(udp_port);
+   sin.sin_family = AF_INET;
+
+   if(bind(sock,(SOCKADDR *) &sin, sizeof sin) == SOCKET_ERROR)
+   {
+      perror("bind()");
+      exit(errno);
+   }
+
+   // Wake up every second to release the idle channels
+   struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+   if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == SOCKET_ERROR)
+   {
+      perror("setsockopt()");
+      exit(errno);
+   }
+
+   return sock;
+}
+
+static udp_peer *find_peer(const SOCKADDR_IN *addr, uint16_t wport)
+{
+   for (int i = 0; i < UDP_MAX_CHANNELS; i++)
+   {
+      udp_peer *p = &peers[i];
+      if (p->used && (p->wport == wport) && (p->addr.sin_port == addr->sin_port) &&
+          (p->addr.sin_addr.s_addr == addr->sin_addr.s_addr))
+      {
+         return p;
+      }
+   }
+   return NULL;
+}
+
+static udp_peer *channel_peer(int32_t channel_id)
+{
+   for (int i = 0; i < UDP_MAX_CHANNELS; i++)
+   {
+      if (peers[i].used && (peers[i].channel_id == channel_id))
+      {
+         return &peers[i];
+      }
+   }
+   return NULL;
+}
+
+static udp_peer *connect_peer(const SOCKADDR_IN *addr, uint16_t wport, connection_handler connection_func)
+{
+   udp_peer *p = NULL;
+
+   for (int i = 0; (i < UDP_MAX_CHANNELS) && (p == NULL); i++)
+   {
+      if (!peers[i].used)
+      {
+         p = &peers[i];
+      }
+   }
+
+   // Grant access to the application layer
+   int32_t channel_id = (p != NULL) ? connection_func() : -1;
+   if (channel_id < 0)
+   {
+      printf("[UDP server] No channel for port %d of %s\r\n", wport, inet_ntoa(addr->sin_addr));
+      return NULL;
+   }
+
+   p->used = true;
+   p->pending = false;
+   p->channel_id = channel_id;
+   p->wport = wport;
+   p->addr = *addr;
+   return p;
+}
+
+// Releases the channels of the clients gone silent
+static void expire_peers(time_t now, disconnection_handler disconnection_func)
+{
+   for (int i = 0; i < UDP_MAX_CHANNELS; i++)
+   {
+      udp_peer *p = &peers[i];
+      if (p->used && !p->pending && ((now - p->last_seen) >= UDP_IDLE_TIMEOUT))
+      {
+         disconnection_func(p->channel_id);
+         p->used = false;
+      }
+   }
+}
+
+// Sends the replies of the batch, then the channels can reuse their buffers
+static void flush_replies(void)
+{
+   unsigned int done = 0U;
+
+   while (done < tx_count)
+   {
+      int ret = sendmmsg(server_sock, &tx_msgs[done], tx_count - done, 0);
+      if (ret > 0)
+      {
+         done += (unsigned int)ret;
+      }
+      else if (errno != EINTR)
+      {
+         // The first datagram left is the faulty one: skip it
+         perror("sendmmsg()");
+         done++;
+      }
+   }
+
+   for (unsigned int i = 0U; i < tx_count; i++)
+   {
+      tx_peers[i]->pending = false;
+      if (sent_callback != NULL)
+      {
+         sent_callback(tx_peers[i]->channel_id);
+      }
+   }
+   tx_count = 0U;
+}
+
+static void queue_reply(udp_peer *p, const csm_chain *chain)
+{
+   struct msghdr *hdr = &tx_msgs[tx_count].msg_hdr;
+
+   for (uint32_t i = 0U; i < chain->nb_segments; i++)
+   {
+      tx_iov[tx_count][i].iov_base = (void *)chain->seg[i].data;
+      tx_iov[tx_count][i].iov_len = chain->seg[i].size;
+   }
+
+   memset(hdr, 0, sizeof(*hdr));
+   hdr->msg_name = &p->addr;
+   hdr->msg_namelen = sizeof(p->addr);
+   hdr->msg_iov = tx_iov[tx_count];
+   hdr->msg_iovlen = chain->nb_segments;
+   tx_peers[tx_count] = p;
+   tx_count++;
+   p->pending = true;
+
+   if (tx_count == UDP_BATCH)
+   {
+      flush_replies();
+   }
+}
+
+static void dispatch(int index, time_t now, data_handler data_func, chain_data_handler chain_func, connection_handler connection_func)
+{
+   uint8_t *data = rx_buffers[index];
+   uint32_t size = rx_msgs[index].msg_len;
+   const SOCKADDR_IN *addr = &rx_addr[index];
+
+   // One whole WPDU per datagram
+   if ((csm_llc_wpdu_frame_size(data, size) != (int)size) || (rx_msgs[index].msg_hdr.msg_flags & MSG_TRUNC))
+   {
+      printf("[UDP server] Invalid datagram from %s\r\n", inet_ntoa(addr->sin_addr));
+      return;
+   }
+
+   uint16_t wport = (uint16_t)((data[2] << 8U) | data[3]);
+   udp_peer *p = find_peer(addr, wport);
+   if (p == NULL)
+   {
+      p = connect_peer(addr, wport, connection_func);
+      if (p == NULL)
+      {
+         return;
+      }
+   }
+   p->last_seen = now;
+
+   // The previous reply of the channel may use the buffers of the channel
+   if (p->pending)
+   {
+      flush_replies();
+   }
+
+   if (chain_func != NULL)
+   {
+      csm_chain reply;
+      csm_chain_init(&reply);
+      if (chain_func(p->channel_id, data, size, UDP_BUF_SIZE, &reply) > 0)
+      {
+         queue_reply(p, &reply);
+      }
+   }
+   else if (data_func != NULL)
+   {
+      int ret = data_func(p->channel_id, data, size, UDP_BUF_SIZE);
+      csm_chain reply;
+      csm_chain_init(&reply);
+      if ((ret > 0) && csm_chain_append(&reply, data, (uint32_t)ret))
+      {
+         queue_reply(p, &reply);
+      }
+   }
+}
+
+static int app(data_handler data_func, chain_data_handler chain_func, connection_handler connection_func, disconnection_handler disconnection_func, int udp_port)
+{
+   time_t last_expiry = time(NULL);
+
+   server_sock = init_connection(udp_port);
+
+   for (int i = 0; i < UDP_BATCH; i++)
+   {
+      rx_iov[i].iov_base = rx_buffers[i];
+      rx_iov[i].iov_len = UDP_BUF_SIZE;
+   }
+
+   printf("[UDP Server] UDP Server started on UDP port: %d\r\n", udp_port);
+
+   while(1)
+   {
+      for (int i = 0; i < UDP_BATCH; i++)
+      {
+         struct msghdr *hdr = &rx_msgs[i].msg_hdr;
+         memset(hdr, 0, sizeof(*hdr));
+         hdr->msg_name = &rx_addr[i];
+         hdr->msg_namelen = sizeof(rx_addr[i]);
+         hdr->msg_iov = &rx_iov[i];
+         hdr->msg_iovlen = 1;
+      }
+
+      // Waits for the first datagram, then takes the ones already there
+      int nb = recvmmsg(server_sock, rx_msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+      time_t now = time(NULL);
+
+      if (nb < 0)
+      {
+         if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+         {
+            perror("recvmmsg()");
+            break;
+         }
+         nb = 0;
+      }
+
+      for (int i = 0; i < nb; i++)
+      {
+         dispatch(i, now, data_func, chain_func, connection_func);
+      }
+      flush_replies();
+
+      if (now != last_expiry)
+      {
+         expire_peers(now, disconnection_func);
+         last_expiry = now;
+      }
+   }
+
+   closesocket(server_sock);
+   server_sock = INVALID_SOCKET;
+   return EXIT_FAILURE;
+}
+
+void udp_server_set_sent_handler(sent_handler sent_func)
+{
+   sent_callback = sent_func;
+}
+
+int udp_server_send_chain(int32_t channel_id, const csm_chain *data)
+{
+   int ret = -1;
+   udp_peer *p = channel_peer(channel_id);
+
+   if ((p != NULL) && (server_sock != INVALID_SOCKET))
+   {
+      struct iovec iov[CSM_CHAIN_MAX_SEGMENTS];
+      struct msghdr hdr;
+
+      // Keep the order with the reply of the batch
+      if (p->pending)
+      {
+         flush_replies();
+      }
+
+      for (uint32_t i = 0U; i < data->nb_segments; i++)
+      {
+         iov[i].iov_base = (void *)data->seg[i].data;
+         iov[i].iov_len = data->seg[i].size;
+      }
+
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_name = &p->addr;
+      hdr.msg_namelen = sizeof(p->addr);
+      hdr.msg_iov = iov;
+      hdr.msg_iovlen = data->nb_segments;
+
+      if (sendmsg(server_sock, &hdr, 0) >= 0)
+      {
+         ret = (int)data->size;
+      }
+      else
+      {
+         perror("sendmsg()");
+      }
+   }
+   return ret;
+}
+
+int udp_server_init(data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int udp_port)
+{
+   return app(data_func, NULL, conn_func, discon_func, udp_port);
+}
+
+int udp_server_init_chain(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int udp_port)
+{
+   return app(NULL, data_func, conn_func, discon_func, udp_port);
+}
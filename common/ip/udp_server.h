@@ -0,0 +1,25 @@
+#ifndef UDP_SERVER_H
+#define UDP_SERVER_H
+
+#include <stdlib.h>
+#include "transports.h"
+
+/**
+ * @brief Wrapper protocol over UDP, one WPDU per datagram
+ *
+ * UDP has no connection: a channel is given to each pair (source address, source wPort)
+ * at its first datagram with the connection handler, and released with the
+ * disconnection handler after UDP_IDLE_TIMEOUT seconds without datagram. The datagrams
+ * are received and the replies sent by batches (recvmmsg/sendmmsg), in one thread.
+ */
+int udp_server_init(data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int udp_port);
+int udp_server_init_chain(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func, int udp_port);
+
+/**
+ * @brief Sends a datagram to a channel outside of the reception handler
+ * Must be called from the thread of the server.
+ */
+int udp_server_send_chain(int32_t channel_id, const csm_chain *data);
+void udp_server_set_sent_handler(sent_handler sent_func);
+
+#endif // UDP_SERVER_H
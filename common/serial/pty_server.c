@@ -0,0 +1,170 @@
+#define _GNU_SOURCE // posix_openpt(), ptsname()
+#include "pty_server.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdbool.h>
+
+#include "csm_array.h"
+#include "hdlc.h"
+
+#endif
+
+#ifndef PTY_BUF_SIZE
+#define PTY_BUF_SIZE        4096
+#endif
+
+static uint8_t rx_buffer[PTY_BUF_SIZE];
+static uint8_t frame_buffer[PTY_BUF_SIZE];
+
+static int open_pty(int *slave)
+{
+   int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+   if ((master < 0) || (grantpt(master) < 0) || (unlockpt(master) < 0))
+   {
+      perror("posix_openpt()");
+      exit(errno);
+   }
+
+   // Kept open, so that the master does not see a hang up between two clients
+   *slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+   if (*slave < 0)
+   {
+      perror("open()");
+      exit(errno);
+   }
+
+   // Binary line: no echo, no translation of the bytes
+   struct termios t_opt;
+   if (tcgetattr(*slave, &t_opt) == 0)
+   {
+      cfmakeraw(&t_opt);
+      (void) tcsetattr(*slave, TCSANOW, &t_opt);
+   }
+
+   return master;
+}
+
+static bool write_chain(int fd, const csm_chain *chain)
+{
+   struct iovec iov[CSM_CHAIN_MAX_SEGMENTS];
+   uint32_t nb = 0U;
+
+   for (uint32_t i = 0U; i < chain->nb_segments; i++)
+   {
+      iov[nb].iov_base = (void *)chain->seg[i].data;
+      iov[nb].iov_len = chain->seg[i].size;
+      nb++;
+   }
+
+   while (nb > 0U)
+   {
+      ssize_t sent = writev(fd, iov, (int)nb);
+      if (sent < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         perror("writev()");
+         return false;
+      }
+
+      // Skip what is written, the line may take the frame in several parts
+      uint32_t first = 0U;
+      while ((first < nb) && ((size_t)sent >= iov[first].iov_len))
+      {
+         sent -= (ssize_t)iov[first].iov_len;
+         first++;
+      }
+      if (first < nb)
+      {
+         iov[first].iov_base = (uint8_t *)iov[first].iov_base + sent;
+         iov[first].iov_len -= (size_t)sent;
+      }
+      memmove(iov, &iov[first], (nb - first) * sizeof(iov[0]));
+      nb -= first;
+   }
+
+   return true;
+}
+
+// Gives the frames completed by the bytes read to the link
+static void dispatch_frames(int fd, int32_t channel_id, hdlc_deframer *def, uint32_t size, chain_data_handler data_func)
+{
+   const uint8_t *data = rx_buffer;
+
+   while (size > 0U)
+   {
+      uint32_t used = 0U;
+      int frame = hdlc_deframer_push(def, data, size, &used);
+
+      if (frame > 0)
+      {
+         csm_chain reply;
+         csm_chain_init(&reply);
+         if (data_func(channel_id, def->buffer, (uint32_t)frame, def->size, &reply) > 0)
+         {
+            (void) write_chain(fd, &reply);
+         }
+      }
+      data += used;
+      size -= used;
+   }
+}
+
+int pty_server_init(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func)
+{
+   int slave = -1;
+   int master = open_pty(&slave);
+   hdlc_deframer def;
+
+   hdlc_deframer_init(&def, frame_buffer, PTY_BUF_SIZE);
+
+   int32_t channel_id = conn_func();
+   if (channel_id < 0)
+   {
+      printf("[PTY server] No channel available\r\n");
+      close(slave);
+      close(master);
+      return EXIT_FAILURE;
+   }
+
+   printf("[PTY Server] Serial line on: %s\r\n", ptsname(master));
+
+   while (1)
+   {
+      ssize_t ret = read(master, rx_buffer, PTY_BUF_SIZE);
+
+      if (ret > 0)
+      {
+         dispatch_frames(master, channel_id, &def, (uint32_t)ret, data_func);
+      }
+      else if ((ret < 0) && (errno == EINTR))
+      {
+         continue;
+      }
+      else
+      {
+         perror("read()");
+         break;
+      }
+   }
+
+   if (def.errors > 0U)
+   {
+      printf("[PTY server] %u frame(s) dropped\r\n", (unsigned int)def.errors);
+   }
+   discon_func(channel_id);
+   close(slave);
+   close(master);
+   return EXIT_FAILURE;
+}
@@ -0,0 +1,17 @@
+#ifndef PTY_SERVER_H
+#define PTY_SERVER_H
+
+#include <stdlib.h>
+#include "transports.h"
+
+/**
+ * @brief Serial line emulated by a pseudo terminal, one channel
+ *
+ * The slave side (/dev/pts/N, printed at start) is opened by the client as a serial
+ * port. The HDLC frames are cut in the byte stream by an incremental deframer, whatever
+ * the size of the reads: the bytes out of a frame (noise, repeated flags) and the frames
+ * with a bad HCS/FCS are skipped. Runs until the master is closed, in the calling thread.
+ */
+int pty_server_init(chain_data_handler data_func, connection_handler conn_func, disconnection_handler discon_func);
+
+#endif // PTY_SERVER_H
@@ -0,0 +1,579 @@
+/*
+ *  AES-NI support functions
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+
+/*
+ * [AES-WP] http://software.intel.com/en-us/articles/intel-advanced-encryption-standard-aes-instructions-set
+ * [CLMUL-WP] http://software.intel.com/en-us/articles/intel-carry-less-multiplication-instruction-and-its-usage-for-computing-the-gcm-mode/
+ */
+
+#if !defined(MBEDTLS_CONFIG_FILE)
+#include "config.h"
+#else
+#include MBEDTLS_CONFIG_FILE
+#endif
+
+#if defined(MBEDTLS_AESNI_C)
+
+#include "aesni.h"
+#include "gcm.h"
+
+#include <string.h>
+
+#if defined(MBEDTLS_HAVE_X86_64)
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+/*
+ * Only the functions below use the AES-NI, PCLMULQDQ and SSSE3 instructions;
+ * they are called after mbedtls_aesni_has_support().
+ */
+#define AESNI_TARGET __attribute__((target("sse2,ssse3,aes,pclmul")))
+
+/*
+ * AES-NI support detection routine
+ */
+int mbedtls_aesni_has_support( unsigned int what )
+{
+    static int done = 0;
+    static unsigned int c = 0;
+
+    if( ! done )
+    {
+        unsigned int a, b, d;
+
+        if( __get_cpuid( 1, &a, &b, &c, &d ) == 0 )
+            c = 0;
+        done = 1;
+    }
+
+    return( ( c & what ) != 0 );
+}
+
+/*
+ * AES-NI AES-ECB block en(de)cryption
+ */
+AESNI_TARGET
+int mbedtls_aesni_crypt_ecb( mbedtls_aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] )
+{
+    const __m128i *rk = (const __m128i *) ctx->rk;
+    __m128i b = _mm_xor_si128( _mm_loadu_si128( (const __m128i *) input ),
+                               _mm_loadu_si128( rk ) );
+    int i;
+
+    if( mode == MBEDTLS_AES_ENCRYPT )
+    {
+        for( i = 1; i < ctx->nr; i++ )
+            b = _mm_aesenc_si128( b, _mm_loadu_si128( rk + i ) );
+        b = _mm_aesenclast_si128( b, _mm_loadu_si128( rk + ctx->nr ) );
+    }
+    else
+    {
+        for( i = 1; i < ctx->nr; i++ )
+            b = _mm_aesdec_si128( b, _mm_loadu_si128( rk + i ) );
+        b = _mm_aesdeclast_si128( b, _mm_loadu_si128( rk + ctx->nr ) );
+    }
+
+    _mm_storeu_si128( (__m128i *) output, b );
+
+    return( 0 );
+}
+
+/*
+ * GCM handles its bit strings with the first bit as the lowest power of X:
+ * the blocks are byte reversed, then the products shifted left by one bit
+ * ([CLMUL-WP] algorithms 2 and 4, Gueron's reduction).
+ */
+AESNI_TARGET
+static inline __m128i gcm_bswap( __m128i x )
+{
+    return( _mm_shuffle_epi8( x, _mm_set_epi8( 0, 1, 2, 3, 4, 5, 6, 7,
+                                               8, 9, 10, 11, 12, 13, 14, 15 ) ) );
+}
+
+/* Accumulates the 256-bit carry-less product a * b in hi:lo */
+AESNI_TARGET
+static inline void gcm_clmul( __m128i a, __m128i b, __m128i *lo, __m128i *hi )
+{
+    __m128i t0 = _mm_clmulepi64_si128( a, b, 0x00 );
+    __m128i t1 = _mm_clmulepi64_si128( a, b, 0x10 );
+    __m128i t2 = _mm_clmulepi64_si128( a, b, 0x01 );
+    __m128i t3 = _mm_clmulepi64_si128( a, b, 0x11 );
+
+    t1 = _mm_xor_si128( t1, t2 );
+    *lo = _mm_xor_si128( *lo, _mm_xor_si128( t0, _mm_slli_si128( t1, 8 ) ) );
+    *hi = _mm_xor_si128( *hi, _mm_xor_si128( t3, _mm_srli_si128( t1, 8 ) ) );
+}
+
+/* Shifts hi:lo left by one bit and reduces it modulo x^128 + x^7 + x^2 + x + 1 */
+AESNI_TARGET
+static inline __m128i gcm_reduce( __m128i lo, __m128i hi )
+{
+    __m128i t7, t8, t9, t2, t4, t5;
+
+    t7 = _mm_srli_epi32( lo, 31 );
+    t8 = _mm_srli_epi32( hi, 31 );
+    lo = _mm_slli_epi32( lo, 1 );
+    hi = _mm_slli_epi32( hi, 1 );
+
+    t9 = _mm_srli_si128( t7, 12 );
+    t8 = _mm_slli_si128( t8, 4 );
+    t7 = _mm_slli_si128( t7, 4 );
+    lo = _mm_or_si128( lo, t7 );
+    hi = _mm_or_si128( hi, t8 );
+    hi = _mm_or_si128( hi, t9 );
+
+    t7 = _mm_slli_epi32( lo, 31 );
+    t8 = _mm_slli_epi32( lo, 30 );
+    t9 = _mm_slli_epi32( lo, 25 );
+    t7 = _mm_xor_si128( t7, _mm_xor_si128( t8, t9 ) );
+    t8 = _mm_srli_si128( t7, 4 );
+    t7 = _mm_slli_si128( t7, 12 );
+    lo = _mm_xor_si128( lo, t7 );
+
+    t2 = _mm_srli_epi32( lo, 1 );
+    t4 = _mm_srli_epi32( lo, 2 );
+    t5 = _mm_srli_epi32( lo, 7 );
+    t2 = _mm_xor_si128( t2, _mm_xor_si128( t4, t5 ) );
+    t2 = _mm_xor_si128( t2, t8 );
+    lo = _mm_xor_si128( lo, t2 );
+
+    return( _mm_xor_si128( hi, lo ) );
+}
+
+/*
+ * GCM multiplication: c = a times b in GF(2^128)
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_mult( unsigned char c[16],
+                     const unsigned char a[16],
+                     const unsigned char b[16] )
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+
+    gcm_clmul( gcm_bswap( _mm_loadu_si128( (const __m128i *) a ) ),
+               gcm_bswap( _mm_loadu_si128( (const __m128i *) b ) ), &lo, &hi );
+
+    _mm_storeu_si128( (__m128i *) c, gcm_bswap( gcm_reduce( lo, hi ) ) );
+}
+
+/*
+ * GCM en(de)cryption, 4 blocks at once: the AES rounds of the four counters
+ * are interleaved, and the GHASH is aggregated with the powers of H
+ *   X' = (X + C0) * H^4 + C1 * H^3 + C2 * H^2 + C3 * H
+ * which needs one reduction instead of four.
+ */
+AESNI_TARGET
+size_t mbedtls_aesni_gcm_crypt( const mbedtls_aes_context *ctx,
+                        int mode,
+                        const unsigned char hpow[4][16],
+                        unsigned char y[16],
+                        unsigned char buf[16],
+                        size_t length,
+                        const unsigned char *input,
+                        unsigned char *output )
+{
+    __m128i rk[15];
+    __m128i h[4];
+    __m128i ctr, acc;
+    const __m128i one = _mm_set_epi32( 0, 0, 0, 1 );
+    size_t done = 0;
+    int i, k;
+
+    for( i = 0; i <= ctx->nr; i++ )
+        rk[i] = _mm_loadu_si128( (const __m128i *) ctx->rk + i );
+
+    for( k = 0; k < 4; k++ )
+        h[k] = gcm_bswap( _mm_loadu_si128( (const __m128i *) hpow[k] ) );
+
+    /* Byte reversed, the 32-bit counter of GCM is the lowest lane */
+    ctr = gcm_bswap( _mm_loadu_si128( (const __m128i *) y ) );
+    acc = gcm_bswap( _mm_loadu_si128( (const __m128i *) buf ) );
+
+    while( length - done >= 64 )
+    {
+        __m128i b[4], in[4], ct[4];
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        for( k = 0; k < 4; k++ )
+        {
+            ctr = _mm_add_epi32( ctr, one );
+            b[k] = _mm_xor_si128( gcm_bswap( ctr ), rk[0] );
+        }
+
+        for( i = 1; i < ctx->nr; i++ )
+        {
+            b[0] = _mm_aesenc_si128( b[0], rk[i] );
+            b[1] = _mm_aesenc_si128( b[1], rk[i] );
+            b[2] = _mm_aesenc_si128( b[2], rk[i] );
+            b[3] = _mm_aesenc_si128( b[3], rk[i] );
+        }
+
+        /* All the input is read before writing: in place is allowed */
+        for( k = 0; k < 4; k++ )
+            in[k] = _mm_loadu_si128( (const __m128i *) ( input + done ) + k );
+
+        for( k = 0; k < 4; k++ )
+        {
+            __m128i out = _mm_xor_si128( _mm_aesenclast_si128( b[k], rk[ctx->nr] ), in[k] );
+            _mm_storeu_si128( (__m128i *) ( output + done ) + k, out );
+            ct[k] = gcm_bswap( ( mode == MBEDTLS_GCM_ENCRYPT ) ? out : in[k] );
+        }
+
+        gcm_clmul( _mm_xor_si128( acc, ct[0] ), h[0], &lo, &hi );
+        gcm_clmul( ct[1], h[1], &lo, &hi );
+        gcm_clmul( ct[2], h[2], &lo, &hi );
+        gcm_clmul( ct[3], h[3], &lo, &hi );
+        acc = gcm_reduce( lo, hi );
+
+        done += 64;
+    }
+
+    _mm_storeu_si128( (__m128i *) y, gcm_bswap( ctr ) );
+    _mm_storeu_si128( (__m128i *) buf, gcm_bswap( acc ) );
+
+    return( done );
+}
+
+/*
+ * Up to 16 bytes, zero padded
+ */
+static void gcm_load_partial( unsigned char block[16],
+                              const unsigned char *p, size_t len )
+{
+    memset( block, 0, 16 );
+    memcpy( block, p, len );
+}
+
+/*
+ * GHASH of m blocks (1 to 4), byte reversed, with one reduction:
+ *   X' = (X + C0) * H^m + C1 * H^(m-1) + ... + C(m-1) * H
+ * hpow holds H^4, H^3, H^2 and H.
+ */
+AESNI_TARGET
+static inline __m128i gcm_ghash_blocks( __m128i acc, const __m128i *c, size_t m,
+                                        const __m128i hpow[4] )
+{
+    __m128i lo = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    size_t j;
+
+    gcm_clmul( _mm_xor_si128( acc, c[0] ), hpow[4 - m], &lo, &hi );
+    for( j = 1; j < m; j++ )
+        gcm_clmul( c[j], hpow[4 - m + j], &lo, &hi );
+
+    return( gcm_reduce( lo, hi ) );
+}
+
+/*
+ * Key stream of two lanes, the 4 next counter blocks of each one: the 8
+ * blocks stay in registers through the rounds. The counters are not updated.
+ */
+AESNI_TARGET
+static inline void gcm_ctr_lanes( const __m128i *rka, __m128i ctra,
+                                  const __m128i *rkb, __m128i ctrb,
+                                  int nr, __m128i ks[8] )
+{
+    const __m128i one = _mm_set_epi32( 0, 0, 0, 1 );
+    __m128i ka, kb;
+    __m128i a0, a1, a2, a3, b0, b1, b2, b3;
+    int i;
+
+    ka = _mm_loadu_si128( rka );
+    kb = _mm_loadu_si128( rkb );
+    ctra = _mm_add_epi32( ctra, one );
+    a0 = _mm_xor_si128( gcm_bswap( ctra ), ka );
+    ctra = _mm_add_epi32( ctra, one );
+    a1 = _mm_xor_si128( gcm_bswap( ctra ), ka );
+    ctra = _mm_add_epi32( ctra, one );
+    a2 = _mm_xor_si128( gcm_bswap( ctra ), ka );
+    ctra = _mm_add_epi32( ctra, one );
+    a3 = _mm_xor_si128( gcm_bswap( ctra ), ka );
+    ctrb = _mm_add_epi32( ctrb, one );
+    b0 = _mm_xor_si128( gcm_bswap( ctrb ), kb );
+    ctrb = _mm_add_epi32( ctrb, one );
+    b1 = _mm_xor_si128( gcm_bswap( ctrb ), kb );
+    ctrb = _mm_add_epi32( ctrb, one );
+    b2 = _mm_xor_si128( gcm_bswap( ctrb ), kb );
+    ctrb = _mm_add_epi32( ctrb, one );
+    b3 = _mm_xor_si128( gcm_bswap( ctrb ), kb );
+
+    for( i = 1; i < nr; i++ )
+    {
+        ka = _mm_loadu_si128( rka + i );
+        kb = _mm_loadu_si128( rkb + i );
+        a0 = _mm_aesenc_si128( a0, ka );
+        b0 = _mm_aesenc_si128( b0, kb );
+        a1 = _mm_aesenc_si128( a1, ka );
+        b1 = _mm_aesenc_si128( b1, kb );
+        a2 = _mm_aesenc_si128( a2, ka );
+        b2 = _mm_aesenc_si128( b2, kb );
+        a3 = _mm_aesenc_si128( a3, ka );
+        b3 = _mm_aesenc_si128( b3, kb );
+    }
+
+    ka = _mm_loadu_si128( rka + nr );
+    kb = _mm_loadu_si128( rkb + nr );
+    ks[0] = _mm_aesenclast_si128( a0, ka );
+    ks[1] = _mm_aesenclast_si128( a1, ka );
+    ks[2] = _mm_aesenclast_si128( a2, ka );
+    ks[3] = _mm_aesenclast_si128( a3, ka );
+    ks[4] = _mm_aesenclast_si128( b0, kb );
+    ks[5] = _mm_aesenclast_si128( b1, kb );
+    ks[6] = _mm_aesenclast_si128( b2, kb );
+    ks[7] = _mm_aesenclast_si128( b3, kb );
+}
+
+/*
+ * Up to 64 bytes of a lane at pos: en(de)cryption with the key stream and
+ * GHASH of the ciphertext, the last partial block zero padded.
+ */
+AESNI_TARGET
+static inline __m128i gcm_lane_blocks( mbedtls_gcm_job *job, int mode, size_t pos,
+                                       const __m128i ks[4], __m128i acc,
+                                       const __m128i hpow[4] )
+{
+    unsigned char block[16];
+    __m128i c[4];
+    __m128i in, out;
+    size_t m, n;
+
+    for( m = 0; m < 4 && pos + 16 * m < job->length; m++ )
+    {
+        size_t off = pos + 16 * m;
+
+        n = job->length - off;
+        if( n >= 16 )
+        {
+            in = _mm_loadu_si128( (const __m128i *) ( job->input + off ) );
+            out = _mm_xor_si128( in, ks[m] );
+            _mm_storeu_si128( (__m128i *) ( job->output + off ), out );
+        }
+        else
+        {
+            gcm_load_partial( block, job->input + off, n );
+            in = _mm_loadu_si128( (const __m128i *) block );
+            out = _mm_xor_si128( in, ks[m] );
+            _mm_storeu_si128( (__m128i *) block, out );
+            memcpy( job->output + off, block, n );
+            memset( block + n, 0, 16 - n );
+            out = _mm_loadu_si128( (const __m128i *) block );
+        }
+
+        c[m] = gcm_bswap( ( mode == MBEDTLS_GCM_ENCRYPT ) ? out : in );
+    }
+
+    return( gcm_ghash_blocks( acc, c, m, hpow ) );
+}
+
+/*
+ * Batch of messages, in lockstep by 64 bytes: the active lanes are taken
+ * by pairs, whose 8 counter blocks go through the AES rounds together as
+ * in mbedtls_aesni_gcm_crypt(). Each lane has its GHASH, aggregated by
+ * groups of 4 blocks. The blocks after the end of a message are ciphered
+ * but not used.
+ */
+AESNI_TARGET
+void mbedtls_aesni_gcm_batch( int mode,
+                      mbedtls_gcm_job *jobs,
+                      size_t count )
+{
+    const __m128i *rk[MBEDTLS_GCM_BATCH_LANES];
+    __m128i h[MBEDTLS_GCM_BATCH_LANES][4];
+    __m128i ctr[MBEDTLS_GCM_BATCH_LANES];
+    __m128i acc[MBEDTLS_GCM_BATCH_LANES];
+    __m128i ek0[MBEDTLS_GCM_BATCH_LANES];
+    size_t active[MBEDTLS_GCM_BATCH_LANES];
+    const __m128i four = _mm_set_epi32( 0, 0, 0, 4 );
+    const __m128i one = _mm_set_epi32( 0, 0, 0, 1 );
+    unsigned char block[16];
+    __m128i c[4], ks[8];
+    size_t max_len = 0;
+    size_t pos, k, j, m, n, nb;
+    int nr;
+
+    nr = ( (const mbedtls_aes_context *) jobs[0].ctx->cipher_ctx.cipher_ctx )->nr;
+
+    for( k = 0; k < count; k++ )
+    {
+        const mbedtls_gcm_context *ctx = jobs[k].ctx;
+
+        rk[k] = (const __m128i *) ( (const mbedtls_aes_context *) ctx->cipher_ctx.cipher_ctx )->rk;
+        for( j = 0; j < 4; j++ )
+            h[k][j] = gcm_bswap( _mm_loadu_si128( (const __m128i *) ctx->HP[j] ) );
+
+        /* J0 = IV || 0^31 || 1, the counter blocks start at J0 + 1 */
+        memcpy( block, jobs[k].iv, 12 );
+        block[12] = block[13] = block[14] = 0;
+        block[15] = 1;
+        ctr[k] = gcm_bswap( _mm_loadu_si128( (const __m128i *) block ) );
+        acc[k] = _mm_setzero_si128();
+
+        if( jobs[k].length > max_len )
+            max_len = jobs[k].length;
+
+        /* GHASH of the additional data */
+        for( pos = 0; pos < jobs[k].add_len; pos += 64 )
+        {
+            for( m = 0; m < 4 && pos + 16 * m < jobs[k].add_len; m++ )
+            {
+                n = jobs[k].add_len - pos - 16 * m;
+                gcm_load_partial( block, jobs[k].add + pos + 16 * m, n > 16 ? 16 : n );
+                c[m] = gcm_bswap( _mm_loadu_si128( (const __m128i *) block ) );
+            }
+            acc[k] = gcm_ghash_blocks( acc[k], c, m, h[k] );
+        }
+    }
+
+    /* E(K, J0), for the tags: the counter blocks minus one */
+    for( k = 0; k < count; k += 2 )
+    {
+        j = ( k + 1 < count ) ? k + 1 : k;
+        gcm_ctr_lanes( rk[k], _mm_sub_epi32( ctr[k], one ),
+                       rk[j], _mm_sub_epi32( ctr[j], one ), nr, ks );
+        ek0[k] = ks[0];
+        ek0[j] = ks[4];
+    }
+
+    /* Counter mode and GHASH of the ciphertext */
+    for( pos = 0; pos < max_len; pos += 64 )
+    {
+        nb = 0;
+        for( k = 0; k < count; k++ )
+        {
+            if( pos < jobs[k].length )
+                active[nb++] = k;
+        }
+
+        for( j = 0; j < nb; j += 2 )
+        {
+            size_t a = active[j];
+            size_t b = ( j + 1 < nb ) ? active[j + 1] : a;
+
+            gcm_ctr_lanes( rk[a], ctr[a], rk[b], ctr[b], nr, ks );
+
+            acc[a] = gcm_lane_blocks( &jobs[a], mode, pos, &ks[0], acc[a], h[a] );
+            ctr[a] = _mm_add_epi32( ctr[a], four );
+
+            if( b != a )
+            {
+                acc[b] = gcm_lane_blocks( &jobs[b], mode, pos, &ks[4], acc[b], h[b] );
+                ctr[b] = _mm_add_epi32( ctr[b], four );
+            }
+        }
+    }
+
+    /* Lengths in bits, then T = E(K, J0) + GHASH */
+    for( k = 0; k < count; k++ )
+    {
+        c[0] = _mm_set_epi64x( (long long) ( (uint64_t) jobs[k].add_len * 8 ),
+                               (long long) ( (uint64_t) jobs[k].length * 8 ) );
+        acc[k] = gcm_ghash_blocks( acc[k], c, 1, h[k] );
+
+        _mm_storeu_si128( (__m128i *) jobs[k].tag,
+                          _mm_xor_si128( ek0[k], gcm_bswap( acc[k] ) ) );
+    }
+}
+
+/*
+ * Compute decryption round keys from encryption round keys
+ */
+AESNI_TARGET
+void mbedtls_aesni_inverse_key( unsigned char *invkey,
+                        const unsigned char *fwdkey, int nr )
+{
+    __m128i *ik = (__m128i *) invkey;
+    const __m128i *fk = (const __m128i *) fwdkey + nr;
+    int i;
+
+    _mm_storeu_si128( ik, _mm_loadu_si128( fk ) );
+
+    for( i = 1, fk--; i < nr; i++, fk-- )
+        _mm_storeu_si128( ik + i, _mm_aesimc_si128( _mm_loadu_si128( fk ) ) );
+
+    _mm_storeu_si128( ik + nr, _mm_loadu_si128( fk ) );
+}
+
+/* SubWord() of FIPS-197, with the S-box of AESKEYGENASSIST */
+AESNI_TARGET
+static inline uint32_t aesni_sub_word( uint32_t w )
+{
+    return( (uint32_t) _mm_cvtsi128_si32(
+                _mm_aeskeygenassist_si128( _mm_set_epi32( 0, 0, (int) w, 0 ), 0 ) ) );
+}
+
+/*
+ * Key expansion of FIPS-197 5.2, for all the key sizes. The words are kept
+ * little endian, so that the round keys are the bytes loaded by AESENC.
+ * Not on the data path: the keys are expanded once per context.
+ */
+AESNI_TARGET
+int mbedtls_aesni_setkey_enc( unsigned char *rk,
+                      const unsigned char *key,
+                      size_t bits )
+{
+    uint32_t w[60];
+    uint32_t rcon = 0x01;
+    size_t nk = bits / 32;
+    size_t nb_words, i;
+
+    switch( bits )
+    {
+        case 128: nb_words = 44; break;
+        case 192: nb_words = 52; break;
+        case 256: nb_words = 60; break;
+        default : return( MBEDTLS_ERR_AES_INVALID_KEY_LENGTH );
+    }
+
+    memcpy( w, key, nk * 4 );
+
+    for( i = nk; i < nb_words; i++ )
+    {
+        uint32_t t = w[i - 1];
+
+        if( i % nk == 0 )
+        {
+            t = aesni_sub_word( ( t >> 8 ) | ( t << 24 ) ) ^ rcon;
+            rcon = ( ( rcon << 1 ) ^ ( ( rcon & 0x80 ) ? 0x1b : 0x00 ) ) & 0xff;
+        }
+        else if( nk > 6 && i % nk == 4 )
+        {
+            t = aesni_sub_word( t );
+        }
+
+        w[i] = w[i - nk] ^ t;
+    }
+
+    memcpy( rk, w, nb_words * 4 );
+
+    return( 0 );
+}
+
+#endif /* MBEDTLS_HAVE_X86_64 */
+
+#endif /* MBEDTLS_AESNI_C */
@@ -0,0 +1,161 @@
+/**
+ * \file aesni.h
+ *
+ * \brief AES-NI for hardware AES acceleration on some Intel processors
+ *
+ *  Copyright (C) 2006-2015, ARM Limited, All Rights Reserved
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *  not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *  WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *
+ *  This file is part of mbed TLS (https://tls.mbed.org)
+ */
+#ifndef MBEDTLS_AESNI_H
+#define MBEDTLS_AESNI_H
+
+#include "aes.h"
+#include "gcm.h"
+
+#define MBEDTLS_AESNI_AES      0x02000000u
+#define MBEDTLS_AESNI_CLMUL    0x00000002u
+
+/*
+ * The instructions are generated with the intrinsics of GCC and Clang, for the
+ * functions of aesni.c only: the rest of the library is built for the baseline
+ * x86-64 and the CPU is checked at runtime with CPUID.
+ */
+#if defined(MBEDTLS_HAVE_ASM) && ( defined(__GNUC__) || defined(__clang__) ) &&  \
+    ( defined(__amd64__) || defined(__x86_64__) )   &&  \
+    ! defined(MBEDTLS_HAVE_X86_64)
+#define MBEDTLS_HAVE_X86_64
+#endif
+
+#if defined(MBEDTLS_HAVE_X86_64)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          AES-NI features detection routine
+ *
+ * \param what     The feature to detect
+ *                 (MBEDTLS_AESNI_AES or MBEDTLS_AESNI_CLMUL)
+ *
+ * \return         1 if CPU has support for the feature, 0 otherwise
+ */
+int mbedtls_aesni_has_support( unsigned int what );
+
+/**
+ * \brief          AES-NI AES-ECB block en(de)cryption
+ *
+ * \param ctx      AES context
+ * \param mode     MBEDTLS_AES_ENCRYPT or MBEDTLS_AES_DECRYPT
+ * \param input    16-byte input block
+ * \param output   16-byte output block
+ *
+ * \return         0 on success (cannot fail)
+ */
+int mbedtls_aesni_crypt_ecb( mbedtls_aes_context *ctx,
+                     int mode,
+                     const unsigned char input[16],
+                     unsigned char output[16] );
+
+/**
+ * \brief          GCM multiplication: c = a * b in GF(2^128)
+ *
+ * \param c        Result
+ * \param a        First operand
+ * \param b        Second operand
+ *
+ * \note           Both operands and result are bit strings interpreted as
+ *                 elements of GF(2^128) as per the GCM spec.
+ */
+void mbedtls_aesni_gcm_mult( unsigned char c[16],
+                     const unsigned char a[16],
+                     const unsigned char b[16] );
+
+/**
+ * \brief          GCM en(de)cryption of whole groups of 4 blocks
+ *
+ * \param ctx      AES context, set up for encryption
+ * \param mode     MBEDTLS_GCM_ENCRYPT or MBEDTLS_GCM_DECRYPT
+ * \param hpow     H^4, H^3, H^2 and H, as per the GCM spec
+ * \param y        Counter block, incremented for each block
+ * \param buf      GHASH accumulator, updated with the ciphertext
+ * \param length   Length of the data, the trailing bytes not multiple of
+ *                 64 are left to the caller
+ * \param input    Buffer holding the input data
+ * \param output   Buffer for holding the output data
+ *
+ * \return         Number of bytes processed
+ *
+ * \note           The four counters are ciphered in parallel and the
+ *                 GHASH of the four blocks is reduced once.
+ */
+size_t mbedtls_aesni_gcm_crypt( const mbedtls_aes_context *ctx,
+                        int mode,
+                        const unsigned char hpow[4][16],
+                        unsigned char y[16],
+                        unsigned char buf[16],
+                        size_t length,
+                        const unsigned char *input,
+                        unsigned char *output );
+
+/**
+ * \brief          GCM en(de)cryption and tag of several messages at once
+ *
+ * \param mode     MBEDTLS_GCM_ENCRYPT or MBEDTLS_GCM_DECRYPT
+ * \param jobs     Messages, their context with AES-NI (aesni set), all
+ *                 with the same key size, and a 12 bytes IV
+ * \param count    Number of jobs, up to MBEDTLS_GCM_BATCH_LANES
+ *
+ * \note           The blocks of the messages are ciphered in parallel, each
+ *                 one with its own round keys and counter, and each message
+ *                 has its GHASH accumulator. The short messages leave the
+ *                 batch when they are done.
+ */
+void mbedtls_aesni_gcm_batch( int mode,
+                      mbedtls_gcm_job *jobs,
+                      size_t count );
+
+/**
+ * \brief           Compute decryption round keys from encryption round keys
+ *
+ * \param invkey    Round keys for the equivalent inverse cipher
+ * \param fwdkey    Original round keys (for encryption)
+ * \param nr        Number of rounds (that is, number of round keys minus one)
+ */
+void mbedtls_aesni_inverse_key( unsigned char *invkey,
+                        const unsigned char *fwdkey, int nr );
+
+/**
+ * \brief           Perform key expansion (for encryption)
+ *
+ * \param rk        Destination buffer where the round keys are written
+ * \param key       Encryption key
+ * \param bits      Key size in bits (must be 128, 192 or 256)
+ *
+ * \return          0 if successful, or MBEDTLS_ERR_AES_INVALID_KEY_LENGTH
+ */
+int mbedtls_aesni_setkey_enc( unsigned char *rk,
+                      const unsigned char *key,
+                      size_t bits );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MBEDTLS_HAVE_X86_64 */
+
+#endif /* MBEDTLS_AESNI_H */
@@ -51,6 +51,7 @@
 
 /* mbed TLS modules */
 #define MBEDTLS_AES_C
+#define MBEDTLS_AESNI_C         /* x86-64 only, selected at runtime (CPUID) */
 #define MBEDTLS_GCM_C
 #define MBEDTLS_CIPHER_C
 #define MBEDTLS_SHA1_C
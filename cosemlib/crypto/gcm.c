@@ -42,7 +42,7 @@
 #include <string.h>
 
 #if defined(MBEDTLS_AESNI_C)
-#include "mbedtls/aesni.h"
+#include "aesni.h"
 #endif
 
 #if defined(MBEDTLS_SELF_TEST) && defined(MBEDTLS_AES_C)
@@ -124,9 +124,15 @@ static int gcm_gen_table( mbedtls_gcm_context *ctx )
     ctx->HH[8] = vh;
 
 #if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
-    /* With CLMUL support, we need only h, not the rest of the table */
+    /* With CLMUL support, we need only h, not the rest of the table, and its
+     * powers for the 4 blocks path */
     if( mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) )
+    {
+        memcpy( ctx->HP[3], h, 16 );
+        for( i = 2; i >= 0; i-- )
+            mbedtls_aesni_gcm_mult( ctx->HP[i], ctx->HP[i + 1], h );
         return( 0 );
+    }
 #endif
 
     /* 0 corresponds to 0 in GF(2^128) */
@@ -187,6 +193,13 @@ int mbedtls_gcm_setkey( mbedtls_gcm_context *ctx,
     if( ( ret = gcm_gen_table( ctx ) ) != 0 )
         return( ret );
 
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    /* The AES context of the cipher is then ciphered by AES-NI directly */
+    ctx->aesni = ( cipher == MBEDTLS_CIPHER_ID_AES &&
+                   mbedtls_aesni_has_support( MBEDTLS_AESNI_AES ) &&
+                   mbedtls_aesni_has_support( MBEDTLS_AESNI_CLMUL ) );
+#endif
+
     return( 0 );
 }
 
@@ -372,6 +385,19 @@ int mbedtls_gcm_update( mbedtls_gcm_context *ctx,
     ctx->len += length;
 
     p = input;
+
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    if( ctx->aesni && length >= 64 )
+    {
+        use_len = mbedtls_aesni_gcm_crypt( (const mbedtls_aes_context *) ctx->cipher_ctx.cipher_ctx,
+                                           ctx->mode, (const unsigned char (*)[16]) ctx->HP,
+                                           ctx->y, ctx->buf, length, p, out_p );
+        length -= use_len;
+        p += use_len;
+        out_p += use_len;
+    }
+#endif
+
     while( length > 0 )
     {
         use_len = ( length < 16 ) ? length : 16;
@@ -466,6 +492,88 @@ int mbedtls_gcm_crypt_and_tag( mbedtls_gcm_context *ctx,
     return( 0 );
 }
 
+/*
+ * Batch of messages: the context of each job is copied, the key schedule
+ * (cipher_ctx) is only read by the encryption of the blocks.
+ */
+static int gcm_job_check( const mbedtls_gcm_job *job )
+{
+    if( job->ctx == NULL || job->iv == NULL ||
+        ( job->add == NULL && job->add_len != 0 ) ||
+        ( (uint64_t) job->add_len ) >> 61 != 0 ||
+        (uint64_t) job->length > 0xFFFFFFFE0ull )
+    {
+        return( MBEDTLS_ERR_GCM_BAD_INPUT );
+    }
+
+    if( job->output > job->input &&
+        (size_t) ( job->output - job->input ) < job->length )
+    {
+        return( MBEDTLS_ERR_GCM_BAD_INPUT );
+    }
+
+    return( 0 );
+}
+
+static int gcm_job_run( mbedtls_gcm_job *job, int mode )
+{
+    int ret;
+    mbedtls_gcm_context ctx = *job->ctx;
+
+    ret = mbedtls_gcm_crypt_and_tag( &ctx, mode, job->length, job->iv, 12,
+                                     job->add, job->add_len, job->input,
+                                     job->output, 16, job->tag );
+
+    /* The copy shares the cipher context, only the GCM state is wiped */
+    mbedtls_zeroize( &ctx, sizeof( mbedtls_gcm_context ) );
+
+    return( ret );
+}
+
+int mbedtls_gcm_crypt_and_tag_batch( int mode,
+                             mbedtls_gcm_job *jobs,
+                             size_t count )
+{
+    int ret;
+    size_t i;
+
+    for( i = 0; i < count; i++ )
+    {
+        if( ( ret = gcm_job_check( &jobs[i] ) ) != 0 )
+            return( ret );
+    }
+
+    i = 0;
+    while( i < count )
+    {
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+        /* Consecutive jobs with AES-NI and the same key size run together */
+        size_t n = 0;
+
+        while( i + n < count && n < MBEDTLS_GCM_BATCH_LANES &&
+               jobs[i + n].ctx->aesni &&
+               ( (const mbedtls_aes_context *) jobs[i + n].ctx->cipher_ctx.cipher_ctx )->nr ==
+               ( (const mbedtls_aes_context *) jobs[i].ctx->cipher_ctx.cipher_ctx )->nr )
+        {
+            n++;
+        }
+
+        if( n > 0 )
+        {
+            mbedtls_aesni_gcm_batch( mode, jobs + i, n );
+            i += n;
+            continue;
+        }
+#endif
+
+        if( ( ret = gcm_job_run( &jobs[i], mode ) ) != 0 )
+            return( ret );
+        i++;
+    }
+
+    return( 0 );
+}
+
 int mbedtls_gcm_auth_decrypt( mbedtls_gcm_context *ctx,
                       size_t length,
                       const unsigned char *iv,
@@ -50,6 +50,10 @@ typedef struct {
     unsigned char y[16];        /*!< Y working value */
     unsigned char buf[16];      /*!< buf working value */
     int mode;                   /*!< Encrypt or Decrypt */
+#if defined(MBEDTLS_AESNI_C)
+    int aesni;                  /*!< AES with AES-NI and CLMUL */
+    unsigned char HP[4][16];    /*!< H^4, H^3, H^2 and H for AES-NI */
+#endif
 }
 mbedtls_gcm_context;
 
@@ -143,6 +147,46 @@ int mbedtls_gcm_auth_decrypt( mbedtls_gcm_context *ctx,
                       const unsigned char *input,
                       unsigned char *output );
 
+/**
+ * \brief          One message of a batch, see mbedtls_gcm_crypt_and_tag_batch()
+ */
+typedef struct {
+    const mbedtls_gcm_context *ctx; /*!< keyed context, read only */
+    const unsigned char *iv;        /*!< 12 bytes initialization vector */
+    const unsigned char *add;       /*!< additional data (or NULL) */
+    size_t add_len;                 /*!< length of additional data */
+    const unsigned char *input;     /*!< buffer holding the input data */
+    unsigned char *output;          /*!< output buffer, can be the input */
+    size_t length;                  /*!< length of the input data */
+    unsigned char tag[16];          /*!< tag computed */
+}
+mbedtls_gcm_job;
+
+#define MBEDTLS_GCM_BATCH_LANES     8   /**< Messages processed together with AES-NI */
+
+/**
+ * \brief           GCM buffer encryption/decryption of several messages
+ *
+ * \note            Gives the same output and tags as mbedtls_gcm_crypt_and_tag()
+ *                  called for each job, the IV being 12 bytes long. The
+ *                  contexts are not modified: a context can be shared by
+ *                  several jobs, each one can have its own key.
+ *                  With AES-NI, up to MBEDTLS_GCM_BATCH_LANES jobs are run
+ *                  together, the AES blocks of all the messages interleaved
+ *                  and a GHASH per message; otherwise the jobs are run one
+ *                  after the other.
+ *
+ * \param mode      MBEDTLS_GCM_ENCRYPT or MBEDTLS_GCM_DECRYPT
+ * \param jobs      messages to process, their tag is written in the job
+ * \param count     number of jobs
+ *
+ * \return          0 if successful or MBEDTLS_ERR_GCM_BAD_INPUT (then no
+ *                  job is processed)
+ */
+int mbedtls_gcm_crypt_and_tag_batch( int mode,
+                             mbedtls_gcm_job *jobs,
+                             size_t count );
+
 /**
  * \brief           Generic GCM stream start function
  *
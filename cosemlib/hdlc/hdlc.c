@@ -53,58 +53,9 @@
 
 */
 
-static const uint16_t fcstab[256] = { 
-     0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf, 
-     0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7, 
-     0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e, 
-     0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876, 
-     0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd, 
-     0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5, 
-     0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c, 
-     0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974, 
-     0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb, 
-     0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3, 
-     0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a, 
-     0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72, 
-	 0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9, 
-     0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1, 
-     0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738, 
-     0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70, 
-     0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7, 
-     0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff, 
-     0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036, 
-     0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e, 
-     0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5, 
-     0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd, 
-     0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134, 
-     0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c, 
-     0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3, 
-     0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb, 
-     0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232, 
-     0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a, 
-     0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1, 
-     0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9, 
-     0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330, 
-     0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78 
-}; 
-
-#define PPPINITFCS16    0xffff  /* Initial FCS value */ 
-/* 
-* Calculate a new fcs given the current fcs and the new data. 
-*/ 
-uint16_t pppfcs16(uint16_t fcs, const uint8_t* cp, uint32_t len) 
-{ 
-	while (len--)
-	{
-		fcs = (fcs >> 8) ^ fcstab[(fcs ^ *cp++) & 0xff]; 
-	}
-	return (fcs); 
-} 
-
-
 // MASKS
 #define HDLC_FORMAT_TYPE	(0xA0)
-#define HDLC_LEN_HI         (0x03)
+#define HDLC_LEN_HI         (0x07)
 
 // BITS
 #define HDLC_SEGMENTATION_BIT	(3)
@@ -112,7 +63,7 @@ uint16_t pppfcs16(uint16_t fcs, const uint8_t* cp, uint32_t len)
 
 static uint16_t hdlc_get_len(const uint8_t *buf)
 {
-	uint16_t len = (buf[0] & HDLC_LEN_HI) << 11;
+	uint16_t len = (uint16_t)(buf[0] & HDLC_LEN_HI) << 8U;
 	return (len + buf[1]);
 }
 
@@ -139,9 +90,9 @@ void hdlc_init(hdlc_t *hdlc)
 	hdlc->data_index = 0U;
 	hdlc->data_size = 0U;
 	hdlc->sender = HDLC_SERVER;
-	hdlc->max_info_field_tx = 128U;
-	hdlc->max_info_field_rx = 128U;
-	hdlc->window_rx = 1U;
+	hdlc->max_info_field_tx = HDLC_DEFAULT_INFO_SIZE;
+	hdlc->max_info_field_rx = HDLC_DEFAULT_INFO_SIZE;
+	hdlc->window_rx = HDLC_MAX_WINDOW; // receive window proposed by a client, the frames of a window are all accepted
 	hdlc->window_tx = 1U;
 }
 
@@ -388,7 +339,7 @@ int hdlc_decode_info_field(hdlc_t *hdlc, const uint8_t *buf, uint16_t info_field
                     // Decode framing options
                     uint8_t index = 3U;
                     uint8_t number_of_tags = 0U;
-                    while (ret == HDLC_OK)
+                    while ((ret == HDLC_OK) && ((index + 2U) <= info_field_size))
                     {
                         uint8_t tag = buf[index];
                         index++;
@@ -452,6 +403,12 @@ int hdlc_decode_info_field(hdlc_t *hdlc, const uint8_t *buf, uint16_t info_field
                             }
                         }
 
+                        else
+                        {
+                            // Unknown parameter, skipped
+                            index += size;
+                        }
+
                         if (number_of_tags >= 4U)
                         {
                             break;
@@ -506,14 +463,14 @@ int hdlc_check_hcs(const uint8_t* buf, uint16_t size)
 }
 
 
-static const uint8_t snrm_nego[] = { 0x81U, 0x80U, 0x12U, 0x05U, 0x01U, 0x80U, 0x06U, 0x01U, 0x80U, 0x07U, 0x04U, 0x00U, 0x00U, 0x00U, 0x01U,
-                                     0x08U, 0x04U, 0x00U, 0x00U, 0x00U, 0x07 };
-static const uint16_t snrm_size = sizeof(snrm_nego);
-
 int hdlc_encode_snrm(hdlc_t *hdlc, uint8_t *buf, uint16_t size)
 {
+    uint8_t params[HDLC_PARAMETERS_SIZE];
+    // Proposal of the client: what it transmits and what it can receive
+    uint16_t params_size = hdlc_encode_parameters(hdlc, params);
+
     hdlc->type = HDLC_PACKET_TYPE_SNRM;
-    return hdlc_encode(hdlc, buf, size, 0x93U, snrm_nego, snrm_size);
+    return hdlc_encode(hdlc, buf, size, 0x93U, params, params_size);
 }
 
 int hdlc_encode_data(hdlc_t *hdlc, uint8_t *buf, uint16_t size, const uint8_t *data, uint16_t data_size)
@@ -530,20 +487,125 @@ int hdlc_encode_rr(hdlc_t *hdlc, uint8_t *buf, uint16_t size)
     return hdlc_encode(hdlc, buf, size, iframe, NULL, 0U);
 }
 
+// Writes a parameter of the negotiation on 1 or 2 bytes (lengths) or 4 bytes (windows)
+static uint8_t hdlc_write_option(uint8_t *buf, uint8_t tag, uint32_t value, uint8_t size)
+{
+    buf[0] = tag;
+    if ((size == 0U) && (value > 0xFFU))
+    {
+        size = 2U;
+    }
+    else if (size == 0U)
+    {
+        size = 1U;
+    }
+    buf[1] = size;
+    for (uint8_t i = 0U; i < size; i++)
+    {
+        buf[2U + i] = (uint8_t)(value >> (8U * (size - 1U - i)));
+    }
+    return size + 2U;
+}
 
-// Size is the max size of the buffer
-int hdlc_encode(hdlc_t *hdlc, uint8_t *buf, uint16_t size, uint8_t frame_type, const uint8_t *data, uint16_t data_size)
+/**
+ * @brief Encodes the parameters of the link in an information field of SNRM or UA
+ * The values are the ones of the sender of the frame (max_info_field_tx is what it transmits)
+ * @return the size of the information field
+ */
+uint16_t hdlc_encode_parameters(const hdlc_t *hdlc, uint8_t *buf)
 {
-    uint16_t index = 0U;
-    uint16_t info_field_start;
-    int ret = -1;
+    uint8_t index = 3U;
+
+    index += hdlc_write_option(&buf[index], 0x05U, hdlc->max_info_field_tx, 0U);
+    index += hdlc_write_option(&buf[index], 0x06U, hdlc->max_info_field_rx, 0U);
+    index += hdlc_write_option(&buf[index], 0x07U, hdlc->window_tx, 4U);
+    index += hdlc_write_option(&buf[index], 0x08U, hdlc->window_rx, 4U);
+
+    buf[0] = 0x81U; // format identifier
+    buf[1] = 0x80U; // group identifier
+    buf[2] = index - 3U;
+    return index;
+}
+
+int hdlc_encode_ua(hdlc_t *hdlc, uint8_t *buf, uint16_t size)
+{
+    uint8_t params[HDLC_PARAMETERS_SIZE];
+    uint16_t params_size = hdlc_encode_parameters(hdlc, params);
+
+    hdlc->type = HDLC_PACKET_TYPE_UA;
+    return hdlc_encode(hdlc, buf, size, 0x73U, params, params_size);
+}
+
+/**
+ * @brief Finds the boundaries of the HDLC frames in a stream (serial line, TCP)
+ * @return the size of the frame at the start of data, 0 if more data is needed, -1 if it is not a frame
+ */
+int hdlc_frame_size(const uint8_t *data, uint32_t size)
+{
+    int ret = 0;
+
+    if ((size > 0U) && (data[0] != 0x7EU))
+    {
+        ret = -1;
+    }
+    else if (size >= 3U)
+    {
+        if ((data[1] & HDLC_FORMAT_TYPE) == HDLC_FORMAT_TYPE)
+        {
+            uint32_t frame_size = hdlc_get_len(&data[1]) + 2U;
+
+            if (frame_size < HDLC_MIN_FRAME_SIZE)
+            {
+                ret = -1;
+            }
+            else if (frame_size <= size)
+            {
+                ret = (data[frame_size - 1U] == 0x7EU) ? (int)frame_size : -1;
+            }
+        }
+        else
+        {
+            ret = -1;
+        }
+    }
 
-    (void) size;
+    return ret;
+}
+
+// Size of a frame with an information field of info_size bytes, both 7E included
+uint16_t hdlc_frame_length(const hdlc_t *hdlc, uint16_t info_size)
+{
+    // 7E + frame format + server address + client address + control + FCS + 7E
+    uint16_t length = 1U + 2U + hdlc->addr_len + 1U + 1U + 2U + 1U;
+
+    if (info_size > 0U)
+    {
+        length += 2U + info_size; // HCS + information field
+    }
+    return length;
+}
+
+/**
+ * @brief Encodes a frame up to its information field (HCS included)
+ * The information field can then be written in place, followed by hdlc_encode_trailer().
+ * @return the index of the information field in the frame
+ */
+uint16_t hdlc_encode_header(hdlc_t *hdlc, uint8_t *buf, uint8_t frame_type, uint16_t info_size)
+{
+    uint16_t index = 0U;
+    uint16_t frame_size = hdlc_frame_length(hdlc, info_size) - 2U; // without both 7E
 
     buf[index] = 0x7EU;
+    index++;
 
-    // Bytes 1 and 2 contains frame length, will be encoded at the end
-    index += 3U; // Jump 7E + frame type/length
+    // Frame type, contains size and segmentation bit
+    buf[index] = 0xA0 + ((frame_size >> 8U) & 0x07U);
+    if (hdlc->segmentation)
+    {
+        buf[index] |= BIT(HDLC_SEGMENTATION_BIT);
+    }
+    buf[index + 1U] = (uint8_t)(frame_size & 0xFFU);
+    index += 2U;
 
     // Encode destination address
 
@@ -566,53 +628,54 @@ int hdlc_encode(hdlc_t *hdlc, uint8_t *buf, uint16_t size, uint8_t frame_type, c
         index++;
     }
 
-    // Encode UA
+    // Encode control field
     buf[index] = frame_type;
     index++; // jump over frame type
 
-    if ((data_size > 0U) &&
-        (data != NULL))
-    {
-        index += 2U; // jump over HCS
-        // memorize info field location
-        info_field_start = index;
-
-        // Copy info field
-        memcpy(&buf[info_field_start], &data[0], data_size);
-        index += data_size;
-    }
-
-    uint16_t frame_size = index + 1U; // Total size including FCS, without both 7E
-
-    // Insert frame type, contains size
-    buf[1] = 0xA0 + ((frame_size >> 8U) & 0x07U);
-    buf[2] = (uint8_t)(frame_size & 0xFFU);
-
-    if ((data_size > 0U) &&
-            (data != NULL))
+    if (info_size > 0U)
     {
         // Compute HCS
-        uint16_t hcs = pppfcs16(PPPINITFCS16, &buf[1], (info_field_start - 3U)); // minus 7E and HCS
+        uint16_t hcs = pppfcs16(PPPINITFCS16, &buf[1], (index - 1U)); // minus 7E
         hcs ^= 0xffff;
 
         // insert HCS
-        hdlc_set_uint16_low_first(&buf[info_field_start - 2U], hcs);
+        hdlc_set_uint16_low_first(&buf[index], hcs);
+        index += 2U; // jump over HCS
     }
 
-    // Now compute FCS
-    uint16_t fcs = pppfcs16(PPPINITFCS16, &buf[1], frame_size - 2U); // without FCS itself
+    return index;
+}
+
+// Computes the FCS of a frame of frame_length bytes (both 7E included) and closes it
+void hdlc_encode_trailer(uint8_t *buf, uint16_t frame_length)
+{
+    uint16_t fcs = pppfcs16(PPPINITFCS16, &buf[1], frame_length - 4U); // without 7E, FCS and 7E
     fcs ^= 0xffff;
 
     // Insert FCS
-    hdlc_set_uint16_low_first(&buf[index], fcs);
+    hdlc_set_uint16_low_first(&buf[frame_length - 3U], fcs);
+    buf[frame_length - 1U] = 0x7EU; // final
+}
 
-    index += 2U; // jump over FCS
-    buf[index] = 0x7EU; // final
-    index++;
+// Size is the max size of the buffer
+int hdlc_encode(hdlc_t *hdlc, uint8_t *buf, uint16_t size, uint8_t frame_type, const uint8_t *data, uint16_t data_size)
+{
+    int ret = -1;
+    uint16_t info_size = (data != NULL) ? data_size : 0U;
+    uint16_t length = hdlc_frame_length(hdlc, info_size);
 
-    if (index <= size)
+    if (length <= size)
     {
-        ret = index;
+        uint16_t index = hdlc_encode_header(hdlc, buf, frame_type, info_size);
+
+        if (info_size > 0U)
+        {
+            // Copy info field
+            memcpy(&buf[index], &data[0], info_size);
+        }
+
+        hdlc_encode_trailer(buf, length);
+        ret = length;
     }
 
     return ret;
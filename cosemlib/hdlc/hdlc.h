@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include "hdlc_config.h"
 
 //#include "transports.h"
 //
@@ -31,6 +32,19 @@ extern "C" {
 #define HDLC_ERR_NEGO   -9
 
 
+// 7E + format + destination + source + control + FCS + 7E, no information field
+#define HDLC_MIN_FRAME_SIZE     9U
+
+// Bytes of a frame around its information field (4 bytes server address)
+#define HDLC_FRAME_OVERHEAD     14U
+
+// Information field of SNRM/UA, with all the parameters on their largest size
+#define HDLC_PARAMETERS_SIZE    23U
+
+// Frame check sequence (CRC-16/X.25 of RFC 1662), on the HCS and the FCS
+#define PPPINITFCS16    0xffffU     // Initial FCS value
+#define PPPGOODFCS16    0xf0b8U     // Residue after the FCS of a good frame
+
 // Packet types
 #define HDLC_PACKET_TYPE_BAD    (0)
 #define HDLC_PACKET_TYPE_I      (1)
@@ -72,10 +86,50 @@ typedef struct
 
 } hdlc_t;
 
+typedef enum
+{
+    HDLC_DEFRAMER_HUNT = 0,     //!< Skips the bytes up to an opening flag
+    HDLC_DEFRAMER_FORMAT = 1,   //!< Frame format field, the frame length
+    HDLC_DEFRAMER_HEADER = 2,   //!< Addresses, control field and HCS
+    HDLC_DEFRAMER_BODY = 3      //!< Information field, FCS and closing flag
+} HDLC_DEFRAMER_STATE;
+
+/**
+ * @brief Cuts the HDLC frames in a byte stream given in chunks of any size (serial line)
+ *
+ * The bytes are copied once in the buffer, the HCS and the FCS computed on the way: a
+ * frame given by hdlc_deframer_push() has its flags, its HCS and its FCS checked. The
+ * frames can share their flags or be separated by several ones. A frame in error (bad
+ * HCS/FCS, too large for the buffer) is dropped and counted; the deframer then waits for
+ * the next flag.
+ */
+typedef struct
+{
+    uint8_t *buffer;            //!< Frame under reception, with its flags
+    uint32_t size;
+    uint32_t pos;               //!< Bytes of the frame received
+    uint16_t length;            //!< Size of the frame, with its flags
+    uint16_t hcs_end;           //!< Index after the HCS, 0 if not known or no HCS
+    uint16_t fcs;               //!< FCS of the bytes received, from the frame format
+    uint8_t state;              //!< HDLC_DEFRAMER_STATE
+    uint32_t errors;            //!< Frames dropped
+} hdlc_deframer;
+
+void hdlc_deframer_init(hdlc_deframer *def, uint8_t *buffer, uint32_t size);
+int hdlc_deframer_push(hdlc_deframer *def, const uint8_t *data, uint32_t size, uint32_t *used);
+
+uint16_t pppfcs16(uint16_t fcs, const uint8_t *cp, uint32_t len);
+
 void hdlc_init(hdlc_t *hdlc);
 int hdlc_decode_info_field(hdlc_t *hdlc, const uint8_t *buf, uint16_t info_field_size);
 int hdlc_encode_snrm(hdlc_t *hdlc, uint8_t *buf, uint16_t size);
 int hdlc_encode_rr(hdlc_t *hdlc, uint8_t *buf, uint16_t size);
+int hdlc_encode_ua(hdlc_t *hdlc, uint8_t *buf, uint16_t size);
+uint16_t hdlc_encode_parameters(const hdlc_t *hdlc, uint8_t *buf);
+uint16_t hdlc_frame_length(const hdlc_t *hdlc, uint16_t info_size);
+uint16_t hdlc_encode_header(hdlc_t *hdlc, uint8_t *buf, uint8_t frame_type, uint16_t info_size);
+void hdlc_encode_trailer(uint8_t *buf, uint16_t frame_length);
+int hdlc_frame_size(const uint8_t *data, uint32_t size);
 int hdlc_encode_data(hdlc_t *hdlc, uint8_t *buf, uint16_t size, const uint8_t *data, uint16_t data_size);
 int hdlc_encode(hdlc_t *hdlc, uint8_t *buf, uint16_t size, uint8_t frame_type, const uint8_t *data, uint16_t data_size);
 int hdlc_decode(hdlc_t *hdlc, const uint8_t *buf, uint16_t size);
@@ -1,9 +1,22 @@
 #ifndef HDLC_CONFIG_H
 #define HDLC_CONFIG_H
 
-const uint16_t cHdlcDefaultInformationSize = 128U;
-const uint8_t cHdlcDefaultAddressSize = 4U; ///< 4 bytes to encode destination address
-const uint16_t cHdlcDefaultAddress = 16U; ///< Default server address
+// Information field length when it is not negotiated (IEC 62056-46)
+#ifndef HDLC_DEFAULT_INFO_SIZE
+#define HDLC_DEFAULT_INFO_SIZE  128U
+#endif
 
-#endif // HDLC_CONFIG_H
+// Largest information field: the frame length is coded on 11 bits
+#ifndef HDLC_MAX_INFO_SIZE
+#define HDLC_MAX_INFO_SIZE      2030U
+#endif
+
+// Largest window, the sequence numbers are coded on 3 bits
+#ifndef HDLC_MAX_WINDOW
+#define HDLC_MAX_WINDOW         7U
+#endif
 
+#define HDLC_DEFAULT_ADDRESS_SIZE   4U  ///< 4 bytes to encode destination address
+#define HDLC_DEFAULT_ADDRESS        16U ///< Default server address
+
+#endif // HDLC_CONFIG_H
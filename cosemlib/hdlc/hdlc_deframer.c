@@ -0,0 +1,242 @@
+/**
+ * Incremental HDLC deframer, for the byte streams (serial line)
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include <string.h>
+
+#include "hdlc.h"
+
+#define HDLC_FLAG               0x7EU
+#define HDLC_MAX_ADDR_SIZE      4U
+
+static void start_frame(hdlc_deframer *def)
+{
+    def->buffer[0] = HDLC_FLAG;
+    def->pos = 1U;
+    def->length = 0U;
+    def->hcs_end = 0U;
+    def->state = HDLC_DEFRAMER_FORMAT;
+}
+
+// The last byte received may be the opening flag of the next frame
+static void drop_frame(hdlc_deframer *def, uint8_t last)
+{
+    def->errors++;
+    if (last == HDLC_FLAG)
+    {
+        start_frame(def);
+    }
+    else
+    {
+        def->state = HDLC_DEFRAMER_HUNT;
+    }
+}
+
+// Index after the control field, 0 if it is not received yet, -1 if an address is too long
+static int header_end(const uint8_t *buf, uint32_t pos)
+{
+    int ret = 0;
+    uint32_t index = 3U; // after the flag and the frame format
+    uint32_t nb_addr = 0U;
+    uint32_t addr_size = 0U;
+
+    // Destination then source address, the last byte of each one has its bit 0 set
+    while ((ret == 0) && (nb_addr < 2U) && (index < pos))
+    {
+        addr_size++;
+        if ((buf[index] & 1U) == 1U)
+        {
+            nb_addr++;
+            addr_size = 0U;
+        }
+        else if (addr_size >= HDLC_MAX_ADDR_SIZE)
+        {
+            ret = -1;
+        }
+        index++;
+    }
+
+    if ((ret == 0) && (nb_addr == 2U) && (index < pos))
+    {
+        ret = (int)(index + 1U);
+    }
+
+    return ret;
+}
+
+void hdlc_deframer_init(hdlc_deframer *def, uint8_t *buffer, uint32_t size)
+{
+    def->buffer = buffer;
+    def->size = size;
+    def->pos = 0U;
+    def->length = 0U;
+    def->hcs_end = 0U;
+    def->fcs = PPPINITFCS16;
+    def->state = HDLC_DEFRAMER_HUNT;
+    def->errors = 0U;
+}
+
+/**
+ * @brief Gives the next bytes of the stream to the deframer
+ * @param used: bytes of data consumed, the others are for the next call
+ * @return the size of the frame completed in the buffer of the deframer, 0 if all the data is consumed
+ *
+ * The frame stays valid up to the next call. The header is read byte by byte to find its
+ * HCS, the rest of the frame is copied and checked by blocks with the slicing-by-8 FCS.
+ */
+int hdlc_deframer_push(hdlc_deframer *def, const uint8_t *data, uint32_t size, uint32_t *used)
+{
+    uint32_t index = 0U;
+    int frame = 0;
+
+    while ((index < size) && (frame == 0))
+    {
+        switch (def->state)
+        {
+            case HDLC_DEFRAMER_HUNT:
+            {
+                const uint8_t *flag = (const uint8_t *)memchr(&data[index], HDLC_FLAG, size - index);
+                if (flag == NULL)
+                {
+                    index = size;
+                }
+                else
+                {
+                    index = (uint32_t)(flag - data) + 1U;
+                    start_frame(def);
+                }
+                break;
+            }
+
+            case HDLC_DEFRAMER_FORMAT:
+            {
+                uint8_t b = data[index];
+                index++;
+
+                // Flags repeated between two frames are skipped
+                if ((def->pos > 1U) || (b != HDLC_FLAG))
+                {
+                    def->buffer[def->pos] = b;
+                    def->pos++;
+
+                    if (def->pos == 3U)
+                    {
+                        def->length = (uint16_t)((((uint16_t)def->buffer[1] & 0x07U) << 8U) + def->buffer[2] + 2U);
+
+                        if (((def->buffer[1] & 0xF0U) != 0xA0U) ||
+                            (def->length < HDLC_MIN_FRAME_SIZE) ||
+                            (def->length > def->size))
+                        {
+                            drop_frame(def, b);
+                        }
+                        else
+                        {
+                            def->fcs = pppfcs16(PPPINITFCS16, &def->buffer[1], 2U);
+                            def->state = HDLC_DEFRAMER_HEADER;
+                        }
+                    }
+                }
+                break;
+            }
+
+            case HDLC_DEFRAMER_HEADER:
+            {
+                uint8_t b = data[index];
+                index++;
+                def->buffer[def->pos] = b;
+                def->pos++;
+                def->fcs = pppfcs16(def->fcs, &b, 1U);
+
+                if (def->hcs_end == 0U)
+                {
+                    int end = header_end(def->buffer, def->pos);
+
+                    if (end < 0)
+                    {
+                        drop_frame(def, b);
+                    }
+                    else if (end > 0)
+                    {
+                        if (((uint32_t)end + 3U) == def->length)
+                        {
+                            // No information field, thus no HCS: the FCS follows
+                            def->state = HDLC_DEFRAMER_BODY;
+                        }
+                        else if (((uint32_t)end + 6U) <= def->length)
+                        {
+                            def->hcs_end = (uint16_t)(end + 2);
+                        }
+                        else
+                        {
+                            drop_frame(def, b);
+                        }
+                    }
+                }
+                else if (def->pos == def->hcs_end)
+                {
+                    if (def->fcs == PPPGOODFCS16)
+                    {
+                        def->state = HDLC_DEFRAMER_BODY;
+                    }
+                    else
+                    {
+                        drop_frame(def, b);
+                    }
+                }
+                break;
+            }
+
+            case HDLC_DEFRAMER_BODY:
+            default:
+            {
+                uint32_t n = def->length - def->pos;
+                if (n > (size - index))
+                {
+                    n = size - index;
+                }
+
+                // The closing flag is out of the FCS
+                uint32_t checked = n;
+                if ((def->pos + checked) >= def->length)
+                {
+                    checked = def->length - 1U - def->pos;
+                }
+
+                memcpy(&def->buffer[def->pos], &data[index], n);
+                def->fcs = pppfcs16(def->fcs, &def->buffer[def->pos], checked);
+                def->pos += n;
+                index += n;
+
+                if (def->pos == def->length)
+                {
+                    uint8_t last = def->buffer[def->length - 1U];
+
+                    if ((last == HDLC_FLAG) && (def->fcs == PPPGOODFCS16))
+                    {
+                        frame = (int)def->length;
+                        // The closing flag can be the opening flag of the next frame
+                        def->pos = 1U;
+                        def->length = 0U;
+                        def->hcs_end = 0U;
+                        def->state = HDLC_DEFRAMER_FORMAT;
+                    }
+                    else
+                    {
+                        drop_frame(def, last);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    *used = index;
+    return frame;
+}
@@ -0,0 +1,441 @@
+/**
+ * HDLC data link layer of a server (secondary station)
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include <string.h>
+
+#include "hdlc_server.h"
+#include "csm_definitions.h"
+
+// Control fields of the responses, F bit set
+#define HDLC_CF_UA      0x73U
+#define HDLC_CF_DM      0x1FU
+
+// LLC of the APDUs (IEC 62056-46): E6 E6 00 for a command and E6 E7 00 for a response
+#define HDLC_LLC_SIZE   3U
+
+static const uint8_t cLlcResponse[HDLC_LLC_SIZE] = { 0xE6U, 0xE7U, 0x00U };
+
+#define HDLC_NEXT(n)    (((n) + 1U) & 0x07U)
+
+// I frame control field: N(R), P/F, N(S)
+#define HDLC_CF_I(nr, ns, pf)   ((uint8_t)(((nr) << 5U) | ((pf) ? 0x10U : 0x00U) | ((ns) << 1U)))
+
+void hdlc_server_init(hdlc_server *srv, int32_t channel_id, uint16_t phy_address, uint8_t *buffer, uint32_t buffer_size, chain_data_handler handler)
+{
+    srv->channel_id = channel_id;
+    srv->phy_address = phy_address;
+    srv->buffer = buffer;
+    srv->buffer_size = buffer_size;
+    srv->handler = handler;
+    srv->release = NULL;
+    srv->max_info_field = HDLC_DEFAULT_INFO_SIZE;
+    srv->max_window = 1U;
+    hdlc_server_reset(srv);
+}
+
+// Back to the disconnected mode, the default parameters apply until the next SNRM
+void hdlc_server_reset(hdlc_server *srv)
+{
+    hdlc_init(&srv->hdlc);
+    srv->hdlc.phy_address = srv->phy_address;
+    srv->state = HDLC_STATE_NDM;
+    srv->vs = 0U;
+    srv->vr = 0U;
+    srv->ns = 0U;
+    srv->peer_busy = FALSE;
+    srv->rx_size = 0U;
+    srv->tx_size = 0U;
+    srv->tx_offset = 0U;
+    srv->tx_pending = 0U;
+}
+
+static int encode_frame(hdlc_server *srv, uint8_t *out, uint32_t out_size, uint8_t control, const uint8_t *data, uint16_t data_size)
+{
+    int ret = -1;
+
+    if ((data_size + HDLC_FRAME_OVERHEAD) <= out_size)
+    {
+        srv->hdlc.sender = HDLC_SERVER;
+        srv->hdlc.segmentation = 0U;
+        ret = hdlc_encode(&srv->hdlc, out, (uint16_t)out_size, control, data, data_size);
+    }
+    else
+    {
+        CSM_ERR("[HDLC] Frame buffer too small");
+    }
+
+    return ret;
+}
+
+static int encode_rr(hdlc_server *srv, uint8_t *out, uint32_t out_size)
+{
+    int ret = -1;
+
+    if (HDLC_FRAME_OVERHEAD <= out_size)
+    {
+        srv->hdlc.sender = HDLC_SERVER;
+        srv->hdlc.segmentation = 0U;
+        srv->hdlc.rrr = srv->vr;
+        ret = hdlc_encode_rr(&srv->hdlc, out, (uint16_t)out_size);
+    }
+
+    return ret;
+}
+
+// Copies a part of the reply, preceded by its LLC, in the information field of a frame
+static void copy_reply(hdlc_server *srv, uint32_t offset, uint32_t size, uint8_t *dst)
+{
+    while ((size > 0U) && (offset < HDLC_LLC_SIZE))
+    {
+        *dst++ = cLlcResponse[offset];
+        offset++;
+        size--;
+    }
+
+    offset -= HDLC_LLC_SIZE;
+    for (uint32_t i = 0U; (i < srv->reply.nb_segments) && (size > 0U); i++)
+    {
+        const csm_segment *seg = &srv->reply.seg[i];
+
+        if (offset >= seg->size)
+        {
+            offset -= seg->size;
+        }
+        else
+        {
+            uint32_t part = seg->size - offset;
+            if (part > size)
+            {
+                part = size;
+            }
+            memcpy(dst, &seg->data[offset], part);
+            dst += part;
+            size -= part;
+            offset = 0U;
+        }
+    }
+}
+
+// Encodes the I frame of the reply at offset, the information field is taken from the reply buffers
+static int encode_segment(hdlc_server *srv, uint32_t offset, uint8_t ns, uint8_t final, uint8_t *out, uint32_t out_size)
+{
+    int ret = -1;
+    uint32_t remaining = srv->tx_size - offset;
+    uint16_t size = (remaining > srv->hdlc.max_info_field_tx) ? srv->hdlc.max_info_field_tx : (uint16_t)remaining;
+
+    srv->hdlc.sender = HDLC_SERVER;
+    srv->hdlc.segmentation = (size < remaining) ? 1U : 0U;
+    srv->hdlc.type = HDLC_PACKET_TYPE_I;
+
+    uint16_t length = hdlc_frame_length(&srv->hdlc, size);
+    if (length <= out_size)
+    {
+        uint16_t index = hdlc_encode_header(&srv->hdlc, out, HDLC_CF_I(srv->vr, ns, final), size);
+        copy_reply(srv, offset, size, &out[index]);
+        hdlc_encode_trailer(out, length);
+        ret = length;
+    }
+    else
+    {
+        CSM_ERR("[HDLC] Frame buffer too small");
+    }
+
+    return ret;
+}
+
+/**
+ * Sends the window: the I frames not acknowledged first (go back N), then the next
+ * ones of the reply, the F bit on the last one. The frames are sent again with the
+ * same N(S) until an N(R) acknowledges them.
+ */
+static int send_window(hdlc_server *srv, uint8_t *out, uint32_t out_size)
+{
+    uint32_t used = 0U;
+    uint32_t offset = srv->tx_offset;
+    uint8_t frames = 0U;
+    int ret = 0;
+
+    while ((ret >= 0) && (frames < srv->hdlc.window_tx) && (offset < srv->tx_size))
+    {
+        uint32_t next = offset + srv->hdlc.max_info_field_tx;
+        uint8_t final = ((frames + 1U) == srv->hdlc.window_tx) || (next >= srv->tx_size);
+
+        ret = encode_segment(srv, offset, (srv->ns + frames) & 0x07U, final, &out[used], out_size - used);
+        if (ret > 0)
+        {
+            used += (uint32_t)ret;
+            offset = next;
+            frames++;
+        }
+    }
+
+    srv->tx_pending = frames;
+    srv->vs = (srv->ns + frames) & 0x07U;
+
+    return (ret < 0) ? ret : (int)used;
+}
+
+// N(R) of the client acknowledges all the I frames before it
+static void acknowledge(hdlc_server *srv, uint8_t nr)
+{
+    uint8_t acked = (nr - srv->ns) & 0x07U;
+
+    if ((srv->tx_size > 0U) && (acked > 0U) && (acked <= srv->tx_pending))
+    {
+        srv->tx_offset += acked * srv->hdlc.max_info_field_tx;
+        srv->tx_pending -= acked;
+        srv->ns = nr;
+        if (srv->tx_offset >= srv->tx_size)
+        {
+            srv->tx_size = 0U;
+            srv->tx_offset = 0U;
+        }
+    }
+}
+
+static void start_reply(hdlc_server *srv, int size)
+{
+    if (size > 0)
+    {
+        srv->tx_size = (uint32_t)size + HDLC_LLC_SIZE;
+        srv->tx_offset = 0U;
+        srv->tx_pending = 0U;
+        srv->ns = srv->vs;
+    }
+}
+
+// Answer to a poll: the window of I frames of the reply, or a RR
+static int answer_poll(hdlc_server *srv, uint8_t *out, uint32_t out_size)
+{
+    if ((srv->tx_size == 0U) && !srv->peer_busy)
+    {
+        // Nothing left to send, maybe a response completed since
+        csm_chain_init(&srv->reply);
+        start_reply(srv, srv->handler(srv->channel_id, NULL, 0U, 0U, &srv->reply));
+    }
+
+    return ((srv->tx_size > 0U) && !srv->peer_busy) ? send_window(srv, out, out_size) : encode_rr(srv, out, out_size);
+}
+
+static int receive_information(hdlc_server *srv, uint8_t *frame, const hdlc_t *rx, uint8_t *out, uint32_t out_size)
+{
+    if (rx->sss != srv->vr)
+    {
+        // Repeated or out of sequence: the client did not receive our answer
+        CSM_LOG("[HDLC] I frame %d dropped, expected %d", rx->sss, srv->vr);
+        return answer_poll(srv, out, out_size);
+    }
+
+    srv->vr = HDLC_NEXT(srv->vr);
+
+    // A new request aborts the reply under transmission
+    srv->tx_size = 0U;
+    srv->tx_offset = 0U;
+    srv->tx_pending = 0U;
+    srv->vs = srv->ns;
+
+    uint8_t *apdu = &frame[rx->data_index];
+    uint32_t size = rx->data_size;
+    uint32_t buffer_size = rx->data_size;
+
+    if (rx->segmentation || (srv->rx_size > 0U))
+    {
+        // Segments of the APDU gathered in the buffer of the link
+        if ((srv->rx_size + rx->data_size) > srv->buffer_size)
+        {
+            CSM_ERR("[HDLC] APDU too big, dropped");
+            srv->rx_size = 0U;
+            return encode_rr(srv, out, out_size);
+        }
+
+        memcpy(&srv->buffer[srv->rx_size], apdu, rx->data_size);
+        srv->rx_size += rx->data_size;
+
+        if (rx->segmentation)
+        {
+            // Other segments of the APDU follow
+            return encode_rr(srv, out, out_size);
+        }
+
+        apdu = srv->buffer;
+        size = srv->rx_size;
+        buffer_size = srv->buffer_size;
+        srv->rx_size = 0U;
+    }
+    // else: the whole APDU is in the frame, executed in place
+
+    if ((size > HDLC_LLC_SIZE) && (apdu[0] == 0xE6U) && (apdu[1] == 0xE6U) && (apdu[2] == 0x00U))
+    {
+        csm_chain_init(&srv->reply);
+        start_reply(srv, srv->handler(srv->channel_id, &apdu[HDLC_LLC_SIZE], size - HDLC_LLC_SIZE, buffer_size - HDLC_LLC_SIZE, &srv->reply));
+    }
+    else
+    {
+        CSM_ERR("[HDLC] Bad LLC");
+    }
+
+    return answer_poll(srv, out, out_size);
+}
+
+static int connect_link(hdlc_server *srv, const uint8_t *frame, const hdlc_t *rx, uint8_t *out, uint32_t out_size)
+{
+    hdlc_t params = *rx;
+
+    // Values of the client, defaults if not present
+    params.max_info_field_tx = HDLC_DEFAULT_INFO_SIZE;
+    params.max_info_field_rx = HDLC_DEFAULT_INFO_SIZE;
+    params.window_tx = 1U;
+    params.window_rx = 1U;
+
+    if (hdlc_decode_info_field(&params, &frame[rx->data_index], rx->data_size) != HDLC_OK)
+    {
+        CSM_ERR("[HDLC] Bad SNRM parameters");
+        return encode_frame(srv, out, out_size, HDLC_CF_DM, NULL, 0U);
+    }
+
+    if (srv->state == HDLC_STATE_NRM)
+    {
+        CSM_LOG("[HDLC] Link reset by SNRM");
+        if (srv->release != NULL)
+        {
+            srv->release(srv->channel_id);
+        }
+    }
+
+    hdlc_server_reset(srv);
+    srv->hdlc.client_addr = rx->client_addr;
+    srv->hdlc.logical_device = rx->logical_device;
+    srv->hdlc.phy_address = rx->phy_address;
+    srv->hdlc.addr_len = rx->addr_len;
+
+    // What the client transmits is what we receive, within the limits of the server
+    uint16_t max_info = (srv->max_info_field < HDLC_MAX_INFO_SIZE) ? srv->max_info_field : HDLC_MAX_INFO_SIZE;
+    uint8_t max_window = (srv->max_window < HDLC_MAX_WINDOW) ? srv->max_window : HDLC_MAX_WINDOW;
+    srv->hdlc.max_info_field_rx = (params.max_info_field_tx < max_info) ? params.max_info_field_tx : max_info;
+    srv->hdlc.max_info_field_tx = (params.max_info_field_rx < max_info) ? params.max_info_field_rx : max_info;
+    srv->hdlc.window_rx = (params.window_tx < max_window) ? params.window_tx : max_window;
+    srv->hdlc.window_tx = (params.window_rx < max_window) ? params.window_rx : max_window;
+    srv->state = HDLC_STATE_NRM;
+
+    CSM_LOG("[HDLC] Connected to client %d, info field tx: %d, rx: %d, window tx: %d, rx: %d", srv->hdlc.client_addr,
+            srv->hdlc.max_info_field_tx, srv->hdlc.max_info_field_rx, srv->hdlc.window_tx, srv->hdlc.window_rx);
+
+    int ret = -1;
+    if ((HDLC_PARAMETERS_SIZE + HDLC_FRAME_OVERHEAD) <= out_size)
+    {
+        srv->hdlc.sender = HDLC_SERVER;
+        ret = hdlc_encode_ua(&srv->hdlc, out, (uint16_t)out_size);
+    }
+    return ret;
+}
+
+static int disconnect_link(hdlc_server *srv, uint8_t *out, uint32_t out_size)
+{
+    int ret;
+
+    if (srv->state == HDLC_STATE_NRM)
+    {
+        if (srv->release != NULL)
+        {
+            srv->release(srv->channel_id);
+        }
+        ret = encode_frame(srv, out, out_size, HDLC_CF_UA, NULL, 0U);
+        hdlc_server_reset(srv);
+        CSM_LOG("[HDLC] Disconnected");
+    }
+    else
+    {
+        ret = encode_frame(srv, out, out_size, HDLC_CF_DM, NULL, 0U);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Processes one frame of the client
+ * The out buffer must hold a window: max_window times the largest information field
+ * plus HDLC_FRAME_OVERHEAD.
+ * @return the size of the frame to send back in out, 0 if none, -1 on error
+ */
+int hdlc_server_input(hdlc_server *srv, uint8_t *frame, uint32_t size, uint8_t *out, uint32_t out_size)
+{
+    hdlc_t rx = srv->hdlc;
+    int ret = 0;
+
+    if ((size < HDLC_MIN_FRAME_SIZE) || (size > 0xFFFFU))
+    {
+        return 0;
+    }
+
+    // Frames with a bad checksum or for another server are ignored
+    rx.sender = HDLC_CLIENT;
+    rx.phy_address = srv->phy_address;
+    rx.data_size = 0U;
+    rx.segmentation = 0U;
+    if (hdlc_decode(&rx, frame, (uint16_t)size) != HDLC_OK)
+    {
+        CSM_LOG("[HDLC] Bad frame");
+        return 0;
+    }
+    if (rx.phy_address != srv->phy_address)
+    {
+        return 0;
+    }
+    if ((srv->state == HDLC_STATE_NRM) && (rx.client_addr != srv->hdlc.client_addr) && (rx.type != HDLC_PACKET_TYPE_SNRM))
+    {
+        return 0;
+    }
+
+    if (rx.type == HDLC_PACKET_TYPE_SNRM)
+    {
+        ret = connect_link(srv, frame, &rx, out, out_size);
+    }
+    else if (rx.type == HDLC_PACKET_TYPE_DISC)
+    {
+        srv->hdlc.client_addr = rx.client_addr;
+        ret = disconnect_link(srv, out, out_size);
+    }
+    else if (srv->state != HDLC_STATE_NRM)
+    {
+        // Only SNRM and DISC are accepted in the disconnected mode
+        if (rx.poll_final)
+        {
+            srv->hdlc.client_addr = rx.client_addr;
+            srv->hdlc.logical_device = rx.logical_device;
+            srv->hdlc.addr_len = rx.addr_len;
+            ret = encode_frame(srv, out, out_size, HDLC_CF_DM, NULL, 0U);
+        }
+    }
+    else if (rx.type == HDLC_PACKET_TYPE_I)
+    {
+        acknowledge(srv, rx.rrr);
+        ret = receive_information(srv, frame, &rx, out, out_size);
+        if (!rx.poll_final && (ret > 0))
+        {
+            ret = 0;
+        }
+    }
+    else if ((rx.type == HDLC_PACKET_TYPE_RR) || (rx.type == HDLC_PACKET_TYPE_RNR))
+    {
+        acknowledge(srv, rx.rrr);
+        srv->peer_busy = (rx.type == HDLC_PACKET_TYPE_RNR) ? TRUE : FALSE;
+        if (rx.poll_final)
+        {
+            ret = answer_poll(srv, out, out_size);
+        }
+    }
+    else
+    {
+        CSM_LOG("[HDLC] Frame type %d ignored", rx.type);
+    }
+
+    return ret;
+}
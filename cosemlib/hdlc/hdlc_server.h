@@ -0,0 +1,81 @@
+/**
+ * HDLC data link layer of a server (secondary station)
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#ifndef HDLC_SERVER_H
+#define HDLC_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdlc.h"
+#include "transports.h"
+
+typedef enum
+{
+    HDLC_STATE_NDM = 0,     //!< Normal disconnected mode, waits for a SNRM
+    HDLC_STATE_NRM = 1      //!< Normal response mode, the link is connected
+} HDLC_STATE;
+
+/**
+ * @brief One link to a client, over a serial line or a stream socket
+ *
+ * The frames received are given one by one to hdlc_server_input(): the client polls the
+ * server with the P bit, the server answers with up to a window of frames, the F bit
+ * on the last one. The APDU of the client is reassembled in the buffer of the link,
+ * then executed by the handler (chain_data_handler); its reply is segmented in I frames
+ * of the negotiated information field size. An RR acknowledges the frames before its
+ * N(R) and asks for the next window, starting again at the first frame not acknowledged.
+ *
+ * An APDU held in one I frame is given to the handler in place, in the frame; the
+ * segmented ones are gathered in the buffer of the link. The I frames of the reply are
+ * encoded with their information field read directly from the reply buffers.
+ *
+ * The handler is called with a NULL APDU when the client polls while the server has
+ * nothing left to send: it can then return a response completed later or the next
+ * block of a general block transfer. The reply must not refer to the frame received
+ * nor to the buffer of the link.
+ */
+typedef struct
+{
+    hdlc_t hdlc;                //!< Addresses of the client and parameters negotiated
+    uint8_t state;              //!< HDLC_STATE
+    uint8_t vs;                 //!< V(S), sequence number of the next I frame sent
+    uint8_t vr;                 //!< V(R), sequence number of the next I frame expected
+    uint8_t ns;                 //!< N(S) of the first I frame not acknowledged
+    uint8_t peer_busy;          //!< RNR received, no I frame until the next RR
+    int32_t channel_id;
+    uint16_t phy_address;       //!< Lower address of the server, other frames are ignored
+    uint16_t max_info_field;    //!< Largest information field proposed by the server
+    uint8_t max_window;         //!< Largest window proposed by the server, up to 7
+
+    uint8_t *buffer;            //!< Segments of the APDU received
+    uint32_t buffer_size;
+    uint32_t rx_size;
+
+    csm_chain reply;            //!< APDU under transmission
+    uint32_t tx_size;           //!< Size of the reply with its LLC, 0 if none
+    uint32_t tx_offset;         //!< Start of the first I frame not acknowledged
+    uint8_t tx_pending;         //!< I frames sent and not acknowledged
+
+    chain_data_handler handler;
+    disconnection_handler release;  //!< Optional, the link (and the association) is released
+} hdlc_server;
+
+void hdlc_server_init(hdlc_server *srv, int32_t channel_id, uint16_t phy_address, uint8_t *buffer, uint32_t buffer_size, chain_data_handler handler);
+void hdlc_server_reset(hdlc_server *srv);
+int hdlc_server_input(hdlc_server *srv, uint8_t *frame, uint32_t size, uint8_t *out, uint32_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HDLC_SERVER_H
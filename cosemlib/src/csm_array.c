@@ -279,3 +279,59 @@ int csm_array_read_u16(csm_array *array, uint16_t *value)
     }
     return ret;
 }
+
+
+void csm_chain_init(csm_chain *chain)
+{
+    chain->nb_segments = 0U;
+    chain->size = 0U;
+}
+
+int csm_chain_append(csm_chain *chain, const uint8_t *data, uint32_t size)
+{
+    int ret = TRUE;
+
+    if (size > 0U)
+    {
+        if (chain->nb_segments < CSM_CHAIN_MAX_SEGMENTS)
+        {
+            chain->seg[chain->nb_segments].data = data;
+            chain->seg[chain->nb_segments].size = size;
+            chain->nb_segments++;
+            chain->size += size;
+        }
+        else
+        {
+            CSM_ERR("[ARRAY] Chain full");
+            ret = FALSE;
+        }
+    }
+
+    return ret;
+}
+
+// Append the written data of the array, the array must not be modified until the chain is sent
+int csm_chain_append_array(csm_chain *chain, csm_array *array)
+{
+    return csm_chain_append(chain, csm_array_start(array), csm_array_written(array));
+}
+
+uint32_t csm_chain_copy(const csm_chain *chain, uint8_t *buffer, uint32_t max_size)
+{
+    uint32_t size = 0U;
+
+    if (chain->size <= max_size)
+    {
+        for (uint32_t i = 0U; i < chain->nb_segments; i++)
+        {
+            (void) memmove(&buffer[size], chain->seg[i].data, chain->seg[i].size);
+            size += chain->seg[i].size;
+        }
+    }
+    else
+    {
+        CSM_ERR("[ARRAY] Chain too big");
+    }
+
+    return size;
+}
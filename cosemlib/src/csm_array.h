@@ -27,6 +27,23 @@ typedef struct {
     uint8_t *buff;
 } csm_array;
 
+#ifndef CSM_CHAIN_MAX_SEGMENTS
+#define CSM_CHAIN_MAX_SEGMENTS  4U
+#endif
+
+// One contiguous part of a message
+typedef struct {
+    const uint8_t *data;
+    uint32_t size;
+} csm_segment;
+
+// Message made of segments located in different buffers, to be sent without copy (writev)
+typedef struct {
+    csm_segment seg[CSM_CHAIN_MAX_SEGMENTS];
+    uint32_t nb_segments;
+    uint32_t size; // total size of the segments
+} csm_chain;
+
 void csm_array_init(csm_array *array, uint8_t *buffer, uint32_t max_size, uint32_t used_size, uint32_t offset);
 void csm_array_reset(csm_array *array);
 void csm_array_dump(csm_array *array);
@@ -64,6 +81,13 @@ uint32_t csm_array_free_size(csm_array *array);
 // Return the data size, after the offset (thus, lower than the total buffer size)
 uint32_t csm_array_data_size(const csm_array *array);
 
+// Segment chains
+void csm_chain_init(csm_chain *chain);
+int csm_chain_append(csm_chain *chain, const uint8_t *data, uint32_t size);
+int csm_chain_append_array(csm_chain *chain, csm_array *array);
+// Flatten the chain into one buffer, return the number of bytes copied (0 if too small)
+uint32_t csm_chain_copy(const csm_chain *chain, uint8_t *buffer, uint32_t max_size);
+
 
 
 #ifdef __cplusplus
@@ -315,6 +315,7 @@ int acse_decode_conformance_block(csm_asso_state *state, csm_ber *ber, csm_array
             valid = valid && csm_array_read_u8(array, &byte);
             valid = valid && (byte == 0U ? TRUE : FALSE); // unused bits in the bitstring
 
+            valid = valid && csm_array_read_u8(array, &byte);
             state->handshake.proposed_conformance = ((uint32_t)byte) << 16U;
             valid = valid && csm_array_read_u8(array, &byte);
             state->handshake.proposed_conformance += ((uint32_t)byte) << 8U;
@@ -360,12 +361,17 @@ static csm_acse_code acse_user_info_decoder(csm_asso_state *state, csm_ber *ber,
                     CSM_LOG("[ACSE] Found xDLMS InitiateRequest encoded APDU");
                     if(csm_array_read_u8(array, &byte))
                     {
+                        state->has_dedicated_key = FALSE;
                         if (byte != AXDR_TAG_NULL)
                         {
-                            // FIXME: copy the dedicated key
+                            // dedicated-key, used by the ded- services of the association
+                            valid = csm_array_read_u8(array, &byte);
+                            valid = valid && (byte == CSM_DEF_DEDICATED_KEY_SIZE);
+                            valid = valid && csm_array_read_buff(array, state->dedicated_key, CSM_DEF_DEDICATED_KEY_SIZE);
+                            state->has_dedicated_key = valid;
                         }
 
-                        valid = csm_axdr_rd_null(array); //  response-allowed
+                        valid = valid && csm_axdr_rd_null(array); //  response-allowed
                     }
                     else
                     {
@@ -1040,9 +1046,34 @@ void csm_asso_init(csm_asso_state *state)
     state->current_block = 0;
     state->state = CSM_RESPONSE_STATE_START;
     state->nb_loops = 0;
+    state->set_block = 0;
+    state->set_offset = 0;
+    state->pending = FALSE;
+    state->has_dedicated_key = FALSE;
+    if (state->sec.moved)
+    {
+        // A ciphered response was the last one sent
+        state->tx.offset = state->sec.tx_offset;
+    }
+    state->sec.active = FALSE;
+    state->sec.moved = FALSE;
+    state->prefetched = FALSE;
+    state->gbt.active = FALSE;
+    state->gbt.wrapped = FALSE;
+    state->gbt.window = 1U;
+    state->gbt.rx_block = 0U;
+    state->gbt.sent = 0U;
+    csm_gbt_receiver_init(&state->gbt.request, 0U, NULL, 0U);
 }
 
 
+// The dedicated key is used while the association is open
+const uint8_t *csm_asso_dedicated_key(const csm_asso_state *state)
+{
+    int open = (state->state_cf == CF_ASSOCIATED) || (state->state_cf == CF_ASSOCIATION_PENDING);
+    return (open && state->has_dedicated_key) ? state->dedicated_key : NULL;
+}
+
 // Check is association is granted
 int csm_asso_is_granted(csm_asso_state *state)
 {
@@ -1340,14 +1371,18 @@ int csm_asso_hls_pass3(csm_asso_state *asso, csm_request *request, csm_array *ar
 
             array->offset = offset; // Restore original offset
 
-            if (res == CSM_SEC_OK)
+            if (res != CSM_SEC_OK)
             {
-                CSM_LOG("[CHAN] HLS Pass 3 success!");
-                ret = TRUE;
+                CSM_ERR("[CHAN] Bad tag");
+            }
+            else if (!csm_sys_check_ic(request->llc.dsap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, ic))
+            {
+                CSM_ERR("[CHAN] HLS Pass 3 replayed");
             }
             else
             {
-                CSM_ERR("[CHAN] Bad tag");
+                CSM_LOG("[CHAN] HLS Pass 3 success!");
+                ret = TRUE;
             }
         }
         else
@@ -1386,10 +1421,14 @@ int csm_asso_hls_pass4(csm_asso_state *asso, csm_request *request, csm_array *ar
     sc.sh_byte = 0U;
     sc.sh_bit_field.authentication = 1U; // Turn on only authentication
 
-    uint32_t ic = 0x01234567U; // FIXME: get the IC from the vital data manager
+    uint32_t ic = 0U;
     uint32_t offset = array->offset; // save offset
 
-    if (offset >= CSM_DEF_MAX_HLS_SIZE)
+    if (!csm_sys_get_ic(request->llc.dsap, CSM_SEC_GUEK, CSM_SEC_IC_SERVER, &ic))
+    {
+        CSM_ERR("[CHAN] No invocation counter left");
+    }
+    else if (offset >= CSM_DEF_MAX_HLS_SIZE)
     {
         array->offset = offset - (asso->handshake.ctos.size - CSM_DEF_SEC_HDR_SIZE - 2U); // 2U is the OctetString encoding
         // Write information data to authenticate
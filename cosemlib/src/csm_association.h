@@ -21,6 +21,8 @@ extern "C" {
 #include <stdint.h>
 #include "csm_ber.h"
 #include "csm_definitions.h"
+#include "csm_database.h"
+#include "csm_gbt.h"
 
 // States machine of the Control Function
 enum state_cf { 
@@ -188,6 +190,19 @@ typedef enum
 
 } csm_response_state;
 
+/*
+Blue Book, Security setup (class_id = 64, version 1), security_policy:
+the protection required on the xDLMS APDUs, in an application context with ciphering.
+*/
+enum csm_security_policy
+{
+    CSM_SEC_POLICY_NONE                     = 0x00U,
+    CSM_SEC_POLICY_AUTHENTICATED_REQUEST    = 0x04U, // bit 2
+    CSM_SEC_POLICY_ENCRYPTED_REQUEST        = 0x08U, // bit 3
+    CSM_SEC_POLICY_AUTHENTICATED_RESPONSE   = 0x20U, // bit 5
+    CSM_SEC_POLICY_ENCRYPTED_RESPONSE       = 0x40U, // bit 6
+};
+
 /**
  * @brief Configuration structure of one association, should be fixed in ROM at compile time
  */
@@ -196,6 +211,7 @@ typedef struct
     csm_llc llc;
     uint32_t conformance;          ///< All services and functionalities authorized.
     uint8_t  is_auto_connected;    ///< Boolean to indicate if the association is auto connected or not;
+    uint8_t  security_policy;      ///< Protection required on the requests and responses (csm_security_policy)
 } csm_asso_config;
 
 typedef struct
@@ -220,6 +236,45 @@ typedef struct
     enum csm_asso_failure_type failure_type; ///<! This field is dedicated to the decoding parts of the ACSE (fields, not BER)
 } csm_asso_handshake;
 
+/**
+ * @brief General block transfer of a long response, server side
+ *
+ * The retention buffer is provided by the application, its size gives the maximum
+ * window of the server. It starts with the data of the first block not acknowledged.
+ * A request received in several blocks is reassembled in the retention buffer first,
+ * the blocks out of sequence being kept in the scratch buffer.
+ */
+typedef struct
+{
+    csm_array retention;    //!< Data of the blocks not acknowledged yet
+    csm_gbt_receiver request; //!< Reassembly of a request sent in several blocks
+    uint32_t block_size;    //!< Size of the block-data, except the last one
+    uint16_t acked;         //!< Last block acknowledged by the client
+    uint16_t next;          //!< Next block to send
+    uint16_t sent;          //!< Highest block sent, the client acknowledges up to it
+    uint16_t window_end;    //!< Last block to send before waiting for an acknowledge
+    uint16_t last;          //!< Last block of the transfer, 0 until all the data is produced
+    uint16_t rx_block;      //!< Last block number received from the client
+    uint8_t window;         //!< Receive window of the client
+    uint8_t active;         //!< Transfer in progress
+    uint8_t wrapped;        //!< The request has been received in one block, answer with GBT
+} csm_gbt_state;
+
+/**
+ * @brief Ciphering of the response to a glo- or ded- request, server side
+ *
+ * The response is ciphered in place: the offset of tx is moved back in its headroom
+ * until the next request.
+ */
+typedef struct
+{
+    uint8_t active;         //!< The response of the current request is ciphered
+    uint8_t sc;             //!< Security control byte of the response
+    csm_sec_key key_id;     //!< Global unicast or dedicated key
+    uint8_t moved;          //!< The offset of tx is moved
+    uint32_t tx_offset;     //!< Offset of tx before the ciphering
+} csm_asso_sec;
+
 /**
  * @brief State and information of the current association
  *
@@ -235,6 +290,8 @@ typedef struct
     enum csm_auth_level auth_level;
     uint8_t client_app_title[CSM_DEF_APP_TITLE_SIZE];
     uint8_t server_app_title[CSM_DEF_APP_TITLE_SIZE];
+    uint8_t dedicated_key[CSM_DEF_DEDICATED_KEY_SIZE];     //!< Given by the client in the InitiateRequest
+    uint8_t has_dedicated_key;
 
     // Valid for the ACSE session establishment, for security reasons it should be erased after all
     csm_asso_handshake handshake;
@@ -242,7 +299,7 @@ typedef struct
     // Pointer to the configuration structure in ROM
     const csm_asso_config *config;
 
-    int8_t channel_id;   //!< Channel ID used buy this association
+    int32_t channel_id;   //!< Channel ID used buy this association
 
     // Block transfer states are in the channel, not in association state
     // In that case, we allow simultaneous read by block on multiple channels (ie: TCP/IP + optical head HDLC)
@@ -257,19 +314,49 @@ typedef struct
     // The entry is then splitted into multiple blocks
     uint32_t current_loop;
     uint32_t nb_loops;
+
+    // General block transfer of a long response, used instead of the service specific blocks
+    csm_gbt_state gbt;
+
+    // A database handler returned CSM_PENDING, the request is finished by csm_server_complete()
+    uint8_t pending;
+
+    // Ciphering of the current response (glo- and ded- services)
+    csm_asso_sec sec;
+
+    // SET by block in progress: last block number received (0 if none) and size of the value received so far
+    uint32_t set_block;
+    uint32_t set_offset;
+    csm_db_request set_request;     //!< Object of the first block, the next ones carry no descriptor
+
+    // Optional buffer where the value of a SET by block is reassembled for the database handlers
+    // that do not stream it; without buffer, only the streaming handlers accept a SET by block
+    csm_array set_value;
   
     csm_array rx;
     csm_array tx;
 
+    // Zero copy: the payload of a GET response is not copied in tx but referenced here, in the
+    // scratch buffer. The APDU is the content of tx followed by this payload.
+    uint8_t zero_copy;
+    csm_segment payload;
+
     // Scratch buffer for the channel. In real life, must be big enough to store the biggest attibute.
     // For example: a billing entry with full capture object configured
     // Thus, it is filled in each loop call.
     csm_array scratch;
 
+    // Optional second scratch buffer (same size and offset), not used if its buffer is NULL.
+    // The next loop of a GET by block is prepared in it while the current block is in flight,
+    // then both buffers are swapped when the next request arrives.
+    csm_array prefetch;
+    uint8_t prefetched;         //!< The prefetch buffer holds the next loop
+    csm_db_code prefetch_code;  //!< Code returned by the handler for the next loop
 
 } csm_asso_state;
 
 void csm_asso_init(csm_asso_state *state);
+const uint8_t *csm_asso_dedicated_key(const csm_asso_state *state);
 int csm_asso_server_execute(csm_asso_state *asso);
 int csm_asso_encoder(csm_asso_state *asso, uint8_t tag);
 int csm_asso_decoder(csm_asso_state *state, csm_array *array, uint8_t tag);
@@ -93,7 +93,12 @@ static const tag_t tags[] = {
         { AXDR_TAG_UNSIGNED16,      0, AXDR_SIZE_2},
         { AXDR_TAG_INTEGER64,       0, AXDR_SIZE_8},
         { AXDR_TAG_UNSIGNED64,      0, AXDR_SIZE_8},
-        { AXDR_TAG_ENUM,            0, AXDR_SIZE_1}
+        { AXDR_TAG_ENUM,            0, AXDR_SIZE_1},
+        { AXDR_TAG_FLOAT32,         0, AXDR_SIZE_4},
+        { AXDR_TAG_FLOAT64,         0, AXDR_SIZE_8},
+        { AXDR_TAG_DATETIME,        0, 12U},
+        { AXDR_TAG_DATE,            0, 5U},
+        { AXDR_TAG_TIME,            0, AXDR_SIZE_4}
 };
 
 static const uint32_t tags_size = sizeof(tags) / sizeof(tags[0]);
@@ -154,6 +159,63 @@ int csm_axdr_decode_tags(csm_array *array, axdr_data_cb callback)
     return ret;
 }
 
+/**
+ * @brief Jump over one Data, whatever its type and its depth
+ *
+ * Arrays and structures are walked without recursion: we only count the number
+ * of elements that remain to be skipped.
+ */
+int csm_axdr_skip_data(csm_array *array)
+{
+    int valid = TRUE;
+    uint32_t remaining = 1U;
+
+    while ((remaining > 0U) && valid)
+    {
+        uint8_t tag = 0xFFU;
+        uint32_t i;
+
+        valid = csm_array_read_u8(array, &tag);
+        remaining--;
+
+        for (i = 0U; (i < tags_size) && valid; i++)
+        {
+            if (tags[i].tag == tag)
+            {
+                uint32_t size = tags[i].size;
+
+                if (tags[i].size == AXDR_SIZE_CODED)
+                {
+                    valid = csm_axdr_size(array, &size);
+                }
+
+                if (tags[i].is_struct)
+                {
+                    remaining += size;
+                }
+                else if (valid && (size > 0U))
+                {
+                    // Special case: transform the size in bytes
+                    if (tag == AXDR_TAG_BITSTRING)
+                    {
+                        size = BITFIELD_BYTES(size);
+                    }
+                    valid = (size <= csm_array_unread(array)) && csm_array_reader_advance(array, size);
+                }
+                break; // enough
+            }
+        }
+
+        // tag not found?
+        if (i >= tags_size)
+        {
+            valid = FALSE;
+        }
+    }
+
+    return valid;
+}
+
 int csm_axdr_decode_block(csm_array *array, uint32_t *size)
 {
     int ret = FALSE;
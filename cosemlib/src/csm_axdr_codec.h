@@ -74,6 +74,11 @@ enum axdr_tag
     AXDR_TAG_INTEGER64      = 20U,
     AXDR_TAG_UNSIGNED64     = 21U,
     AXDR_TAG_ENUM           = 22U,
+    AXDR_TAG_FLOAT32        = 23U,
+    AXDR_TAG_FLOAT64        = 24U,
+    AXDR_TAG_DATETIME       = 25U,
+    AXDR_TAG_DATE           = 26U,
+    AXDR_TAG_TIME           = 27U,
     AXDR_TAG_UNKNOWN        = 255U
 
 };
@@ -89,6 +94,7 @@ int csm_axdr_rd_octetstring(csm_array *array, uint32_t *size);
 
 int csm_axdr_decode_tags(csm_array *array, axdr_data_cb callback);
 int csm_axdr_decode_block(csm_array *array, uint32_t *size);
+int csm_axdr_skip_data(csm_array *array);
 
 // ----------------- Encoders
 
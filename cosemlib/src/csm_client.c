@@ -82,6 +82,20 @@ int svc_is_normal_response(uint8_t type)
     return istype;
 }
 
+int svc_is_with_list_response(uint8_t type, enum csm_service service)
+{
+    int istype = FALSE;
+
+    // get-response-with-list [3], set-response-with-list [5], action-response-with-list [3]
+    if (((type == 3U) && (service != SVC_SET)) ||
+        ((type == 5U) && (service == SVC_SET)))
+    {
+        istype = TRUE;
+    }
+
+    return istype;
+}
+
 int svc_is_data_block_response(uint8_t type)
 {
     int istype = FALSE;
@@ -250,6 +264,15 @@ static int svc_response_decoder(csm_response *response, csm_array *array)
 
             // Now the read pointer is on the data
         }
+        else if (svc_is_with_list_response(type, response->service))
+        {
+            ber_length size;
+            response->type = SVC_RESPONSE_WITH_LIST;
+            CSM_LOG("[SVC] Response-WithList");
+            valid = valid && csm_ber_read_len(array, &size);
+            response->list_size = size.length;
+            // Now the read pointer is on the first result, see csm_client_decode_list_result()
+        }
         else
         {
             CSM_LOG("[SVC] Service not supported");
@@ -259,6 +282,89 @@ static int svc_response_decoder(csm_response *response, csm_array *array)
     return valid;
 }
 
+/*
+Get-Data-Result ::= CHOICE
+{
+    data                            [0] Data,
+    data-access-result              [1] IMPLICIT Data-Access-Result
+}
+*/
+static int svc_get_data_result_decoder(csm_response *response, csm_array *array)
+{
+    uint8_t choice = 0xFFU;
+    int valid = csm_array_read_u8(array, &choice);
+
+    if (valid && (choice == 0U))
+    {
+        // Next bytes are the data
+        response->has_data = TRUE;
+        response->access_result = CSM_ACCESS_RESULT_SUCCESS;
+    }
+    else if (valid && (choice == 1U))
+    {
+        uint8_t result;
+        valid = csm_array_read_u8(array, &result);
+        valid = valid && svc_is_valid_data_access_result(result);
+        if (valid)
+        {
+            response->access_result = (csm_data_access_result)result;
+        }
+    }
+    else
+    {
+        valid = FALSE;
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Decodes the next result of a response with list
+ *
+ * GET: Get-Data-Result, the read pointer is on the data if any
+ * SET: Data-Access-Result
+ * ACTION: Action-Response-With-Optional-Data (Action-Result then optional Get-Data-Result)
+ */
+int csm_client_decode_list_result(csm_response *response, csm_array *array)
+{
+    int valid = FALSE;
+    uint8_t result;
+
+    response->has_data = FALSE;
+    response->access_result = CSM_ACCESS_RESULT_NOT_SET;
+
+    if (response->service == SVC_GET)
+    {
+        valid = svc_get_data_result_decoder(response, array);
+    }
+    else if (response->service == SVC_SET)
+    {
+        valid = csm_array_read_u8(array, &result);
+        valid = valid && svc_is_valid_data_access_result(result);
+        if (valid)
+        {
+            response->access_result = (csm_data_access_result)result;
+        }
+    }
+    else if (response->service == SVC_ACTION)
+    {
+        uint8_t presence = 0U;
+        valid = csm_array_read_u8(array, &result);
+        valid = valid && svc_is_valid_action_result(result);
+        valid = valid && csm_array_read_u8(array, &presence);
+        if (valid)
+        {
+            response->action_result = (csm_action_result)result;
+            if (presence)
+            {
+                valid = svc_get_data_result_decoder(response, array);
+            }
+        }
+    }
+
+    return valid;
+}
+
 static int svc_get_response_decoder(csm_response *response, csm_array *array)
 {
     response->service = SVC_GET;
@@ -335,9 +441,9 @@ int csm_client_encode_selective_access_by_range(csm_array *array, csm_object_t *
     valid = valid && csm_axdr_wr_capture_object(array, restricting_object);
 
     // 2. start date
-    valid = valid && csm_axdr_wr_octetstring(array, csm_array_rd_current(start), csm_array_written(start));
+    valid = valid && csm_axdr_wr_octetstring(array, csm_array_rd_current(start), csm_array_written(start), AXDR_TAG_OCTETSTRING);
     // 3. end date
-    valid = valid && csm_axdr_wr_octetstring(array, csm_array_rd_current(end), csm_array_written(end));
+    valid = valid && csm_axdr_wr_octetstring(array, csm_array_rd_current(end), csm_array_written(end), AXDR_TAG_OCTETSTRING);
 
     // 4. selected values
     valid = valid && csm_array_write_u8(array, 0x01U); // selected values
@@ -399,6 +505,71 @@ int csm_client_decode(csm_response *response, csm_array *array)
     return valid;
 }
 
+/**
+ * @brief Reassembles a response sent with general block transfer
+ *
+ * Each General-Block-Transfer APDU received is appended to the apdu array. When the
+ * last block is received, the complete response is decoded. Check rx->ack_required
+ * to know if an acknowledge must be sent with csm_gbt_encode_ack().
+ */
+int csm_client_decode_gbt(csm_gbt_receiver *rx, csm_response *response, csm_array *array, csm_array *apdu)
+{
+    int valid = csm_gbt_receive(rx, array, apdu);
+
+    if (valid && rx->complete)
+    {
+        valid = csm_client_decode(response, apdu);
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Same as csm_client_decode(), a glo- or ded- response is deciphered in place first
+ * @param server_title: system title of the server, given in the AARE
+ */
+int csm_client_decode_ciphered(csm_response *response, csm_request *request, csm_array *array, const uint8_t *server_title)
+{
+    int valid = FALSE;
+    uint8_t tag = 0U;
+    uint8_t inner = 0U;
+    csm_sec_key key_id = CSM_SEC_GUEK;
+    csm_sec_control_byte sc;
+    uint32_t ic = 0U;
+
+    if (!csm_array_get(array, array->rd_index, &tag))
+    {
+        CSM_ERR("[SVC] Empty response");
+    }
+    else if (csm_sec_plain_tag(tag, &key_id) == 0U)
+    {
+        valid = csm_client_decode(response, array);
+    }
+    else if (csm_array_reader_advance(array, 1U) &&
+             (csm_sec_unwrap_apdu(array, request, key_id, server_title, &sc, &ic) == CSM_SEC_OK) &&
+             csm_sys_check_ic(request->llc.dsap, key_id, CSM_SEC_IC_SERVER, ic) &&
+             csm_array_get(array, 0U, &inner) && (inner == csm_sec_plain_tag(tag, &key_id)))
+    {
+        valid = csm_client_decode(response, array);
+    }
+    else
+    {
+        CSM_ERR("[SVC] Bad ciphered response");
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Ciphers in place the request encoded in the array into a glo- (CSM_SEC_GUEK) or ded- (CSM_SEC_DEK) request
+ *
+ * The array needs CSM_SEC_HEADROOM bytes before its start, see csm_sec_wrap_apdu().
+ */
+int csm_client_encode_ciphered(csm_request *request, csm_array *array, csm_sec_key key_id, csm_sec_control_byte sc, uint32_t ic)
+{
+    return (csm_sec_wrap_apdu(array, request, key_id, csm_sys_get_system_title(), sc, ic) == CSM_SEC_OK) ? TRUE : FALSE;
+}
+
 void csm_client_init(csm_request *request, csm_response *response)
 {
     (void) request;
@@ -429,6 +600,10 @@ uint8_t csm_get_request_type(csm_request *request)
     {
         type = 1U;
     }
+    else if (request->type == SVC_REQUEST_WITH_LIST)
+    {
+        type = (request->db_request.service == SVC_SET) ? 4U : 3U;
+    }
     else
     {
         // Next
@@ -529,4 +704,32 @@ C3 01 41
      }
      return valid;
  }
- 
+
+/*
+Get-Request-With-List, the attributes are read without selective access:
+
+C0 03 C1
+   02 // two attributes
+      0001 0000600100FF 02 00
+      0003 0100010800FF 02 00
+ */
+int csm_client_encode_get_with_list(csm_request *request, const csm_object_t *objects, uint32_t nb_objects, csm_array *array)
+{
+    request->db_request.service = SVC_GET;
+    request->type = SVC_REQUEST_WITH_LIST;
+
+    int valid = csm_array_write_u8(array, AXDR_GET_REQUEST);
+    valid = valid && csm_array_write_u8(array, csm_get_request_type(request));
+    valid = valid && csm_array_write_u8(array, request->sender_invoke_id);
+    valid = valid && csm_ber_write_len(array, nb_objects);
+
+    for (uint32_t i = 0U; (i < nb_objects) && valid; i++)
+    {
+        valid = valid && csm_array_write_u16(array, objects[i].class_id);
+        valid = valid && csm_array_write_buff(array, (const uint8_t *)&objects[i].obis.A, 6U);
+        valid = valid && csm_array_write_u8(array, objects[i].id);
+        valid = valid && csm_array_write_u8(array, 0U); // no selective access
+    }
+
+    return valid;
+}
@@ -19,6 +19,8 @@ extern "C" {
 #include "csm_definitions.h"
 #include "csm_association.h"
 #include "csm_database.h"
+#include "csm_gbt.h"
+#include "csm_security.h"
 
 
 // ----------------------------------- CLIENT SERVICES -----------------------------------
@@ -26,7 +28,12 @@ extern "C" {
 void csm_client_init(csm_request *request, csm_response *response);
 int csm_client_has_more_data(csm_response *response);
 int csm_client_decode(csm_response *response, csm_array *array);
+int csm_client_decode_gbt(csm_gbt_receiver *rx, csm_response *response, csm_array *array, csm_array *apdu);
+int csm_client_decode_ciphered(csm_response *response, csm_request *request, csm_array *array, const uint8_t *server_title);
+int csm_client_encode_ciphered(csm_request *request, csm_array *array, csm_sec_key key_id, csm_sec_control_byte sc, uint32_t ic);
 int svc_request_encoder(csm_request *request, csm_array *array);
+int csm_client_decode_list_result(csm_response *response, csm_array *array);
+int csm_client_encode_get_with_list(csm_request *request, const csm_object_t *objects, uint32_t nb_objects, csm_array *array);
 int csm_client_encode_selective_access_by_range(csm_array *array, csm_object_t *restricting_object, csm_array *start, csm_array *end);
 
 
@@ -35,6 +35,9 @@ typedef enum
     CSM_ERR_UNAUTHORIZED_ACCESS, //!< Attribute access problem
     CSM_ERR_TEMPORARY_FAILURE,   ///< Temporary failure
     CSM_ERR_DATA_CONTENT_NOT_OK, ///< Data content is not accepted.
+
+    // Not an error: answer later with csm_server_complete(), the output array must be kept
+    CSM_PENDING,
 } csm_db_code;
 
 // Attributes access rights
@@ -103,9 +106,22 @@ typedef struct
 {
     const db_object_descr *object; ///< Pointer to the cosem object
     uint8_t db_index; // database number (index)
-    uint8_t obj_index; // object index in the database
+    uint16_t obj_index; // object index in the database
 } db_obj_handle;
 
+/**
+ * @brief Slot of the OBIS lookup index (open addressing)
+ *
+ * The key packs the class id and the 48-bit OBIS code; a null key marks a free slot
+ * (class id zero does not exist in the Blue Book).
+ */
+typedef struct
+{
+    uint64_t key;
+    uint8_t db_index;
+    uint16_t obj_index;
+} db_index_entry;
+
 // Forward declarations
 struct db_element;
 
@@ -114,6 +130,8 @@ typedef struct
     const struct db_element *el;
     uint32_t size;
     uint16_t logical_device;
+    db_index_entry *index;   //!< Optional hash index of the objects, NULL means linear search
+    uint32_t index_size;     //!< Number of slots of the index, power of two
 
 } csm_db_t;
 
@@ -37,6 +37,10 @@ extern "C" {
 #define CSM_LOG(...) printf("[LOG]");printf(__VA_ARGS__);printf("\r\n")
 #endif
 
+#ifndef CSM_WARN
+#define CSM_WARN(...) printf("[WARN]");printf(__VA_ARGS__);printf("\r\n")
+#endif
+
 #ifndef CSM_ERR
 #define CSM_ERR(...) printf("[ERR]");printf(__VA_ARGS__);printf("\r\n")
 #endif
@@ -48,6 +52,7 @@ extern "C" {
 #define CSM_DEF_LLS_MIN_SIZE            1U
 
 #define CSM_DEF_APP_TITLE_SIZE      8U
+#define CSM_DEF_DEDICATED_KEY_SIZE  16U
 #define CSM_DEF_CHALLENGE_SIZE      64U
 #define CSM_DEF_MAX_HLS_SIZE        (1U + 16U + CSM_DEF_CHALLENGE_SIZE) // SC + AK + Challenge
 
@@ -74,7 +79,22 @@ enum xdlms_tag
     AXDR_GET_RESPONSE       = 196U,
     AXDR_SET_RESPONSE       = 197U,
     AXDR_ACTION_RESPONSE    = 199U,
-    AXDR_EXCEPTION_RESPONSE = 216U
+    // Global ciphering: service tag + 8
+    AXDR_GLO_GET_REQUEST    = 200U,
+    AXDR_GLO_SET_REQUEST    = 201U,
+    AXDR_GLO_ACTION_REQUEST = 203U,
+    AXDR_GLO_GET_RESPONSE   = 204U,
+    AXDR_GLO_SET_RESPONSE   = 205U,
+    AXDR_GLO_ACTION_RESPONSE = 207U,
+    // Dedicated ciphering: service tag + 16
+    AXDR_DED_GET_REQUEST    = 208U,
+    AXDR_DED_SET_REQUEST    = 209U,
+    AXDR_DED_ACTION_REQUEST = 211U,
+    AXDR_DED_GET_RESPONSE   = 212U,
+    AXDR_DED_SET_RESPONSE   = 213U,
+    AXDR_DED_ACTION_RESPONSE = 215U,
+    AXDR_EXCEPTION_RESPONSE = 216U,
+    AXDR_GENERAL_BLOCK_TRANSFER = 224U
 };
 
 enum csm_conformance_mask
@@ -85,6 +105,7 @@ enum csm_conformance_mask
     general-protection                 (1),
     general-block-transfer             (2),
     */
+    CSM_CBLOCK_GENERAL_BLOCK_TRANSFER           = 0x00200000U, // bit 2  - general-block-transfer
     CSM_CBLOCK_READ                             = 0x00100000U, // bit 3  - read
     CSM_CBLOCK_WRITE                            = 0x00080000U, // bit 4  - write
     CSM_CBLOCK_UNCONFIRMED_WRITE                = 0x00040000U, // bit 5  - unconfirmed-write
@@ -137,7 +158,7 @@ typedef struct
 } csm_llc;
 
 enum csm_service { SVC_UNKOWN, SVC_GET, SVC_SET, SVC_ACTION, SVC_EXCEPTION };
-enum svc_request { SVC_REQUEST_NORMAL, SVC_REQUEST_NEXT };
+enum svc_request { SVC_REQUEST_NORMAL, SVC_REQUEST_NEXT, SVC_REQUEST_WITH_LIST, SVC_REQUEST_WITH_FIRST_DATABLOCK, SVC_REQUEST_WITH_DATABLOCK };
 
 
 typedef struct
@@ -147,6 +168,13 @@ typedef struct
 } csm_opt_data;
 
 
+/**
+ * SET by block: the value is streamed to the database handlers that opt in (streaming
+ * flag of their db_element), one call per block. The input array contains only the raw-data
+ * of the block, that is a chunk of the A-XDR encoded value cut at an arbitrary position.
+ * block_number is zero for a value received in one piece, or reassembled for the other
+ * handlers. If a long SET is aborted, the next block number one restarts the value.
+ */
 typedef struct
 {
     uint32_t block_number;
@@ -155,6 +183,8 @@ typedef struct
     csm_opt_data sel_access;
     csm_object_t logical_name;
     uint8_t next;
+    uint8_t last_block;     //!< SET by block: this chunk ends the value
+    uint32_t block_offset;  //!< SET by block: position of this chunk in the value
 } csm_db_request;
 
 typedef struct
@@ -163,7 +193,7 @@ typedef struct
     uint8_t sender_invoke_id;
     enum svc_request type; // Type of the request (normal, next ...)
     csm_llc llc;
-    int8_t channel_id; // Channel in use
+    int32_t channel_id; // Channel in use
 
 } csm_request;
 
@@ -214,7 +244,31 @@ typedef struct
     uint8_t service_err;
 } csm_exception;
 
-enum svc_response   { SVC_RESPONSE_NORMAL, SVC_RESPONSE_WITH_DATABLOCK };
+/*
+ExceptionResponse ::= SEQUENCE
+{
+    state-error [0] IMPLICIT ENUMERATED { service-not-allowed (1), service-unknown (2) },
+    service-error [1] CHOICE { operation-not-possible [1], service-not-supported [2], other-reason [3],
+        pdu-too-long [4], deciphering-error [5], invocation-counter-error [6] }
+}
+*/
+enum csm_exception_state_error
+{
+    CSM_EXCEPTION_SERVICE_NOT_ALLOWED       = 1U,
+    CSM_EXCEPTION_SERVICE_UNKNOWN           = 2U
+};
+
+enum csm_exception_service_error
+{
+    CSM_EXCEPTION_OPERATION_NOT_POSSIBLE    = 1U,
+    CSM_EXCEPTION_SERVICE_NOT_SUPPORTED     = 2U,
+    CSM_EXCEPTION_OTHER_REASON              = 3U,
+    CSM_EXCEPTION_PDU_TOO_LONG              = 4U,
+    CSM_EXCEPTION_DECIPHERING_ERROR         = 5U,
+    CSM_EXCEPTION_INVOCATION_COUNTER_ERROR  = 6U
+};
+
+enum svc_response   { SVC_RESPONSE_NORMAL, SVC_RESPONSE_WITH_DATABLOCK, SVC_RESPONSE_WITH_LIST };
 
 
 /*
@@ -233,6 +287,42 @@ typedef enum
     SVC_GET_RESPONSE_WITH_LIST = 3
 } svc_response_type;
 
+/*
+Set-Response ::= CHOICE
+{
+set-response-normal                     [1] IMPLICIT Set-Response-Normal,
+set-response-datablock                  [2] IMPLICIT Set-Response-Datablock,
+set-response-last-datablock             [3] IMPLICIT Set-Response-Last-Datablock,
+set-response-last-datablock-with-list   [4] IMPLICIT Set-Response-Last-Datablock-With-List,
+set-response-with-list                  [5] IMPLICIT Set-Response-With-List
+}
+*/
+typedef enum
+{
+    SVC_SET_RESPONSE_NORMAL = 1,
+    SVC_SET_RESPONSE_DATABLOCK = 2,
+    SVC_SET_RESPONSE_LAST_DATABLOCK = 3,
+    SVC_SET_RESPONSE_LAST_DATABLOCK_WITH_LIST = 4,
+    SVC_SET_RESPONSE_WITH_LIST = 5
+} svc_set_response_type;
+
+/*
+Action-Response ::= CHOICE
+{
+action-response-normal                  [1] IMPLICIT Action-Response-Normal,
+action-response-with-pblock             [2] IMPLICIT Action-Response-With-Pblock,
+action-response-with-list               [3] IMPLICIT Action-Response-With-List,
+action-response-next-pblock             [4] IMPLICIT Action-Response-Next-Pblock
+}
+*/
+typedef enum
+{
+    SVC_ACTION_RESPONSE_NORMAL = 1,
+    SVC_ACTION_RESPONSE_WITH_PBLOCK = 2,
+    SVC_ACTION_RESPONSE_WITH_LIST = 3,
+    SVC_ACTION_RESPONSE_NEXT_PBLOCK = 4
+} svc_action_response_type;
+
 
 typedef struct
 {
@@ -246,6 +336,7 @@ typedef struct
     uint32_t block_number;
     csm_exception exception;
     uint8_t has_data;
+    uint32_t list_size; // Number of results of a response with list
 } csm_response;
 
 // ----------------------------- IMPLEMENTATION SPECIFIC INTERFACE -----------------------------
@@ -283,6 +374,7 @@ typedef enum
     CSM_SEC_GUEK,   //!< global unicast encryption key GUEK
     CSM_SEC_GBEK,   //!< global broadcast encryption key GBEK
     CSM_SEC_GAK,    //!< (global) authentication key, GAK
+    CSM_SEC_DEK,    //!< dedicated key of the association, NULL if the client has not given one
 } csm_sec_key;
 
 
@@ -294,6 +386,26 @@ typedef enum
 
 uint8_t *csm_sys_get_key(uint8_t sap, csm_sec_key key_id);
 
+// Dedicated key (CSM_SEC_DEK) of the association open on the channel, NULL when it has none
+void csm_sys_set_dedicated_key(int32_t channel_id, const uint8_t *key);
+
+typedef enum
+{
+    CSM_SEC_IC_CLIENT,
+    CSM_SEC_IC_SERVER,
+} csm_sec_ic;
+
+// Invocation counter of the next APDU ciphered with the key, FALSE if there is none left
+int csm_sys_get_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *value);
+
+// Accepts the invocation counter of an APDU received with the key, FALSE for a replay
+int csm_sys_check_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t value);
+
+// Persistent memory of the invocation counters (csm_ic.h): end of the window reserved for a counter
+// csm_sys_load_ic() returns FALSE if the counter has never been stored
+int csm_sys_load_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *limit);
+int csm_sys_store_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t limit);
+
 
 /**
  * output: 16 bytes array
@@ -310,9 +422,28 @@ void csm_hal_sha1(const uint8_t *input, uint32_t size, uint8_t *output);
  */
 void csm_hal_sha256(const uint8_t *input, uint32_t size, uint8_t *output);
 
-int csm_sys_gcm_init(int8_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len);
-int csm_sys_gcm_update(int8_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt);
-int csm_sys_gcm_finish(int8_t channel_id, uint8_t *tag);
+int csm_sys_gcm_init(int32_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len);
+int csm_sys_gcm_update(int32_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt);
+int csm_sys_gcm_finish(int32_t channel_id, uint8_t *tag);
+
+// One packet of a batch, its data is (de)ciphered in place
+typedef struct
+{
+    int32_t channel_id;
+    uint8_t sap;                //!< The keys are the ones of this SAP
+    uint8_t iv[12];
+    const uint8_t *aad;
+    uint32_t aad_len;
+    uint8_t *data;
+    uint32_t data_len;
+    uint8_t tag[16];            //!< Computed by the HAL
+} csm_sys_gcm_job;
+
+/**
+ * Same result as csm_sys_gcm_init/update/finish for each job; the HAL can process several
+ * packets together (different channels or associations, thus keys).
+ */
+int csm_sys_gcm_batch(csm_sec_key key_id, csm_sec_mode mode, csm_sys_gcm_job *jobs, uint32_t nb_jobs);
 
 #ifdef __cplusplus
 }
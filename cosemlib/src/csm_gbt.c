@@ -0,0 +1,225 @@
+/**
+ * General block transfer (GBT) coder/decoder
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include "csm_gbt.h"
+#include "csm_ber.h"
+#include <string.h>
+
+#define GBT_LAST_BLOCK      0x80U
+#define GBT_STREAMING       0x40U
+#define GBT_WINDOW_MASK     0x3FU
+
+// Encodes the APDU up to the length of the block-data, the data must follow
+int csm_gbt_encode_header(csm_array *array, const csm_gbt_block *block)
+{
+    uint8_t control = block->window & GBT_WINDOW_MASK;
+
+    if (block->last_block)
+    {
+        control |= GBT_LAST_BLOCK;
+    }
+    if (block->streaming)
+    {
+        control |= GBT_STREAMING;
+    }
+
+    int valid = csm_array_write_u8(array, AXDR_GENERAL_BLOCK_TRANSFER);
+    valid = valid && csm_array_write_u8(array, control);
+    valid = valid && csm_array_write_u16(array, block->block_number);
+    valid = valid && csm_array_write_u16(array, block->block_number_ack);
+    valid = valid && csm_ber_write_len(array, block->size);
+    return valid;
+}
+
+// Decodes the APDU after the tag, the array is left on the block-data
+int csm_gbt_decode_header(csm_array *array, csm_gbt_block *block)
+{
+    uint8_t control = 0U;
+    ber_length size;
+
+    int valid = csm_array_read_u8(array, &control);
+    valid = valid && csm_array_read_u16(array, &block->block_number);
+    valid = valid && csm_array_read_u16(array, &block->block_number_ack);
+    valid = valid && csm_ber_read_len(array, &size);
+    valid = valid && (size.length <= csm_array_unread(array));
+
+    if (valid)
+    {
+        block->last_block = (control & GBT_LAST_BLOCK) ? TRUE : FALSE;
+        block->streaming = (control & GBT_STREAMING) ? TRUE : FALSE;
+        block->window = control & GBT_WINDOW_MASK;
+        block->size = size.length;
+    }
+
+    return valid;
+}
+
+// Number, size and last-block of a block kept out of sequence, followed by its data
+#define GBT_KEPT_HEADER_SIZE    5U
+
+void csm_gbt_receiver_init(csm_gbt_receiver *rx, uint8_t window, uint8_t *retention, uint32_t size)
+{
+    csm_array_init(&rx->retention, retention, (retention != NULL) ? size : 0U, 0U, 0U);
+    rx->block_number = 0U;
+    rx->received = 0U;
+    rx->window = (window > CSM_GBT_MAX_WINDOW) ? CSM_GBT_MAX_WINDOW : window;
+    rx->complete = FALSE;
+    rx->ack_required = FALSE;
+}
+
+// Position of the block kept with this number, or the end of the retention buffer
+static uint32_t gbt_find_kept(csm_gbt_receiver *rx, uint16_t block_number)
+{
+    const uint8_t *kept = csm_array_start(&rx->retention);
+    uint32_t written = csm_array_written(&rx->retention);
+    uint32_t pos = 0U;
+
+    while (pos < written)
+    {
+        uint16_t number = (uint16_t)((kept[pos] << 8U) | kept[pos + 1U]);
+        if (number == block_number)
+        {
+            break;
+        }
+        pos += GBT_KEPT_HEADER_SIZE + (uint32_t)((kept[pos + 2U] << 8U) | kept[pos + 3U]);
+    }
+
+    return pos;
+}
+
+// First block kept after the last block received in sequence, 0 if none
+static uint16_t gbt_first_kept(csm_gbt_receiver *rx)
+{
+    const uint8_t *kept = csm_array_start(&rx->retention);
+    uint32_t written = csm_array_written(&rx->retention);
+    uint16_t first = 0U;
+
+    for (uint32_t pos = 0U; pos < written; pos += GBT_KEPT_HEADER_SIZE + (uint32_t)((kept[pos + 2U] << 8U) | kept[pos + 3U]))
+    {
+        uint16_t number = (uint16_t)((kept[pos] << 8U) | kept[pos + 1U]);
+        if ((first == 0U) || (number < first))
+        {
+            first = number;
+        }
+    }
+
+    return first;
+}
+
+static int gbt_keep(csm_gbt_receiver *rx, const csm_gbt_block *block, const uint8_t *data)
+{
+    int valid = (gbt_find_kept(rx, block->block_number) == csm_array_written(&rx->retention)) &&
+                ((GBT_KEPT_HEADER_SIZE + block->size) <= csm_array_free_size(&rx->retention));
+
+    valid = valid && csm_array_write_u16(&rx->retention, block->block_number);
+    valid = valid && csm_array_write_u16(&rx->retention, (uint16_t)block->size);
+    valid = valid && csm_array_write_u8(&rx->retention, block->last_block);
+    valid = valid && csm_array_write_buff(&rx->retention, data, block->size);
+
+    return valid;
+}
+
+// Appends the blocks kept that now follow in sequence, and removes them from the retention buffer
+static int gbt_append_kept(csm_gbt_receiver *rx, csm_array *apdu)
+{
+    int valid = TRUE;
+    uint32_t pos = gbt_find_kept(rx, (uint16_t)(rx->received + 1U));
+
+    while (valid && !rx->complete && (pos < csm_array_written(&rx->retention)))
+    {
+        uint8_t *kept = csm_array_start(&rx->retention);
+        uint32_t size = (uint32_t)((kept[pos + 2U] << 8U) | kept[pos + 3U]);
+        uint32_t entry_size = GBT_KEPT_HEADER_SIZE + size;
+
+        valid = csm_array_write_buff(apdu, &kept[pos + GBT_KEPT_HEADER_SIZE], size);
+        if (valid)
+        {
+            rx->received++;
+            rx->complete = kept[pos + 4U];
+            memmove(&kept[pos], &kept[pos + entry_size], csm_array_written(&rx->retention) - pos - entry_size);
+            rx->retention.wr_index -= entry_size;
+            pos = gbt_find_kept(rx, (uint16_t)(rx->received + 1U));
+        }
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Decodes one GBT APDU and appends its data to the APDU under reassembly
+ *
+ * An acknowledge is required at the end of each window of the sender; the application
+ * should also acknowledge after a timeout, when the block ending the window has been lost.
+ */
+int csm_gbt_receive(csm_gbt_receiver *rx, csm_array *array, csm_array *apdu)
+{
+    csm_gbt_block block;
+    uint8_t tag = 0U;
+
+    int valid = csm_array_read_u8(array, &tag);
+    valid = valid && (tag == AXDR_GENERAL_BLOCK_TRANSFER);
+    valid = valid && csm_gbt_decode_header(array, &block);
+
+    if (valid)
+    {
+        if (block.block_number == (uint16_t)(rx->received + 1U))
+        {
+            valid = csm_array_write_buff(apdu, csm_array_rd_current(array), block.size);
+            if (valid)
+            {
+                rx->received = block.block_number;
+                rx->complete = block.last_block;
+                valid = gbt_append_kept(rx, apdu);
+            }
+        }
+        else if ((block.block_number > rx->received) && !rx->complete && gbt_keep(rx, &block, csm_array_rd_current(array)))
+        {
+            CSM_LOG("[GBT] Block %d kept, expected %d", block.block_number, rx->received + 1U);
+        }
+        else
+        {
+            CSM_LOG("[GBT] Block %d dropped, expected %d", block.block_number, rx->received + 1U);
+        }
+        (void) csm_array_reader_advance(array, block.size);
+
+        // The last block does not need to be acknowledged
+        rx->ack_required = !block.streaming && !rx->complete;
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Acknowledges the last block received in sequence, the sender continues from the next one
+ *
+ * When blocks are kept after a missing one, the window covers the missing blocks only.
+ */
+int csm_gbt_encode_ack(csm_gbt_receiver *rx, csm_array *array)
+{
+    csm_gbt_block block;
+    uint16_t first_kept = gbt_first_kept(rx);
+
+    rx->block_number++;
+    block.last_block = TRUE;
+    block.streaming = FALSE;
+    block.window = rx->window;
+    block.block_number = rx->block_number;
+    block.block_number_ack = rx->received;
+    block.size = 0U;
+    rx->ack_required = FALSE;
+
+    if ((first_kept > 0U) && ((uint16_t)(first_kept - rx->received - 1U) < block.window))
+    {
+        block.window = (uint8_t)(first_kept - rx->received - 1U);
+    }
+
+    return csm_gbt_encode_header(array, &block);
+}
@@ -0,0 +1,79 @@
+/**
+ * General block transfer (GBT) coder/decoder
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#ifndef CSM_GBT_H
+#define CSM_GBT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "csm_array.h"
+#include "csm_definitions.h"
+
+/*
+General-Block-Transfer ::= SEQUENCE
+{
+    block-control                   Unsigned8,
+    block-number                    Unsigned16,
+    block-number-ack                Unsigned16,
+    block-data                      OCTET STRING
+}
+
+block-control: bit 7 is last-block, bit 6 is streaming, bits 0 to 5 are the window size
+*/
+
+// Tag, block-control, block-number, block-number-ack and length (3 bytes max)
+#define CSM_GBT_HEADER_SIZE     9U
+#define CSM_GBT_MAX_WINDOW      63U
+
+typedef struct
+{
+    uint8_t last_block;
+    uint8_t streaming;          //!< More blocks follow without acknowledge
+    uint8_t window;             //!< Receive window of the sender
+    uint16_t block_number;
+    uint16_t block_number_ack;
+    uint32_t size;              //!< Size of the block-data
+} csm_gbt_block;
+
+/**
+ * @brief Reception of a data stream sent with GBT
+ *
+ * Blocks are appended in sequence. A block received after a missing one is kept in the
+ * retention buffer until the missing blocks arrive. The acknowledge then asks again for
+ * the missing blocks only: it acknowledges the last block received in sequence with a
+ * window that ends before the first block kept, so the sender resends the gap and waits.
+ * Without retention buffer, the blocks out of sequence are dropped and the sender resends
+ * the whole window.
+ */
+typedef struct
+{
+    csm_array retention;        //!< Blocks kept out of sequence: number, size, last-block and data of each
+    uint16_t block_number;      //!< Our block number, incremented for each acknowledge
+    uint16_t received;          //!< Last block received in sequence
+    uint8_t window;             //!< Our receive window
+    uint8_t complete;           //!< Last block received
+    uint8_t ack_required;       //!< The sender waits for an acknowledge
+} csm_gbt_receiver;
+
+int csm_gbt_encode_header(csm_array *array, const csm_gbt_block *block);
+int csm_gbt_decode_header(csm_array *array, csm_gbt_block *block);
+
+void csm_gbt_receiver_init(csm_gbt_receiver *rx, uint8_t window, uint8_t *retention, uint32_t size);
+int csm_gbt_receive(csm_gbt_receiver *rx, csm_array *array, csm_array *apdu);
+int csm_gbt_encode_ack(csm_gbt_receiver *rx, csm_array *array);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CSM_GBT_H
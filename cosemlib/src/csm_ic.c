@@ -0,0 +1,130 @@
+/**
+ * Invocation counters of the security layer, reserved by windows in a persistent memory
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include "csm_ic.h"
+#include <string.h>
+
+#define IC_LAST_VALUE   0xFFFFFFFFU
+
+typedef struct
+{
+    uint32_t value;     //!< Sent: next value given, received: lowest value accepted
+    uint32_t limit;     //!< End of the window reserved in the persistent memory
+    uint8_t sap;
+    uint8_t key_id;
+    uint8_t ic;
+    uint8_t valid;
+} ic_counter;
+
+static ic_counter counters[CSM_IC_MAX_COUNTERS];
+
+void csm_ic_init(void)
+{
+    memset(counters, 0, sizeof(counters));
+}
+
+// Counter in RAM, loaded from the persistent memory the first time
+static ic_counter *ic_get(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic)
+{
+    ic_counter *counter = NULL;
+    ic_counter *unused = NULL;
+
+    for (uint32_t i = 0U; i < CSM_IC_MAX_COUNTERS; i++)
+    {
+        if (!counters[i].valid)
+        {
+            unused = (unused == NULL) ? &counters[i] : unused;
+        }
+        else if ((counters[i].sap == sap) && (counters[i].key_id == key_id) && (counters[i].ic == ic))
+        {
+            counter = &counters[i];
+            break;
+        }
+    }
+
+    if ((counter == NULL) && (unused != NULL))
+    {
+        uint32_t limit = 0U;
+        if (!csm_sys_load_ic(sap, key_id, ic, &limit))
+        {
+            limit = 0U; // Never stored, the counter starts at zero
+        }
+
+        counter = unused;
+        counter->value = limit;
+        counter->limit = limit;
+        counter->sap = sap;
+        counter->key_id = key_id;
+        counter->ic = ic;
+        counter->valid = TRUE;
+    }
+    else if (counter == NULL)
+    {
+        CSM_ERR("[IC] No more invocation counters");
+    }
+
+    return counter;
+}
+
+// The values below value + CSM_IC_WINDOW can be used, even after a reset
+static int ic_reserve(ic_counter *counter, uint32_t value)
+{
+    uint32_t limit = (value < (IC_LAST_VALUE - CSM_IC_WINDOW)) ? (value + CSM_IC_WINDOW) : IC_LAST_VALUE;
+    int valid = csm_sys_store_ic(counter->sap, (csm_sec_key)counter->key_id, (csm_sec_ic)counter->ic, limit);
+
+    if (valid)
+    {
+        counter->limit = limit;
+    }
+    else
+    {
+        CSM_ERR("[IC] Cannot store the invocation counter");
+    }
+
+    return valid;
+}
+
+int csm_ic_next(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *value)
+{
+    ic_counter *counter = ic_get(sap, key_id, ic);
+    int valid = (counter != NULL) && (counter->value != IC_LAST_VALUE);
+
+    if (valid && (counter->value >= counter->limit))
+    {
+        valid = ic_reserve(counter, counter->value);
+    }
+
+    if (valid)
+    {
+        *value = counter->value;
+        counter->value++;
+    }
+
+    return valid;
+}
+
+int csm_ic_check(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t value)
+{
+    ic_counter *counter = ic_get(sap, key_id, ic);
+    int valid = (counter != NULL) && (value >= counter->value) && (value != IC_LAST_VALUE);
+
+    if (valid && (value >= counter->limit))
+    {
+        valid = ic_reserve(counter, value + 1U);
+    }
+
+    if (valid)
+    {
+        counter->value = value + 1U;
+    }
+
+    return valid;
+}
@@ -0,0 +1,61 @@
+/**
+ * Invocation counters of the security layer, reserved by windows in a persistent memory
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#ifndef CSM_IC_H
+#define CSM_IC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "csm_definitions.h"
+
+// Invocation counters reserved by one write in the persistent memory
+#ifndef CSM_IC_WINDOW
+#define CSM_IC_WINDOW           1024U
+#endif
+
+// Counters managed at the same time: one per SAP, key and direction
+#ifndef CSM_IC_MAX_COUNTERS
+#define CSM_IC_MAX_COUNTERS     8U
+#endif
+
+/*
+The counters are incremented in RAM. Only the end of the window of values reserved for a
+counter is written in the persistent memory (csm_sys_store_ic()), once every CSM_IC_WINDOW
+APDUs. After a reset, a counter resumes at the end of its window: the values that may have
+been used before are never given nor accepted again.
+
+The last value of a counter (0xFFFFFFFF) is never used: the key must be changed before.
+*/
+
+/**
+ * @brief Forgets the counters in RAM, they are loaded again from the persistent memory when used
+ */
+void csm_ic_init(void);
+
+/**
+ * @brief Invocation counter of the next APDU sent with the key
+ * @return FALSE if the counter is exhausted or cannot be reserved in the persistent memory
+ */
+int csm_ic_next(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *value);
+
+/**
+ * @brief Accepts the invocation counter of an APDU received with the key
+ * @return FALSE for a replay (value not greater than the last one accepted) or a persistence error
+ */
+int csm_ic_check(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CSM_IC_H
@@ -43,3 +43,30 @@ int csm_llc_wpdu_encode(uint8_t *buffer, uint32_t payload_size, uint16_t ssap, u
 
     return COSEM_WRAPPER_SIZE;
 }
+
+/**
+ * @brief Size of the WPDU at the start of a TCP stream
+ *
+ * TCP gives no message boundaries: a read can hold a part of a WPDU or several ones.
+ *
+ * @return the size of the whole WPDU (wrapper included), 0 if the wrapper is not
+ * fully received yet, -1 if the stream is not a wrapper protocol stream
+ */
+int csm_llc_wpdu_frame_size(const uint8_t *buffer, uint32_t size)
+{
+    int ret = 0;
+
+    if (size >= COSEM_WRAPPER_SIZE)
+    {
+        if (GET_BE16(&buffer[0U]) == COSEM_WRAPPER_VERSION)
+        {
+            ret = (int)(GET_BE16(&buffer[6]) + COSEM_WRAPPER_SIZE);
+        }
+        else
+        {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
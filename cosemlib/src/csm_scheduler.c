@@ -0,0 +1,142 @@
+/**
+ * Deficit round-robin scheduler of the server channels
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include "csm_scheduler.h"
+#include "os_util.h"
+
+void csm_sched_init(csm_scheduler *sched, csm_sched_channel *channels, uint32_t max_channels, uint32_t quantum, csm_sched_execute_handler execute, csm_sched_send_handler send)
+{
+    sched->channels = channels;
+    sched->max_channels = max_channels;
+    sched->nb_channels = 0U;
+    sched->quantum = quantum;
+    sched->execute = execute;
+    sched->send = send;
+}
+
+// Returns the index of the channel, -1 if the scheduler is full
+int csm_sched_add(csm_scheduler *sched, csm_server_context_t *ctx)
+{
+    int index = -1;
+
+    if (sched->nb_channels < sched->max_channels)
+    {
+        csm_sched_channel *channel = &sched->channels[sched->nb_channels];
+        channel->ctx = ctx;
+        channel->deficit = 0;
+        channel->ready = FALSE;
+        index = (int)sched->nb_channels;
+        sched->nb_channels++;
+    }
+
+    return index;
+}
+
+/**
+ * @brief Signals a request received in the rx array of the channel
+ * The rx array must not be touched until the request is executed: the transport
+ * should stop reading the channel while csm_sched_is_busy() is true.
+ */
+int csm_sched_ready(csm_scheduler *sched, int index)
+{
+    int valid = FALSE;
+
+    if ((index >= 0) && ((uint32_t)index < sched->nb_channels) && !sched->channels[index].ready)
+    {
+        sched->channels[index].ready = TRUE;
+        valid = TRUE;
+    }
+    else
+    {
+        CSM_ERR("[SCHED] Channel %d not available", index);
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Forgets the request waiting on the channel and its credit, when the channel is closed
+ */
+void csm_sched_cancel(csm_scheduler *sched, int index)
+{
+    if ((index >= 0) && ((uint32_t)index < sched->nb_channels))
+    {
+        sched->channels[index].ready = FALSE;
+        sched->channels[index].deficit = 0;
+    }
+}
+
+static int sched_has_blocks(const csm_server_context_t *ctx)
+{
+    return ctx->asso.gbt.active && (ctx->asso.gbt.next <= ctx->asso.gbt.window_end);
+}
+
+static int sched_has_work(const csm_sched_channel *channel)
+{
+    // A request answered later stays in rx, not executed
+    return (channel->ready && !channel->ctx->asso.pending) || sched_has_blocks(channel->ctx);
+}
+
+int csm_sched_is_busy(const csm_scheduler *sched, int index)
+{
+    const csm_sched_channel *channel = &sched->channels[index];
+    return channel->ready || sched_has_blocks(channel->ctx);
+}
+
+/**
+ * @brief Serves one round of all the channels
+ * @return the number of APDUs sent
+ */
+uint32_t csm_sched_run(csm_scheduler *sched)
+{
+    uint32_t sent = 0U;
+
+    for (uint32_t i = 0U; i < sched->nb_channels; i++)
+    {
+        csm_sched_channel *channel = &sched->channels[i];
+
+        if (sched_has_work(channel))
+        {
+            channel->deficit += (int32_t)sched->quantum;
+        }
+
+        while ((channel->deficit > 0) && sched_has_work(channel))
+        {
+            int size = 0;
+
+            // A new request goes first, it aborts or acknowledges the blocks in progress
+            if (channel->ready && !channel->ctx->asso.pending)
+            {
+                channel->ready = FALSE;
+                size = sched->execute(channel->ctx);
+            }
+            else
+            {
+                size = csm_server_gbt_next(channel->ctx);
+            }
+
+            if (size > 0)
+            {
+                sched->send(channel->ctx, size);
+                channel->deficit -= size;
+                sent++;
+            }
+        }
+
+        // An idle channel does not save credit for later, but pays its debt
+        if (!sched_has_work(channel) && (channel->deficit > 0))
+        {
+            channel->deficit = 0;
+        }
+    }
+
+    return sent;
+}
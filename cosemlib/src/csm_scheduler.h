@@ -0,0 +1,72 @@
+/**
+ * Deficit round-robin scheduler of the server channels
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#ifndef CSM_SCHEDULER_H
+#define CSM_SCHEDULER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "csm_server.h"
+
+/**
+ * @brief Executes the request received in the rx array of the context
+ * Usually a call to csm_server_execute() with the configuration of the application.
+ * @return the number of bytes to send, as csm_server_execute()
+ */
+typedef int (*csm_sched_execute_handler)(csm_server_context_t *ctx);
+
+/**
+ * @brief Sends the APDU in the tx array of the context, followed by its zero-copy payload
+ */
+typedef void (*csm_sched_send_handler)(csm_server_context_t *ctx, int size);
+
+typedef struct
+{
+    csm_server_context_t *ctx;
+    int32_t deficit;        //!< Bytes the channel can still send in the current round, negative if overdrawn
+    uint8_t ready;          //!< A request waits in the rx array
+} csm_sched_channel;
+
+/**
+ * @brief Fair sharing of the server between the channels
+ *
+ * Each channel receives a quantum of bytes per round and sends responses while its
+ * deficit is positive; the bytes sent beyond are paid in the next rounds. The blocks
+ * of a general block transfer window are scheduled one by one, so a bulk read is
+ * interleaved with the short requests of the other channels.
+ *
+ * The channels are stored in an array given by the application, sized with its
+ * number of channels.
+ */
+typedef struct
+{
+    csm_sched_channel *channels;
+    uint32_t max_channels;
+    uint32_t nb_channels;
+    uint32_t quantum;       //!< Bytes added to the deficit of a busy channel at each round
+    csm_sched_execute_handler execute;
+    csm_sched_send_handler send;
+} csm_scheduler;
+
+void csm_sched_init(csm_scheduler *sched, csm_sched_channel *channels, uint32_t max_channels, uint32_t quantum, csm_sched_execute_handler execute, csm_sched_send_handler send);
+int csm_sched_add(csm_scheduler *sched, csm_server_context_t *ctx);
+int csm_sched_ready(csm_scheduler *sched, int index);
+void csm_sched_cancel(csm_scheduler *sched, int index);
+int csm_sched_is_busy(const csm_scheduler *sched, int index);
+uint32_t csm_sched_run(csm_scheduler *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CSM_SCHEDULER_H
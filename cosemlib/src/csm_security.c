@@ -10,25 +10,27 @@
  */
 
 #include "csm_security.h"
+#include "csm_ber.h"
 #include "os_util.h"
 #include <string.h>
 
-csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, const uint8_t *system_title)
+// Reads the security header and prepares the deciphering of the packet; tag_read is NULL without authentication
+static csm_sec_result sec_decrypt_prepare(csm_array *array, csm_request *request, const uint8_t *system_title, csm_sys_gcm_job *job, uint8_t **tag_read)
 {
     csm_sec_result retcode = CSM_SEC_OK;
     csm_sec_control_byte sc;
     uint32_t ic;
-    uint8_t *tag_read = NULL;
     uint32_t data_size = 0U;
     uint32_t aad_size = 0U;
-    uint8_t IV[12];
+
+    *tag_read = NULL;
 
     csm_array_read_u8(array, &sc.sh_byte);
     csm_array_read_u32(array, &ic);
 
     // Prepare IV
-    memcpy(&IV[0], &system_title[0], CSM_DEF_APP_TITLE_SIZE);
-    PUT_BE32(&IV[CSM_DEF_APP_TITLE_SIZE], ic);
+    memcpy(&job->iv[0], &system_title[0], CSM_DEF_APP_TITLE_SIZE);
+    PUT_BE32(&job->iv[CSM_DEF_APP_TITLE_SIZE], ic);
 
     uint8_t *data = csm_array_rd_current(array); // point to the information or tag
 
@@ -57,6 +59,7 @@ csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, cons
             {
                 data_size -= 12U;
                 aad_size += 17U;
+                *tag_read = data + data_size;
             }
             else
             {
@@ -73,7 +76,7 @@ csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, cons
         {
             data_size = (unread - 12U);
             aad_size = 17U + data_size; // SC + AK size + information size
-            tag_read = data + data_size;
+            *tag_read = data + data_size;
         }
         else
         {
@@ -90,18 +93,22 @@ csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, cons
         aad_size = 0U;
     }
 
-    csm_sys_gcm_init(request->channel_id, request->llc.dsap, CSM_SEC_GUEK, CSM_SEC_DECRYPT, IV, aad, aad_size);
-
-    // Decrypt in place
-    csm_sys_gcm_update(request->channel_id, data, data_size, data);
+    job->channel_id = request->channel_id;
+    job->sap = request->llc.dsap;
+    job->aad = aad;
+    job->aad_len = aad_size;
+    job->data = data;
+    job->data_len = data_size;
 
-    uint8_t tag[16U];
-    csm_sys_gcm_finish(request->channel_id, tag);
+    return retcode;
+}
 
+static csm_sec_result sec_check_tag(csm_sec_result retcode, const csm_sys_gcm_job *job, const uint8_t *tag_read)
+{
     if ((tag_read != NULL) && (retcode == CSM_SEC_OK))
     {
         // Need to validate the tag
-        if (memcmp(tag, tag_read, 12U) != 0)
+        if (memcmp(job->tag, tag_read, 12U) != 0)
         {
             retcode = CSM_SEC_AUTH_FAILURE;
         }
@@ -110,7 +117,72 @@ csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, cons
     return retcode;
 }
 
-csm_sec_result csm_sec_auth_encrypt(csm_array *array, csm_request *request, const uint8_t *system_title, csm_sec_control_byte sc, uint32_t ic)
+static csm_sec_result sec_auth_decrypt(csm_array *array, csm_request *request, csm_sec_key key_id, const uint8_t *system_title)
+{
+    csm_sys_gcm_job job;
+    uint8_t *tag_read = NULL;
+    csm_sec_result retcode = sec_decrypt_prepare(array, request, system_title, &job, &tag_read);
+
+    int valid = csm_sys_gcm_init(job.channel_id, job.sap, key_id, CSM_SEC_DECRYPT, job.iv, job.aad, job.aad_len);
+
+    // Decrypt in place
+    valid = valid && csm_sys_gcm_update(job.channel_id, job.data, job.data_len, job.data);
+
+    valid = valid && csm_sys_gcm_finish(job.channel_id, job.tag);
+
+    if (!valid && (retcode == CSM_SEC_OK))
+    {
+        CSM_ERR("[SEC] Deciphering failure");
+        retcode = CSM_SEC_CRYPT_FAILURE;
+    }
+
+    return sec_check_tag(retcode, &job, tag_read);
+}
+
+csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, const uint8_t *system_title)
+{
+    return sec_auth_decrypt(array, request, CSM_SEC_GUEK, system_title);
+}
+
+uint32_t csm_sec_auth_decrypt_batch(csm_array *arrays[], csm_request *requests[], const uint8_t *system_titles[], csm_sec_result results[], uint32_t count)
+{
+    csm_sys_gcm_job jobs[CSM_SEC_BATCH_SIZE];
+    uint8_t *tags_read[CSM_SEC_BATCH_SIZE];
+    uint32_t nb_ok = 0U;
+
+    for (uint32_t first = 0U; first < count; first += CSM_SEC_BATCH_SIZE)
+    {
+        uint32_t nb = ((count - first) < CSM_SEC_BATCH_SIZE) ? (count - first) : CSM_SEC_BATCH_SIZE;
+
+        for (uint32_t i = 0U; i < nb; i++)
+        {
+            results[first + i] = sec_decrypt_prepare(arrays[first + i], requests[first + i], system_titles[first + i], &jobs[i], &tags_read[i]);
+        }
+
+        // Decrypt in place
+        int valid = csm_sys_gcm_batch(CSM_SEC_GUEK, CSM_SEC_DECRYPT, jobs, nb);
+
+        for (uint32_t i = 0U; i < nb; i++)
+        {
+            if (!valid && (results[first + i] == CSM_SEC_OK))
+            {
+                CSM_ERR("[SEC] Batch deciphering failure");
+                results[first + i] = CSM_SEC_CRYPT_FAILURE;
+            }
+
+            results[first + i] = sec_check_tag(results[first + i], &jobs[i], tags_read[i]);
+
+            if (results[first + i] == CSM_SEC_OK)
+            {
+                nb_ok++;
+            }
+        }
+    }
+
+    return nb_ok;
+}
+
+static csm_sec_result sec_auth_encrypt(csm_array *array, csm_request *request, csm_sec_key key_id, const uint8_t *system_title, csm_sec_control_byte sc, uint32_t ic)
 {
     csm_sec_result retcode = CSM_SEC_OK;
     uint8_t *tag_ptr = NULL;
@@ -142,18 +214,9 @@ csm_sec_result csm_sec_auth_encrypt(csm_array *array, csm_request *request, cons
         if (sc.sh_bit_field.authentication)
         {
             CSM_LOG("[SEC] Authentication enabled");
-            // E + A: size must be higher than the tag
-            if (unread > 12U)
-            {
-                data_size -= 12U;
-                aad_size += 17U;
-                tag_ptr = data + data_size;
-            }
-            else
-            {
-                CSM_ERR("[SEC] Bad packet size for deciphering");
-                retcode = CSM_SEC_ERROR;
-            }
+            // E + A: the tag follows the ciphered information
+            aad_size += 17U;
+            tag_ptr = data + data_size;
         }
     }
     else if (sc.sh_bit_field.authentication)
@@ -180,15 +243,19 @@ csm_sec_result csm_sec_auth_encrypt(csm_array *array, csm_request *request, cons
         aad_size = 0U;
     }
 
-    csm_sys_gcm_init(request->channel_id, request->llc.dsap, CSM_SEC_GUEK, CSM_SEC_ENCRYPT, IV, aad, aad_size);
+    int valid = csm_sys_gcm_init(request->channel_id, request->llc.dsap, key_id, CSM_SEC_ENCRYPT, IV, aad, aad_size);
 
-    // Encrypt in place
-    csm_sys_gcm_update(request->channel_id, data, data_size, data);
+    // Encrypt in place, the information is already written in the array
+    valid = valid && csm_sys_gcm_update(request->channel_id, data, data_size, data);
 
     uint8_t tag[16U];
-    csm_sys_gcm_finish(request->channel_id, tag);
+    valid = valid && csm_sys_gcm_finish(request->channel_id, tag);
 
-    csm_array_writer_advance(array, data_size); // Jump over crypted data
+    if (!valid && (retcode == CSM_SEC_OK))
+    {
+        CSM_ERR("[SEC] Ciphering failure");
+        retcode = CSM_SEC_CRYPT_FAILURE;
+    }
 
     if ((tag_ptr != NULL) && (retcode == CSM_SEC_OK))
     {
@@ -198,3 +265,153 @@ csm_sec_result csm_sec_auth_encrypt(csm_array *array, csm_request *request, cons
 
     return retcode;
 }
+
+csm_sec_result csm_sec_auth_encrypt(csm_array *array, csm_request *request, const uint8_t *system_title, csm_sec_control_byte sc, uint32_t ic)
+{
+    return sec_auth_encrypt(array, request, CSM_SEC_GUEK, system_title, sc, ic);
+}
+
+static int sec_is_service_tag(uint8_t tag)
+{
+    return ((tag == AXDR_GET_REQUEST) || (tag == AXDR_SET_REQUEST) || (tag == AXDR_ACTION_REQUEST) ||
+            (tag == AXDR_GET_RESPONSE) || (tag == AXDR_SET_RESPONSE) || (tag == AXDR_ACTION_RESPONSE)) ? TRUE : FALSE;
+}
+
+uint8_t csm_sec_plain_tag(uint8_t tag, csm_sec_key *key_id)
+{
+    uint8_t plain = 0U;
+
+    if ((tag >= AXDR_GLO_GET_REQUEST) && (tag <= AXDR_GLO_ACTION_RESPONSE))
+    {
+        plain = tag - CSM_SEC_GLO_TAG_OFFSET;
+        *key_id = CSM_SEC_GUEK;
+    }
+    else if ((tag >= AXDR_DED_GET_REQUEST) && (tag <= AXDR_DED_ACTION_RESPONSE))
+    {
+        plain = tag - CSM_SEC_DED_TAG_OFFSET;
+        *key_id = CSM_SEC_DEK;
+    }
+
+    return sec_is_service_tag(plain) ? plain : 0U;
+}
+
+uint8_t csm_sec_ciphered_tag(uint8_t tag, csm_sec_key key_id)
+{
+    uint8_t ciphered = 0U;
+
+    if (sec_is_service_tag(tag))
+    {
+        ciphered = (key_id == CSM_SEC_DEK) ? (tag + CSM_SEC_DED_TAG_OFFSET) : (tag + CSM_SEC_GLO_TAG_OFFSET);
+    }
+
+    return ciphered;
+}
+
+// Size of the BER encoding of a length
+static uint32_t sec_ber_len_size(uint32_t len)
+{
+    return (len < 128U) ? 1U : ((len < 256U) ? 2U : 3U);
+}
+
+/*
+Ciphered APDU: tag || length || SC || IC || information || T
+
+The information is ciphered where it is, the header is written in the headroom of the array
+and T is appended. On error, the array keeps its offset.
+*/
+csm_sec_result csm_sec_wrap_apdu(csm_array *array, csm_request *request, csm_sec_key key_id, const uint8_t *system_title, csm_sec_control_byte sc, uint32_t ic)
+{
+    csm_sec_result retcode = CSM_SEC_ERROR;
+    uint8_t tag = 0U;
+    uint32_t size = csm_array_written(array);
+    uint32_t tag_size = sc.sh_bit_field.authentication ? 12U : 0U;
+    uint32_t len = CSM_DEF_SEC_HDR_SIZE + size + tag_size;
+    uint32_t hdr_size = 1U + sec_ber_len_size(len) + CSM_DEF_SEC_HDR_SIZE;
+
+    if (csm_array_get(array, 0U, &tag))
+    {
+        tag = csm_sec_ciphered_tag(tag, key_id);
+    }
+
+    if (tag == 0U)
+    {
+        CSM_ERR("[SEC] APDU cannot be ciphered");
+    }
+    else if ((array->offset < hdr_size) || (array->offset < CSM_SEC_HEADROOM) || (csm_array_free_size(array) < tag_size))
+    {
+        CSM_ERR("[SEC] No room to cipher the APDU");
+    }
+    else
+    {
+        array->offset -= hdr_size;
+        array->rd_index = hdr_size;
+        array->wr_index = hdr_size + size;
+
+        retcode = sec_auth_encrypt(array, request, key_id, system_title, sc, ic);
+
+        uint32_t written = csm_array_written(array);
+        array->rd_index = 0U;
+        array->wr_index = 0U;
+
+        int valid = csm_array_write_u8(array, tag);
+        valid = valid && csm_ber_write_len(array, len);
+        valid = valid && csm_array_write_u8(array, sc.sh_byte);
+        valid = valid && csm_array_write_u32(array, ic);
+
+        if (valid && (retcode == CSM_SEC_OK))
+        {
+            array->wr_index = written;
+        }
+        else
+        {
+            array->offset += hdr_size;
+            array->wr_index = 0U;
+            retcode = (retcode == CSM_SEC_OK) ? CSM_SEC_ERROR : retcode;
+        }
+    }
+
+    return retcode;
+}
+
+/*
+The information is deciphered where it is, then the array starts with the plain APDU.
+*/
+csm_sec_result csm_sec_unwrap_apdu(csm_array *array, csm_request *request, csm_sec_key key_id, const uint8_t *system_title, csm_sec_control_byte *sc, uint32_t *ic)
+{
+    csm_sec_result retcode = CSM_SEC_ERROR;
+    ber_length len;
+
+    if (!csm_ber_read_len(array, &len) || (len.length != csm_array_unread(array)) ||
+        (len.length < CSM_DEF_SEC_HDR_SIZE) || !csm_array_get(array, array->rd_index, &sc->sh_byte))
+    {
+        CSM_ERR("[SEC] Bad ciphered APDU length");
+    }
+    else if ((array->offset + array->rd_index + CSM_DEF_SEC_HDR_SIZE) < CSM_SEC_HEADROOM)
+    {
+        CSM_ERR("[SEC] No room to decipher the APDU");
+    }
+    else if ((sc->sh_bit_field.security_suite != 0U) || sc->sh_bit_field.compression)
+    {
+        CSM_ERR("[SEC] Security suite not supported");
+    }
+    else
+    {
+        if ((key_id == CSM_SEC_GUEK) && sc->sh_bit_field.key_set)
+        {
+            key_id = CSM_SEC_GBEK;
+        }
+
+        *ic = GET_BE32(csm_array_rd_current(array) + 1U);
+        retcode = sec_auth_decrypt(array, request, key_id, system_title);
+
+        if (retcode == CSM_SEC_OK)
+        {
+            uint32_t size = csm_array_unread(array) - (sc->sh_bit_field.authentication ? 12U : 0U);
+            array->offset += array->rd_index;
+            array->rd_index = 0U;
+            array->wr_index = size;
+        }
+    }
+
+    return retcode;
+}
@@ -21,6 +21,21 @@ extern "C" {
 
 #define CSM_DEF_SEC_HDR_SIZE    5U
 
+// Packets given together to the HAL by csm_sec_auth_decrypt_batch()
+#ifndef CSM_SEC_BATCH_SIZE
+#define CSM_SEC_BATCH_SIZE      8U
+#endif
+
+// Tag of a glo- or ded- APDU: tag of the service + offset
+#define CSM_SEC_GLO_TAG_OFFSET  8U
+#define CSM_SEC_DED_TAG_OFFSET  16U
+
+// Beginning of the AAD (SC || AK), built in the array just before the information
+#define CSM_SEC_HEADROOM        (1U + 16U)
+
+// Maximum size added to an APDU by the ciphering: tag, length (3 bytes max), SC, IC and T
+#define CSM_SEC_APDU_OVERHEAD   (1U + 3U + CSM_DEF_SEC_HDR_SIZE + 12U)
+
 
 // A Cosem secure packet has the following form:
 //     SC || IC || Information || T
@@ -48,12 +63,6 @@ typedef union
     } sh_bit_field;
 } csm_sec_control_byte;
 
-typedef struct
-{
-    uint32_t client_ic; //!< Invocation counter of the client
-    uint32_t server_ic; //!< Invocation counter of the server
-} csm_sec_context;
-
 typedef enum
 {
     CSM_SEC_OK = 0,
@@ -71,6 +80,48 @@ typedef enum
 csm_sec_result csm_sec_auth_decrypt(csm_array *array, csm_request *request, const uint8_t *system_title);
 csm_sec_result csm_sec_auth_encrypt(csm_array *array, csm_request *request, const uint8_t *system_title, csm_sec_control_byte sc, uint32_t ic);
 
+/**
+ * @brief Same as csm_sec_auth_decrypt() for several packets, deciphered together by the HAL
+ * @param system_titles: system title of the sender of each packet
+ * @param results: result of each packet
+ * @return the number of packets deciphered and authenticated (CSM_SEC_OK)
+ *
+ * Meant for a data concentrator or a server receiving many APDUs at once: the GCM of
+ * the packets is interleaved by groups of CSM_SEC_BATCH_SIZE (csm_sys_gcm_batch()).
+ */
+uint32_t csm_sec_auth_decrypt_batch(csm_array *arrays[], csm_request *requests[], const uint8_t *system_titles[], csm_sec_result results[], uint32_t count);
+
+/**
+ * @brief Tag of the service carried by a glo- or ded- APDU (GET, SET and ACTION)
+ * @param key_id: CSM_SEC_GUEK for glo-, CSM_SEC_DEK for ded-
+ * @return the tag of the service, 0 if the APDU is not a ciphered service
+ */
+uint8_t csm_sec_plain_tag(uint8_t tag, csm_sec_key *key_id);
+
+/**
+ * @brief Tag of the glo- (CSM_SEC_GUEK) or ded- (CSM_SEC_DEK) APDU of a service, 0 if it cannot be ciphered
+ */
+uint8_t csm_sec_ciphered_tag(uint8_t tag, csm_sec_key key_id);
+
+/**
+ * @brief Ciphers in place the APDU written in the array into a glo- or ded- APDU
+ *
+ * The offset of the array is moved back to write the tag, length and security header
+ * in its headroom (CSM_SEC_HEADROOM bytes at least), T is appended. On error, the offset
+ * is kept and the array is empty.
+ */
+csm_sec_result csm_sec_wrap_apdu(csm_array *array, csm_request *request, csm_sec_key key_id, const uint8_t *system_title, csm_sec_control_byte sc, uint32_t ic);
+
+/**
+ * @brief Deciphers in place a glo- or ded- APDU, its tag already read
+ * @param key_id: from csm_sec_plain_tag(), the broadcast key is used if the SC asks for it
+ * @param sc: security control byte of the APDU
+ * @param ic: invocation counter of the APDU, to be checked against replays on success
+ *
+ * On success, the offset of the array is moved forward: the array holds the plain APDU only.
+ */
+csm_sec_result csm_sec_unwrap_apdu(csm_array *array, csm_request *request, csm_sec_key key_id, const uint8_t *system_title, csm_sec_control_byte *sc, uint32_t *ic);
+
 
 #ifdef __cplusplus
 }
@@ -1,43 +1,62 @@
+#include <string.h>
 #include "csm_server.h"
 #include "csm_axdr_codec.h"
+#include "csm_ber.h"
+#include "csm_gbt.h"
+#include "csm_security.h"
 
 static const uint32_t gResponseNormalHeaderSize = 6U; // Offset where data can be returned for an Action
-static const uint32_t gResponseWithDataBlockHeaderSize = 8U;
+static const uint32_t gResponseWithDataBlockHeaderSize = 12U; // Including the raw-data choice and its length (3 bytes max)
+// Answer to the requests received while a response is pending
+static const uint8_t gBusyException[3] = { AXDR_EXCEPTION_RESPONSE, CSM_EXCEPTION_SERVICE_NOT_ALLOWED, CSM_EXCEPTION_OPERATION_NOT_POSSIBLE };
 
 
-// FIXME: add parameters to specialize the exception response
-int svc_exception_response_encoder(csm_array *array)
+static int svc_exception_encoder(csm_array *array, uint8_t state_error, uint8_t service_error)
 {
     int valid = csm_array_write_u8(array, AXDR_EXCEPTION_RESPONSE);
-    valid = valid && csm_array_write_u8(array, 1U);
-    valid = valid && csm_array_write_u8(array, 1U);
+    valid = valid && csm_array_write_u8(array, state_error);
+    valid = valid && csm_array_write_u8(array, service_error);
     return valid;
 }
 
-enum data_access_result
+int svc_exception_response_encoder(csm_array *array)
 {
-    SRV_RESULT_SUCCESS              = 0U,
-    SRV_RESULT_HARDWARE_FAULT       = 1U,
-    SRV_RESULT_TEMPORARY_FAILURE    = 2U,
-    SRV_RESULT_READ_WRITE_DENIED    = 3U,
-    SRV_RESULT_OBJECT_UNDEFINED     = 4U,
-    SRV_RESULT_OTHER_REASON         = 250U
-};
+    return svc_exception_encoder(array, CSM_EXCEPTION_SERVICE_NOT_ALLOWED, CSM_EXCEPTION_OPERATION_NOT_POSSIBLE);
+}
 
-int svc_data_access_result_encoder(csm_array *array, csm_db_code code)
+static csm_data_access_result svc_data_access_result(csm_db_code code)
 {
-    uint8_t result;
+    csm_data_access_result result;
     // Transform the code into a DLMS/Cosem valid response
-    if (code == CSM_OK)
+    switch (code)
     {
-        result = SRV_RESULT_SUCCESS;
-    }
-    else
-    {
-        result = SRV_RESULT_OTHER_REASON;
+    case CSM_OK:
+        result = CSM_ACCESS_RESULT_SUCCESS;
+        break;
+    case CSM_ERR_OBJECT_NOT_FOUND:
+        result = CSM_ACCESS_RESULT_OBJECT_UNDEFINED;
+        break;
+    case CSM_ERR_UNAUTHORIZED_ACCESS:
+        result = CSM_ACCESS_RESULT_READ_WRITE_DENIED;
+        break;
+    case CSM_ERR_TEMPORARY_FAILURE:
+    case CSM_PENDING: // Not allowed in lists and blocks
+        result = CSM_ACCESS_RESULT_TEMPORARY_FAILURE;
+        break;
+    case CSM_ERR_DATA_CONTENT_NOT_OK:
+        result = CSM_ACCESS_RESULT_TYPE_UNMATCHED;
+        break;
+    default:
+        result = CSM_ACCESS_RESULT_OTHER_REASON;
+        break;
     }
 
-    return csm_array_write_u8(array, result);
+    return result;
+}
+
+int svc_data_access_result_encoder(csm_array *array, csm_db_code code)
+{
+    return csm_array_write_u8(array, (uint8_t)svc_data_access_result(code));
 }
 
 
@@ -58,8 +77,35 @@ int svc_is_next_request(uint8_t type, enum csm_service service)
 {
     int istype = FALSE;
 
-    // Same type for SET/GET/ACTION
-    if ((type == 2U) && (service != SVC_ACTION))
+    // get-request-next [2], SET type 2 is the first datablock
+    if ((type == 2U) && (service == SVC_GET))
+    {
+        istype = TRUE;
+    }
+
+    return istype;
+}
+
+int svc_is_set_datablock_request(uint8_t type, enum csm_service service)
+{
+    int istype = FALSE;
+
+    // set-request-with-first-datablock [2], set-request-with-datablock [3]
+    if (((type == 2U) || (type == 3U)) && (service == SVC_SET))
+    {
+        istype = TRUE;
+    }
+
+    return istype;
+}
+
+int svc_is_with_list_request(uint8_t type, enum csm_service service)
+{
+    int istype = FALSE;
+
+    // get-request-with-list [3], set-request-with-list [4], action-request-with-list [3]
+    if (((type == 3U) && (service != SVC_SET)) ||
+        ((type == 4U) && (service == SVC_SET)))
     {
         istype = TRUE;
     }
@@ -67,6 +113,36 @@ int svc_is_next_request(uint8_t type, enum csm_service service)
     return istype;
 }
 
+/*
+Cosem-Attribute-Descriptor ::= SEQUENCE
+{
+    class-id        Cosem-Class-Id,
+    instance-id     Cosem-Object-Instance-Id,
+    attribute-id    Cosem-Object-Attribute-Id
+}
+Optionally followed by the selective access for GET and SET services (Cosem-Attribute-Descriptor-With-Selection).
+The Cosem-Method-Descriptor has the same encoding, without selective access.
+*/
+static int svc_decode_descriptor(csm_request *request, csm_array *array)
+{
+    int valid = csm_array_read_u16(array, &request->db_request.logical_name.class_id);
+    valid = valid && csm_array_read_buff(array, &request->db_request.logical_name.obis.A, 6U);
+    valid = valid && csm_array_read_u8(array, (uint8_t*)&request->db_request.logical_name.id);
+
+    if (request->db_request.service != SVC_ACTION)
+    {
+        // GET and SET services can have selective access parameter (option)
+        valid = valid && csm_array_read_u8(array, &request->db_request.sel_access.enable);
+
+        if (request->db_request.sel_access.enable)
+        {
+            // Retrieve selective access data, user side decoding
+            valid = valid && csm_hal_decode_selective_access(request, array);
+        }
+    }
+
+    return valid;
+}
 
 int svc_decode_request(csm_request *request, csm_array *array)
 {
@@ -78,40 +154,629 @@ int svc_decode_request(csm_request *request, csm_array *array)
     {
         if (svc_is_normal_request(type))
         {
+            request->type = SVC_REQUEST_NORMAL;
             request->db_request.next = FALSE;
-            valid = valid && csm_array_read_u16(array, &request->db_request.logical_name.class_id);
-            valid = valid && csm_array_read_buff(array, &request->db_request.logical_name.obis.A, 6U);
-            valid = valid && csm_array_read_u8(array, (uint8_t*)&request->db_request.logical_name.id);
-
-            if (request->db_request.service != SVC_ACTION)
-            {
-                // GET and SET services can have selective access parameter (option)
-                valid = valid && csm_array_read_u8(array, &request->db_request.sel_access.enable);
-
-                if (request->db_request.sel_access.enable)
-                {
-                    // Retrieve selective access data, user side decoding
-                    valid = valid && csm_hal_decode_selective_access(request, array);
-                }
-            }
+            request->db_request.block_number = 0U;
+            valid = valid && svc_decode_descriptor(request, array);
 
-            if (request->db_request.service != SVC_GET)
+            if (request->db_request.service == SVC_ACTION)
             {
-                // SET and ACTION services can have data in the request
+                // ACTION service can have data in the request (optional)
                 valid = valid && csm_array_read_u8(array, &request->db_request.additional_data.enable);
                 // Data is following in the array
             }
+            else
+            {
+                // Mandatory value for SET
+                request->db_request.additional_data.enable = (request->db_request.service == SVC_SET);
+            }
         }
         else if (svc_is_next_request(type, request->db_request.service))
         {
+            request->type = SVC_REQUEST_NEXT;
             request->db_request.next = TRUE;
             valid = valid && csm_array_read_u32(array, &request->db_request.block_number); // save the invoke ID to reuse the same
         }
+        else if (svc_is_with_list_request(type, request->db_request.service))
+        {
+            // The list is decoded by the service itself, item per item
+            request->type = SVC_REQUEST_WITH_LIST;
+            request->db_request.next = FALSE;
+            request->db_request.block_number = 0U;
+        }
+        else if (svc_is_set_datablock_request(type, request->db_request.service))
+        {
+            // The DataBlock-SA is decoded by the service itself
+            request->db_request.next = FALSE;
+            request->db_request.additional_data.enable = TRUE;
+            if (type == 2U)
+            {
+                request->type = SVC_REQUEST_WITH_FIRST_DATABLOCK;
+                valid = valid && svc_decode_descriptor(request, array);
+            }
+            else
+            {
+                // Same attribute than the first datablock
+                request->type = SVC_REQUEST_WITH_DATABLOCK;
+            }
+        }
+        else
+        {
+            CSM_ERR("[SVC] Unsupported request type %d", type);
+            valid = FALSE;
+        }
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Encodes the value of one attribute, all the loops included
+ *
+ * The logical name is answered here, the other attributes by the application.
+ * If the application answers in multiple loops, they are all called: the item
+ * must be complete to be part of a list.
+ */
+static csm_db_code svc_get_item(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    csm_db_code code = CSM_ERR_OBJECT_ERROR;
+
+    ctx->asso.state = CSM_RESPONSE_STATE_START;
+
+    if (ctx->request.db_request.logical_name.id == 1)
+    {
+        // Encode the object descriptor
+        if (csm_axdr_wr_octetstring(out, &ctx->request.db_request.logical_name.obis.A, 6U, AXDR_TAG_OCTETSTRING))
+        {
+            code = CSM_OK;
+        }
+    }
+    else
+    {
+        code = ctx->db_access_func(ctx, in, out);
+
+        while ((code == CSM_OK_BLOCK) && (ctx->asso.current_loop < ctx->asso.nb_loops))
+        {
+            ctx->asso.state = CSM_RESPONSE_STATE_NEXT_LOOP;
+            code = ctx->db_access_func(ctx, in, out);
+        }
+
+        if (code == CSM_OK_BLOCK)
+        {
+            code = CSM_OK;
+        }
+        else if (code == CSM_PENDING)
+        {
+            CSM_ERR("[SVC] Pending response not allowed in a list");
+            code = CSM_ERR_TEMPORARY_FAILURE;
+        }
+        ctx->asso.state = CSM_RESPONSE_STATE_START;
+    }
+
+    return code;
+}
+
+// Appends the end of the response: copied in tx, or referenced in place with zero copy
+static int svc_write_payload(csm_server_context_t *ctx, csm_array *out, const uint8_t *data, uint32_t size)
+{
+    int valid = FALSE;
+
+    // A ciphered response is ciphered in place, in tx
+    if (!ctx->asso.zero_copy || ctx->asso.sec.active)
+    {
+        valid = csm_array_write_buff(out, data, size);
+    }
+    else if ((ctx->asso.payload.size == 0U) && (csm_array_free_size(out) >= size))
+    {
+        // Same bound than a copy: the whole APDU must fit in the transmit buffer
+        ctx->asso.payload.data = data;
+        ctx->asso.payload.size = size;
+        valid = TRUE;
+    }
+    else
+    {
+        CSM_ERR("[SVC] Response too long");
+    }
+
+    return valid;
+}
+
+// Services and functionalities proposed by the client in the AARQ and authorized by the association
+static uint32_t svc_conformance(const csm_server_context_t *ctx)
+{
+    return ctx->asso.handshake.proposed_conformance & ctx->asso.config->conformance;
+}
+
+// Maximum APDU size the client can receive with our transmit buffer
+static uint32_t svc_get_max_pdu_size(csm_server_context_t *ctx, csm_array *out)
+{
+    uint32_t max_pdu_size = csm_array_data_size(out);
+    if (max_pdu_size > ctx->asso.handshake.client_max_receive_pdu_size)
+    {
+        max_pdu_size = ctx->asso.handshake.client_max_receive_pdu_size;
+    }
+    if (ctx->asso.sec.active)
+    {
+        max_pdu_size = (max_pdu_size > CSM_SEC_APDU_OVERHEAD) ? (max_pdu_size - CSM_SEC_APDU_OVERHEAD) : 0U;
+    }
+    return max_pdu_size;
+}
+
+// Maximum window of the server, given by the retention buffer size
+static uint8_t svc_gbt_server_window(csm_server_context_t *ctx)
+{
+    uint32_t window = csm_array_data_size(&ctx->asso.gbt.retention) / ctx->asso.gbt.block_size;
+    return (window > CSM_GBT_MAX_WINDOW) ? CSM_GBT_MAX_WINDOW : (uint8_t)window;
+}
+
+static int svc_gbt_is_allowed(csm_server_context_t *ctx, csm_array *out)
+{
+    int allowed = FALSE;
+
+    // A ciphered response is ciphered as a whole: it cannot be streamed, the service blocks are used
+    if ((svc_conformance(ctx) & CSM_CBLOCK_GENERAL_BLOCK_TRANSFER) &&
+        (ctx->asso.gbt.retention.buff != NULL) && !ctx->asso.sec.active)
+    {
+        ctx->asso.gbt.block_size = svc_get_max_pdu_size(ctx, out) - CSM_GBT_HEADER_SIZE;
+        // At least one block must fit in the retention buffer
+        allowed = (svc_gbt_server_window(ctx) > 0U);
+    }
+
+    return allowed;
+}
+
+/**
+ * @brief Fills the retention buffer with the remaining data of the scratch buffer
+ *
+ * The next loops are asked to the application until the retention buffer is full
+ * or all the data is produced. The number of the last block is known at this point.
+ */
+static csm_db_code svc_gbt_fill(csm_server_context_t *ctx)
+{
+    csm_db_code code = CSM_OK;
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+    csm_array *scratch = &ctx->asso.scratch;
+
+    while ((code == CSM_OK) && (gbt->last == 0U))
+    {
+        uint32_t size = csm_array_unread(scratch);
+
+        if (size > 0U)
+        {
+            uint32_t free_size = csm_array_free_size(&gbt->retention);
+            if (free_size == 0U)
+            {
+                break;
+            }
+            size = (size > free_size) ? free_size : size;
+            (void) csm_array_write_buff(&gbt->retention, csm_array_rd_current(scratch), size);
+            (void) csm_array_reader_advance(scratch, size);
+        }
+        else if (ctx->asso.current_loop < ctx->asso.nb_loops)
+        {
+            ctx->asso.state = CSM_RESPONSE_STATE_NEXT_LOOP;
+            csm_array_reset(scratch);
+            code = ctx->db_access_func(ctx, &ctx->asso.rx, scratch);
+            if (code == CSM_OK_BLOCK)
+            {
+                code = CSM_OK;
+            }
+            else if (code == CSM_PENDING)
+            {
+                CSM_ERR("[SVC] Pending response not allowed with general block transfer");
+                code = CSM_ERR_TEMPORARY_FAILURE;
+            }
+        }
+        else
+        {
+            uint32_t nb_blocks = (csm_array_written(&gbt->retention) + gbt->block_size - 1U) / gbt->block_size;
+            gbt->last = gbt->acked + ((nb_blocks > 0U) ? nb_blocks : 1U);
+            ctx->asso.state = CSM_RESPONSE_STATE_START;
+        }
+    }
+
+    return code;
+}
+
+static int svc_gbt_block_encoder(csm_server_context_t *ctx, csm_array *out)
+{
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+    csm_gbt_block block;
+
+    // The retention buffer begins with the first block not acknowledged
+    uint32_t start = (uint32_t)(gbt->next - gbt->acked - 1U) * gbt->block_size;
+    uint32_t size = csm_array_written(&gbt->retention) - start;
+    size = (size > gbt->block_size) ? gbt->block_size : size;
+
+    block.last_block = (gbt->next == gbt->last);
+    block.streaming = !block.last_block && (gbt->next != gbt->window_end);
+    block.window = svc_gbt_server_window(ctx);
+    block.block_number = gbt->next;
+    block.block_number_ack = gbt->rx_block;
+    block.size = size;
+
+    csm_array_reset(out);
+    int valid = csm_gbt_encode_header(out, &block);
+    valid = valid && csm_array_write_buff(out, csm_array_start(&gbt->retention) + start, size);
+
+    if (gbt->next > gbt->sent)
+    {
+        gbt->sent = gbt->next;
     }
+    gbt->next++;
 
     return valid;
 }
 
+// Sends the first block of the window following the last acknowledged block
+static csm_db_code svc_gbt_window(csm_server_context_t *ctx, csm_array *out)
+{
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+    uint8_t window = svc_gbt_server_window(ctx);
+
+    if ((gbt->window > 0U) && (gbt->window < window))
+    {
+        window = gbt->window;
+    }
+
+    csm_db_code code = svc_gbt_fill(ctx);
+
+    gbt->next = gbt->acked + 1U;
+    gbt->window_end = gbt->acked + window;
+    if ((gbt->last != 0U) && (gbt->window_end > gbt->last))
+    {
+        gbt->window_end = gbt->last;
+    }
+
+    if (code == CSM_OK)
+    {
+        code = svc_gbt_block_encoder(ctx, out) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+    }
+
+    if (code != CSM_OK)
+    {
+        gbt->active = FALSE;
+    }
+
+    return code;
+}
+
+/**
+ * @brief Starts a general block transfer of the response
+ *
+ * The stream is the APDU already encoded in the output array, followed by the
+ * unread data of the scratch buffer and the next loops of the application.
+ */
+static csm_db_code svc_gbt_start(csm_server_context_t *ctx, csm_array *out)
+{
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+
+    CSM_LOG("[SVC] Response sent with general block transfer");
+
+    csm_array_reset(&gbt->retention);
+    gbt->acked = 0U;
+    gbt->sent = 0U;
+    gbt->last = 0U;
+    gbt->active = TRUE;
+
+    int valid = csm_array_write_array(&gbt->retention, out);
+    if (valid && (ctx->asso.payload.size > 0U))
+    {
+        // Response already encoded with zero copy
+        valid = csm_array_write_buff(&gbt->retention, ctx->asso.payload.data, ctx->asso.payload.size);
+        ctx->asso.payload.size = 0U;
+    }
+
+    if (!valid)
+    {
+        gbt->active = FALSE;
+        return CSM_ERR_BAD_ENCODING;
+    }
+
+    return svc_gbt_window(ctx, out);
+}
+
+// Releases the acknowledged blocks and sends the next window
+static csm_db_code svc_gbt_acknowledge(csm_server_context_t *ctx, uint16_t block_number_ack, csm_array *out)
+{
+    csm_db_code code = CSM_OK;
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+
+    // The blocks resent after a loss are acknowledged with the blocks the client kept after them
+    if ((block_number_ack > gbt->acked) && (block_number_ack <= gbt->sent))
+    {
+        uint32_t size = (uint32_t)(block_number_ack - gbt->acked) * gbt->block_size;
+        uint32_t written = csm_array_written(&gbt->retention);
+        size = (size > written) ? written : size;
+        memmove(csm_array_start(&gbt->retention), csm_array_start(&gbt->retention) + size, written - size);
+        gbt->retention.wr_index -= size;
+        gbt->acked = block_number_ack;
+    }
+
+    if ((gbt->last != 0U) && (gbt->acked >= gbt->last))
+    {
+        CSM_LOG("[SVC] General block transfer finished");
+        gbt->active = FALSE;
+    }
+    else
+    {
+        // Also resends the blocks lost since the acknowledged one
+        code = svc_gbt_window(ctx, out);
+    }
+
+    return code;
+}
+
+/**
+ * @brief Sends the next block of the scratch buffer with a Get-Response-With-Datablock
+ *
+ * The scratch buffer contains the current loop. When all the data of the loop is sent,
+ * the next request asks the application for the next loop. The last block is
+ * detected when all the loops are done and the scratch buffer is empty.
+ */
+static int svc_get_block_encoder(csm_server_context_t *ctx, csm_array *out)
+{
+    // Detect last block:
+    //  - when all loops are done
+    //  - When there is no more data to read
+    uint8_t last_block = FALSE;
+    // Compute the maximum size to send to the client
+    uint32_t client_max_pdu_size = svc_get_max_pdu_size(ctx, out);
+    client_max_pdu_size -= gResponseWithDataBlockHeaderSize; // remove the header size
+
+    const uint8_t *data = csm_array_rd_current(&ctx->asso.scratch);
+    uint32_t size_to_send = csm_array_unread(&ctx->asso.scratch);
+
+    // We determine if the application loop buffer can be send in one block or multiple
+    // We can send the data in one block if the sratch buffer is smaller than the client max pdu size
+    if (size_to_send <= client_max_pdu_size)
+    {
+        // Prepare next time, ask for next loop
+        ctx->asso.state = CSM_RESPONSE_STATE_NEXT_LOOP;
+        // Detect last block boolean state
+        if (ctx->asso.current_loop >= ctx->asso.nb_loops)
+        {
+            last_block = TRUE;
+        }
+    }
+    else
+    {
+        // Read a maximum of client_max_pdu_size bytes, the remaining ones are sent with the next blocks
+        size_to_send = client_max_pdu_size;
+        ctx->asso.state = CSM_RESPONSE_STATE_SENDING;
+    }
+    csm_array_reader_advance(&ctx->asso.scratch, size_to_send); // manually advance the read pointer
+
+    // Header
+    int valid = csm_array_write_u8(out, AXDR_GET_RESPONSE);
+    valid = valid && csm_array_write_u8(out, SVC_GET_RESPONSE_WITH_DATABLOCK);
+    valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+
+    /*
+    DataBlock-G ::= SEQUENCE -- G == DataBlock for the GET-response
+    {
+        last-block                  BOOLEAN,
+        block-number                Unsigned32,
+        result CHOICE
+        {
+            raw-data                    [0] IMPLICIT OCTET STRING,
+            data-access-result          [1] IMPLICIT Data-Access-Result
+        }
+    }
+    */
+
+    valid = valid && csm_array_write_u8(out, last_block);
+
+    ctx->asso.current_block++;
+    valid = valid && csm_array_write_u32(out, ctx->asso.current_block);
+
+    /*
+    result CHOICE
+    {
+        raw-data   [0] IMPLICIT OCTET STRING,
+        data-access-result  [1] IMPLICIT Data-Access-Result
+    }
+    */
+
+    valid = valid && csm_array_write_u8(out, 0U); // tag = 0 because IMPLICIT
+    valid = valid && csm_ber_write_len(out, size_to_send);
+    valid = valid && svc_write_payload(ctx, out, data, size_to_send);
+
+    if (last_block)
+    {
+        // auto reset all states
+        ctx->asso.current_block = 0;
+        ctx->asso.state = CSM_RESPONSE_STATE_START;
+    }
+
+    return valid;
+}
+
+/**
+ * @brief Encodes the response of a request already fully answered in the scratch buffer
+ *
+ * The response is sent in one APDU if it fits in the client PDU, otherwise
+ * the scratch buffer content is sent by blocks.
+ */
+static int svc_get_response_encoder(csm_server_context_t *ctx, csm_array *out, uint8_t type)
+{
+    int valid = TRUE;
+    // Tag, type, invoke-id and choice of the first result
+    uint32_t header_size = (type == SVC_GET_RESPONSE_NORMAL) ? 4U : 3U;
+
+    if ((header_size + csm_array_unread(&ctx->asso.scratch)) <= svc_get_max_pdu_size(ctx, out))
+    {
+        valid = valid && csm_array_write_u8(out, AXDR_GET_RESPONSE);
+        valid = valid && csm_array_write_u8(out, type);
+        valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+        if (type == SVC_GET_RESPONSE_NORMAL)
+        {
+            valid = valid && csm_array_write_u8(out, 0U); // data result
+        }
+        valid = valid && svc_write_payload(ctx, out, csm_array_rd_current(&ctx->asso.scratch), csm_array_written(&ctx->asso.scratch)); // append the data
+    }
+    else
+    {
+        // Too big, one single loop sent by blocks
+        CSM_LOG("[SVC] Response too long, reply by block");
+        ctx->asso.current_block = 0U;
+        ctx->asso.current_loop = 0U;
+        ctx->asso.nb_loops = 0U;
+
+        if (svc_gbt_is_allowed(ctx, out))
+        {
+            valid = valid && csm_array_write_u8(out, AXDR_GET_RESPONSE);
+            valid = valid && csm_array_write_u8(out, type);
+            valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+            if (type == SVC_GET_RESPONSE_NORMAL)
+            {
+                valid = valid && csm_array_write_u8(out, 0U); // data result
+            }
+            valid = valid && (svc_gbt_start(ctx, out) == CSM_OK);
+        }
+        else
+        {
+            valid = svc_get_block_encoder(ctx, out);
+        }
+    }
+
+    return valid;
+}
+
+/*
+Get-Request-With-List ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    attribute-descriptor-list       SEQUENCE OF Cosem-Attribute-Descriptor-With-Selection
+}
+
+Get-Response-With-List ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    result                          SEQUENCE OF Get-Data-Result
+}
+
+Get-Data-Result ::= CHOICE
+{
+    data                            [0] Data,
+    data-access-result              [1] IMPLICIT Data-Access-Result
+}
+
+The list of results is prepared in the scratch buffer, the raw-data of the blocks
+are the encoding of the SEQUENCE OF Get-Data-Result if the response is too long.
+*/
+static csm_db_code svc_get_with_list(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    csm_db_code code = CSM_ERR_BAD_ENCODING;
+    csm_array *scratch = &ctx->asso.scratch;
+    ber_length nb_items;
+
+    int valid = csm_ber_read_len(in, &nb_items);
+    valid = valid && csm_ber_write_len(scratch, nb_items.length);
+
+    for (uint32_t i = 0U; (i < nb_items.length) && valid; i++)
+    {
+        valid = svc_decode_descriptor(&ctx->request, in);
+
+        if (valid)
+        {
+            uint32_t item_start = scratch->wr_index;
+            valid = csm_array_write_u8(scratch, 0U); // data
+
+            csm_db_code item_code = svc_get_item(ctx, in, scratch);
+
+            if (item_code != CSM_OK)
+            {
+                // Replace the partial data, if any, by the error
+                scratch->wr_index = item_start;
+                valid = csm_array_write_u8(scratch, 1U); // data-access-result
+                valid = valid && svc_data_access_result_encoder(scratch, item_code);
+            }
+        }
+    }
+
+    if (valid)
+    {
+        valid = svc_get_response_encoder(ctx, out, SVC_GET_RESPONSE_WITH_LIST);
+    }
+    else
+    {
+        CSM_ERR("[SVC] Cannot encode the list, check the scratch buffer size");
+    }
+
+    if (valid)
+    {
+        code = CSM_OK;
+    }
+
+    return code;
+}
+
+/**
+ * @brief Encodes the GET response once the application has answered
+ *
+ * Called just after the application or by csm_server_complete(). Errors are
+ * returned as is.
+ */
+static csm_db_code svc_get_end(csm_server_context_t *ctx, csm_db_code code)
+{
+    csm_array *out = &ctx->asso.tx;
+
+    if (code == CSM_PENDING)
+    {
+        CSM_LOG("[SVC] GET.response pending");
+        ctx->asso.pending = TRUE;
+    }
+    else if (ctx->request.type == SVC_REQUEST_NEXT)
+    {
+        if ((code == CSM_OK_BLOCK) || (code == CSM_OK))
+        {
+            code = svc_get_block_encoder(ctx, out) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+        }
+    }
+    else if (code == CSM_OK)
+    {
+        code = svc_get_response_encoder(ctx, out, SVC_GET_RESPONSE_NORMAL) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+    }
+    else if ((code == CSM_OK_BLOCK) && svc_gbt_is_allowed(ctx, out))
+    {
+        // First loop, the whole Get-Response-Normal is streamed
+        int valid = csm_array_write_u8(out, AXDR_GET_RESPONSE);
+        valid = valid && csm_array_write_u8(out, SVC_GET_RESPONSE_NORMAL);
+        valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+        valid = valid && csm_array_write_u8(out, 0U); // data result
+        code = valid ? svc_gbt_start(ctx, out) : CSM_ERR_BAD_ENCODING;
+    }
+    else if (code == CSM_OK_BLOCK)
+    {
+        // First loop
+        ctx->asso.current_block = 0U;
+        code = svc_get_block_encoder(ctx, out) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+    }
+
+    return code;
+}
+
+static csm_db_code svc_get_exception(csm_server_context_t *ctx, csm_db_code code)
+{
+    if ((code != CSM_OK) && (code != CSM_OK_BLOCK) && (code != CSM_PENDING))
+    {
+        csm_array_reset(&ctx->asso.tx);
+        ctx->asso.payload.size = 0U;
+        ctx->asso.state = CSM_RESPONSE_STATE_START;
+        if (svc_exception_response_encoder(&ctx->asso.tx))
+        {
+            code = CSM_OK;
+        }
+        else
+        {
+            CSM_ERR("[SVC] Internal problem, cannot encore exception response");
+        }
+    }
+
+    return code;
+}
+
 static csm_db_code svc_get_request_decoder(csm_server_context_t *ctx)
 {
     csm_db_code code = CSM_ERR_BAD_ENCODING;
@@ -122,156 +787,412 @@ static csm_db_code svc_get_request_decoder(csm_server_context_t *ctx)
     csm_array *in = &ctx->asso.rx;
     csm_array *out = &ctx->asso.tx;
 
-    // Prepare the intermediate buffer
-    csm_array_reset(&ctx->asso.scratch);
-
     if (svc_decode_request(&ctx->request, in))
     {
+        if (ctx->request.type != SVC_REQUEST_NEXT)
+        {
+            // A new request aborts any block transfer in progress
+            ctx->asso.state = CSM_RESPONSE_STATE_START;
+            ctx->asso.prefetched = FALSE;
+            // Prepare the intermediate buffer
+            csm_array_reset(&ctx->asso.scratch);
+        }
+
         if (ctx->db != NULL)
         {
             CSM_LOG("[SVC] Encoding GET.response");
 
-            // if attribute 1 (logical name) is asked, anwer with the object descriptor
-            // else, ask the application to provide the data
-
-            if (ctx->request.db_request.logical_name.id == 1)
+            if (ctx->request.type == SVC_REQUEST_WITH_LIST)
             {
-                // Encode the object descriptor
-                int valid = csm_array_write_u8(out, AXDR_GET_RESPONSE);
-                valid = valid && csm_array_write_u8(out, SVC_GET_RESPONSE_NORMAL); // default, can be changed by the application
-                valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
-                valid = valid && csm_array_write_u8(out, 0U); // data result
-                valid = valid && csm_axdr_wr_octetstring(out, &ctx->request.db_request.logical_name.obis.A, 6U, AXDR_TAG_OCTETSTRING);
-                if (valid)
+                if (svc_conformance(ctx) & CSM_CBLOCK_MULTIPLE_REFERENCES)
                 {
-                    code = CSM_OK;
+                    code = svc_get_with_list(ctx, in, out);
+                }
+                else
+                {
+                    CSM_ERR("[SVC] Multiple references not allowed");
+                    code = CSM_ERR_UNAUTHORIZED_ACCESS;
                 }
-                return code;
-            }
-
-            // We pass the scratch buffer as an output array so that we can manage the block transfer easier   
-            code = ctx->db_access_func(ctx, in, &ctx->asso.scratch);
-
-            if (code == CSM_OK)
-            {
-                int valid = csm_array_write_u8(out, AXDR_GET_RESPONSE);
-                valid = valid && csm_array_write_u8(out, SVC_GET_RESPONSE_NORMAL); // default, can be changed by the application
-                valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
-                valid = valid && csm_array_write_u8(out, 0U); // data result
-                valid = valid && csm_array_write_array(out, &ctx->asso.scratch); // append the data
             }
-            else if (code == CSM_OK_BLOCK)
+            else if (ctx->request.type == SVC_REQUEST_NEXT)
             {
-                // First loop
-                if (ctx->asso.state == CSM_RESPONSE_STATE_START)
+                if (ctx->asso.state == CSM_RESPONSE_STATE_SENDING)
                 {
-                    ctx->asso.current_block = 0U;
-                    ctx->asso.state = CSM_RESPONSE_STATE_SENDING;
+                    // The current loop is not fully sent, continue with the remaining data of the scratch buffer
+                    code = CSM_OK_BLOCK;
                 }
-
-                // Compute transmit buffer capacity
-
-                // Detect last block:
-                //  - when all loops are done
-                //  - When there is no more data to read
-                uint8_t last_block = FALSE;
-                // Compute the maximum size to send to the client
-                uint16_t client_max_pdu_size = csm_array_data_size(out);
-                if (client_max_pdu_size > ctx->asso.handshake.client_max_receive_pdu_size)
+                else if ((ctx->asso.state == CSM_RESPONSE_STATE_NEXT_LOOP) && ctx->asso.prefetched)
                 {
-                    client_max_pdu_size = ctx->asso.handshake.client_max_receive_pdu_size;
+                    // The next loop is ready, the current block is sent: swap the buffers
+                    csm_array scratch = ctx->asso.scratch;
+                    ctx->asso.scratch = ctx->asso.prefetch;
+                    ctx->asso.prefetch = scratch;
+                    ctx->asso.prefetched = FALSE;
+                    code = ctx->asso.prefetch_code;
                 }
-                client_max_pdu_size -= gResponseWithDataBlockHeaderSize; // remove the header size
-
-                const uint8_t *data = csm_array_rd_current(&ctx->asso.scratch);
-                uint32_t size_to_send = csm_array_unread(&ctx->asso.scratch);
-
-                // We determine if the application loop buffer can be send in one block or multiple
-                // We can send the data in one block if the sratch buffer is smaller than the client max pdu size
-                if (size_to_send <= client_max_pdu_size)
+                else if (ctx->asso.state == CSM_RESPONSE_STATE_NEXT_LOOP)
                 {
-                    // Prepare next time, ask for next loop
-                    ctx->asso.state = CSM_RESPONSE_STATE_NEXT_LOOP;
-                    // Detect last block boolean state
-                    if (ctx->asso.current_loop == ctx->asso.nb_loops)
-                    {
-                        last_block = TRUE;
-                    }
+                    csm_array_reset(&ctx->asso.scratch);
+                    code = ctx->db_access_func(ctx, in, &ctx->asso.scratch);
                 }
                 else
                 {
-                    // Read a maximum of client_max_pdu_size bytes
-                    size_to_send = client_max_pdu_size;
+                    CSM_ERR("[SVC] No block transfer in progress");
+                    code = CSM_ERR_OBJECT_ERROR;
                 }
-                csm_array_reader_advance(&ctx->asso.scratch, size_to_send); // manually advance the read pointer
 
-                // Header
-                int valid = csm_array_write_u8(out, AXDR_GET_RESPONSE);
-                valid = valid && csm_array_write_u8(out, SVC_GET_RESPONSE_WITH_DATABLOCK);
-                valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+                code = svc_get_end(ctx, code);
+            }
+            else if (ctx->request.db_request.logical_name.id == 1)
+            {
+                // if attribute 1 (logical name) is asked, anwer with the object descriptor
+                code = svc_get_item(ctx, in, &ctx->asso.scratch);
+                code = svc_get_response_encoder(ctx, out, SVC_GET_RESPONSE_NORMAL) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+            }
+            else
+            {
+                // else, ask the application to provide the data
+                // We pass the scratch buffer as an output array so that we can manage the block transfer easier
+                code = ctx->db_access_func(ctx, in, &ctx->asso.scratch);
+                code = svc_get_end(ctx, code);
+            }
+        }
+        else
+        {
+            CSM_ERR("[SVC] Database pointer not set");
+            code = CSM_ERR_OBJECT_ERROR;
+        }
+    }
 
-                /*
-                DataBlock-G ::= SEQUENCE -- G == DataBlock for the GET-response
-                {
-                    last-block                  BOOLEAN,
-                    block-number                Unsigned32,
-                    result CHOICE
-                    {
-                        raw-data                    [0] IMPLICIT OCTET STRING,
-                        data-access-result          [1] IMPLICIT Data-Access-Result
-                    }
-                }
-                */
+    return svc_get_exception(ctx, code);
+}
 
-                valid = valid && csm_array_write_u8(out, last_block);
 
-                ctx->asso.current_block++;
-                valid = valid && csm_array_write_u32(out, ctx->asso.current_block);
+// Jump over a Cosem-Attribute-Descriptor-With-Selection or a Cosem-Method-Descriptor
+static int svc_skip_descriptor(enum csm_service service, csm_array *array)
+{
+    // class-id, instance-id, attribute-id / method-id
+    int valid = csm_array_reader_advance(array, 9U);
 
-                /*
-                result CHOICE
-                {
-                    raw-data   [0] IMPLICIT OCTET STRING,
-                    data-access-result  [1] IMPLICIT Data-Access-Result
-                }
-                */
+    if (service != SVC_ACTION)
+    {
+        uint8_t sel_access = 0U;
+        valid = valid && csm_array_read_u8(array, &sel_access);
+
+        if (valid && sel_access)
+        {
+            // access-selector then access-parameters
+            valid = csm_array_reader_advance(array, 1U);
+            valid = valid && csm_axdr_skip_data(array);
+        }
+    }
+
+    return valid;
+}
+
+// Encodes the SET/ACTION response once the application has answered
+static csm_db_code svc_set_or_action_end(csm_server_context_t *ctx, csm_db_code code)
+{
+    csm_array *out = &ctx->asso.tx;
+
+    if (code == CSM_PENDING)
+    {
+        CSM_LOG("[SVC] SET/ACTION.response pending");
+        ctx->asso.pending = TRUE;
+        return code;
+    }
+
+    uint32_t reply_size = out->wr_index;
+
+    // Encode the response
+    out->offset -= gResponseNormalHeaderSize;
+    out->wr_index = 0U;
+
+    uint8_t service_resp = (ctx->request.db_request.service == SVC_SET) ? AXDR_SET_RESPONSE : AXDR_ACTION_RESPONSE;
+    int valid = csm_array_write_u8(out, service_resp);
+    valid = valid && csm_array_write_u8(out, (ctx->request.db_request.service == SVC_SET) ? SVC_SET_RESPONSE_NORMAL : SVC_ACTION_RESPONSE_NORMAL);
+    valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+    valid = valid && svc_data_access_result_encoder(out, code);
+
+    if (ctx->request.db_request.service == SVC_ACTION)
+    {
+        // Encode additional data if any
+        if (reply_size > 0U)
+        {
+            valid = valid && csm_array_write_u8(out, 1U); // presence flag for optional return-parameters
+            valid = valid && csm_array_write_u8(out, 0U); // Data
+            valid = valid && csm_array_writer_advance(out, reply_size); // Virtually add the data (already encoded in the buffer)
+        }
+        else
+        {
+            valid = valid && csm_array_write_u8(out, 0U); // presence flag for optional return-parameters
+        }
+    }
+
+    return valid ? CSM_OK : CSM_ERR_BAD_ENCODING;
+}
+
+static csm_db_code svc_set_or_action_normal(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    // The output data will point to a different area into our working buffer
+    // This will help us to encode the data
+    out->offset += gResponseNormalHeaderSize; // begin to encode the reply just after the response header
+    out->rd_index = 0U;
+    out->wr_index = 0U;
+
+    return svc_set_or_action_end(ctx, ctx->db_access_func(ctx, in, out));
+}
+
+/*
+Set-Request-With-List ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    attribute-descriptor-list       SEQUENCE OF Cosem-Attribute-Descriptor-With-Selection,
+    value-list                      SEQUENCE OF Data
+}
+
+Set-Response-With-List ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    result                          SEQUENCE OF Data-Access-Result
+}
+
+Action-Request-With-List ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    cosem-method-descriptor-list    SEQUENCE OF Cosem-Method-Descriptor,
+    method-invocation-parameters    SEQUENCE OF Data
+}
+
+Action-Response-With-List ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    list-of-responses               SEQUENCE OF Action-Response-With-Optional-Data
+}
+
+Action-Response-With-Optional-Data ::= SEQUENCE
+{
+    result                          Action-Result,
+    return-parameters               Get-Data-Result OPTIONAL
+}
+
+The descriptors and the values are two separated lists: two read cursors walk
+through the request in parallel, no copy is made. Each application call sees only
+its own Data. The results are encoded in place in the transmit buffer.
+*/
+static csm_db_code svc_set_or_action_with_list(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    csm_array values = *in;
+    ber_length nb_items;
+    ber_length nb_values;
+
+    int valid = csm_ber_read_len(in, &nb_items);
+
+    // Position the second cursor on the value list
+    values.rd_index = in->rd_index;
+    for (uint32_t i = 0U; (i < nb_items.length) && valid; i++)
+    {
+        valid = svc_skip_descriptor(ctx->request.db_request.service, &values);
+    }
+    valid = valid && csm_ber_read_len(&values, &nb_values);
+    valid = valid && (nb_values.length == nb_items.length);
+
+    uint8_t service_resp = (ctx->request.db_request.service == SVC_SET) ? AXDR_SET_RESPONSE : AXDR_ACTION_RESPONSE;
+    valid = valid && csm_array_write_u8(out, service_resp);
+    valid = valid && csm_array_write_u8(out, (ctx->request.db_request.service == SVC_SET) ? SVC_SET_RESPONSE_WITH_LIST : SVC_ACTION_RESPONSE_WITH_LIST);
+    valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+    valid = valid && csm_ber_write_len(out, nb_items.length);
+
+    ctx->request.db_request.additional_data.enable = TRUE;
+
+    for (uint32_t i = 0U; (i < nb_items.length) && valid; i++)
+    {
+        valid = svc_decode_descriptor(&ctx->request, in);
 
-                
-                valid = valid && csm_axdr_wr_octetstring(out, data, size_to_send, 0); // tag = 0 because IMPLICIT   
+        // Bound the value of this item
+        csm_array value = values;
+        valid = valid && csm_axdr_skip_data(&values);
+        value.wr_index = values.rd_index;
 
-                
-                if (last_block)
+        if (valid)
+        {
+            csm_db_code code;
+
+            if (ctx->request.db_request.service == SVC_SET)
+            {
+                csm_array_reset(&ctx->asso.scratch);
+                code = ctx->db_access_func(ctx, &value, &ctx->asso.scratch);
+                valid = svc_data_access_result_encoder(out, code);
+            }
+            else
+            {
+                // Return parameters are encoded after the result, the presence flag and the Data choice
+                csm_array reply;
+                uint32_t reply_offset = out->offset + out->wr_index + 3U;
+                csm_array_init(&reply, out->buff, out->size, 0U, (reply_offset < out->size) ? reply_offset : out->size);
+
+                code = ctx->db_access_func(ctx, &value, &reply);
+
+                valid = svc_data_access_result_encoder(out, code);
+                if ((code == CSM_OK) && (csm_array_written(&reply) > 0U))
                 {
-                    // auto reset all states
-                    ctx->asso.current_block = 0;
-                    ctx->asso.state = CSM_RESPONSE_STATE_START;
+                    valid = valid && csm_array_write_u8(out, 1U); // presence flag for optional return-parameters
+                    valid = valid && csm_array_write_u8(out, 0U); // Data
+                    valid = valid && csm_array_writer_advance(out, csm_array_written(&reply)); // already encoded in the buffer
+                }
+                else
+                {
+                    valid = valid && csm_array_write_u8(out, 0U); // presence flag for optional return-parameters
                 }
             }
         }
-        else
+    }
+
+    if (!valid)
+    {
+        CSM_ERR("[SVC] Bad request or response too long");
+    }
+
+    return valid ? CSM_OK : CSM_ERR_BAD_ENCODING;
+}
+
+/*
+Set-Request-With-First-Datablock ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    cosem-attribute-descriptor      Cosem-Attribute-Descriptor,
+    access-selection                Selective-Access-Descriptor OPTIONAL,
+    datablock                       DataBlock-SA
+}
+
+Set-Request-With-Datablock ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    datablock                       DataBlock-SA
+}
+
+DataBlock-SA ::= SEQUENCE
+{
+    last-block                      BOOLEAN,
+    block-number                    Unsigned32,
+    raw-data                        OCTET STRING
+}
+
+Set-Response-Datablock ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    block-number                    Unsigned32
+}
+
+Set-Response-Last-Datablock ::= SEQUENCE
+{
+    invoke-id-and-priority          Invoke-Id-And-Priority,
+    result                          Data-Access-Result,
+    block-number                    Unsigned32
+}
+
+The value is not reassembled here: each raw-data is given to the database directly
+from the receive buffer, which reassembles it for the handlers that do not stream.
+Any error ends the long SET with a last datablock response.
+*/
+static csm_db_code svc_set_by_block(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    csm_data_access_result result = CSM_ACCESS_RESULT_SUCCESS;
+    uint8_t last_block = FALSE;
+    uint32_t block_number = 0U;
+    ber_length size;
+
+    int valid = csm_array_read_u8(in, &last_block);
+    valid = valid && csm_array_read_u32(in, &block_number);
+    valid = valid && csm_ber_read_len(in, &size);
+    valid = valid && (size.length <= csm_array_unread(in));
+
+    if (!valid)
+    {
+        return CSM_ERR_BAD_ENCODING;
+    }
+
+    if (ctx->request.type == SVC_REQUEST_WITH_FIRST_DATABLOCK)
+    {
+        // Restart, a previous long SET is silently aborted
+        ctx->asso.set_block = 0U;
+        ctx->asso.set_offset = 0U;
+        ctx->asso.set_request = ctx->request.db_request;
+        if (block_number != 1U)
         {
-            CSM_ERR("[SVC] Database pointer not set");
-            code = CSM_ERR_OBJECT_ERROR;
+            result = CSM_ACCESS_RESULT_DATA_BLOCK_NUMBER_INVALID;
         }
     }
+    else if (ctx->asso.set_block == 0U)
+    {
+        result = CSM_ACCESS_RESULT_NO_LONG_SET_IN_PROGRESS;
+    }
+    else if (block_number != (ctx->asso.set_block + 1U))
+    {
+        result = CSM_ACCESS_RESULT_DATA_BLOCK_NUMBER_INVALID;
+    }
+    else
+    {
+        // Other requests may have been processed since the previous block
+        ctx->request.db_request = ctx->asso.set_request;
+    }
+
+    if (result == CSM_ACCESS_RESULT_SUCCESS)
+    {
+        // Bound the raw-data of this block
+        csm_array chunk = *in;
+        chunk.wr_index = in->rd_index + size.length;
+
+        ctx->request.db_request.block_number = block_number;
+        ctx->request.db_request.last_block = last_block;
+        ctx->request.db_request.block_offset = ctx->asso.set_offset;
+
+        csm_array_reset(&ctx->asso.scratch);
+        result = svc_data_access_result(ctx->db_access_func(ctx, &chunk, &ctx->asso.scratch));
+
+        ctx->asso.set_block = block_number;
+        ctx->asso.set_offset += size.length;
+    }
 
-    if (code > CSM_OK_BLOCK)
+    if ((result != CSM_ACCESS_RESULT_SUCCESS) || last_block)
     {
-        csm_array_reset(out);
-        if (svc_exception_response_encoder(out))
+        CSM_LOG("[SVC] Long SET finished, result: %d", (int)result);
+        ctx->asso.set_block = 0U;
+        ctx->asso.set_offset = 0U;
+        last_block = TRUE;
+    }
+
+    valid = csm_array_write_u8(out, AXDR_SET_RESPONSE);
+    valid = valid && csm_array_write_u8(out, last_block ? SVC_SET_RESPONSE_LAST_DATABLOCK : SVC_SET_RESPONSE_DATABLOCK);
+    valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
+    if (last_block)
+    {
+        valid = valid && csm_array_write_u8(out, (uint8_t)result);
+    }
+    valid = valid && csm_array_write_u32(out, block_number);
+
+    return valid ? CSM_OK : CSM_ERR_BAD_ENCODING;
+}
+
+static csm_db_code svc_set_or_action_exception(csm_server_context_t *ctx, csm_db_code code)
+{
+    if ((code != CSM_OK) && (code != CSM_PENDING))
+    {
+        CSM_ERR("[SVC][SET] Encoding error");
+        csm_array_reset(&ctx->asso.tx);
+        if (svc_exception_response_encoder(&ctx->asso.tx))
         {
             code = CSM_OK;
         }
         else
         {
-            CSM_ERR("[SVC] Internal problem, cannot encore exception response");
+            CSM_ERR("[SVC][SET] Internal problem, cannot encore exception response");
         }
     }
 
     return code;
 }
 
-
 static csm_db_code svc_set_or_action_decoder(csm_server_context_t *ctx)
 {
     csm_db_code code = CSM_ERR_BAD_ENCODING;
@@ -284,49 +1205,38 @@ static csm_db_code svc_set_or_action_decoder(csm_server_context_t *ctx)
         {
             CSM_LOG("[SVC] Encoding SET/ACTION.response");
 
-            // The output data will point to a different area into our working buffer
-            // This will help us to encode the data
-            uint32_t reply_size = 0U;
-            out->offset += gResponseNormalHeaderSize; // begin to encode the reply just after the response header
-            out->rd_index = 0U;
-            out->wr_index = 0U;
-
-            code = ctx->db_access_func(ctx, in, out);
-
-            reply_size = out->wr_index;
-
-            // Encode the response
-            out->offset -= gResponseNormalHeaderSize;
-            out->wr_index = 0U;
-
-            uint8_t service_resp = (ctx->request.db_request.service == SVC_SET) ? AXDR_SET_RESPONSE : AXDR_ACTION_RESPONSE;
-            int valid = csm_array_write_u8(out, service_resp);
-            valid = valid && csm_array_write_u8(out, 1U); // FIXME: use proper service tag according to service type
-            valid = valid && csm_array_write_u8(out, ctx->request.sender_invoke_id);
-            valid = svc_data_access_result_encoder(out, code);
-
-            if (ctx->request.db_request.service == SVC_ACTION)
+            if (ctx->request.type == SVC_REQUEST_NORMAL)
+            {
+                code = svc_set_or_action_normal(ctx, in, out);
+            }
+            else if (ctx->request.type == SVC_REQUEST_WITH_LIST)
             {
-                // Encode additional data if any
-                if (reply_size > 0U)
+                if (svc_conformance(ctx) & CSM_CBLOCK_MULTIPLE_REFERENCES)
                 {
-                    valid = valid && csm_array_write_u8(out, 1U); // presence flag for optional return-parameters
-                    valid = valid && csm_array_write_u8(out, 0U); // Data
-                    valid = valid && csm_array_writer_advance(out, reply_size); // Virtually add the data (already encoded in the buffer)
+                    code = svc_set_or_action_with_list(ctx, in, out);
                 }
                 else
                 {
-                    valid = valid && csm_array_write_u8(out, 0U); // presence flag for optional return-parameters
+                    CSM_ERR("[SVC] Multiple references not allowed");
+                    code = CSM_ERR_UNAUTHORIZED_ACCESS;
                 }
             }
-
-            if (!valid)
+            else if ((ctx->request.type == SVC_REQUEST_WITH_FIRST_DATABLOCK) ||
+                     (ctx->request.type == SVC_REQUEST_WITH_DATABLOCK))
             {
-                code = CSM_ERR_BAD_ENCODING;
+                if (svc_conformance(ctx) & CSM_CBLOCK_BLOCK_TRANSFER_WITH_SET_OR_WRITE)
+                {
+                    code = svc_set_by_block(ctx, in, out);
+                }
+                else
+                {
+                    CSM_ERR("[SVC] Block transfer with SET not allowed");
+                    code = CSM_ERR_UNAUTHORIZED_ACCESS;
+                }
             }
             else
             {
-                code = CSM_OK;
+                CSM_ERR("[SVC] Request type not supported");
             }
         }
         else
@@ -336,24 +1246,7 @@ static csm_db_code svc_set_or_action_decoder(csm_server_context_t *ctx)
         }
     }
 
-    if (code != CSM_OK)
-    {
-        csm_array_reset(out);
-        if (svc_exception_response_encoder(out))
-        {
-            code = CSM_OK;
-        }
-        else
-        {
-            CSM_ERR("[SVC][SET] Internal problem, cannot encore exception response");
-        }
-    }
-    else
-    {
-        CSM_ERR("[SVC][SET] Encoding error");
-    }
-
-    return code;
+    return svc_set_or_action_exception(ctx, code);
 }
 
 static csm_db_code svc_set_request_decoder(csm_server_context_t *ctx)
@@ -392,6 +1285,308 @@ static const csm_service_handler services[] =
 #define NUMBER_OF_SERVICES (sizeof(services) / sizeof(services[0]))
 
 
+static csm_db_code svc_service_dispatch(csm_server_context_t *ctx, uint8_t tag)
+{
+    csm_db_code code = CSM_ERR_OBJECT_ERROR;
+
+    for (uint32_t i = 0U; i < NUMBER_OF_SERVICES; i++)
+    {
+        const csm_service_handler *srv = &services[i];
+        if ((srv->tag == tag) && (srv->decoder != NULL))
+        {
+            CSM_LOG("[SVC] Found service");
+            // Any other request aborts the general block transfer in progress
+            ctx->asso.gbt.active = FALSE;
+            code = srv->decoder(ctx);
+            break;
+        }
+    }
+
+    return code;
+}
+
+// The response is an exception, in clear
+static csm_db_code svc_security_exception(csm_server_context_t *ctx, uint8_t service_error)
+{
+    csm_array_reset(&ctx->asso.tx);
+    ctx->asso.payload.size = 0U;
+    ctx->asso.sec.active = FALSE;
+    return svc_exception_encoder(&ctx->asso.tx, CSM_EXCEPTION_SERVICE_NOT_ALLOWED, service_error) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+}
+
+// Ciphers the response in place in tx, an exception response stays in clear
+static csm_db_code svc_secure_response(csm_server_context_t *ctx)
+{
+    csm_db_code code = CSM_OK;
+    csm_array *out = &ctx->asso.tx;
+    uint8_t tag = AXDR_EXCEPTION_RESPONSE;
+
+    if (ctx->asso.sec.active && csm_array_get(out, 0U, &tag) && (tag != AXDR_EXCEPTION_RESPONSE))
+    {
+        csm_sec_control_byte sc;
+        uint32_t offset = out->offset;
+        uint32_t ic = 0U;
+        sc.sh_byte = ctx->asso.sec.sc;
+
+        if (!csm_sys_get_ic(ctx->request.llc.dsap, ctx->asso.sec.key_id, CSM_SEC_IC_SERVER, &ic))
+        {
+            CSM_ERR("[SVC] No invocation counter left");
+            code = svc_security_exception(ctx, CSM_EXCEPTION_INVOCATION_COUNTER_ERROR);
+        }
+        else if (csm_sec_wrap_apdu(out, &ctx->request, ctx->asso.sec.key_id, csm_sys_get_system_title(), sc, ic) == CSM_SEC_OK)
+        {
+            ctx->asso.sec.tx_offset = offset;
+            ctx->asso.sec.moved = TRUE;
+        }
+        else
+        {
+            CSM_ERR("[SVC] Ciphering error");
+            code = svc_security_exception(ctx, CSM_EXCEPTION_OTHER_REASON);
+        }
+    }
+
+    return code;
+}
+
+/*
+glo- and ded- requests: the APDU is deciphered where it is in rx, then processed like a request
+in clear. The response is ciphered where it is encoded in tx, the security header goes in the
+headroom of the array (CSM_DEF_MAX_HLS_SIZE). The response has the protection of the request
+and the one required by the security policy of the association.
+*/
+static csm_db_code svc_secured_decoder(csm_server_context_t *ctx, uint8_t tag)
+{
+    csm_db_code code = CSM_ERR_OBJECT_ERROR;
+    csm_array *in = &ctx->asso.rx;
+    csm_sec_key key_id = CSM_SEC_GUEK;
+    csm_sec_control_byte sc;
+    uint32_t ic = 0U;
+    uint8_t policy = ctx->asso.config->security_policy;
+    uint8_t plain = csm_sec_plain_tag(tag, &key_id);
+    uint8_t inner = 0U;
+
+    if ((ctx->asso.ref != LN_REF_WITH_CYPHERING) && (ctx->asso.ref != SN_REF_WITH_CYPHERING))
+    {
+        CSM_ERR("[SVC] Ciphered request without ciphering context");
+        code = svc_security_exception(ctx, CSM_EXCEPTION_OPERATION_NOT_POSSIBLE);
+    }
+    else if (csm_sec_unwrap_apdu(in, &ctx->request, key_id, ctx->asso.client_app_title, &sc, &ic) != CSM_SEC_OK)
+    {
+        CSM_ERR("[SVC] Deciphering error");
+        code = svc_security_exception(ctx, CSM_EXCEPTION_DECIPHERING_ERROR);
+    }
+    else if (!csm_sys_check_ic(ctx->request.llc.dsap, ((key_id == CSM_SEC_GUEK) && sc.sh_bit_field.key_set) ? CSM_SEC_GBEK : key_id,
+                               CSM_SEC_IC_CLIENT, ic))
+    {
+        // Checked once deciphered: a forged APDU does not move the counter
+        CSM_ERR("[SVC] Invocation counter replayed");
+        code = svc_security_exception(ctx, CSM_EXCEPTION_INVOCATION_COUNTER_ERROR);
+    }
+    else if (((policy & CSM_SEC_POLICY_AUTHENTICATED_REQUEST) && !sc.sh_bit_field.authentication) ||
+             ((policy & CSM_SEC_POLICY_ENCRYPTED_REQUEST) && !sc.sh_bit_field.encryption))
+    {
+        CSM_ERR("[SVC] Request less protected than the security policy");
+        code = svc_security_exception(ctx, CSM_EXCEPTION_OPERATION_NOT_POSSIBLE);
+    }
+    else if (!csm_array_read_u8(in, &inner) || (inner != plain))
+    {
+        CSM_ERR("[SVC] Ciphered APDU of another service");
+        code = svc_security_exception(ctx, CSM_EXCEPTION_OPERATION_NOT_POSSIBLE);
+    }
+    else
+    {
+        csm_sec_control_byte response_sc;
+        response_sc.sh_byte = 0U;
+        response_sc.sh_bit_field.authentication = (sc.sh_bit_field.authentication || (policy & CSM_SEC_POLICY_AUTHENTICATED_RESPONSE)) ? 1U : 0U;
+        response_sc.sh_bit_field.encryption = (sc.sh_bit_field.encryption || (policy & CSM_SEC_POLICY_ENCRYPTED_RESPONSE)) ? 1U : 0U;
+
+        ctx->asso.sec.active = TRUE;
+        ctx->asso.sec.sc = response_sc.sh_byte;
+        ctx->asso.sec.key_id = key_id;
+
+        code = svc_service_dispatch(ctx, plain);
+
+        if ((code == CSM_OK) || (code == CSM_OK_BLOCK))
+        {
+            code = svc_secure_response(ctx);
+        }
+    }
+
+    return code;
+}
+
+static csm_db_code svc_dispatch(csm_server_context_t *ctx, uint8_t tag)
+{
+    csm_db_code code = CSM_ERR_OBJECT_ERROR;
+    csm_sec_key key_id = CSM_SEC_GUEK;
+    uint8_t policy = ctx->asso.config->security_policy;
+
+    if (csm_sec_plain_tag(tag, &key_id) != 0U)
+    {
+        code = svc_secured_decoder(ctx, tag);
+    }
+    else if ((policy & (CSM_SEC_POLICY_AUTHENTICATED_REQUEST | CSM_SEC_POLICY_ENCRYPTED_REQUEST)) &&
+             (ctx->asso.state_cf == CF_ASSOCIATED))
+    {
+        // The reply to the HLS challenge (association pending) can be in clear
+        CSM_ERR("[SVC] The security policy requires a ciphered request");
+        code = svc_security_exception(ctx, CSM_EXCEPTION_OPERATION_NOT_POSSIBLE);
+    }
+    else
+    {
+        code = svc_service_dispatch(ctx, tag);
+    }
+
+    return code;
+}
+
+// Sends the response of a request received with GBT in one block, unless it is already streamed
+static csm_db_code svc_gbt_wrap(csm_server_context_t *ctx)
+{
+    csm_db_code code = CSM_OK;
+    csm_array *out = &ctx->asso.tx;
+
+    if (!ctx->asso.gbt.active && (csm_array_written(out) > 0U))
+    {
+        // Short response, in one block
+        csm_array_reset(&ctx->asso.scratch);
+        ctx->asso.current_loop = 0U;
+        ctx->asso.nb_loops = 0U;
+        code = svc_gbt_start(ctx, out);
+    }
+
+    return code;
+}
+
+// Executes the request reassembled in the retention buffer, its response is also sent with GBT
+static csm_db_code svc_gbt_request(csm_server_context_t *ctx)
+{
+    csm_db_code code = CSM_OK;
+    csm_array *in = &ctx->asso.rx;
+    csm_array *out = &ctx->asso.tx;
+    uint8_t tag = 0U;
+
+    // The last block is in the retention buffer, rx now holds the whole request
+    csm_array_reset(in);
+    csm_array_reset(out);
+
+    if (!csm_array_write_array(in, &ctx->asso.gbt.retention))
+    {
+        CSM_ERR("[SVC] Request too long");
+        code = svc_exception_encoder(out, CSM_EXCEPTION_SERVICE_NOT_ALLOWED, CSM_EXCEPTION_PDU_TOO_LONG) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+    }
+    else if (csm_array_read_u8(in, &tag) && (tag != AXDR_GENERAL_BLOCK_TRANSFER))
+    {
+        ctx->asso.gbt.wrapped = TRUE;
+        code = svc_dispatch(ctx, tag);
+        if (code == CSM_OK)
+        {
+            code = svc_gbt_wrap(ctx);
+        }
+    }
+    else
+    {
+        code = CSM_ERR_BAD_ENCODING;
+    }
+
+    return code;
+}
+
+/*
+A General-Block-Transfer from the client is either an acknowledge (no block-data),
+or a block of a request. The blocks of a request are reassembled in the retention
+buffer, the server acknowledges them at the end of each window of the client. The
+response of a request received with GBT is also sent with GBT.
+*/
+static csm_db_code svc_gbt_decoder(csm_server_context_t *ctx)
+{
+    csm_db_code code = CSM_ERR_BAD_ENCODING;
+    csm_array *in = &ctx->asso.rx;
+    csm_array *out = &ctx->asso.tx;
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+    csm_gbt_block block;
+    csm_array header = *in;
+
+    if (!svc_gbt_is_allowed(ctx, out))
+    {
+        CSM_ERR("[SVC] General block transfer not allowed");
+        csm_array_reset(out);
+        code = svc_exception_encoder(out, CSM_EXCEPTION_SERVICE_NOT_ALLOWED, CSM_EXCEPTION_SERVICE_NOT_SUPPORTED) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+    }
+    else if (csm_gbt_decode_header(&header, &block))
+    {
+        gbt->window = block.window;
+        gbt->rx_block = block.block_number;
+
+        if (block.size == 0U)
+        {
+            code = CSM_OK;
+            if (gbt->active)
+            {
+                code = svc_gbt_acknowledge(ctx, block.block_number_ack, out);
+            }
+        }
+        else
+        {
+            if (block.block_number == 1U)
+            {
+                // A new request, the response in progress is aborted
+                gbt->active = FALSE;
+                csm_array_reset(&gbt->retention);
+                csm_gbt_receiver_init(&gbt->request, svc_gbt_server_window(ctx), csm_array_start(&ctx->asso.scratch), csm_array_data_size(&ctx->asso.scratch));
+            }
+
+            // Back to the tag, read again by the receiver
+            in->rd_index--;
+            if (gbt->request.window == 0U)
+            {
+                CSM_ERR("[SVC] Block %d of a request not started", block.block_number);
+            }
+            else if (!csm_gbt_receive(&gbt->request, in, &gbt->retention))
+            {
+                CSM_ERR("[SVC] Request too long");
+                csm_array_reset(out);
+                code = svc_exception_encoder(out, CSM_EXCEPTION_SERVICE_NOT_ALLOWED, CSM_EXCEPTION_PDU_TOO_LONG) ? CSM_OK : CSM_ERR_BAD_ENCODING;
+                gbt->request.window = 0U;
+            }
+            else if (gbt->request.complete)
+            {
+                gbt->request.window = 0U;
+                code = svc_gbt_request(ctx);
+            }
+            else
+            {
+                // Nothing to send while the client streams its window
+                csm_array_reset(out);
+                code = gbt->request.ack_required ? (csm_gbt_encode_ack(&gbt->request, out) ? CSM_OK : CSM_ERR_BAD_ENCODING) : CSM_OK;
+            }
+        }
+    }
+
+    return code;
+}
+
+int csm_server_gbt_next(csm_server_context_t *ctx)
+{
+    int number_of_bytes = 0;
+    csm_gbt_state *gbt = &ctx->asso.gbt;
+
+    if (gbt->active && (gbt->next <= gbt->window_end))
+    {
+        if (svc_gbt_block_encoder(ctx, &ctx->asso.tx))
+        {
+            number_of_bytes = csm_array_written(&ctx->asso.tx);
+        }
+        else
+        {
+            CSM_ERR("[SVC] Encoding error!");
+            gbt->active = FALSE;
+        }
+    }
+
+    return number_of_bytes;
+}
+
 int csm_server_services_execute(csm_server_context_t *ctx)
 {
     int number_of_bytes = 0;
@@ -400,28 +1595,36 @@ int csm_server_services_execute(csm_server_context_t *ctx)
     {
         uint8_t tag;
         csm_array *in = &ctx->asso.rx;
+        // The deciphering and the general block transfer move the start of rx
+        uint32_t rx_offset = in->offset;
         if (csm_array_read_u8(in, &tag))
         {
-            for (uint32_t i = 0U; i < NUMBER_OF_SERVICES; i++)
+            csm_db_code code = CSM_ERR_OBJECT_ERROR;
+            if (tag == AXDR_GENERAL_BLOCK_TRANSFER)
             {
-                const csm_service_handler *srv = &services[i];
-                if ((srv->tag == tag) && (srv->decoder != NULL))
-                {
-                    CSM_LOG("[SVC] Found service");
-                    csm_db_code code = srv->decoder(ctx);
-                    if ((code == CSM_OK) ||
-                        (code == CSM_OK_BLOCK))
-                    {
-                        number_of_bytes = csm_array_written(&ctx->asso.tx);
-                    }
-                    else
-                    {
-                        CSM_ERR("[SVC] Encoding error!");
-                    }
-                    break;
-                }
+                code = svc_gbt_decoder(ctx);
+            }
+            else
+            {
+                ctx->asso.gbt.wrapped = FALSE;
+                code = svc_dispatch(ctx, tag);
+            }
+
+            if ((code == CSM_OK) ||
+                (code == CSM_OK_BLOCK))
+            {
+                number_of_bytes = csm_array_written(&ctx->asso.tx) + ctx->asso.payload.size;
+            }
+            else if (code == CSM_PENDING)
+            {
+                CSM_LOG("[SVC] Response pending");
+            }
+            else
+            {
+                CSM_ERR("[SVC] Encoding error!");
             }
         }
+        in->offset = rx_offset;
     }
     else
     {
@@ -430,6 +1633,82 @@ int csm_server_services_execute(csm_server_context_t *ctx)
     return number_of_bytes;
 }
 
+int csm_server_complete(csm_server_context_t *ctx, csm_db_code code)
+{
+    int number_of_bytes = 0;
+
+    if (!ctx->asso.pending)
+    {
+        CSM_ERR("[SVC] No response pending");
+        return number_of_bytes;
+    }
+
+    ctx->asso.pending = FALSE;
+    ctx->asso.payload.size = 0U;
+    if (code == CSM_PENDING)
+    {
+        CSM_ERR("[SVC] Cannot stay pending on completion");
+        code = CSM_ERR_TEMPORARY_FAILURE;
+    }
+
+    if (ctx->request.db_request.service == SVC_GET)
+    {
+        code = svc_get_exception(ctx, svc_get_end(ctx, code));
+    }
+    else
+    {
+        code = svc_set_or_action_exception(ctx, svc_set_or_action_end(ctx, code));
+    }
+
+    if (code == CSM_OK)
+    {
+        code = svc_secure_response(ctx);
+    }
+
+    if ((code == CSM_OK) && ctx->asso.gbt.wrapped)
+    {
+        code = svc_gbt_wrap(ctx);
+    }
+
+    if (code == CSM_OK)
+    {
+        number_of_bytes = csm_array_written(&ctx->asso.tx) + ctx->asso.payload.size;
+    }
+    else
+    {
+        CSM_ERR("[SVC] Encoding error!");
+    }
+
+    return number_of_bytes;
+}
+
+int csm_server_prefetch(csm_server_context_t *ctx)
+{
+    int prefetched = FALSE;
+    csm_asso_state *asso = &ctx->asso;
+
+    if ((asso->prefetch.buff != NULL) && !asso->prefetched && !asso->pending && !asso->gbt.active &&
+        (asso->state == CSM_RESPONSE_STATE_NEXT_LOOP) && (ctx->request.db_request.service == SVC_GET) &&
+        (ctx->db_access_func != NULL))
+    {
+        // Same input as a Get-Request-Next: nothing left to read
+        csm_array in = asso->rx;
+        in.rd_index = in.wr_index;
+
+        csm_array_reset(&asso->prefetch);
+        asso->prefetch_code = ctx->db_access_func(ctx, &in, &asso->prefetch);
+        if (asso->prefetch_code == CSM_PENDING)
+        {
+            CSM_ERR("[SVC] Pending response not allowed in prefetch");
+            asso->prefetch_code = CSM_ERR_TEMPORARY_FAILURE;
+        }
+        asso->prefetched = TRUE;
+        prefetched = TRUE;
+    }
+
+    return prefetched;
+}
+
 int csm_server_hls_execute(csm_server_context_t *ctx)
 {
     // FIXME: restrict only to the current association object and reply_to_hls_authentication method
@@ -481,6 +1760,25 @@ int csm_server_execute(csm_server_context_t *ctx, const csm_asso_config *configs
         return ret;
     }
 
+    if (ctx->asso.pending)
+    {
+        // The output array of the handler is kept: the exception is sent as the payload, tx stays empty
+        CSM_ERR("[SVC] Busy, waiting for the database");
+        ctx->asso.payload.data = gBusyException;
+        ctx->asso.payload.size = sizeof(gBusyException);
+        return (int)ctx->asso.payload.size;
+    }
+
+    ctx->asso.payload.size = 0U;
+
+    // The previous response may have been ciphered in the headroom of tx
+    if (ctx->asso.sec.moved)
+    {
+        ctx->asso.tx.offset = ctx->asso.sec.tx_offset;
+        ctx->asso.sec.moved = FALSE;
+    }
+    ctx->asso.sec.active = FALSE;
+
     uint8_t tag;
     if (csm_array_get(&ctx->asso.rx, 0U, &tag))
     {
@@ -491,6 +1789,7 @@ int csm_server_execute(csm_server_context_t *ctx, const csm_asso_config *configs
         case CSM_ASSO_RLRE:
         case CSM_ASSO_RLRQ:
             ret = csm_asso_server_execute(&ctx->asso);
+            csm_sys_set_dedicated_key(ctx->request.channel_id, csm_asso_dedicated_key(&ctx->asso));
             break;
         default:
             if (ctx->asso.state_cf == CF_ASSOCIATED)
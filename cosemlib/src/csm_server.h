@@ -37,6 +37,7 @@ struct db_element
     const db_object_descr *objects;
     csm_db_access_handler handler;
     uint32_t nb_objects;
+    uint8_t streaming;  //!< SET by block: the handler receives each block, otherwise the value reassembled
 };
  
 
@@ -45,6 +46,45 @@ int csm_server_execute( csm_server_context_t *cosem_ctx,
                         csm_db_t *db, uint32_t number_of_logical_devices
                         );
 
+/**
+ * @brief Encodes the next block of the current general block transfer window
+ *
+ * To be called after csm_server_execute() until it returns zero, each block
+ * is a complete APDU to send in the tx array.
+ *
+ * @return the number of bytes to send, 0 at the end of the window
+ */
+int csm_server_gbt_next(csm_server_context_t *ctx);
+
+/**
+ * @brief Finishes a request left pending by the database handler
+ *
+ * When the handler returns CSM_PENDING, csm_server_execute() returns zero and
+ * answers the other requests of the association with an exception-response,
+ * sent as the payload (tx is left untouched). The handler writes the data into
+ * the output array it has received, then the application calls this function
+ * with the final code (CSM_OK, CSM_OK_BLOCK or an error). Both are done in the
+ * thread that calls csm_server_execute() for the association.
+ *
+ * CSM_PENDING is only allowed for GET, SET and ACTION normal requests and the
+ * next blocks of a GET; elsewhere, it is answered as a temporary failure and
+ * the handler must drop the operation.
+ *
+ * @return the number of bytes to send in the tx array, like csm_server_execute()
+ */
+int csm_server_complete(csm_server_context_t *ctx, csm_db_code code);
+
+/**
+ * @brief Prepares the next loop of a GET by block in the prefetch buffer
+ *
+ * To be called once the current block is sent (the zero-copy payload refers to the
+ * scratch buffer), while waiting for the next request. The Get-Request-Next is then
+ * answered without calling the database handler.
+ *
+ * @return TRUE if the next loop has been prepared
+ */
+int csm_server_prefetch(csm_server_context_t *ctx);
+
 
 #ifdef __cplusplus
 }
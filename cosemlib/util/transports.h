@@ -2,12 +2,52 @@
 #define TRANSPORTS_H
 
 #include <stdint.h>
+#include "csm_array.h"
 
 
 /**
  * @brief Cosem handler called from the transport layer upon reception of data
  */
-typedef int (*data_handler)(int8_t channel_id, uint8_t *data, uint32_t payload_size, uint32_t buffer_size);
+typedef int (*data_handler)(int32_t channel_id, uint8_t *data, uint32_t payload_size, uint32_t buffer_size);
+
+/**
+ * @brief Same as data_handler, the reply is a chain of segments sent without copy (writev)
+ * The segments must remain valid until the next call on the same channel.
+ */
+typedef int (*chain_data_handler)(int32_t channel_id, uint8_t *data, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply);
+
+/**
+ * @brief Sends a chain of segments to a channel, outside of the reception handler
+ */
+typedef int (*chain_send_handler)(int32_t channel_id, const csm_chain *data);
+
+/**
+ * @brief Hands a value to the thread that serves the channel, callable from any thread
+ * @return 0 if the value is queued
+ */
+typedef int (*post_handler)(int32_t channel_id, int value);
+
+/**
+ * @brief Called by the transport, in the thread that serves the channel, with a value posted by another thread
+ */
+typedef void (*posted_handler)(int32_t channel_id, int value);
+
+/**
+ * @brief Called by the transport once a reply is sent, the channel then waits for the next request
+ */
+typedef void (*sent_handler)(int32_t channel_id);
+
+/**
+ * @brief Finds the boundaries of the packets in a stream transport (TCP)
+ * @return the size of the packet at the start of data, 0 if more data is needed, -1 if the stream is invalid
+ */
+typedef int (*frame_handler)(const uint8_t *data, uint32_t size);
+
+/**
+ * @brief Called by a multi-threaded transport at the start of each thread
+ * @param shard: index of the thread
+ */
+typedef void (*thread_handler)(int shard);
 
 /**
  * @brief Connection handler called from the transport
@@ -15,14 +55,14 @@ typedef int (*data_handler)(int8_t channel_id, uint8_t *data, uint32_t payload_s
  * @param event: transport layer event
  * @return channel id
  */
-typedef int8_t (*connection_handler)();
+typedef int32_t (*connection_handler)();
 
 /**
  * @brief Disconnection handler called from the transport
  * @param channel: channel number
  * 
  */
-typedef void (*disconnection_handler)(int8_t channel_id);
+typedef void (*disconnection_handler)(int32_t channel_id);
 
 #endif // TRANSPORTS_H
 
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Compares the epoll and io_uring backends of the TCP server with the echo server
+#
+#   ./compare.sh <build directory> [tcp_bench.py options]
+#
+# Each backend is started in turn on the same port and loaded by tcp_bench.py, which
+# prints the requests per second and the latency percentiles (p50, p99, max).
+
+BUILD=${1:-.}
+shift
+PORT=4064
+BENCH="$(dirname "$0")/tcp_bench.py"
+
+for SERVER in tcpbench tcpbench_uring; do
+    if [ ! -x "$BUILD/$SERVER" ]; then
+        echo "$SERVER not built, skipped"
+        continue
+    fi
+    "$BUILD/$SERVER" $PORT > /dev/null &
+    PID=$!
+    sleep 1
+    echo "== $SERVER"
+    python3 "$BENCH" --port $PORT "$@"
+    kill $PID
+    wait $PID 2> /dev/null
+done
@@ -0,0 +1,259 @@
+/**
+ * Throughput of the deciphering of secured APDUs, one by one and by batch, in MB/s
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "csm_security.h"
+#include "os_util.h"
+#include "gcm.h"
+
+/*
+ * Compares, on APDUs ciphered and authenticated (SC = 0x30):
+ *   - single: csm_sec_auth_decrypt() for each APDU, the GCM of a packet after the other;
+ *   - batch: csm_sec_auth_decrypt_batch(), the HAL interleaves the GCM of 8 packets.
+ * The key is expanded once, as with the keyring of the HAL of the meter.
+ *
+ *   ./gcmbench [MB per run]
+ */
+
+#define BENCH_APDUS     256U
+#define BENCH_MAX_APDU  500U
+#define BENCH_HEADROOM  16U
+#define BENCH_BUF_SIZE  (BENCH_HEADROOM + CSM_DEF_SEC_HDR_SIZE + BENCH_MAX_APDU + 12U)
+
+static uint8_t key_guek[16] = { 0x00U,0x01U,0x02U,0x03U,0x04U,0x05U,0x06U,0x07U,0x08U,0x09U,0x0AU,0x0BU,0x0CU,0x0DU,0x0EU,0x0FU };
+static uint8_t key_gak[16] = { 0xD0U,0xD1U,0xD2U,0xD3U,0xD4U,0xD5U,0xD6U,0xD7U,0xD8U,0xD9U,0xDAU,0xDBU,0xDCU,0xDDU,0xDEU,0xDFU };
+static const uint8_t title[CSM_DEF_APP_TITLE_SIZE] = { 0x4DU, 0x4DU, 0x4DU, 0x00U, 0x00U, 0xBCU, 0x61U, 0x4EU };
+
+// Minimal HAL: one context keyed with the GUEK
+static mbedtls_gcm_context gcm_ctx;
+
+uint8_t *csm_sys_get_key(uint8_t sap, csm_sec_key key_id)
+{
+    (void) sap;
+    return (key_id == CSM_SEC_GAK) ? key_gak : key_guek;
+}
+
+int csm_sys_gcm_init(int32_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
+{
+    (void) channel_id;
+    (void) sap;
+    (void) key_id;
+    int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
+    return (mbedtls_gcm_starts(&gcm_ctx, mbed_mode, iv, 12, aad, aad_len) == 0) ? TRUE : FALSE;
+}
+
+int csm_sys_gcm_update(int32_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
+{
+    (void) channel_id;
+    return (mbedtls_gcm_update(&gcm_ctx, plain_len, plain, crypt) == 0) ? TRUE : FALSE;
+}
+
+int csm_sys_gcm_finish(int32_t channel_id, uint8_t *tag)
+{
+    (void) channel_id;
+    return (mbedtls_gcm_finish(&gcm_ctx, tag, 16) == 0) ? TRUE : FALSE;
+}
+
+int csm_sys_gcm_batch(csm_sec_key key_id, csm_sec_mode mode, csm_sys_gcm_job *jobs, uint32_t nb_jobs)
+{
+    (void) key_id;
+    int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
+    mbedtls_gcm_job gcm_jobs[MBEDTLS_GCM_BATCH_LANES];
+    int valid = TRUE;
+
+    for (uint32_t first = 0U; first < nb_jobs; first += MBEDTLS_GCM_BATCH_LANES)
+    {
+        uint32_t nb = ((nb_jobs - first) < MBEDTLS_GCM_BATCH_LANES) ? (nb_jobs - first) : MBEDTLS_GCM_BATCH_LANES;
+
+        for (uint32_t i = 0U; i < nb; i++)
+        {
+            csm_sys_gcm_job *job = &jobs[first + i];
+            gcm_jobs[i].ctx = &gcm_ctx;
+            gcm_jobs[i].iv = job->iv;
+            gcm_jobs[i].add = job->aad;
+            gcm_jobs[i].add_len = job->aad_len;
+            gcm_jobs[i].input = job->data;
+            gcm_jobs[i].output = job->data;
+            gcm_jobs[i].length = job->data_len;
+        }
+
+        valid = valid && (mbedtls_gcm_crypt_and_tag_batch(mbed_mode, gcm_jobs, nb) == 0);
+
+        for (uint32_t i = 0U; i < nb; i++)
+        {
+            memcpy(jobs[first + i].tag, gcm_jobs[i].tag, 16U);
+        }
+    }
+
+    return valid;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+static uint8_t packets[BENCH_APDUS][BENCH_BUF_SIZE];   // ciphered APDUs, never modified
+static uint8_t work[BENCH_APDUS][BENCH_BUF_SIZE];      // deciphered in place
+static uint8_t plain[BENCH_APDUS][BENCH_MAX_APDU];
+static uint32_t sizes[BENCH_APDUS];
+static uint32_t packet_sizes[BENCH_APDUS];
+
+static csm_array arrays[BENCH_APDUS];
+static csm_array *array_ptrs[BENCH_APDUS];
+static csm_request requests[BENCH_APDUS];
+static csm_request *request_ptrs[BENCH_APDUS];
+static const uint8_t *titles[BENCH_APDUS];
+static csm_sec_result results[BENCH_APDUS];
+
+// SC || IC || ciphered information || T
+static void build_packet(uint32_t index, uint32_t size)
+{
+    uint8_t *buf = packets[index];
+    uint8_t iv[12];
+    uint8_t aad[17];
+    uint8_t tag[16];
+    uint32_t ic = 1U + index;
+
+    buf[BENCH_HEADROOM] = 0x30U;
+    PUT_BE32(&buf[BENCH_HEADROOM + 1U], ic);
+    memcpy(iv, title, CSM_DEF_APP_TITLE_SIZE);
+    PUT_BE32(&iv[CSM_DEF_APP_TITLE_SIZE], ic);
+    aad[0] = 0x30U;
+    memcpy(&aad[1], key_gak, 16U);
+
+    for (uint32_t i = 0U; i < size; i++)
+    {
+        plain[index][i] = (uint8_t)rand();
+    }
+
+    uint8_t *data = &buf[BENCH_HEADROOM + CSM_DEF_SEC_HDR_SIZE];
+    mbedtls_gcm_crypt_and_tag(&gcm_ctx, MBEDTLS_GCM_ENCRYPT, size, iv, 12, aad, sizeof(aad), plain[index], data, 16, tag);
+    memcpy(&data[size], tag, 12U);
+
+    sizes[index] = size;
+    packet_sizes[index] = CSM_DEF_SEC_HDR_SIZE + size + 12U;
+}
+
+static void restore_packets(void)
+{
+    for (uint32_t i = 0U; i < BENCH_APDUS; i++)
+    {
+        memcpy(work[i], packets[i], BENCH_BUF_SIZE);
+        csm_array_init(&arrays[i], work[i], BENCH_BUF_SIZE, packet_sizes[i], BENCH_HEADROOM);
+    }
+}
+
+static void check_packets(void)
+{
+    for (uint32_t i = 0U; i < BENCH_APDUS; i++)
+    {
+        if ((results[i] != CSM_SEC_OK) ||
+            (memcmp(&work[i][BENCH_HEADROOM + CSM_DEF_SEC_HDR_SIZE], plain[i], sizes[i]) != 0))
+        {
+            printf("Bad deciphering of APDU %u\r\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Seconds spent deciphering, the copy of the packets is not counted
+static double run(int batch, uint32_t runs)
+{
+    double elapsed = 0.0;
+
+    for (uint32_t r = 0U; r < runs; r++)
+    {
+        restore_packets();
+        double start = now();
+
+        if (batch)
+        {
+            csm_sec_auth_decrypt_batch(array_ptrs, request_ptrs, titles, results, BENCH_APDUS);
+        }
+        else
+        {
+            for (uint32_t i = 0U; i < BENCH_APDUS; i++)
+            {
+                results[i] = csm_sec_auth_decrypt(&arrays[i], &requests[i], title);
+            }
+        }
+
+        elapsed += now() - start;
+    }
+
+    check_packets();
+    return elapsed;
+}
+
+int main(int argc, const char * argv[])
+{
+    uint32_t megabytes = (argc > 1) ? (uint32_t)atoi(argv[1]) : 64U;
+
+    mbedtls_gcm_init(&gcm_ctx);
+    mbedtls_gcm_setkey(&gcm_ctx, MBEDTLS_CIPHER_ID_AES, key_guek, 128);
+
+    for (uint32_t i = 0U; i < BENCH_APDUS; i++)
+    {
+        memset(&requests[i], 0, sizeof(csm_request));
+        requests[i].llc.dsap = 1U;
+        array_ptrs[i] = &arrays[i];
+        request_ptrs[i] = &requests[i];
+        titles[i] = title;
+    }
+
+    // Mixed sizes, then fixed ones
+    static const uint32_t fixed[] = { 0U, 50U, 128U, 256U, 500U };
+
+    printf("Deciphering of %u APDUs (E + A), %u MB per run\r\n", BENCH_APDUS, megabytes);
+    printf("%10s %14s %14s %8s\r\n", "APDU", "single MB/s", "batch MB/s", "ratio");
+
+    for (uint32_t f = 0U; f < (sizeof(fixed) / sizeof(fixed[0])); f++)
+    {
+        uint32_t total = 0U;
+        srand(1);
+        for (uint32_t i = 0U; i < BENCH_APDUS; i++)
+        {
+            uint32_t size = (fixed[f] == 0U) ? (50U + ((uint32_t)rand() % 451U)) : fixed[f];
+            build_packet(i, size);
+            total += size;
+        }
+
+        uint32_t runs = (megabytes * 1000000U) / total;
+        if (runs == 0U)
+        {
+            runs = 1U;
+        }
+
+        double single_rate = ((double)total * runs) / run(FALSE, runs) / 1e6;
+        double batch_rate = ((double)total * runs) / run(TRUE, runs) / 1e6;
+
+        char label[16];
+        if (fixed[f] == 0U)
+        {
+            snprintf(label, sizeof(label), "50-500");
+        }
+        else
+        {
+            snprintf(label, sizeof(label), "%u", fixed[f]);
+        }
+        printf("%10s %14.1f %14.1f %7.2fx\r\n", label, single_rate, batch_rate, batch_rate / single_rate);
+    }
+
+    mbedtls_gcm_free(&gcm_ctx);
+    return EXIT_SUCCESS;
+}
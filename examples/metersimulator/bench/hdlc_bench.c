@@ -0,0 +1,232 @@
+/**
+ * Throughput of the HDLC reception on a byte stream, in MB/s
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hdlc.h"
+
+/*
+ * Compares, for several sizes of reads:
+ *   - bytewise: the former reception of the serial line, the frames searched in an
+ *     accumulation buffer (hdlc_frame_size) then their HCS/FCS computed byte by byte;
+ *   - deframer: hdlc_deframer_push(), one copy and the slicing-by-8 FCS on the way.
+ *
+ *   ./hdlcbench [information field size] [MB per run]
+ */
+
+#define BENCH_FRAMES    64U
+#define BENCH_RX_SIZE   4096U
+
+static uint16_t bytewise_tab[256];
+
+static void bytewise_init(void)
+{
+    for (uint32_t b = 0U; b < 256U; b++)
+    {
+        uint16_t fcs = (uint16_t)b;
+        for (uint32_t bit = 0U; bit < 8U; bit++)
+        {
+            fcs = (fcs & 1U) ? ((fcs >> 1U) ^ 0x8408U) : (fcs >> 1U);
+        }
+        bytewise_tab[b] = fcs;
+    }
+}
+
+static uint16_t bytewise_fcs16(uint16_t fcs, const uint8_t *cp, uint32_t len)
+{
+    while (len--)
+    {
+        fcs = (fcs >> 8) ^ bytewise_tab[(fcs ^ *cp++) & 0xff];
+    }
+    return fcs;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+static uint8_t rx_buffer[BENCH_RX_SIZE];
+static uint8_t frame_buffer[BENCH_RX_SIZE];
+static uint32_t frames_ok;
+
+// Former serial line reception: accumulation, frame search, HCS and FCS byte by byte
+static void run_bytewise(const uint8_t *stream, uint32_t size, uint32_t chunk)
+{
+    uint32_t used = 0U;
+
+    for (uint32_t index = 0U; index < size; index += chunk)
+    {
+        uint32_t n = ((size - index) < chunk) ? (size - index) : chunk;
+        memcpy(&rx_buffer[used], &stream[index], n);
+        used += n;
+
+        uint32_t start = 0U;
+        while (start < used)
+        {
+            int frame = hdlc_frame_size(&rx_buffer[start], used - start);
+            if (frame < 0)
+            {
+                start++;
+            }
+            else if ((frame == 0) || ((uint32_t)frame > (used - start)))
+            {
+                break;
+            }
+            else
+            {
+                // HCS after the client address, the 4 bytes server address and the control field
+                const uint8_t *f = &rx_buffer[start];
+                if ((bytewise_fcs16(PPPINITFCS16, &f[1], 10U) == PPPGOODFCS16) &&
+                    (bytewise_fcs16(PPPINITFCS16, &f[1], (uint32_t)frame - 2U) == PPPGOODFCS16))
+                {
+                    frames_ok++;
+                }
+                start += (uint32_t)frame;
+            }
+        }
+        memmove(rx_buffer, &rx_buffer[start], used - start);
+        used -= start;
+    }
+}
+
+static void run_deframer(const uint8_t *stream, uint32_t size, uint32_t chunk)
+{
+    static hdlc_deframer def;
+    hdlc_deframer_init(&def, frame_buffer, sizeof(frame_buffer));
+
+    for (uint32_t index = 0U; index < size; index += chunk)
+    {
+        uint32_t n = ((size - index) < chunk) ? (size - index) : chunk;
+        const uint8_t *data = &stream[index];
+
+        while (n > 0U)
+        {
+            uint32_t used = 0U;
+            if (hdlc_deframer_push(&def, data, n, &used) > 0)
+            {
+                frames_ok++;
+            }
+            data += used;
+            n -= used;
+        }
+    }
+}
+
+typedef void (*bench_func)(const uint8_t *stream, uint32_t size, uint32_t chunk);
+
+static double measure(bench_func func, const uint8_t *stream, uint32_t size, uint32_t chunk, uint32_t runs, uint32_t nb_frames)
+{
+    frames_ok = 0U;
+    double start = now();
+    for (uint32_t i = 0U; i < runs; i++)
+    {
+        func(stream, size, chunk);
+    }
+    double elapsed = now() - start;
+
+    if (frames_ok != (runs * nb_frames))
+    {
+        printf("Frames lost: %u/%u\r\n", frames_ok, runs * nb_frames);
+        exit(EXIT_FAILURE);
+    }
+    return ((double)size * runs) / elapsed / 1e6;
+}
+
+int main(int argc, const char * argv[])
+{
+    uint32_t info_size = (argc > 1) ? (uint32_t)atoi(argv[1]) : HDLC_MAX_INFO_SIZE;
+    uint32_t megabytes = (argc > 2) ? (uint32_t)atoi(argv[2]) : 64U;
+
+    if ((info_size == 0U) || (info_size > HDLC_MAX_INFO_SIZE))
+    {
+        printf("Information field from 1 to %u bytes\r\n", HDLC_MAX_INFO_SIZE);
+        return EXIT_FAILURE;
+    }
+
+    bytewise_init();
+
+    // I frames of a server with a 4 bytes address
+    uint32_t frame_size = info_size + HDLC_FRAME_OVERHEAD;
+    uint8_t *stream = (uint8_t *)malloc(BENCH_FRAMES * frame_size);
+    uint8_t *info = (uint8_t *)malloc(info_size);
+    uint32_t size = 0U;
+
+    for (uint32_t i = 0U; i < info_size; i++)
+    {
+        info[i] = (uint8_t)rand();
+    }
+
+    hdlc_t hdlc;
+    hdlc_init(&hdlc);
+    hdlc.sender = HDLC_SERVER;
+    hdlc.client_addr = 1U;
+    hdlc.logical_device = 1U;
+    hdlc.phy_address = 17U;
+    hdlc.max_info_field_tx = (uint16_t)info_size;
+
+    for (uint32_t i = 0U; i < BENCH_FRAMES; i++)
+    {
+        hdlc.sss = (uint8_t)(i & 7U);
+        int ret = hdlc_encode(&hdlc, &stream[size], (uint16_t)frame_size, HDLC_PACKET_TYPE_I, info, (uint16_t)info_size);
+        if (ret <= 0)
+        {
+            printf("Encoding error\r\n");
+            return EXIT_FAILURE;
+        }
+        size += (uint32_t)ret;
+    }
+
+    uint32_t runs = (megabytes * 1000000U) / size;
+    if (runs == 0U)
+    {
+        runs = 1U;
+    }
+
+    static const uint32_t chunks[] = { 1U, 16U, 256U, 4096U };
+
+    printf("HDLC reception, %u frames of %u bytes, %u MB per run\r\n", BENCH_FRAMES, frame_size, megabytes);
+    printf("%8s %14s %14s %8s\r\n", "read", "bytewise MB/s", "deframer MB/s", "ratio");
+
+    for (uint32_t c = 0U; c < (sizeof(chunks) / sizeof(chunks[0])); c++)
+    {
+        double old_rate = measure(run_bytewise, stream, size, chunks[c], runs, BENCH_FRAMES);
+        double new_rate = measure(run_deframer, stream, size, chunks[c], runs, BENCH_FRAMES);
+        printf("%8u %14.1f %14.1f %7.2fx\r\n", chunks[c], old_rate, new_rate, new_rate / old_rate);
+    }
+
+    // The frame check sequence alone
+    double start = now();
+    uint16_t fcs = 0U;
+    for (uint32_t i = 0U; i < runs; i++)
+    {
+        fcs ^= bytewise_fcs16(PPPINITFCS16, stream, size);
+    }
+    double old_rate = ((double)size * runs) / (now() - start) / 1e6;
+
+    start = now();
+    for (uint32_t i = 0U; i < runs; i++)
+    {
+        fcs ^= pppfcs16(PPPINITFCS16, stream, size);
+    }
+    double new_rate = ((double)size * runs) / (now() - start) / 1e6;
+
+    printf("%8s %14.1f %14.1f %7.2fx (FCS only, 0x%04X)\r\n", "-", old_rate, new_rate, new_rate / old_rate, fcs);
+
+    free(info);
+    free(stream);
+    return EXIT_SUCCESS;
+}
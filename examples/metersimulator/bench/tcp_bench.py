@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""
+Load generator for the TCP server: many idle connections, some active ones
+
+The active connections send a wrapper PDU and wait for the reply (ping-pong),
+the idle ones are only kept open. Run against tcp_bench_server (echo) or the
+meter simulator. The file descriptor limit must be raised for big runs:
+
+    ulimit -n 16384
+    ./tcpbench 4064 [event loops] &
+    python3 tcp_bench.py --port 4064 --idle 10000 --active 1000 --duration 10 [--processes 4]
+"""
+
+import argparse
+import multiprocessing
+import selectors
+import socket
+import struct
+import time
+
+# GET.request of the clock time (0.0.1.0.0.255 attribute 2) in a wrapper PDU, public client
+APDU = bytes.fromhex("C001C100080000010000FF0200")
+REQUEST = struct.pack(">HHHH", 1, 16, 1, len(APDU)) + APDU
+
+
+def connect_all(host, port, count):
+    socks = []
+    for _ in range(count):
+        s = socket.create_connection((host, port))
+        s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        socks.append(s)
+    return socks
+
+
+def run(args, idle_count, active_count):
+    t0 = time.monotonic()
+    idle = connect_all(args.host, args.port, idle_count)
+    active = connect_all(args.host, args.port, active_count)
+    connect_time = time.monotonic() - t0
+
+    sel = selectors.DefaultSelector()
+    sent_at = {}
+    for s in active:
+        s.setblocking(False)
+        sel.register(s, selectors.EVENT_READ)
+        s.send(REQUEST)
+        sent_at[s] = time.monotonic()
+
+    latencies = []
+    end = time.monotonic() + args.duration
+    while time.monotonic() < end:
+        for key, _ in sel.select(timeout=1.0):
+            s = key.fileobj
+            data = s.recv(65536)
+            if not data:
+                sel.unregister(s)
+                continue
+            now = time.monotonic()
+            latencies.append(now - sent_at[s])
+            s.send(REQUEST)
+            sent_at[s] = now
+
+    for s in idle + active:
+        s.close()
+    return connect_time, latencies
+
+
+def worker(args, index, queue):
+    # The connections are spread over the processes
+    share = lambda total: total // args.processes + (1 if index < total % args.processes else 0)
+    queue.put(run(args, share(args.idle), share(args.active)))
+
+
+def main(args):
+    queue = multiprocessing.Queue()
+    workers = [multiprocessing.Process(target=worker, args=(args, i, queue)) for i in range(args.processes)]
+    for w in workers:
+        w.start()
+    results = [queue.get() for _ in workers]
+    for w in workers:
+        w.join()
+
+    latencies = sorted(l for _, lat in results for l in lat)
+    print(f"{args.idle} idle + {args.active} active connections in {max(t for t, _ in results):.2f} s")
+    if latencies:
+        p = lambda q: latencies[min(len(latencies) - 1, int(q * len(latencies)))] * 1e6
+        print(f"{len(latencies) / args.duration:.0f} req/s, latency p50 {p(0.5):.0f} us, "
+              f"p99 {p(0.99):.0f} us, max {latencies[-1] * 1e6:.0f} us")
+    else:
+        print("No reply")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=4064)
+    parser.add_argument("--idle", type=int, default=10000)
+    parser.add_argument("--active", type=int, default=1000)
+    parser.add_argument("--duration", type=float, default=10.0)
+    parser.add_argument("--processes", type=int, default=1, help="load generator processes")
+    main(parser.parse_args())
@@ -0,0 +1,83 @@
+/**
+ * Echo server used to benchmark the TCP transport, without the Cosem stack
+ *
+ * Copyright (c) 2016, Anthony Rabine
+ * All rights reserved.
+ *
+ * This software may be modified and distributed under the terms of the MIT license.
+ * See LICENSE.txt for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "tcp_server.h"
+
+// Connections served at the same time, shared by all the event loops
+#ifndef BENCH_MAX_CHANNELS
+#define BENCH_MAX_CHANNELS  16384
+#endif
+
+// Stack of the free channel ids, the loops connect and disconnect concurrently
+static int32_t free_channels[BENCH_MAX_CHANNELS];
+static int32_t nb_free = 0;
+static pthread_mutex_t channels_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void bench_init_channels(void)
+{
+    for (int32_t i = 0; i < BENCH_MAX_CHANNELS; i++)
+    {
+        free_channels[i] = BENCH_MAX_CHANNELS - 1 - i;
+    }
+    nb_free = BENCH_MAX_CHANNELS;
+}
+
+static int32_t bench_connect()
+{
+    int32_t ret = -1;
+
+    pthread_mutex_lock(&channels_lock);
+    if (nb_free > 0)
+    {
+        nb_free--;
+        ret = free_channels[nb_free];
+    }
+    pthread_mutex_unlock(&channels_lock);
+    return ret;
+}
+
+static void bench_disconnect(int32_t channel_id)
+{
+    if (channel_id >= 0)
+    {
+        pthread_mutex_lock(&channels_lock);
+        free_channels[nb_free] = channel_id;
+        nb_free++;
+        pthread_mutex_unlock(&channels_lock);
+    }
+}
+
+static int bench_echo(int32_t channel_id, uint8_t *data, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply)
+{
+    (void) channel_id;
+    (void) buffer_size;
+    return csm_chain_append(reply, data, payload_size) ? (int)payload_size : -1;
+}
+
+int main(int argc, const char * argv[])
+{
+    int port = (argc > 1) ? atoi(argv[1]) : 4064;
+    int loops = (argc > 2) ? atoi(argv[2]) : 1;
+
+    bench_init_channels();
+    tcp_server_set_channels(BENCH_MAX_CHANNELS);
+
+    printf("Starting TCP echo bench server on port %d, %d event loop(s)\r\n", port, loops);
+    if (loops > 1)
+    {
+        return tcp_server_init_sharded(bench_echo, bench_connect, bench_disconnect, NULL, port, loops);
+    }
+    return tcp_server_init_chain(bench_echo, bench_connect, bench_disconnect, port);
+}
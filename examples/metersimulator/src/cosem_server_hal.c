@@ -1,6 +1,7 @@
 // Cosem library
 #include "csm_association.h"
 #include "csm_definitions.h"
+#include "csm_ic.h"
 
 // OS/System definitions
 #include "os_util.h"
@@ -12,10 +13,12 @@
 
 // File system
 #include "fs.h"
+#include "bsp_flash.h"
 
 // Standard libraries
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 /*
 the  leading  (i.e.  the  leftmost)  64  bits  (8  octets)  shall  hold  the  fixed  field.  It  shall  contain  the
@@ -36,8 +39,34 @@ static uint8_t key_kek[16] = { 0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0
 static uint8_t key_guek[16] = { 0x00U,0x01U,0x02U,0x03U,0x04U,0x05U,0x06U,0x07U,0x08U,0x09U,0x0AU,0x0BU,0x0CU,0x0DU,0x0EU,0x0FU };
 static uint8_t key_gak[16] = { 0xD0U,0xD1U,0xD2U,0xD3U,0xD4U,0xD5U,0xD6U,0xD7U,0xD8U,0xD9U,0xDAU,0xDBU,0xDCU,0xDDU,0xDEU,0xDFU };
 
-// Keep a context by channel to be thread safe
-mbedtls_gcm_context chan_ctx[METER_NUMBER_OF_ASSOCIATIONS];
+// Keyring of the expanded keys (AES round keys and GHASH tables), per SAP and key id
+#ifndef METER_KEYRING_SIZE
+#define METER_KEYRING_SIZE  4U
+#endif
+
+typedef struct
+{
+    mbedtls_gcm_context ctx;    //!< Keyed once, restarted with the IV and AAD of each APDU
+    uint8_t key[16];            //!< Key expanded in ctx, a different key invalidates the entry
+    uint8_t sap;
+    uint8_t key_id;
+    uint8_t valid;
+    uint8_t pinned;             //!< Used by a job of the batch under processing, not replaced
+} keyring_entry;
+
+// One keyring per channel: the channels of each thread are disjoint, no lock is needed
+typedef struct
+{
+    keyring_entry entries[METER_KEYRING_SIZE];  // zeroed: initialized contexts (mbedtls_gcm_init)
+    keyring_entry *current;                     //!< Entry of the APDU under ciphering
+    uint8_t next;                               //!< Entry replaced by the next key
+} keyring;
+
+static keyring chan_keyring[METER_NUMBER_OF_CHANNELS];
+
+// Dedicated keys given by the clients in the InitiateRequest, one per association open
+static uint8_t chan_dek[METER_NUMBER_OF_CHANNELS][CSM_DEF_DEDICATED_KEY_SIZE];
+static uint8_t chan_has_dek[METER_NUMBER_OF_CHANNELS];
 
 void csm_sys_set_system_title(const uint8_t *buf)
 {
@@ -45,24 +74,226 @@ void csm_sys_set_system_title(const uint8_t *buf)
 }
 
 
-typedef enum
+// The invocation counters are shared by the event loop threads
+static pthread_mutex_t ic_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int csm_sys_get_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *value)
+{
+    pthread_mutex_lock(&ic_lock);
+    int valid = csm_ic_next(sap, key_id, ic, value);
+    pthread_mutex_unlock(&ic_lock);
+    return valid;
+}
+
+int csm_sys_check_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t value)
 {
-    CSM_SEC_IC_CLIENT,
-    CSM_SEC_IC_SERVER,
-} csm_sec_ic;
+    pthread_mutex_lock(&ic_lock);
+    int valid = csm_ic_check(sap, key_id, ic, value);
+    pthread_mutex_unlock(&ic_lock);
+    return valid;
+}
+
+/*
+The windows of the invocation counters are logged in two flash blocks, used in turn. The first
+record of a block is its header: the active block is the one with the greatest sequence number.
+A record is appended for each window, the last record of a counter is the valid one. When the
+active block is full, the last record of each counter is copied into the other block and its
+header is written last: a reset before resumes from the previous block.
+Each record is written through to the file of the simulated flash.
+*/
+#ifndef METER_IC_FLASH_BLOCK
+#define METER_IC_FLASH_BLOCK    0U      // and the next one
+#endif
 
+typedef struct
+{
+    uint8_t sap;        //!< 0xFF: erased, end of the log
+    uint8_t key_id;
+    uint8_t ic;
+    uint8_t reserved;
+    uint32_t limit;     //!< Sequence number of the block in the header
+} ic_record;
 
-// FIXME: create one pair IC per SAP
-static uint32_t gIc = 0x01234567U;
+#define IC_RECORDS_PER_BLOCK    (FS_BLOCK_SIZE / sizeof(ic_record))
+#define IC_ERASED               0xFFU
+#define IC_HEADER               0xFEU
 
-uint32_t csm_sys_get_ic(uint8_t sap, csm_sec_ic ic)
+typedef struct
 {
-    (void) sap;
-    (void) ic;
+    uint32_t block;     //!< Active block
+    uint32_t sequence;
+    uint32_t free;      //!< First free record of the active block, 0 if there is no active block
+    uint8_t open;
+} ic_log;
+
+static ic_log gIcLog;
+
+static int ic_match(const ic_record *record, uint8_t sap, csm_sec_key key_id, csm_sec_ic ic)
+{
+    return (record->sap == sap) && (record->key_id == key_id) && (record->ic == ic);
+}
+
+static void ic_read(uint32_t block, uint32_t index, ic_record *record)
+{
+    bsp_flash_read(record, block, index * sizeof(ic_record), sizeof(ic_record));
+}
+
+// Finds the active block and its end, once
+static void ic_log_open(void)
+{
+    ic_record record;
+
+    if (!gIcLog.open)
+    {
+        bsp_flash_initialize();
+        gIcLog.block = METER_IC_FLASH_BLOCK;
+        gIcLog.sequence = 0U;
+        gIcLog.free = 0U;
+
+        for (uint32_t i = 0U; i < 2U; i++)
+        {
+            ic_read(METER_IC_FLASH_BLOCK + i, 0U, &record);
+
+            if ((record.sap == IC_HEADER) && ((gIcLog.free == 0U) || (record.limit > gIcLog.sequence)))
+            {
+                gIcLog.block = METER_IC_FLASH_BLOCK + i;
+                gIcLog.sequence = record.limit;
+                gIcLog.free = 1U;
+            }
+        }
+
+        while ((gIcLog.free > 0U) && (gIcLog.free < IC_RECORDS_PER_BLOCK))
+        {
+            ic_read(gIcLog.block, gIcLog.free, &record);
+
+            if (record.sap == IC_ERASED)
+            {
+                break;
+            }
+            gIcLog.free++;
+        }
+
+        gIcLog.open = TRUE;
+    }
+}
+
+// Copies the last record of each counter into the other block, which becomes the active one
+static int ic_log_switch(void)
+{
+    ic_record records[CSM_IC_MAX_COUNTERS];
+    ic_record record;
+    uint32_t nb = 0U;
+    int valid = TRUE;
+    uint32_t target = METER_IC_FLASH_BLOCK;
+
+    if ((gIcLog.free > 0U) && (gIcLog.block == METER_IC_FLASH_BLOCK))
+    {
+        target = METER_IC_FLASH_BLOCK + 1U;
+    }
+
+    for (uint32_t i = 1U; valid && (i < gIcLog.free); i++)
+    {
+        ic_read(gIcLog.block, i, &record);
+        uint32_t j = 0U;
+
+        while ((j < nb) && !ic_match(&records[j], record.sap, (csm_sec_key)record.key_id, (csm_sec_ic)record.ic))
+        {
+            j++;
+        }
+
+        if (j < CSM_IC_MAX_COUNTERS)
+        {
+            records[j] = record;
+            nb = (j == nb) ? (nb + 1U) : nb;
+        }
+        else
+        {
+            valid = FALSE; // More counters than the RAM can hold
+        }
+    }
+
+    if (valid)
+    {
+        bsp_flash_erase(target);
+
+        for (uint32_t i = 0U; i < nb; i++)
+        {
+            bsp_flash_write(&records[i], target, (i + 1U) * sizeof(ic_record), sizeof(ic_record));
+        }
+
+        record.sap = IC_HEADER;
+        record.key_id = IC_ERASED;
+        record.ic = IC_ERASED;
+        record.reserved = IC_ERASED;
+        record.limit = gIcLog.sequence + 1U;
+
+        valid = bsp_flash_write(&record, target, 0U, sizeof(ic_record));
+        valid = valid && bsp_flash_sync(target);
+    }
+
+    if (valid)
+    {
+        gIcLog.block = target;
+        gIcLog.sequence++;
+        gIcLog.free = nb + 1U;
+    }
+    else
+    {
+        CSM_ERR("[IC] Cannot compact the log of the invocation counters");
+    }
+
+    return valid;
+}
+
+int csm_sys_load_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *limit)
+{
+    ic_record record;
+    int found = FALSE;
+
+    ic_log_open();
+
+    for (uint32_t i = 1U; i < gIcLog.free; i++)
+    {
+        ic_read(gIcLog.block, i, &record);
+
+        if (ic_match(&record, sap, key_id, ic))
+        {
+            *limit = record.limit;
+            found = TRUE;
+        }
+    }
+
+    return found;
+}
+
+int csm_sys_store_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t limit)
+{
+    ic_record record;
+    int valid = TRUE;
+
+    ic_log_open();
+
+    if ((gIcLog.free == 0U) || (gIcLog.free == IC_RECORDS_PER_BLOCK))
+    {
+        valid = ic_log_switch();
+    }
+
+    record.sap = sap;
+    record.key_id = key_id;
+    record.ic = ic;
+    record.reserved = IC_ERASED;
+    record.limit = limit;
+
+    // Used once written in the file: a restart never resumes before
+    valid = valid && bsp_flash_write(&record, gIcLog.block, gIcLog.free * sizeof(ic_record), sizeof(ic_record));
+    valid = valid && bsp_flash_sync(gIcLog.block);
+
+    if (valid)
+    {
+        gIcLog.free++;
+    }
 
-    uint32_t value = gIc;
-    gIc++;
-    return value;
+    return valid;
 }
 
 const uint8_t *csm_sys_get_system_title()
@@ -84,39 +315,171 @@ uint8_t *csm_sys_get_key(uint8_t sap, csm_sec_key key_id)
     case CSM_SEC_GUEK:
         key = key_guek;
         break;
-//    case CSM_SEC_GBEK:
-//        key = key_gbek;
-//        break;
-    default:
     case CSM_SEC_GAK:
         key = key_gak;
         break;
+    case CSM_SEC_DEK:   // Per channel, see keyring_get()
+    case CSM_SEC_GBEK:  // No broadcast key
+    default:
+        break;
     }
 
     return key;
 }
 
+void csm_sys_set_dedicated_key(int32_t channel_id, const uint8_t *key)
+{
+    if ((channel_id > CSM_CHANNEL_INVALID_ID) && (channel_id < (int32_t)METER_NUMBER_OF_CHANNELS))
+    {
+        chan_has_dek[channel_id] = (key != NULL) ? TRUE : FALSE;
+        if (key != NULL)
+        {
+            memcpy(chan_dek[channel_id], key, CSM_DEF_DEDICATED_KEY_SIZE);
+        }
+    }
+}
 
-int csm_sys_gcm_init(int8_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
+
+static keyring_entry *keyring_get(int32_t channel_id, uint8_t sap, csm_sec_key key_id)
+{
+    keyring *ring = &chan_keyring[channel_id];
+    const uint8_t *key = csm_sys_get_key(sap, key_id);
+    keyring_entry *entry = NULL;
+
+    if (key_id == CSM_SEC_DEK)
+    {
+        key = chan_has_dek[channel_id] ? chan_dek[channel_id] : NULL;
+    }
+
+    for (uint32_t i = 0U; i < METER_KEYRING_SIZE; i++)
+    {
+        if (ring->entries[i].valid && (ring->entries[i].sap == sap) && (ring->entries[i].key_id == key_id))
+        {
+            entry = &ring->entries[i];
+            break;
+        }
+    }
+
+    // NULL when all the entries are pinned by a batch
+    for (uint32_t i = 0U; (entry == NULL) && (i < METER_KEYRING_SIZE); i++)
+    {
+        keyring_entry *victim = &ring->entries[ring->next];
+        ring->next = (ring->next + 1U) % METER_KEYRING_SIZE;
+
+        if (!victim->pinned)
+        {
+            entry = victim;
+            entry->valid = FALSE;
+            entry->sap = sap;
+            entry->key_id = key_id;
+        }
+    }
+
+    // The key is expanded again only when it has changed
+    if ((entry != NULL) && (key != NULL) && (!entry->valid || (memcmp(entry->key, key, sizeof(entry->key)) != 0)))
+    {
+        entry->valid = (mbedtls_gcm_setkey(&entry->ctx, MBEDTLS_CIPHER_ID_AES, key, 128) == 0) ? TRUE : FALSE;
+        memcpy(entry->key, key, sizeof(entry->key));
+    }
+
+    // No key (a dedicated key not given): the entry is not used
+    return ((entry != NULL) && (key != NULL) && entry->valid) ? entry : NULL;
+}
+
+int csm_sys_gcm_init(int32_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
 {
     int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
-    mbedtls_gcm_init(&chan_ctx[channel_id]);
-    mbedtls_gcm_setkey(&chan_ctx[channel_id], MBEDTLS_CIPHER_ID_AES, csm_sys_get_key(sap, key_id), 128);
-    int res = mbedtls_gcm_starts(&chan_ctx[channel_id], mbed_mode, iv, 12, aad, aad_len);
+    keyring_entry *entry = keyring_get(channel_id, sap, key_id);
+    chan_keyring[channel_id].current = entry;
+
+    int res = (entry != NULL) ? mbedtls_gcm_starts(&entry->ctx, mbed_mode, iv, 12, aad, aad_len) : -1;
     return (res == 0) ? TRUE : FALSE;
 }
 
-int csm_sys_gcm_update(int8_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
+int csm_sys_gcm_update(int32_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
 {
-    mbedtls_gcm_update(&chan_ctx[channel_id], plain_len, plain, crypt);
-    return TRUE;
+    keyring_entry *entry = chan_keyring[channel_id].current;
+    int res = (entry != NULL) ? mbedtls_gcm_update(&entry->ctx, plain_len, plain, crypt) : -1;
+    return (res == 0) ? TRUE : FALSE;
 }
 
 // Sizes are total sizes of plain and AAD
-int csm_sys_gcm_finish(int8_t channel_id, uint8_t *tag)
+int csm_sys_gcm_finish(int32_t channel_id, uint8_t *tag)
+{
+    keyring_entry *entry = chan_keyring[channel_id].current;
+    int res = (entry != NULL) ? mbedtls_gcm_finish(&entry->ctx, tag, 16) : -1;
+    return (res == 0) ? TRUE : FALSE;
+}
+
+// Runs a group of jobs, the keyring entries are released
+static int gcm_batch_flush(int mbed_mode, mbedtls_gcm_job *gcm_jobs, csm_sys_gcm_job **jobs, keyring_entry **entries, uint32_t nb)
+{
+    int res = mbedtls_gcm_crypt_and_tag_batch(mbed_mode, gcm_jobs, nb);
+
+    for (uint32_t i = 0U; i < nb; i++)
+    {
+        entries[i]->pinned = FALSE;
+        memcpy(jobs[i]->tag, gcm_jobs[i].tag, sizeof(jobs[i]->tag));
+    }
+
+    return (res == 0) ? TRUE : FALSE;
+}
+
+/**
+ * The jobs are given to mbedtls by groups of MBEDTLS_GCM_BATCH_LANES. The keyring entries of a
+ * group stay pinned until it is processed; if a channel has no entry left, the group is run first.
+ */
+int csm_sys_gcm_batch(csm_sec_key key_id, csm_sec_mode mode, csm_sys_gcm_job *jobs, uint32_t nb_jobs)
 {
-    mbedtls_gcm_finish(&chan_ctx[channel_id], tag, 16);
-    return TRUE;
+    int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
+    mbedtls_gcm_job gcm_jobs[MBEDTLS_GCM_BATCH_LANES];
+    csm_sys_gcm_job *group[MBEDTLS_GCM_BATCH_LANES];
+    keyring_entry *entries[MBEDTLS_GCM_BATCH_LANES];
+    uint32_t nb = 0U;
+    int valid = TRUE;
+
+    for (uint32_t i = 0U; (i < nb_jobs) && valid; i++)
+    {
+        csm_sys_gcm_job *job = &jobs[i];
+        keyring_entry *entry = keyring_get(job->channel_id, job->sap, key_id);
+
+        if ((entry == NULL) && (nb > 0U))
+        {
+            valid = gcm_batch_flush(mbed_mode, gcm_jobs, group, entries, nb);
+            nb = 0U;
+            entry = keyring_get(job->channel_id, job->sap, key_id);
+        }
+
+        valid = valid && (entry != NULL);
+
+        if (valid)
+        {
+            entry->pinned = TRUE;
+            entries[nb] = entry;
+            group[nb] = job;
+            gcm_jobs[nb].ctx = &entry->ctx;
+            gcm_jobs[nb].iv = job->iv;
+            gcm_jobs[nb].add = job->aad;
+            gcm_jobs[nb].add_len = job->aad_len;
+            gcm_jobs[nb].input = job->data;
+            gcm_jobs[nb].output = job->data;
+            gcm_jobs[nb].length = job->data_len;
+            nb++;
+
+            if (nb == MBEDTLS_GCM_BATCH_LANES)
+            {
+                valid = gcm_batch_flush(mbed_mode, gcm_jobs, group, entries, nb);
+                nb = 0U;
+            }
+        }
+    }
+
+    if (nb > 0U)
+    {
+        valid = gcm_batch_flush(mbed_mode, gcm_jobs, group, entries, nb) && valid;
+    }
+
+    return valid;
 }
 
 static const uint8_t default_password[CSM_DEF_LLS_MAX_SIZE] = { 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U };
@@ -37,6 +37,10 @@ const db_attr_descr logical_device_name[] = {
 { DB_ACCESS_GET, 2 }
 };
 
+const db_attr_descr operating_time_attributes[] = {
+{ DB_ACCESS_GET, 2 },
+};
+
 const db_object_descr clock_objects[] = {
     {&clock_attributes[0], NULL, 8U , { 0U, 0U, 1U, 0U, 0U, 255U } , 0U , 8U, 0U },
 };
@@ -46,10 +50,15 @@ const db_object_descr associations_objects[] = {
     {&logical_device_name[0], NULL, 1U , { 0U, 0U, 42U, 0U, 0U, 255U } , 0U , 1U, 0U },
 };
 
+const db_object_descr deferred_objects[] = {
+    {&operating_time_attributes[0], NULL, 1U , { 0U, 0U, 96U, 8U, 0U, 255U } , 0U , 1U, 0U },
+};
+
 
 const struct db_element gDataBaseList[] = {
     { &clock_objects[0], db_cosem_clock_func, sizeof(clock_objects) / sizeof(clock_objects[0]) },
     { &associations_objects[0], db_cosem_associations_func, sizeof(associations_objects) / sizeof(associations_objects[0]) },
+    { &deferred_objects[0], meter_deferred_func, sizeof(deferred_objects) / sizeof(deferred_objects[0]) },
 };
 
 
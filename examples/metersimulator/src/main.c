@@ -1,18 +1,71 @@
 
 #include "meter.h"
 #include "tcp_server.h"
+#include "udp_server.h"
+#include "pty_server.h"
+#include "hdlc.h"
+#include "csm_llc.h"
 #include "server_config.h"
+#include "meter_definitions.h"
 
 int main(int argc, const char * argv[])
 {
-    (void) argc;
-    (void) argv;
+    // Wrapper over TCP by default, first argument:
+    //   "udp": wrapper over UDP
+    //   "hdlc": HDLC frames over TCP
+    //   "pty": HDLC frames over a pseudo terminal, as a serial line
+    const char *link = (argc > 1) ? argv[1] : "";
+    int use_udp = (strcmp(link, "udp") == 0);
+    int use_hdlc = (strcmp(link, "hdlc") == 0);
+    int use_pty = (strcmp(link, "pty") == 0);
 
     meter_initialize();
     
     printf("Starting DLMS/Cosem meter simulator\r\nCosem library version: %s\r\n\r\n", CSM_DEF_LIB_VERSION);
 
-    int ret = tcp_server_init(meter_tcp_data_handler, meter_connect, meter_disconnect, TCP_PORT);
+    if (use_udp)
+    {
+        meter_set_sender(udp_server_send_chain);
+        udp_server_set_sent_handler(meter_sent);
+        (void) udp_server_init_chain(meter_udp_chain_handler, meter_connect, meter_disconnect, UDP_PORT);
+        printf("Exiting DLMS/Cosem meter simulator\r\n");
+        return 0;
+    }
+
+    if (use_pty)
+    {
+        // The server answers only when polled: no sender
+        (void) pty_server_init(meter_hdlc_chain_handler, meter_connect, meter_disconnect);
+        printf("Exiting DLMS/Cosem meter simulator\r\n");
+        return 0;
+    }
+
+    chain_data_handler handler = meter_tcp_chain_handler;
+    int port = TCP_PORT;
+
+    // The responses left pending are completed in the event loop of their channel
+    tcp_server_set_channels((int32_t)METER_NUMBER_OF_CHANNELS);
+    meter_set_poster(tcp_server_post);
+    tcp_server_set_posted_handler(meter_posted);
+
+    if (use_hdlc)
+    {
+        handler = meter_hdlc_chain_handler;
+        port = HDLC_TCP_PORT;
+        tcp_server_set_frame_handler(hdlc_frame_size);
+    }
+    else
+    {
+        meter_set_sender(tcp_server_send_chain);
+        tcp_server_set_sent_handler(meter_sent);
+        tcp_server_set_frame_handler(csm_llc_wpdu_frame_size);
+    }
+
+#if METER_NUMBER_OF_LOOPS > 1
+    int ret = tcp_server_init_sharded(handler, meter_connect, meter_disconnect, meter_thread_init, port, METER_NUMBER_OF_LOOPS);
+#else
+    int ret = tcp_server_init_chain(handler, meter_connect, meter_disconnect, port);
+#endif
     
     printf("Exiting DLMS/Cosem meter simulator\r\n");
 
@@ -5,11 +5,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h> // to initialize the seed
+#include <pthread.h>
 
 #include "csm_array.h"
 #include "csm_ber.h"
+#include "csm_axdr_codec.h"
 #include "csm_llc.h"
+#include "csm_scheduler.h"
+#include "hdlc_server.h"
 
 #include "app_database.h"
 
@@ -45,44 +50,107 @@ static csm_db_t database[METER_NUMBER_OF_LOGICAL_DEVICES] = {
     }
 };
 
+static db_index_entry db_index[METER_NUMBER_OF_LOGICAL_DEVICES][METER_DB_INDEX_SIZE];
+static uint8_t object_list_cache[METER_NUMBER_OF_LOGICAL_DEVICES][METER_OBJECT_LIST_CACHE_SIZE];
+
 
 typedef struct
 {
     uint8_t rx_buffer[BUF_SIZE];
     uint8_t tx_buffer[BUF_SIZE];
     uint8_t scratch_buffer[METER_SCRATCH_BUF_SIZE];    
+    uint8_t gbt_buffer[METER_GBT_BUF_SIZE];
+    uint8_t prefetch_buffer[METER_SCRATCH_BUF_SIZE];
+    uint8_t set_value_buffer[METER_SCRATCH_BUF_SIZE];
+    uint8_t hdlc_buffer[METER_PDU_SIZE];
 } asso_buffers_t;
 
-static asso_buffers_t com_buffers[METER_NUMBER_OF_ASSOCIATIONS];
+static asso_buffers_t com_buffers[METER_NUMBER_OF_CHANNELS];
+
+static csm_server_context_t contexes[METER_NUMBER_OF_CHANNELS];
+
+// Event loop of the calling thread, it owns the channels [loop * METER_CHANNELS_PER_LOOP, (loop + 1) * METER_CHANNELS_PER_LOOP[
+static __thread uint32_t meter_loop = 0U;
 
-static csm_server_context_t contexes[METER_NUMBER_OF_ASSOCIATIONS];
+// Transport used to send the responses completed asynchronously
+static chain_send_handler sender = NULL;
+
+// Hands the completions of the worker threads to the event loop of the channel
+static post_handler poster = NULL;
+
+// Reading of the operating time in progress on each channel
+typedef struct
+{
+    csm_array *out;     //!< Output array of the handler, written by the event loop
+    uint32_t value;     //!< Written by the worker thread
+} meter_job;
+
+static meter_job jobs[METER_NUMBER_OF_CHANNELS];
+
+// Channels waiting for a worker; a channel has at most one request pending, the queue cannot overflow
+static int32_t job_queue[METER_NUMBER_OF_CHANNELS];
+static uint32_t job_first = 0U;
+static uint32_t job_count = 0U;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_once_t workers_once = PTHREAD_ONCE_INIT;
+static uint32_t nb_workers = 0U;
+
+// Value posted to the event loop of a channel to run a round of its scheduler, the completions are csm_db_code
+#define METER_POST_SCHEDULE    (-1)
+
+// Fair sharing of each event loop between its channels, when the responses are sent by the loop
+static csm_scheduler scheds[METER_NUMBER_OF_LOOPS];
+static csm_sched_channel sched_channels[METER_NUMBER_OF_LOOPS][METER_CHANNELS_PER_LOOP];
+static int sched_posted[METER_NUMBER_OF_LOOPS];
+
+// HDLC data link of each channel, when the meter is read with HDLC frames
+static hdlc_server links[METER_NUMBER_OF_CHANNELS];
+static uint8_t hdlc_frames[METER_NUMBER_OF_CHANNELS][METER_HDLC_WINDOW * (METER_HDLC_INFO_SIZE + HDLC_FRAME_OVERHEAD)];
+static int deferred[METER_NUMBER_OF_CHANNELS];
 
 static const csm_asso_config default_assos_config[METER_NUMBER_OF_ASSOCIATIONS] =
 {
     // Public association
     { {16U, 1U},
-      CSM_CBLOCK_GET | CSM_CBLOCK_BLOCK_TRANSFER_WITH_GET_OR_READ,
+      CSM_CBLOCK_GET | CSM_CBLOCK_BLOCK_TRANSFER_WITH_GET_OR_READ | CSM_CBLOCK_MULTIPLE_REFERENCES | CSM_CBLOCK_GENERAL_BLOCK_TRANSFER,
       0U, // No auto-connected
+      CSM_SEC_POLICY_NONE,
     },
 
     // Client management association
     { {1U, 1U},
-        CSM_CBLOCK_GET | CSM_CBLOCK_ACTION | CSM_CBLOCK_SET |CSM_CBLOCK_BLOCK_TRANSFER_WITH_GET_OR_READ | CSM_CBLOCK_SELECTIVE_ACCESS,
+        CSM_CBLOCK_GET | CSM_CBLOCK_ACTION | CSM_CBLOCK_SET |CSM_CBLOCK_BLOCK_TRANSFER_WITH_GET_OR_READ | CSM_CBLOCK_SELECTIVE_ACCESS | CSM_CBLOCK_MULTIPLE_REFERENCES | CSM_CBLOCK_GENERAL_BLOCK_TRANSFER,
         0U, // No auto-connected
+        CSM_SEC_POLICY_NONE, // glo- and ded- requests accepted with a ciphering context, not required
     }
 };
 
 
-int8_t meter_connect()
+void meter_thread_init(int loop)
+{
+    if ((loop >= 0) && ((uint32_t)loop < METER_NUMBER_OF_LOOPS))
+    {
+        meter_loop = (uint32_t)loop;
+    }
+    else
+    {
+        CSM_ERR("[LLC] Loop %d out of range", loop);
+    }
+}
+
+int32_t meter_connect()
 {
-    int8_t ret = CSM_CHANNEL_INVALID_ID;
+    int32_t ret = CSM_CHANNEL_INVALID_ID;
+    uint32_t first = meter_loop * METER_CHANNELS_PER_LOOP;
 
-    for (uint32_t i = 0U; i < METER_NUMBER_OF_ASSOCIATIONS; i++)
+    for (uint32_t i = first; i < (first + METER_CHANNELS_PER_LOOP); i++)
     {
-        if (contexes[i].asso.state_cf == CF_INACTIVE)
+        // A channel closed with a response pending is reused once completed
+        if ((contexes[i].asso.state_cf == CF_INACTIVE) && !contexes[i].asso.pending)
         {
             contexes[i].asso.state_cf = CF_IDLE;
-            ret = i;
+            ret = (int32_t)i;
             CSM_LOG("[LLC] Channel %d connected", ret);
             break;
         }
@@ -91,25 +159,258 @@ int8_t meter_connect()
     return ret;
 }
 
-void meter_disconnect(int8_t channel_id)
+void meter_disconnect(int32_t channel_id)
 {
     if (channel_id > CSM_CHANNEL_INVALID_ID)
     {
         contexes[channel_id].asso.state_cf = CF_INACTIVE;
+        hdlc_server_reset(&links[channel_id]);
+        deferred[channel_id] = 0;
+        csm_sys_set_dedicated_key(channel_id, NULL);
+        // Nothing more to send on the channel
+        csm_sched_cancel(&scheds[channel_id / METER_CHANNELS_PER_LOOP], channel_id % METER_CHANNELS_PER_LOOP);
+        contexes[channel_id].asso.gbt.active = FALSE;
+    }
+    else
+    {
+        CSM_ERR("[LLC] Channel id invalid");
+    }
+}
+
+
+// Appends the APDU of the tx array with its wrapper, returns the number of bytes added
+static int meter_wpdu_append(csm_server_context_t *ctx, uint8_t *buffer, uint32_t pos, uint32_t buffer_size)
+{
+    int ret = -1;
+    uint32_t apdu_size = csm_array_written(&ctx->asso.tx);
+
+    if (apdu_size > 0)
+    {
+        // Compute total packet size
+        if ((pos + apdu_size + COSEM_WRAPPER_SIZE) <= buffer_size)
+        {
+            // Encode the packet
+            int llc_size = csm_llc_wpdu_encode(&buffer[pos], apdu_size, ctx->request.llc.ssap, ctx->request.llc.dsap);
+            // Append the APDU to the buffer, after the LLC
+            memcpy(&buffer[pos + llc_size], csm_array_start(&ctx->asso.tx), apdu_size);
+            ret = apdu_size + llc_size;
+        }
+        else
+        {
+            CSM_ERR("[LLC] APDU too big for TCP layer");
+        }
+    }
+    else
+    {
+        CSM_ERR("[LLC] No APDU to send");
+    }
+
+    return ret;
+}
+
+// Chain of the response in tx: the wrapper encoded in the headroom of the tx buffer, the APDU header and the payload
+static int meter_reply_chain(csm_server_context_t *ctx, int apdu_size, csm_chain *reply)
+{
+    uint8_t *wpdu = csm_array_start(&ctx->asso.tx) - COSEM_WRAPPER_SIZE;
+    int llc_size = csm_llc_wpdu_encode(wpdu, apdu_size, ctx->request.llc.ssap, ctx->request.llc.dsap);
+
+    csm_chain_init(reply);
+    int valid = csm_chain_append(reply, wpdu, llc_size + csm_array_written(&ctx->asso.tx));
+    valid = valid && csm_chain_append(reply, ctx->asso.payload.data, ctx->asso.payload.size);
+    return valid;
+}
+
+// Executes the APDU in rx, the addresses of the request are set, returns the size of the APDU to reply
+static int meter_server_execute(csm_server_context_t *ctx)
+{
+    csm_array_reset(&ctx->asso.tx);
+
+    int ret = csm_server_execute(ctx, &default_assos_config[0], METER_NUMBER_OF_ASSOCIATIONS, &database[0], METER_NUMBER_OF_LOGICAL_DEVICES);
+    if (ret <= 0)
+    {
+        CSM_LOG("[LLC] No reply");
+    }
+    return ret;
+}
+
+static void meter_load_apdu(csm_server_context_t *ctx, const uint8_t *apdu, uint32_t size)
+{
+    csm_array_reset(&ctx->asso.rx);
+    csm_array_write_buff(&ctx->asso.rx, apdu, size);
+}
+
+// Executes the APDU received, returns the size of the APDU to reply
+static int meter_execute_apdu(csm_server_context_t *ctx, const uint8_t *apdu, uint32_t size)
+{
+    meter_load_apdu(ctx, apdu, size);
+    return meter_server_execute(ctx);
+}
+
+// Decodes the wrapper and executes the request, returns the size of the APDU to reply
+static int meter_execute(int32_t channel_id, uint8_t *buffer, uint32_t payload_size)
+{
+    int ret = -1;
+
+    print_hex((const char *)(buffer), payload_size);
+
+    if (channel_id > CSM_CHANNEL_INVALID_ID)
+    {
+        csm_server_context_t *ctx = &contexes[channel_id];
+
+        ret = csm_llc_wpdu_decode(buffer, payload_size, &ctx->request.llc.ssap, &ctx->request.llc.dsap);
+        if (ret > 0)
+        {
+            CSM_LOG("[LLC] Packet decoded");
+            // Only the Cosem ADPU (jump over the TCP wrapper)
+            ret = meter_execute_apdu(ctx, &buffer[COSEM_WRAPPER_SIZE], ret);
+        }
+        else
+        {
+            CSM_ERR("[LLC] Packet not decoded");
+        }
     }
     else
     {
         CSM_ERR("[LLC] Channel id invalid");
     }
+
+    return ret;
+}
+
+// The responses are sent by the event loop of the channel, shared between the channels by a scheduler
+static int meter_scheduled(void)
+{
+    return (poster != NULL) && (sender != NULL);
+}
+
+// Sends the APDU of tx followed by its payload, the transport does not notify these replies
+static void meter_sched_send(csm_server_context_t *ctx, int size)
+{
+    csm_chain reply;
+
+    if (meter_reply_chain(ctx, size, &reply) && (sender(ctx->asso.channel_id, &reply) >= 0))
+    {
+        meter_sent(ctx->asso.channel_id);
+    }
+}
+
+// Runs a round of the scheduler of the loop, once the loop has read its sockets again
+static void meter_schedule(int32_t channel_id)
+{
+    if (!sched_posted[meter_loop])
+    {
+        sched_posted[meter_loop] = (poster(channel_id, METER_POST_SCHEDULE) == 0);
+        if (!sched_posted[meter_loop])
+        {
+            CSM_ERR("[LLC] Cannot post the scheduling of channel %d", channel_id);
+        }
+    }
+}
+
+static void meter_sched_round(void)
+{
+    csm_scheduler *sched = &scheds[meter_loop];
+
+    sched_posted[meter_loop] = FALSE;
+    (void) csm_sched_run(sched);
+
+    // More requests or blocks to send: the next round after the new requests of the loop
+    for (uint32_t i = 0U; i < sched->nb_channels; i++)
+    {
+        if (csm_sched_is_busy(sched, (int)i))
+        {
+            meter_schedule((int32_t)((meter_loop * METER_CHANNELS_PER_LOOP) + i));
+            break;
+        }
+    }
 }
 
+// Sends the response and the next blocks of its general block transfer window, one by one
+static void meter_send_blocks(int32_t channel_id, csm_server_context_t *ctx, int apdu_size)
+{
+    csm_chain reply;
+
+    if (meter_scheduled())
+    {
+        if (apdu_size > 0)
+        {
+            meter_sched_send(ctx, apdu_size);
+        }
+        // The other blocks are sent by the scheduler, between the responses of the other channels
+        if (ctx->asso.gbt.active)
+        {
+            meter_schedule(channel_id);
+        }
+    }
+    else
+    {
+        while ((apdu_size > 0) && meter_reply_chain(ctx, apdu_size, &reply))
+        {
+            if (sender != NULL)
+            {
+                (void) sender(channel_id, &reply);
+            }
+            apdu_size = ctx->asso.gbt.active ? csm_server_gbt_next(ctx) : 0;
+        }
+    }
+}
 
 /**
- * @brief tcp_data_handler
+ * @brief Queues the request received for the scheduler of the event loop
+ * The response is sent by a later round. A request received while another one is pending is
+ * refused at once, as the server does not queue it.
+ *
+ * @return 0, nothing to reply at once, or -1 if the packet is not decoded
+ */
+static int meter_queue(int32_t channel_id, uint8_t *buffer, uint32_t payload_size)
+{
+    csm_server_context_t *ctx = &contexes[channel_id];
+    csm_scheduler *sched = &scheds[meter_loop];
+    int index = channel_id % METER_CHANNELS_PER_LOOP;
+
+    print_hex((const char *)(buffer), payload_size);
+
+    int ret = csm_llc_wpdu_decode(buffer, payload_size, &ctx->request.llc.ssap, &ctx->request.llc.dsap);
+    if (ret > 0)
+    {
+        // The request sent before the response of the previous one is served first, rx is then free
+        while (sched->channels[index].ready)
+        {
+            (void) csm_sched_run(sched);
+        }
+
+        if (ctx->asso.pending)
+        {
+            meter_send_blocks(channel_id, ctx, meter_execute_apdu(ctx, &buffer[COSEM_WRAPPER_SIZE], ret));
+        }
+        else
+        {
+            meter_load_apdu(ctx, &buffer[COSEM_WRAPPER_SIZE], ret);
+            (void) csm_sched_ready(sched, index);
+            meter_schedule(channel_id);
+        }
+        ret = 0;
+    }
+    else
+    {
+        CSM_ERR("[LLC] Packet not decoded");
+    }
+
+    return ret;
+}
+
+/**
+ * @brief tcp_chain_handler
  * This link layer manages the data between the transport (TCP/IP) and the Cosem stack
  * The function is called by the TCP/IP server upon reception of a new packet.
- * The passed buffer must be filled by the reply, if any, and return the according number
- * of bytes to transfer back to the sender.
+ * The reply, if any, is described by a chain of segments sent without copy:
+ *   - the wrapper, encoded in the headroom of the tx buffer, followed by the APDU header
+ *   - the payload of the response, still in the scratch buffer
+ * A general block transfer window is copied in the passed buffer, as one segment.
+ *
+ * When the event loop sends the responses (meter_set_sender() and meter_set_poster()), the
+ * request is queued instead: the scheduler of the loop executes it and sends the blocks of
+ * its window one by one, interleaved with the responses of the other channels.
  *
  * The data link layer is application specific - but rather simple - and must be implemented
  * in the application side. Thus, the DLMS/Cosem stack remains agnostic on the transport layer.
@@ -119,64 +420,161 @@ void meter_disconnect(int8_t channel_id)
  * @param size
  * @return > 0 the number of bytes to reply back to the sender
  */
-int meter_tcp_data_handler(int8_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size)
-{   
-    int ret = -1;
+int meter_tcp_chain_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply)
+{
     CSM_LOG("[LLC] TCP Packet received");
 
-    print_hex((const char *)(buffer), payload_size);
+    csm_chain_init(reply);
 
-    if (channel_id > CSM_CHANNEL_INVALID_ID)
+    int ret = -1;
+
+    if (meter_scheduled() && (channel_id > CSM_CHANNEL_INVALID_ID))
+    {
+        ret = meter_queue(channel_id, buffer, payload_size);
+    }
+    else
+    {
+        ret = meter_execute(channel_id, buffer, payload_size);
+    }
+
+    // Some data to reply, the queued requests have none yet
+    if (ret > 0)
     {
         csm_server_context_t *ctx = &contexes[channel_id];
+        int valid = meter_reply_chain(ctx, ret, reply);
 
-        ret = csm_llc_wpdu_decode(buffer, payload_size, &ctx->request.llc.ssap, &ctx->request.llc.dsap);
-        if (ret > 0)
+        if (valid && ctx->asso.gbt.active)
         {
-            CSM_LOG("[LLC] Packet decoded");
-            csm_array_reset(&ctx->asso.rx);
-            csm_array_reset(&ctx->asso.tx);
-            // Append only the Cosem ADPU (jump over the TCP wrapper)
-            csm_array_write_buff(&ctx->asso.rx, &buffer[COSEM_WRAPPER_SIZE], ret);
-
-            ret = csm_server_execute(ctx, &default_assos_config[0], METER_NUMBER_OF_ASSOCIATIONS, &database[0], METER_NUMBER_OF_LOGICAL_DEVICES);
-
-            // Some data to reply
-            if (ret > 0)
+            // General block transfer: the other blocks of the window follow in the same TCP packet.
+            // They are encoded one by one in tx, so the whole window is gathered in the buffer.
+            uint32_t pos = csm_chain_copy(reply, buffer, buffer_size);
+            while ((pos > 0U) && (csm_server_gbt_next(ctx) > 0))
             {
-                // Encode the packet
-                int llc_size = csm_llc_wpdu_encode(buffer, ret, ctx->request.llc.ssap, ctx->request.llc.dsap);
-                // Add the Cosem APDU
-                uint32_t apdu_size = csm_array_written(&ctx->asso.tx);
-                if (apdu_size > 0)
+                int size = meter_wpdu_append(ctx, buffer, pos, buffer_size);
+                if (size > 0)
                 {
-                    // Compute total packet size
-                    ret = apdu_size + llc_size;
-                    if (ret <= buffer_size)
-                    {
-                        // Append the APDU to the buffer, after the LLC
-                        memcpy(&buffer[llc_size], csm_array_start(&ctx->asso.tx), ret);
-                    }
-                    else
-                    {
-                        CSM_ERR("[LLC] APDU too big for TCP layer");
-                        ret = -1;
-                    }
+                    pos += size;
                 }
                 else
                 {
-                    CSM_ERR("[LLC] No APDU to send");
-                    ret = -1;
+                    break;
                 }
             }
-            else
-            {
-                CSM_LOG("[LLC] No reply");
-            }
+            csm_chain_init(reply);
+            valid = (pos > 0U) && csm_chain_append(reply, buffer, pos);
+        }
+
+        ret = valid ? (int)reply->size : -1;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief udp_chain_handler
+ * Same as meter_tcp_chain_handler() for the wrapper over UDP, where a datagram holds one
+ * WPDU: the blocks of a general block transfer window are sent as separate datagrams
+ * with the sender, before returning.
+ *
+ * @return > 0 the number of bytes to reply back to the sender, 0 if already sent
+ */
+int meter_udp_chain_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply)
+{
+    (void) buffer_size;
+    CSM_LOG("[LLC] UDP Datagram received");
+
+    csm_chain_init(reply);
+
+    int ret = meter_execute(channel_id, buffer, payload_size);
+
+    if (ret > 0)
+    {
+        csm_server_context_t *ctx = &contexes[channel_id];
+
+        if (ctx->asso.gbt.active)
+        {
+            meter_send_blocks(channel_id, ctx, ret);
+            ret = 0;
         }
         else
         {
-            CSM_ERR("[LLC] Packet not decoded");
+            ret = meter_reply_chain(ctx, ret, reply) ? (int)reply->size : -1;
+        }
+    }
+
+    return ret;
+}
+
+// Chain of the APDU in tx followed by its payload, the HDLC link adds the LLC
+static int meter_apdu_chain(csm_server_context_t *ctx, csm_chain *reply)
+{
+    csm_chain_init(reply);
+    int valid = csm_chain_append_array(reply, &ctx->asso.tx);
+    valid = valid && csm_chain_append(reply, ctx->asso.payload.data, ctx->asso.payload.size);
+    return valid ? (int)reply->size : -1;
+}
+
+/**
+ * @brief Cosem handler of the HDLC links
+ * Called with the APDU received, without its LLC, or with a NULL APDU when the client polls
+ * for more data: the next block of a general block transfer or a response completed since.
+ *
+ * @return > 0 the size of the APDU to reply, segmented by the link
+ */
+static int meter_hdlc_apdu_handler(int32_t channel_id, uint8_t *apdu, uint32_t size, uint32_t buffer_size, csm_chain *reply)
+{
+    (void) buffer_size;
+    csm_server_context_t *ctx = &contexes[channel_id];
+    int ret = 0;
+
+    if (apdu != NULL)
+    {
+        ctx->request.llc.ssap = links[channel_id].hdlc.client_addr;
+        ctx->request.llc.dsap = links[channel_id].hdlc.logical_device;
+        ret = meter_execute_apdu(ctx, apdu, size);
+    }
+    else if (deferred[channel_id] > 0)
+    {
+        ret = deferred[channel_id];
+        deferred[channel_id] = 0;
+    }
+    else if (ctx->asso.gbt.active)
+    {
+        ret = csm_server_gbt_next(ctx);
+    }
+
+    return (ret > 0) ? meter_apdu_chain(ctx, reply) : ret;
+}
+
+// DISC or new SNRM: the association of the link is released
+static void meter_hdlc_release(int32_t channel_id)
+{
+    csm_asso_init(&contexes[channel_id].asso);
+    contexes[channel_id].asso.state_cf = CF_IDLE;
+    deferred[channel_id] = 0;
+}
+
+/**
+ * @brief hdlc_chain_handler
+ * Same as meter_tcp_chain_handler() for the HDLC frames (IEC 62056-46), over a serial line or
+ * a stream socket. The data link layer is terminated here, one frame at a time: the reply is
+ * at most one window of frames, in the frame buffer of the channel.
+ *
+ * @return > 0 the number of bytes to reply back to the sender
+ */
+int meter_hdlc_chain_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply)
+{
+    (void) buffer_size;
+    int ret = -1;
+
+    csm_chain_init(reply);
+
+    if ((channel_id > CSM_CHANNEL_INVALID_ID) && (channel_id < (int32_t)METER_NUMBER_OF_CHANNELS))
+    {
+        ret = hdlc_server_input(&links[channel_id], buffer, payload_size, hdlc_frames[channel_id], sizeof(hdlc_frames[channel_id]));
+        if (ret > 0)
+        {
+            ret = csm_chain_append(reply, hdlc_frames[channel_id], (uint32_t)ret) ? ret : -1;
         }
     }
     else
@@ -187,8 +585,233 @@ int meter_tcp_data_handler(int8_t channel_id, uint8_t *buffer, uint32_t payload_
     return ret;
 }
 
+/**
+ * @brief tcp_data_handler
+ * Same as meter_tcp_chain_handler(), the reply is copied in the passed buffer.
+ *
+ * @return > 0 the number of bytes to reply back to the sender
+ */
+int meter_tcp_data_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size)
+{
+    csm_chain reply;
+    int ret = meter_tcp_chain_handler(channel_id, buffer, payload_size, buffer_size, &reply);
+
+    if (ret > 0)
+    {
+        ret = csm_chain_copy(&reply, buffer, buffer_size);
+        if (ret == 0)
+        {
+            CSM_ERR("[LLC] APDU too big for TCP layer");
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+// The reply is sent, prepare the next block of a GET by block while the client reads this one
+void meter_sent(int32_t channel_id)
+{
+    if ((channel_id > CSM_CHANNEL_INVALID_ID) && (channel_id < (int32_t)METER_NUMBER_OF_CHANNELS))
+    {
+        (void) csm_server_prefetch(&contexes[channel_id]);
+    }
+}
+
+const csm_server_context_t *meter_context(int32_t channel_id)
+{
+    const csm_server_context_t *ctx = NULL;
+
+    if ((channel_id > CSM_CHANNEL_INVALID_ID) && (channel_id < (int32_t)METER_NUMBER_OF_CHANNELS))
+    {
+        ctx = &contexes[channel_id];
+    }
+    return ctx;
+}
+
+void meter_set_sender(chain_send_handler send_func)
+{
+    sender = send_func;
+}
+
+void meter_set_poster(post_handler post_func)
+{
+    poster = post_func;
+}
 
-void meter_send_ascii_tcp_message(int8_t channel_id, const char *message, uint32_t size)
+/**
+ * @brief Completes a request left pending by the database, from any thread
+ *
+ * With a poster, the completion is run later by the event loop of the channel (meter_completed()),
+ * otherwise at once: the caller must then be the thread of the channel.
+ */
+void meter_complete(int32_t channel_id, csm_db_code code)
+{
+    if (poster == NULL)
+    {
+        meter_completed(channel_id, code);
+    }
+    else if (poster(channel_id, code) != 0)
+    {
+        CSM_ERR("[LLC] Cannot post the completion of channel %d", channel_id);
+    }
+}
+
+/**
+ * @brief Values posted to the event loop of a channel: completion of a pending request or round of the scheduler
+ */
+void meter_posted(int32_t channel_id, int value)
+{
+    if (value == METER_POST_SCHEDULE)
+    {
+        meter_sched_round();
+    }
+    else
+    {
+        meter_completed(channel_id, value);
+    }
+}
+
+/**
+ * @brief Sends the response of a request left pending by the database, in the thread of the channel
+ *
+ * The data read by the worker is written in the output array of the handler, then the response
+ * is encoded. The blocks of a general block transfer window are sent one by one.
+ */
+void meter_completed(int32_t channel_id, int code)
+{
+    if ((channel_id <= CSM_CHANNEL_INVALID_ID) || (channel_id >= (int32_t)METER_NUMBER_OF_CHANNELS))
+    {
+        CSM_ERR("[LLC] Channel id invalid");
+        return;
+    }
+
+    csm_server_context_t *ctx = &contexes[channel_id];
+    meter_job *job = &jobs[channel_id];
+
+    // The output array belongs to the handler as long as the response is pending
+    if (ctx->asso.pending && (job->out != NULL) && (code == CSM_OK))
+    {
+        code = csm_axdr_wr_u32(job->out, job->value) ? CSM_OK : CSM_ERR_OBJECT_ERROR;
+    }
+    job->out = NULL;
+
+    int size = csm_server_complete(ctx, (csm_db_code)code);
+
+    if (sender == NULL)
+    {
+        // HDLC: the server speaks only when polled, the response waits for the next RR
+        deferred[channel_id] = size;
+    }
+    else
+    {
+        meter_send_blocks(channel_id, ctx, size);
+    }
+}
+
+// Operating time in seconds, from the monotonic clock
+static uint32_t meter_operating_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)now.tv_sec;
+}
+
+// Worker thread reading the operating time of the queued channels, as a slow sub-device would
+static void *meter_worker(void *arg)
+{
+    (void) arg;
+    struct timespec delay = { 0, (long)METER_DEFERRED_DELAY_MS * 1000000L };
+
+    for (;;)
+    {
+        pthread_mutex_lock(&job_lock);
+        while (job_count == 0U)
+        {
+            pthread_cond_wait(&job_ready, &job_lock);
+        }
+        int32_t channel_id = job_queue[job_first];
+        job_first = (job_first + 1U) % METER_NUMBER_OF_CHANNELS;
+        job_count--;
+        pthread_mutex_unlock(&job_lock);
+
+        (void) nanosleep(&delay, NULL);
+        jobs[channel_id].value = meter_operating_time();
+        meter_complete(channel_id, CSM_OK);
+    }
+
+    return NULL;
+}
+
+static void meter_start_workers(void)
+{
+    for (uint32_t i = 0U; i < METER_NUMBER_OF_WORKERS; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, meter_worker, NULL) == 0)
+        {
+            (void) pthread_detach(thread);
+            nb_workers++;
+        }
+        else
+        {
+            CSM_ERR("[LLC] Cannot start worker %d", i);
+        }
+    }
+}
+
+// Queues the request of a channel for the worker pool, started on the first request
+static int meter_queue_job(int32_t channel_id)
+{
+    (void) pthread_once(&workers_once, meter_start_workers);
+
+    int valid = (nb_workers > 0U);
+    if (valid)
+    {
+        pthread_mutex_lock(&job_lock);
+        job_queue[(job_first + job_count) % METER_NUMBER_OF_CHANNELS] = channel_id;
+        job_count++;
+        pthread_cond_signal(&job_ready);
+        pthread_mutex_unlock(&job_lock);
+    }
+
+    return valid;
+}
+
+csm_db_code meter_deferred_func(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    (void) in;
+    csm_db_code code = CSM_ERR_OBJECT_ERROR;
+    int32_t channel_id = ctx->request.channel_id;
+
+    if (ctx->request.db_request.service != SVC_GET)
+    {
+        code = CSM_ERR_UNAUTHORIZED_ACCESS;
+    }
+    else if (poster != NULL)
+    {
+        // Answered by meter_completed(), in the event loop of the channel
+        jobs[channel_id].out = out;
+        if (meter_queue_job(channel_id))
+        {
+            code = CSM_PENDING;
+        }
+        else
+        {
+            jobs[channel_id].out = NULL;
+            code = CSM_ERR_TEMPORARY_FAILURE;
+        }
+    }
+    else
+    {
+        // No event loop to post the completion to: read at once
+        code = csm_axdr_wr_u32(out, meter_operating_time()) ? CSM_OK : CSM_ERR_OBJECT_ERROR;
+    }
+
+    return code;
+}
+
+void meter_send_ascii_tcp_message(int32_t channel_id, const char *message, uint32_t size)
 {
     uint32_t payload_size = size / 2;
     if (payload_size > BUF_SIZE)
@@ -220,15 +843,44 @@ void meter_initialize()
     // Init random seed
     srand(time(NULL));
 
+    // Hash the objects of each logical device for fast lookups
+    for (uint32_t i = 0U; i < METER_NUMBER_OF_LOGICAL_DEVICES; i++)
+    {
+        (void) csm_db_index_build(&database[i], &db_index[i][0], METER_DB_INDEX_SIZE);
+        // Read only from now, the event loop threads share it
+        (void) db_cosem_associations_prepare(&database[i], &object_list_cache[i][0], METER_OBJECT_LIST_CACHE_SIZE);
+    }
+
     // Initialize the communication buffers for all the associations
-    for (uint32_t i = 0U; i < METER_NUMBER_OF_ASSOCIATIONS; i++)
+    for (uint32_t i = 0U; i < METER_NUMBER_OF_CHANNELS; i++)
     {
         csm_array_init(&contexes[i].asso.rx, com_buffers[i].rx_buffer, sizeof(com_buffers[i].rx_buffer), 0U, BUF_APDU_OFFSET);
         csm_array_init(&contexes[i].asso.tx, com_buffers[i].tx_buffer, sizeof(com_buffers[i].tx_buffer), 0U, BUF_APDU_OFFSET);
         csm_array_init(&contexes[i].asso.scratch, com_buffers[i].scratch_buffer, sizeof(com_buffers[i].scratch_buffer), 0U, BUF_APDU_OFFSET);
+        csm_array_init(&contexes[i].asso.prefetch, com_buffers[i].prefetch_buffer, sizeof(com_buffers[i].prefetch_buffer), 0U, BUF_APDU_OFFSET);
+        csm_array_init(&contexes[i].asso.set_value, com_buffers[i].set_value_buffer, sizeof(com_buffers[i].set_value_buffer), 0U, 0U);
+        csm_array_init(&contexes[i].asso.gbt.retention, com_buffers[i].gbt_buffer, sizeof(com_buffers[i].gbt_buffer), 0U, 0U);
         contexes[i].db_access_func = csm_db_access_func;
         contexes[i].asso.channel_id = i;
+        contexes[i].request.channel_id = i; // Keyring of the channel
+        contexes[i].asso.zero_copy = TRUE;
         csm_asso_init(&contexes[i].asso);
+
+        hdlc_server_init(&links[i], i, METER_HDLC_ADDRESS, com_buffers[i].hdlc_buffer, sizeof(com_buffers[i].hdlc_buffer), meter_hdlc_apdu_handler);
+        links[i].max_info_field = METER_HDLC_INFO_SIZE;
+        links[i].max_window = METER_HDLC_WINDOW;
+        links[i].release = meter_hdlc_release;
+    }
+
+    // The channels of each event loop, in the order of their index in the scheduler
+    for (uint32_t loop = 0U; loop < METER_NUMBER_OF_LOOPS; loop++)
+    {
+        csm_sched_init(&scheds[loop], &sched_channels[loop][0], METER_CHANNELS_PER_LOOP, METER_SCHED_QUANTUM, meter_server_execute, meter_sched_send);
+        for (uint32_t i = 0U; i < METER_CHANNELS_PER_LOOP; i++)
+        {
+            (void) csm_sched_add(&scheds[loop], &contexes[(loop * METER_CHANNELS_PER_LOOP) + i]);
+        }
+        sched_posted[loop] = FALSE;
     }
 }
 
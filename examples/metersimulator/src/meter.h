@@ -25,6 +25,7 @@ extern "C" {
 #include "csm_array.h"
 #include "csm_ber.h"
 #include "csm_definitions.h"
+#include "csm_database.h"
 
 // Meter environment
 #include "app_database.h"
@@ -34,12 +35,30 @@ extern "C" {
 
 void meter_initialize();
 
-int8_t meter_connect();
-void meter_disconnect(int8_t channel_id);
-int meter_tcp_data_handler(int8_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size);
+void meter_thread_init(int loop);
+int32_t meter_connect();
+void meter_disconnect(int32_t channel_id);
+int meter_tcp_data_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size);
+int meter_tcp_chain_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply);
+int meter_hdlc_chain_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply);
+int meter_udp_chain_handler(int32_t channel_id, uint8_t *buffer, uint32_t payload_size, uint32_t buffer_size, csm_chain *reply);
+
+// Responses left pending by the database handler (CSM_PENDING)
+void meter_set_sender(chain_send_handler send_func);
+void meter_set_poster(post_handler post_func);
+void meter_complete(int32_t channel_id, csm_db_code code);
+void meter_completed(int32_t channel_id, int code);
+void meter_posted(int32_t channel_id, int value);
+void meter_sent(int32_t channel_id);
+
+// Server context of a channel, to supervise its state (read only)
+const csm_server_context_t *meter_context(int32_t channel_id);
+
+// Operating time, read by a worker thread: the response is completed later
+csm_db_code meter_deferred_func(csm_server_context_t *ctx, csm_array *in, csm_array *out);
 
 // ASCII string of hexadecimal values TCP Wrapper + cosem APDU
-void meter_send_ascii_tcp_message(int8_t channel_id, const char *message, uint32_t size);
+void meter_send_ascii_tcp_message(int32_t channel_id, const char *message, uint32_t size);
 
 #ifdef __cplusplus
 }
@@ -22,6 +22,64 @@
 #define METER_NUMBER_OF_ASSOCIATIONS    2U
 #endif
 
+// Event loop threads of the TCP server, each one serves its own slice of channels
+#ifndef METER_NUMBER_OF_LOOPS
+#define METER_NUMBER_OF_LOOPS    1U
+#endif
+
+#ifndef METER_CHANNELS_PER_LOOP
+#define METER_CHANNELS_PER_LOOP    METER_NUMBER_OF_ASSOCIATIONS
+#endif
+
+// One server context (and its buffers) per simultaneous connection
+#define METER_NUMBER_OF_CHANNELS    (METER_NUMBER_OF_LOOPS * METER_CHANNELS_PER_LOOP)
+
+// General block transfer retention buffer, gives the maximum window (here 4 blocks of one PDU)
+// Without event loop, the whole window is sent in one TCP packet: TCP_BUF_SIZE must be big enough
+#ifndef METER_GBT_BUF_SIZE
+#define METER_GBT_BUF_SIZE    (4U * METER_PDU_SIZE)
+#endif
+
+// Slots of the OBIS index of each logical device (power of two, twice the number of objects)
+#ifndef METER_DB_INDEX_SIZE
+#define METER_DB_INDEX_SIZE    64U
+#endif
+
+// Pre-encoded object_list of each logical device, see db_cosem_associations_list_size()
+#ifndef METER_OBJECT_LIST_CACHE_SIZE
+#define METER_OBJECT_LIST_CACHE_SIZE    4096U
+#endif
+
+// Lower HDLC address of the meter (physical device on the multi-drop)
+#ifndef METER_HDLC_ADDRESS
+#define METER_HDLC_ADDRESS    17U
+#endif
+
+// Largest information field of the HDLC frames accepted in the UA (up to 2030)
+#ifndef METER_HDLC_INFO_SIZE
+#define METER_HDLC_INFO_SIZE    2030U
+#endif
+
+// Largest number of I frames sent before an acknowledge (1 to 7)
+#ifndef METER_HDLC_WINDOW
+#define METER_HDLC_WINDOW    7U
+#endif
+
+// Worker threads reading the operating time, shared by all the channels
+#ifndef METER_NUMBER_OF_WORKERS
+#define METER_NUMBER_OF_WORKERS    2U
+#endif
+
+// Time taken by a worker thread to read the operating time, answered later (CSM_PENDING)
+#ifndef METER_DEFERRED_DELAY_MS
+#define METER_DEFERRED_DELAY_MS    20U
+#endif
+
+// Bytes sent by a channel in each round of the scheduler of its event loop
+#ifndef METER_SCHED_QUANTUM
+#define METER_SCHED_QUANTUM    METER_PDU_SIZE
+#endif
+
 
 #define BUF_WRAPPER_OFFSET  (CSM_DEF_MAX_HLS_SIZE)
 #define BUF_APDU_OFFSET     (COSEM_WRAPPER_SIZE + CSM_DEF_MAX_HLS_SIZE)
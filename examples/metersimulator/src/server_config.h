@@ -2,6 +2,8 @@
 #define SERVER_CONFIG_H
 
 #define TCP_PORT            4063
+#define UDP_PORT            4063
+#define HDLC_TCP_PORT       4064
 
 
 #endif // SERVER_CONFIG_H
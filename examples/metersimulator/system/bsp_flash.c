@@ -19,10 +19,13 @@ void bsp_flash_initialize()
 {
 	if (!loaded)
 	{
+	    // Erased, up to the end of a shorter file
+	    memset(&gMemory[0], 0xFF, MEMORY_SIZE);
+
 	    if( access( "mem.dat", F_OK ) != -1 )
 	    {
 	        // file exists
-	        FILE * file = fopen( "mem.dat", "wb" );
+	        FILE * file = fopen( "mem.dat", "rb" );
 
             if (file)
             {
@@ -30,11 +33,6 @@ void bsp_flash_initialize()
                 fclose( file );
             }
 
-	    }
-	    else
-	    {
-	        // file doesn't exist
-	        memset(&gMemory[0], 0xFF, MEMORY_SIZE);
 	    }
 
 		loaded = 1;
@@ -84,3 +82,34 @@ int bsp_flash_write(void * data, uint32_t block, uint32_t offset, uint32_t size)
 	return 1;
 }
 
+
+// Writes a block through to the file, as a non-volatile memory would keep it
+int bsp_flash_sync(uint32_t block)
+{
+    int ret = 0;
+    FILE * file = fopen( "mem.dat", "r+b" );
+
+    if (file)
+    {
+        ret = (fseek( file, block*FS_BLOCK_SIZE, SEEK_SET ) == 0) &&
+              (fwrite( &gMemory[block*FS_BLOCK_SIZE], 1, FS_BLOCK_SIZE, file ) == FS_BLOCK_SIZE);
+    }
+    else
+    {
+        // First write: the file holds the whole memory
+        file = fopen( "mem.dat", "wb+" );
+
+        if (file)
+        {
+            ret = (fwrite( gMemory, 1, sizeof(gMemory), file ) == sizeof(gMemory));
+        }
+    }
+
+    if (file)
+    {
+        ret = ret && (fflush( file ) == 0) && (fsync( fileno( file ) ) == 0);
+        fclose( file );
+    }
+
+    return ret;
+}
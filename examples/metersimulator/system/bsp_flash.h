@@ -9,6 +9,7 @@ void bsp_flash_initialize();
 int bsp_flash_read(void * data, uint32_t block, uint32_t offset, uint32_t datalen);
 int bsp_flash_write(void * data, uint32_t block, uint32_t offset, uint32_t size);
 int bsp_flash_erase(uint32_t block);
+int bsp_flash_sync(uint32_t block);
 void bsp_flash_suspend();
 void bsp_flash_resume();
 void bsp_flash_stop();
@@ -79,28 +79,122 @@ static int csm_db_check_attribute(csm_db_request *db_request, const db_object_de
 }
 
 
-static int csm_db_get_object(csm_server_context_t *ctx, db_obj_handle *handle)
+static uint64_t csm_db_index_key(uint16_t class_id, const csm_obis_code *obis)
+{
+    return ((uint64_t)class_id << 48U) |
+           ((uint64_t)obis->A << 40U) |
+           ((uint64_t)obis->B << 32U) |
+           ((uint64_t)obis->C << 24U) |
+           ((uint64_t)obis->D << 16U) |
+           ((uint64_t)obis->E << 8U) |
+           (uint64_t)obis->F;
+}
+
+static uint32_t csm_db_index_slot(uint64_t key, uint32_t index_size)
+{
+    // Fibonacci hashing, the index size is a power of two
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32U) & (index_size - 1U);
+}
+
+int csm_db_index_build(csm_db_t *db, db_index_entry *index, uint32_t index_size)
+{
+    int valid = (db != NULL) && (index != NULL);
+    uint32_t nb_objects = 0U;
+
+    // Power of two only, to replace the modulo by a mask
+    valid = valid && (index_size > 0U) && ((index_size & (index_size - 1U)) == 0U);
+
+    if (valid)
+    {
+        db->index = NULL;
+        for (uint32_t slot = 0U; slot < index_size; slot++)
+        {
+            index[slot].key = 0U;
+        }
+
+        for (uint8_t i = 0U; (i < db->size) && valid; i++)
+        {
+            const struct db_element *obj_list = &db->el[i];
+            nb_objects += obj_list->nb_objects;
+
+            // Keep at least one free slot so that a miss always terminates
+            valid = (nb_objects < index_size);
+
+            for (uint32_t object_index = 0U; (object_index < obj_list->nb_objects) && valid; object_index++)
+            {
+                const db_object_descr *curr_obj = &obj_list->objects[object_index];
+                uint64_t key = csm_db_index_key(curr_obj->class_id, &curr_obj->obis_code);
+                uint32_t slot = csm_db_index_slot(key, index_size);
+
+                // Linear probing; on duplicated objects, the first declared one wins like the linear search
+                while ((index[slot].key != 0U) && (index[slot].key != key))
+                {
+                    slot = (slot + 1U) & (index_size - 1U);
+                }
+
+                if (index[slot].key == 0U)
+                {
+                    index[slot].key = key;
+                    index[slot].db_index = i;
+                    index[slot].obj_index = object_index;
+                }
+            }
+        }
+
+        if (valid)
+        {
+            db->index = index;
+            db->index_size = index_size;
+        }
+        else
+        {
+            CSM_ERR("[DB] Index too small for %d objects", nb_objects);
+        }
+    }
+
+    return valid;
+}
+
+int csm_db_find_object(const csm_db_t *db, const csm_object_t *ln, db_obj_handle *handle)
 {
     uint8_t found = FALSE;
 
-    for (uint8_t i = 0U; (i < ctx->db->size) && (!found); i++)
+    if (db->index != NULL)
     {
-        const struct db_element *obj_list = &ctx->db->el[i];
+        uint64_t key = csm_db_index_key(ln->class_id, &ln->obis);
+        uint32_t slot = csm_db_index_slot(key, db->index_size);
 
-        // Loop on all cosem object in list
-        for (uint32_t object_index = 0U; (object_index < obj_list->nb_objects) && (!found); object_index++)
+        while ((db->index[slot].key != 0U) && (!found))
         {
-            const db_object_descr *curr_obj = &obj_list->objects[object_index];
-            // Check the obis code
-            if ((curr_obj->class_id == ctx->request.db_request.logical_name.class_id) &&
-                     csm_is_obis_equal(&curr_obj->obis_code, &(ctx->request.db_request.logical_name.obis)))
+            if (db->index[slot].key == key)
             {
-                handle->object       = curr_obj;
-                handle->db_index     = i;
-                handle->obj_index    = object_index;
+                handle->db_index     = db->index[slot].db_index;
+                handle->obj_index    = db->index[slot].obj_index;
+                handle->object       = &db->el[handle->db_index].objects[handle->obj_index];
+                found = TRUE;
+            }
+            slot = (slot + 1U) & (db->index_size - 1U);
+        }
+    }
+    else
+    {
+        for (uint8_t i = 0U; (i < db->size) && (!found); i++)
+        {
+            const struct db_element *obj_list = &db->el[i];
 
-                // Verify that this object contains the suitable method/attribute and if we can access to it
-                found = csm_db_check_attribute(&ctx->request.db_request, curr_obj);
+            // Loop on all cosem object in list
+            for (uint32_t object_index = 0U; (object_index < obj_list->nb_objects) && (!found); object_index++)
+            {
+                const db_object_descr *curr_obj = &obj_list->objects[object_index];
+                // Check the obis code
+                if ((curr_obj->class_id == ln->class_id) &&
+                         csm_is_obis_equal(&curr_obj->obis_code, &ln->obis))
+                {
+                    handle->object       = curr_obj;
+                    handle->db_index     = i;
+                    handle->obj_index    = object_index;
+                    found = TRUE;
+                }
             }
         }
     }
@@ -109,6 +203,49 @@ static int csm_db_get_object(csm_server_context_t *ctx, db_obj_handle *handle)
 }
 
 
+static int csm_db_get_object(csm_server_context_t *ctx, db_obj_handle *handle)
+{
+    int found = csm_db_find_object(ctx->db, &ctx->request.db_request.logical_name, handle);
+
+    if (found)
+    {
+        // Verify that this object contains the suitable method/attribute and if we can access to it
+        found = csm_db_check_attribute(&ctx->request.db_request, handle->object);
+    }
+
+    return found;
+}
+
+
+/**
+ * SET by block to a handler that does not stream the value: the blocks are appended in the
+ * reassembly buffer of the association, the handler is called once with the whole value
+ */
+static csm_db_code csm_db_set_by_block(csm_server_context_t *ctx, const struct db_element *db_element, csm_array *in, csm_array *out)
+{
+    csm_db_code code = CSM_OK;
+    csm_array *value = &ctx->asso.set_value;
+
+    if (ctx->request.db_request.block_offset == 0U)
+    {
+        csm_array_reset(value);
+    }
+
+    if (!csm_array_write_buff(value, csm_array_rd_current(in), csm_array_unread(in)))
+    {
+        CSM_ERR("[DB] Value too long to be reassembled");
+        code = CSM_ERR_TEMPORARY_FAILURE;
+    }
+    else if (ctx->request.db_request.last_block)
+    {
+        // Same call as a value received in one piece
+        ctx->request.db_request.block_number = 0U;
+        code = db_element->handler(ctx, value, out);
+    }
+
+    return code;
+}
+
 csm_db_code csm_db_access_func(csm_server_context_t *ctx, csm_array *in, csm_array *out)
 {
     csm_db_code code = CSM_ERR_OBJECT_ERROR;
@@ -121,13 +258,17 @@ csm_db_code csm_db_access_func(csm_server_context_t *ctx, csm_array *in, csm_arr
     {
         // Ok, call the database main function
         const struct db_element *db_element = &ctx->db->el[handle.db_index];
-        if (db_element->handler != NULL)
+        if (db_element->handler == NULL)
         {
-            code = db_element->handler(ctx, in, out);
+            CSM_ERR("[DB] Cannot access to DB handler function");
+        }
+        else if ((ctx->request.db_request.service == SVC_SET) && (ctx->request.db_request.block_number > 0U) && !db_element->streaming)
+        {
+            code = csm_db_set_by_block(ctx, db_element, in, out);
         }
         else
         {
-            CSM_ERR("[DB] Cannot access to DB handler function");
+            code = db_element->handler(ctx, in, out);
         }
     }
     else
@@ -12,6 +12,21 @@ extern "C" {
 // Database access from Cosem
 csm_db_code csm_db_access_func(csm_server_context_t *ctx, csm_array *in, csm_array *out);
 
+/**
+ * @brief Build the OBIS hash index of a database
+ *
+ * The lookup of csm_db_access_func() is then O(1) instead of a scan of all the objects.
+ * The index memory is provided by the application (no dynamic allocation), its size must be
+ * a power of two and greater than the number of objects (twice is a good load factor).
+ * The index must be rebuilt if the object lists change.
+ *
+ * @return TRUE if the index is in use, otherwise the linear search is kept
+ */
+int csm_db_index_build(csm_db_t *db, db_index_entry *index, uint32_t index_size);
+
+// Lookup of an object by class id and OBIS code (no access rights check)
+int csm_db_find_object(const csm_db_t *db, const csm_object_t *ln, db_obj_handle *handle);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,13 +7,200 @@ typedef struct
     uint32_t element_idx;
     uint32_t nb_elements;
     uint32_t object_idx;
+    // When the object list is cached, one loop is one window of the encoded buffer
+    uint32_t offset;
+    uint32_t window;
 
 } asso_db_context_t;
 
 static  asso_db_context_t g_asso_db_contexes[DB_NUMBER_OF_ASSOCIATIONS] = {0};
 
+/**
+ * The object_list only depends on the logical device: it is encoded once, in a buffer
+ * provided by the application, then the block transfer serves windows of this buffer
+ */
+typedef struct
+{
+    const csm_db_t *db;     //!< Logical device encoded in this cache, NULL if the slot is free
+    const uint8_t *buffer;
+    uint32_t size;
+
+} asso_object_list_cache_t;
+
+static asso_object_list_cache_t g_object_list_cache[DB_NUMBER_OF_LOGICAL_DEVICES];
+
 static const char DefaultUser[] = "DEFAULT_USER";
 
+static int db_encode_object(csm_array *out, const db_object_descr *obj)
+{
+    int valid = TRUE;
+
+    valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
+    valid = valid && csm_ber_write_len(out, 4);
+    
+    valid = valid && csm_axdr_wr_u16(out, obj->class_id);
+    valid = valid && csm_axdr_wr_u8(out, obj->version);
+    valid = valid && csm_axdr_wr_octetstring(out, &obj->obis_code.A, 6U, AXDR_TAG_OCTETSTRING);
+    
+    valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
+    valid = valid && csm_ber_write_len(out, 2);
+
+    // Attributes access rights
+    valid = valid && csm_array_write_u8(out, AXDR_TAG_ARRAY);
+    valid = valid && csm_ber_write_len(out, obj->nb_attr + 1);
+
+    // Auto encode logical name (always attribute 1)
+    valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
+    valid = valid && csm_ber_write_len(out, 3);
+    valid = valid && csm_axdr_wr_i8(out, 1);
+    valid = valid && csm_axdr_wr_enum(out, DB_ACCESS_GET);
+    valid = valid && csm_array_write_u8(out, AXDR_TAG_NULL);
+
+    // Encode the other attributes (id > 1)
+    for (int a  = 0; a < obj->nb_attr; a++)
+    {
+        const db_attr_descr *attr = &obj->attr_list[a];
+        valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
+        valid = valid && csm_ber_write_len(out, 3);
+        valid = valid && csm_axdr_wr_i8(out, attr->number);
+        valid = valid && csm_axdr_wr_enum(out, attr->access_rights);
+        valid = valid && csm_array_write_u8(out, AXDR_TAG_NULL);
+    }
+
+    // Encode the methods
+    valid = valid && csm_array_write_u8(out, AXDR_TAG_ARRAY);
+    valid = valid && csm_ber_write_len(out, obj->nb_meth);
+    for (int a  = 0; a < obj->nb_meth; a++)
+    {
+        const db_attr_descr *attr = &obj->meth_list[a];
+        valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
+        valid = valid && csm_ber_write_len(out, 2);
+        valid = valid && csm_axdr_wr_i8(out, attr->number);
+        valid = valid && csm_axdr_wr_enum(out, attr->access_rights);
+    }
+
+    return valid;
+}
+
+static uint32_t db_ber_len_size(uint32_t len)
+{
+    uint32_t size = 1U;
+
+    while (len > 127U)
+    {
+        size++;
+        len >>= 8U;
+    }
+
+    return size;
+}
+
+uint32_t db_cosem_associations_list_size(const csm_db_t *db)
+{
+    uint32_t nb_objects = 0U;
+    uint32_t size = 0U;
+
+    for (uint32_t i = 0U; i < db->size; i++)
+    {
+        const struct db_element *e = &db->el[i];
+        nb_objects += e->nb_objects;
+
+        for (uint32_t j = 0U; j < e->nb_objects; j++)
+        {
+            const db_object_descr *obj = &e->objects[j];
+
+            // structure {class_id, version, logical_name, structure {attributes, methods}}
+            size += 2U + 3U + 2U + 8U + 2U;
+            size += 1U + db_ber_len_size(obj->nb_attr + 1U) + ((obj->nb_attr + 1U) * 7U);
+            size += 1U + db_ber_len_size(obj->nb_meth) + (obj->nb_meth * 6U);
+        }
+    }
+
+    return size + 1U + db_ber_len_size(nb_objects);
+}
+
+static const asso_object_list_cache_t *db_get_object_list_cache(const csm_db_t *db)
+{
+    const asso_object_list_cache_t *cache = NULL;
+
+    for (uint32_t i = 0U; i < DB_NUMBER_OF_LOGICAL_DEVICES; i++)
+    {
+        if (g_object_list_cache[i].db == db)
+        {
+            cache = &g_object_list_cache[i];
+            break;
+        }
+    }
+
+    return cache;
+}
+
+int db_cosem_associations_prepare(const csm_db_t *db, uint8_t *buffer, uint32_t size)
+{
+    asso_object_list_cache_t *cache = NULL;
+    uint32_t list_size = db_cosem_associations_list_size(db);
+    csm_array array;
+    uint32_t nb_objects = 0U;
+
+    db_cosem_associations_invalidate(db);
+
+    for (uint32_t i = 0U; (i < DB_NUMBER_OF_LOGICAL_DEVICES) && (cache == NULL); i++)
+    {
+        if (g_object_list_cache[i].db == NULL)
+        {
+            cache = &g_object_list_cache[i];
+        }
+    }
+
+    int valid = (cache != NULL) && (buffer != NULL) && (list_size <= size);
+
+    if (valid)
+    {
+        csm_array_init(&array, buffer, size, 0U, 0U);
+
+        for (uint32_t i = 0U; i < db->size; i++)
+        {
+            nb_objects += db->el[i].nb_objects;
+        }
+
+        valid = csm_array_write_u8(&array, AXDR_TAG_ARRAY);
+        valid = valid && csm_ber_write_len(&array, nb_objects);
+
+        for (uint32_t i = 0U; (i < db->size) && valid; i++)
+        {
+            const struct db_element *e = &db->el[i];
+            for (uint32_t j = 0U; (j < e->nb_objects) && valid; j++)
+            {
+                valid = db_encode_object(&array, &e->objects[j]);
+            }
+        }
+    }
+
+    if (valid)
+    {
+        cache->db = db;
+        cache->buffer = buffer;
+        cache->size = csm_array_written(&array);
+    }
+    else
+    {
+        CSM_WARN("[DB] Object list of %u bytes not cached in %u bytes, encoded per object", list_size, size);
+    }
+
+    return valid;
+}
+
+void db_cosem_associations_invalidate(const csm_db_t *db)
+{
+    for (uint32_t i = 0U; i < DB_NUMBER_OF_LOGICAL_DEVICES; i++)
+    {
+        if (g_object_list_cache[i].db == db)
+        {
+            g_object_list_cache[i].db = NULL;
+        }
+    }
+}
+
 csm_db_code db_cosem_associations_func(csm_server_context_t *ctx, csm_array *in, csm_array *out)
 {
     csm_db_code code = CSM_ERR_OBJECT_ERROR;
@@ -48,6 +235,38 @@ csm_db_code db_cosem_associations_func(csm_server_context_t *ctx, csm_array *in,
                     return code;
                 }
 
+                const asso_object_list_cache_t *cache = db_get_object_list_cache(ctx->db);
+
+                if (cache != NULL)
+                {
+                    // -------- ONE LOOP == ONE WINDOW OF THE ENCODED LIST --------
+                    if (ctx->asso.state == CSM_RESPONSE_STATE_START)
+                    {
+                        asso_ctx->offset = 0U;
+                        asso_ctx->window = csm_array_free_size(out);
+                        ctx->asso.current_loop = 0;
+                        ctx->asso.nb_loops = (asso_ctx->window > 0U) ? ((cache->size + asso_ctx->window - 1U) / asso_ctx->window) : 0U;
+                    }
+
+                    uint32_t size = cache->size - asso_ctx->offset;
+                    if (size > asso_ctx->window)
+                    {
+                        size = asso_ctx->window;
+                    }
+
+                    if (csm_array_write_buff(out, &cache->buffer[asso_ctx->offset], size))
+                    {
+                        asso_ctx->offset += size;
+                        ctx->asso.current_loop++;
+                    }
+                    else
+                    {
+                        code = CSM_ERR_TEMPORARY_FAILURE;
+                    }
+
+                    return code;
+                }
+
                 // -------- ONE LOOP == ONE OBJECT --------
                 if (ctx->asso.state == CSM_RESPONSE_STATE_START)
                 {
@@ -74,49 +293,7 @@ csm_db_code db_cosem_associations_func(csm_server_context_t *ctx, csm_array *in,
                 const struct db_element *e = &ctx->db->el[asso_ctx->element_idx];
                 const db_object_descr *obj = &e->objects[asso_ctx->object_idx];
 
-                valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
-                valid = valid && csm_ber_write_len(out, 4);
-                
-                valid = valid && csm_axdr_wr_u16(out, obj->class_id);
-                valid = valid && csm_axdr_wr_u8(out, obj->version);
-                valid = valid && csm_axdr_wr_octetstring(out, &obj->obis_code.A, 6U, AXDR_TAG_OCTETSTRING);
-                
-                valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
-                valid = valid && csm_ber_write_len(out, 2);
-
-                // Attributes access rights
-                valid = valid && csm_array_write_u8(out, AXDR_TAG_ARRAY);
-                valid = valid && csm_ber_write_len(out, obj->nb_attr + 1);
-
-                // Auto encode logical name (always attribute 1)
-                valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
-                valid = valid && csm_ber_write_len(out, 3);
-                valid = valid && csm_axdr_wr_i8(out, 1);
-                valid = valid && csm_axdr_wr_enum(out, DB_ACCESS_GET);
-                valid = valid && csm_array_write_u8(out, AXDR_TAG_NULL);
-
-                // Encode the other attributes (id > 1)
-                for (int a  = 0; a < obj->nb_attr; a++)
-                {
-                    const db_attr_descr *attr = &obj->attr_list[a];
-                    valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
-                    valid = valid && csm_ber_write_len(out, 3);
-                    valid = valid && csm_axdr_wr_i8(out, attr->number);
-                    valid = valid && csm_axdr_wr_enum(out, attr->access_rights);
-                    valid = valid && csm_array_write_u8(out, AXDR_TAG_NULL);
-                }
-
-                // Encode the methods
-                valid = valid && csm_array_write_u8(out, AXDR_TAG_ARRAY);
-                valid = valid && csm_ber_write_len(out, obj->nb_meth);
-                for (int a  = 0; a < obj->nb_meth; a++)
-                {
-                    const db_attr_descr *attr = &obj->meth_list[a];
-                    valid = valid && csm_array_write_u8(out, AXDR_TAG_STRUCTURE);
-                    valid = valid && csm_ber_write_len(out, 2);
-                    valid = valid && csm_axdr_wr_i8(out, attr->number);
-                    valid = valid && csm_axdr_wr_enum(out, attr->access_rights);
-                }
+                valid = valid && db_encode_object(out, obj);
 
                 asso_ctx->object_idx++;
                 if (asso_ctx->object_idx >= e->nb_objects)
@@ -10,6 +10,23 @@ extern "C" {
 
 csm_db_code db_cosem_associations_func(csm_server_context_t *ctx, csm_array *in, csm_array *out);
 
+// Size in bytes of the encoded object_list of a logical device, to size the cache buffer
+uint32_t db_cosem_associations_list_size(const csm_db_t *db);
+
+/**
+ * @brief Encode the object_list of a logical device in a buffer provided by the application
+ *
+ * The block transfer then serves windows of this buffer. The cache is only read afterwards,
+ * so several threads can serve the same logical device. Without cache, or if the list does
+ * not fit, the object_list is encoded one object per loop.
+ *
+ * @return TRUE if the object_list is cached
+ */
+int db_cosem_associations_prepare(const csm_db_t *db, uint8_t *buffer, uint32_t size);
+
+// Drop the pre-encoded object_list of a logical device, to prepare again when its object lists change
+void db_cosem_associations_invalidate(const csm_db_t *db);
+
 #ifdef __cplusplus
 }
 #endif
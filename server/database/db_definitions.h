@@ -3,3 +3,7 @@
 #ifndef DB_NUMBER_OF_ASSOCIATIONS
 #define DB_NUMBER_OF_ASSOCIATIONS 4
 #endif
+
+#ifndef DB_NUMBER_OF_LOGICAL_DEVICES
+#define DB_NUMBER_OF_LOGICAL_DEVICES 1
+#endif
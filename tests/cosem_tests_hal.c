@@ -1,6 +1,7 @@
 // Cosem library
 #include "csm_association.h"
 #include "csm_definitions.h"
+#include "csm_ic.h"
 
 // OS/System definitions
 #include "os_util.h"
@@ -32,8 +33,46 @@ static uint8_t system_title[CSM_DEF_APP_TITLE_SIZE] = { 0x4DU, 0x4DU, 0x4DU, 0x0
 //static uint8_t key_kek[16] = { 0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU,0xFFU };
 
 
-// Keep a context by channel to be thread safe
-mbedtls_gcm_context chan_ctx[NUMBER_OF_CHANNELS];
+typedef struct
+{
+    uint8_t sap; //!< Sap number of the association
+    uint8_t guek[16];
+    uint8_t gbek[16];
+    uint8_t gak[16];
+    uint8_t lls_password[CSM_DEF_LLS_MAX_SIZE]; // Password.
+    uint8_t mechanism_id;
+    uint8_t security_policy;
+    uint8_t dek[16];        //!< Dedicated key of the association
+    uint8_t has_dek;
+} cfg_cosem;
+
+cfg_cosem test_conf;
+
+// Keyring of the expanded keys (AES round keys and GHASH tables), per SAP and key id
+#define KEYRING_SIZE    4U
+
+typedef struct
+{
+    mbedtls_gcm_context ctx;    //!< Keyed once, restarted with the IV and AAD of each APDU
+    uint8_t key[16];            //!< Key expanded in ctx, a different key invalidates the entry
+    uint8_t sap;
+    uint8_t key_id;
+    uint8_t valid;
+    uint8_t pinned;             //!< Used by a job of the batch under processing, not replaced
+} keyring_entry;
+
+// One keyring per channel, to be thread safe
+typedef struct
+{
+    keyring_entry entries[KEYRING_SIZE];    // zeroed: initialized contexts (mbedtls_gcm_init)
+    keyring_entry *current;                 //!< Entry of the APDU under ciphering
+    uint8_t next;                           //!< Entry replaced by the next key
+} keyring;
+
+static keyring chan_keyring[NUMBER_OF_CHANNELS];
+
+// Number of key expansions, to check the keyring
+uint32_t csm_sys_key_expansions = 0U;
 
 void csm_sys_set_system_title(const uint8_t *buf)
 {
@@ -41,21 +80,89 @@ void csm_sys_set_system_title(const uint8_t *buf)
 }
 
 
-typedef enum
+int csm_sys_get_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *value)
 {
-    CSM_SEC_IC_CLIENT,
-    CSM_SEC_IC_SERVER,
-} csm_sec_ic;
+    return csm_ic_next(sap, key_id, ic, value);
+}
 
+int csm_sys_check_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t value)
+{
+    return csm_ic_check(sap, key_id, ic, value);
+}
+
+// Persistent memory of the invocation counters, kept by csm_ic_init() to simulate a reset
+typedef struct
+{
+    uint32_t limit;
+    uint8_t sap;
+    uint8_t key_id;
+    uint8_t ic;
+    uint8_t valid;
+} ic_record;
 
-// FIXME: create one pair IC per SAP
-static uint32_t gIc = 0U;
+static ic_record ic_records[CSM_IC_MAX_COUNTERS];
 
-uint32_t csm_sys_get_ic(uint8_t sap, csm_sec_ic ic)
+// Number of writes of the invocation counters, to check the windows
+uint32_t csm_sys_ic_writes = 0U;
+
+// Erases the invocation counters of the persistent memory
+void csm_sys_erase_ic(void)
 {
-    (void) sap;
-    (void) ic;
-    return gIc++;
+    memset(ic_records, 0, sizeof(ic_records));
+    csm_sys_ic_writes = 0U;
+}
+
+static ic_record *ic_find(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic)
+{
+    ic_record *record = NULL;
+
+    for (uint32_t i = 0U; i < CSM_IC_MAX_COUNTERS; i++)
+    {
+        if (ic_records[i].valid && (ic_records[i].sap == sap) && (ic_records[i].key_id == key_id) && (ic_records[i].ic == ic))
+        {
+            record = &ic_records[i];
+            break;
+        }
+    }
+
+    return record;
+}
+
+int csm_sys_load_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t *limit)
+{
+    ic_record *record = ic_find(sap, key_id, ic);
+
+    if (record != NULL)
+    {
+        *limit = record->limit;
+    }
+
+    return (record != NULL) ? TRUE : FALSE;
+}
+
+int csm_sys_store_ic(uint8_t sap, csm_sec_key key_id, csm_sec_ic ic, uint32_t limit)
+{
+    ic_record *record = ic_find(sap, key_id, ic);
+
+    for (uint32_t i = 0U; (record == NULL) && (i < CSM_IC_MAX_COUNTERS); i++)
+    {
+        if (!ic_records[i].valid)
+        {
+            record = &ic_records[i];
+            record->sap = sap;
+            record->key_id = key_id;
+            record->ic = ic;
+            record->valid = TRUE;
+        }
+    }
+
+    if (record != NULL)
+    {
+        record->limit = limit;
+        csm_sys_ic_writes++;
+    }
+
+    return (record != NULL) ? TRUE : FALSE;
 }
 
 const uint8_t *csm_sys_get_system_title()
@@ -66,65 +173,190 @@ const uint8_t *csm_sys_get_system_title()
 uint8_t *csm_sys_get_key(uint8_t sap, csm_sec_key key_id)
 {
     (void) sap; // FIXME: manage one key per SAP in a configuration file
-    (void) key_id;
     uint8_t *key = NULL;
 
-    /*
     switch(key_id)
     {
-    case CSM_SEC_KEK:
-        key = key_kek;
-        break;
     case CSM_SEC_GUEK:
-        key = key_guek;
+        key = test_conf.guek;
         break;
     case CSM_SEC_GBEK:
-        key = key_gbek;
+        key = test_conf.gbek;
         break;
-    default:
     case CSM_SEC_GAK:
-        key = key_gak;
+        key = test_conf.gak;
+        break;
+    case CSM_SEC_DEK:
+        key = test_conf.has_dek ? test_conf.dek : NULL;
+        break;
+    case CSM_SEC_KEK:
+    default:
         break;
     }
-    */
+
     return key;
 }
 
+// Replaces a key of the configuration, a NULL dedicated key removes it
+void csm_sys_set_key(uint8_t sap, csm_sec_key key_id, const uint8_t *key)
+{
+    if (key_id == CSM_SEC_DEK)
+    {
+        test_conf.has_dek = (key != NULL) ? TRUE : FALSE;
+    }
+
+    uint8_t *dest = csm_sys_get_key(sap, key_id);
+
+    if ((dest != NULL) && (key != NULL))
+    {
+        memcpy(dest, key, 16U);
+    }
+}
+
+// One association in the tests: the dedicated key of any channel is the one of the configuration
+void csm_sys_set_dedicated_key(int32_t channel_id, const uint8_t *key)
+{
+    (void) channel_id;
+    csm_sys_set_key(0U, CSM_SEC_DEK, key);
+}
+
+static keyring_entry *keyring_get(int32_t channel_id, uint8_t sap, csm_sec_key key_id)
+{
+    keyring *ring = &chan_keyring[channel_id];
+    const uint8_t *key = csm_sys_get_key(sap, key_id);
+    keyring_entry *entry = NULL;
+
+    for (uint32_t i = 0U; i < KEYRING_SIZE; i++)
+    {
+        if (ring->entries[i].valid && (ring->entries[i].sap == sap) && (ring->entries[i].key_id == key_id))
+        {
+            entry = &ring->entries[i];
+            break;
+        }
+    }
+
+    // NULL when all the entries are pinned by a batch
+    for (uint32_t i = 0U; (entry == NULL) && (i < KEYRING_SIZE); i++)
+    {
+        keyring_entry *victim = &ring->entries[ring->next];
+        ring->next = (ring->next + 1U) % KEYRING_SIZE;
 
-int csm_sys_gcm_init(int8_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
+        if (!victim->pinned)
+        {
+            entry = victim;
+            entry->valid = FALSE;
+            entry->sap = sap;
+            entry->key_id = key_id;
+        }
+    }
+
+    // The key is expanded again only when it has changed
+    if ((entry != NULL) && (key != NULL) && (!entry->valid || (memcmp(entry->key, key, sizeof(entry->key)) != 0)))
+    {
+        entry->valid = (mbedtls_gcm_setkey(&entry->ctx, MBEDTLS_CIPHER_ID_AES, key, 128) == 0) ? TRUE : FALSE;
+        memcpy(entry->key, key, sizeof(entry->key));
+        csm_sys_key_expansions++;
+    }
+
+    // No key (a dedicated key not given): the entry is not used
+    return ((entry != NULL) && (key != NULL) && entry->valid) ? entry : NULL;
+}
+
+int csm_sys_gcm_init(int32_t channel_id, uint8_t sap, csm_sec_key key_id, csm_sec_mode mode, const uint8_t *iv, const uint8_t *aad, uint32_t aad_len)
 {
     int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
-    mbedtls_gcm_init(&chan_ctx[channel_id]);
-    mbedtls_gcm_setkey(&chan_ctx[channel_id], MBEDTLS_CIPHER_ID_AES, csm_sys_get_key(sap, key_id), 128);
-    int res = mbedtls_gcm_starts(&chan_ctx[channel_id], mbed_mode, iv, 12, aad, aad_len);
+    keyring_entry *entry = keyring_get(channel_id, sap, key_id);
+    chan_keyring[channel_id].current = entry;
+
+    int res = (entry != NULL) ? mbedtls_gcm_starts(&entry->ctx, mbed_mode, iv, 12, aad, aad_len) : -1;
     return (res == 0) ? TRUE : FALSE;
 }
 
-int csm_sys_gcm_update(int8_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
+int csm_sys_gcm_update(int32_t channel_id, const uint8_t *plain, uint32_t plain_len, uint8_t *crypt)
 {
-    mbedtls_gcm_update(&chan_ctx[channel_id], plain_len, plain, crypt);
-    return TRUE;
+    keyring_entry *entry = chan_keyring[channel_id].current;
+    int res = (entry != NULL) ? mbedtls_gcm_update(&entry->ctx, plain_len, plain, crypt) : -1;
+    return (res == 0) ? TRUE : FALSE;
 }
 
 // Sizes are total sizes of plain and AAD
-int csm_sys_gcm_finish(int8_t channel_id, uint8_t *tag)
+int csm_sys_gcm_finish(int32_t channel_id, uint8_t *tag)
 {
-    mbedtls_gcm_finish(&chan_ctx[channel_id], tag, 16);
-    return TRUE;
+    keyring_entry *entry = chan_keyring[channel_id].current;
+    int res = (entry != NULL) ? mbedtls_gcm_finish(&entry->ctx, tag, 16) : -1;
+    return (res == 0) ? TRUE : FALSE;
 }
 
-typedef struct
+// Runs a group of jobs, the keyring entries are released
+static int gcm_batch_flush(int mbed_mode, mbedtls_gcm_job *gcm_jobs, csm_sys_gcm_job **jobs, keyring_entry **entries, uint32_t nb)
 {
-    uint8_t sap; //!< Sap number of the association
-    uint8_t guek[16];
-    uint8_t gbek[16];
-    uint8_t gak[16];
-    uint8_t lls_password[CSM_DEF_LLS_MAX_SIZE]; // Password.
-    uint8_t mechanism_id;
-    uint8_t security_policy;
-} cfg_cosem;
+    int res = mbedtls_gcm_crypt_and_tag_batch(mbed_mode, gcm_jobs, nb);
 
-cfg_cosem test_conf;
+    for (uint32_t i = 0U; i < nb; i++)
+    {
+        entries[i]->pinned = FALSE;
+        memcpy(jobs[i]->tag, gcm_jobs[i].tag, sizeof(jobs[i]->tag));
+    }
+
+    return (res == 0) ? TRUE : FALSE;
+}
+
+/**
+ * The jobs are given to mbedtls by groups of MBEDTLS_GCM_BATCH_LANES. The keyring entries of a
+ * group stay pinned until it is processed; if a channel has no entry left, the group is run first.
+ */
+int csm_sys_gcm_batch(csm_sec_key key_id, csm_sec_mode mode, csm_sys_gcm_job *jobs, uint32_t nb_jobs)
+{
+    int mbed_mode = (mode == CSM_SEC_ENCRYPT) ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
+    mbedtls_gcm_job gcm_jobs[MBEDTLS_GCM_BATCH_LANES];
+    csm_sys_gcm_job *group[MBEDTLS_GCM_BATCH_LANES];
+    keyring_entry *entries[MBEDTLS_GCM_BATCH_LANES];
+    uint32_t nb = 0U;
+    int valid = TRUE;
+
+    for (uint32_t i = 0U; (i < nb_jobs) && valid; i++)
+    {
+        csm_sys_gcm_job *job = &jobs[i];
+        keyring_entry *entry = keyring_get(job->channel_id, job->sap, key_id);
+
+        if ((entry == NULL) && (nb > 0U))
+        {
+            valid = gcm_batch_flush(mbed_mode, gcm_jobs, group, entries, nb);
+            nb = 0U;
+            entry = keyring_get(job->channel_id, job->sap, key_id);
+        }
+
+        valid = valid && (entry != NULL);
+
+        if (valid)
+        {
+            entry->pinned = TRUE;
+            entries[nb] = entry;
+            group[nb] = job;
+            gcm_jobs[nb].ctx = &entry->ctx;
+            gcm_jobs[nb].iv = job->iv;
+            gcm_jobs[nb].add = job->aad;
+            gcm_jobs[nb].add_len = job->aad_len;
+            gcm_jobs[nb].input = job->data;
+            gcm_jobs[nb].output = job->data;
+            gcm_jobs[nb].length = job->data_len;
+            nb++;
+
+            if (nb == MBEDTLS_GCM_BATCH_LANES)
+            {
+                valid = gcm_batch_flush(mbed_mode, gcm_jobs, group, entries, nb);
+                nb = 0U;
+            }
+        }
+    }
+
+    if (nb > 0U)
+    {
+        valid = gcm_batch_flush(mbed_mode, gcm_jobs, group, entries, nb) && valid;
+    }
+
+    return valid;
+}
 
 static const uint8_t default_password[CSM_DEF_LLS_MAX_SIZE] = { 0U, 0U, 0U, 0U, 0U, 0U, 0U, 0U };
 
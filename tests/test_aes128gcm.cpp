@@ -1,8 +1,14 @@
 
 #include "gcm.h"
+#include "os_util.h"
+#include "csm_definitions.h"
+#include "csm_security.h"
 #include "catch.hpp"
 #include "string.h"
 
+extern "C" void csm_sys_set_key(uint8_t sap, csm_sec_key key_id, const uint8_t *key);
+extern "C" uint32_t csm_sys_key_expansions;
+
 
 void hexdump(void *ptr, int buflen)
 {
@@ -156,3 +162,262 @@ TEST_CASE("GreenBookHlsMechanism5Vector" , "[Aes128Gcm]")
     free(aad);
 }
 
+
+// The whole buffer given at once (4 blocks path of AES-NI, when available) and block by block give the same result
+TEST_CASE("BulkUpdate", "[Aes128Gcm]")
+{
+    const unsigned char key[32] = {0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08,
+                                   0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+    const unsigned char IV[12] = {0xca,0xfe,0xba,0xbe,0xfa,0xce,0xdb,0xad,0xde,0xca,0xf8,0x88};
+    const unsigned char aad[5] = {0x30,0x01,0x02,0x03,0x04};
+    static const uint32_t sizes[] = { 0U, 15U, 16U, 63U, 64U, 65U, 127U, 128U, 200U, 1000U };
+    static const unsigned int keybits[] = { 128U, 256U };
+
+    unsigned char plaintext[1000];
+    unsigned char bulk[1000];
+    unsigned char blocks[1000];
+    unsigned char bulk_tag[16];
+    unsigned char blocks_tag[16];
+
+    for (uint32_t i = 0U; i < sizeof(plaintext); i++)
+    {
+        plaintext[i] = (unsigned char)(i * 7U + 3U);
+    }
+
+    for (uint32_t k = 0U; k < (sizeof(keybits) / sizeof(keybits[0])); k++)
+    {
+        for (uint32_t s = 0U; s < (sizeof(sizes) / sizeof(sizes[0])); s++)
+        {
+            uint32_t size = sizes[s];
+            mbedtls_gcm_context ctx;
+            mbedtls_gcm_init(&ctx);
+            REQUIRE(mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, keybits[k]) == 0);
+
+            REQUIRE(mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, size, IV, 12, aad, sizeof(aad), plaintext, bulk, 16, bulk_tag) == 0);
+
+            REQUIRE(mbedtls_gcm_starts(&ctx, MBEDTLS_GCM_ENCRYPT, IV, 12, aad, sizeof(aad)) == 0);
+            for (uint32_t i = 0U; i < size; i += 16U)
+            {
+                uint32_t block = ((size - i) > 16U) ? 16U : (size - i);
+                REQUIRE(mbedtls_gcm_update(&ctx, block, &plaintext[i], &blocks[i]) == 0);
+            }
+            REQUIRE(mbedtls_gcm_finish(&ctx, blocks_tag, 16) == 0);
+
+            REQUIRE(memcmp(bulk, blocks, size) == 0);
+            REQUIRE(memcmp(bulk_tag, blocks_tag, 16) == 0);
+
+            // Deciphered in place
+            REQUIRE(mbedtls_gcm_auth_decrypt(&ctx, size, IV, 12, aad, sizeof(aad), bulk_tag, 16, bulk, bulk) == 0);
+            REQUIRE(memcmp(bulk, plaintext, size) == 0);
+
+            mbedtls_gcm_free(&ctx);
+        }
+    }
+
+    // NIST test case 3 in one update: 64 bytes, 4 blocks at once
+    const unsigned char nist_plain[]={0xd9,0x31,0x32,0x25,0xf8,0x84,0x06,0xe5,0xa5,0x59,0x09,0xc5,0xaf,0xf5,0x26,0x9a,0x86,0xa7,0xa9,0x53,0x15,0x34,0xf7,0xda,0x2e,0x4c,0x30,0x3d,0x8a,0x31,0x8a,0x72,0x1c,0x3c,0x0c,0x95,0x95,0x68,0x09,0x53,0x2f,0xcf,0x0e,0x24,0x49,0xa6,0xb5,0x25,0xb1,0x6a,0xed,0xf5,0xaa,0x0d,0xe6,0x57,0xba,0x63,0x7b,0x39,0x1a,0xaf,0xd2,0x55};
+    static const unsigned char expected[] = { 0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6, 0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4 };
+    mbedtls_gcm_context ctx;
+    mbedtls_gcm_init(&ctx);
+    mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 128);
+    REQUIRE(mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, sizeof(nist_plain), IV, 12, NULL, 0, nist_plain, bulk, 16, bulk_tag) == 0);
+    REQUIRE(memcmp(bulk_tag, expected, 16) == 0);
+    mbedtls_gcm_free(&ctx);
+}
+
+static void KeyringCipher(int32_t channel_id, uint8_t sap, csm_sec_key key_id, const unsigned char *IV, const unsigned char *plain, uint32_t size, unsigned char *out, unsigned char *tag)
+{
+    const unsigned char aad[1] = {0x30};
+    REQUIRE(csm_sys_gcm_init(channel_id, sap, key_id, CSM_SEC_ENCRYPT, IV, aad, sizeof(aad)) == TRUE);
+    REQUIRE(csm_sys_gcm_update(channel_id, plain, size, out) == TRUE);
+    REQUIRE(csm_sys_gcm_finish(channel_id, tag) == TRUE);
+}
+
+static void DirectCipher(const unsigned char *key, const unsigned char *IV, const unsigned char *plain, uint32_t size, unsigned char *out, unsigned char *tag)
+{
+    const unsigned char aad[1] = {0x30};
+    mbedtls_gcm_context ctx;
+    mbedtls_gcm_init(&ctx);
+    REQUIRE(mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, 128) == 0);
+    REQUIRE(mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, size, IV, 12, aad, sizeof(aad), plain, out, 16, tag) == 0);
+    mbedtls_gcm_free(&ctx);
+}
+
+// The keys are expanded once per channel, SAP and key id, then again only when they change
+TEST_CASE("Keyring", "[Aes128Gcm]")
+{
+    const unsigned char key1[16] = {0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+    const unsigned char key2[16] = {0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,0x08,0x09,0x0A,0x0B,0x0C,0x0D,0x0E,0x0F};
+    unsigned char IV[12] = {0x4D,0x4D,0x4D,0x00,0x00,0xBC,0x61,0x4E,0x00,0x00,0x00,0x01};
+    unsigned char plain[100];
+    unsigned char out[100], tag[16];
+    unsigned char expected[100], expected_tag[16];
+
+    for (uint32_t i = 0U; i < sizeof(plain); i++)
+    {
+        plain[i] = (unsigned char)i;
+    }
+
+    csm_sys_set_key(1U, CSM_SEC_GUEK, key1);
+    csm_sys_set_key(1U, CSM_SEC_GAK, key2);
+    uint32_t expansions = csm_sys_key_expansions;
+
+    for (uint32_t ic = 1U; ic <= 3U; ic++)
+    {
+        IV[11] = (unsigned char)ic;
+        KeyringCipher(0, 1U, CSM_SEC_GUEK, IV, plain, sizeof(plain), out, tag);
+        DirectCipher(key1, IV, plain, sizeof(plain), expected, expected_tag);
+        REQUIRE(memcmp(out, expected, sizeof(plain)) == 0);
+        REQUIRE(memcmp(tag, expected_tag, 16) == 0);
+    }
+    REQUIRE(csm_sys_key_expansions <= (expansions + 1U));
+    expansions = csm_sys_key_expansions;
+
+    // Another key id, then back to the first one: kept in the keyring
+    KeyringCipher(0, 1U, CSM_SEC_GAK, IV, plain, sizeof(plain), out, tag);
+    DirectCipher(key2, IV, plain, sizeof(plain), expected, expected_tag);
+    REQUIRE(memcmp(tag, expected_tag, 16) == 0);
+    REQUIRE(csm_sys_key_expansions == (expansions + 1U));
+    KeyringCipher(0, 1U, CSM_SEC_GUEK, IV, plain, sizeof(plain), out, tag);
+    REQUIRE(csm_sys_key_expansions == (expansions + 1U));
+
+    // A key change invalidates its entry
+    csm_sys_set_key(1U, CSM_SEC_GUEK, key2);
+    KeyringCipher(0, 1U, CSM_SEC_GUEK, IV, plain, sizeof(plain), out, tag);
+    REQUIRE(csm_sys_key_expansions == (expansions + 2U));
+    REQUIRE(memcmp(out, expected, sizeof(plain)) == 0);
+    REQUIRE(memcmp(tag, expected_tag, 16) == 0);
+
+    // Deciphered on the other channel
+    REQUIRE(csm_sys_gcm_init(1, 1U, CSM_SEC_GUEK, CSM_SEC_DECRYPT, IV, (const uint8_t *)"\x30", 1U) == TRUE);
+    REQUIRE(csm_sys_gcm_update(1, out, sizeof(out), out) == TRUE);
+    REQUIRE(csm_sys_gcm_finish(1, tag) == TRUE);
+    REQUIRE(memcmp(out, plain, sizeof(plain)) == 0);
+    REQUIRE(memcmp(tag, expected_tag, 16) == 0);
+}
+
+// Secured packet SC || IC || information || T, with room before it for the AAD written in place
+static uint32_t BuildSecuredPacket(uint8_t *buf, uint8_t sc, uint32_t ic, const uint8_t *title, const uint8_t *guek, const uint8_t *gak, const uint8_t *info, uint32_t size)
+{
+    uint8_t IV[12];
+    uint8_t aad[17U + 500U];
+    uint8_t tag[16];
+    uint8_t *data = &buf[16U + 5U];
+    uint32_t aad_len = 0U;
+    uint32_t packet_size = 5U + size;
+    csm_sec_control_byte control;
+    control.sh_byte = sc;
+
+    buf[16U] = sc;
+    PUT_BE32(&buf[17U], ic);
+    memcpy(IV, title, CSM_DEF_APP_TITLE_SIZE);
+    PUT_BE32(&IV[CSM_DEF_APP_TITLE_SIZE], ic);
+
+    aad[0] = sc;
+    memcpy(&aad[1], gak, 16U);
+
+    if (control.sh_bit_field.authentication)
+    {
+        aad_len = 17U;
+        if (!control.sh_bit_field.encryption)
+        {
+            memcpy(&aad[17], info, size);
+            aad_len += size;
+        }
+    }
+
+    mbedtls_gcm_context ctx;
+    mbedtls_gcm_init(&ctx);
+    REQUIRE(mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, guek, 128) == 0);
+    REQUIRE(mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, control.sh_bit_field.encryption ? size : 0U,
+                                      IV, 12, aad, aad_len, info, data, 16, tag) == 0);
+    mbedtls_gcm_free(&ctx);
+
+    if (!control.sh_bit_field.encryption)
+    {
+        memcpy(data, info, size);
+    }
+
+    if (control.sh_bit_field.authentication)
+    {
+        memcpy(&data[size], tag, 12U);
+        packet_size += 12U;
+    }
+
+    return packet_size;
+}
+
+// The packets deciphered by batch give the same plain text and results as one by one
+TEST_CASE("BatchDecrypt", "[Aes128Gcm]")
+{
+    const unsigned char guek[16] = {0xfe,0xff,0xe9,0x92,0x86,0x65,0x73,0x1c,0x6d,0x6a,0x8f,0x94,0x67,0x30,0x83,0x08};
+    const unsigned char gak[16] = {0xD0,0xD1,0xD2,0xD3,0xD4,0xD5,0xD6,0xD7,0xD8,0xD9,0xDA,0xDB,0xDC,0xDD,0xDE,0xDF};
+    const uint8_t title[CSM_DEF_APP_TITLE_SIZE] = {0x4D,0x4D,0x4D,0x00,0x00,0xBC,0x61,0x4E};
+    const uint8_t controls[3] = {0x30U, 0x20U, 0x10U}; // E + A, E only, A only
+    const uint32_t nb = 19U;
+    const uint32_t buf_size = 16U + 5U + 500U + 12U;
+
+    static uint8_t plain[19][500];
+    static uint8_t single_buf[19][16U + 5U + 500U + 12U];
+    static uint8_t batch_buf[19][16U + 5U + 500U + 12U];
+    csm_array single_arrays[19], batch_arrays[19];
+    csm_request requests[19];
+    csm_array *arrays[19];
+    csm_request *request_ptrs[19];
+    const uint8_t *titles[19];
+    csm_sec_result results[19];
+    uint32_t sizes[19];
+
+    csm_sys_set_key(1U, CSM_SEC_GUEK, guek);
+    csm_sys_set_key(1U, CSM_SEC_GAK, gak);
+
+    for (uint32_t i = 0U; i < nb; i++)
+    {
+        // Mixed APDU sizes from 50 to 500 bytes; on the first channel, more SAPs than entries in the keyring
+        sizes[i] = 50U + ((i * 97U) % 451U);
+        for (uint32_t j = 0U; j < sizes[i]; j++)
+        {
+            plain[i][j] = (uint8_t)(i + (j * 7U));
+        }
+
+        uint32_t packet_size = BuildSecuredPacket(single_buf[i], controls[i % 3U], 0x100U + i, title, guek, gak, plain[i], sizes[i]);
+        memcpy(batch_buf[i], single_buf[i], buf_size);
+
+        memset(&requests[i], 0, sizeof(csm_request));
+        requests[i].channel_id = (i < 8U) ? 0 : 1;
+        requests[i].llc.dsap = (uint16_t)(1U + (i % 6U));
+
+        csm_array_init(&single_arrays[i], single_buf[i], buf_size, packet_size, 16U);
+        csm_array_init(&batch_arrays[i], batch_buf[i], buf_size, packet_size, 16U);
+        arrays[i] = &batch_arrays[i];
+        request_ptrs[i] = &requests[i];
+        titles[i] = title;
+    }
+
+    // Corrupted tags, E + A and A only
+    single_buf[3][16U + 5U + sizes[3]] ^= 0x01U;
+    batch_buf[3][16U + 5U + sizes[3]] ^= 0x01U;
+    single_buf[5][16U + 5U + sizes[5] + 11U] ^= 0x80U;
+    batch_buf[5][16U + 5U + sizes[5] + 11U] ^= 0x80U;
+
+    REQUIRE(csm_sec_auth_decrypt_batch(arrays, request_ptrs, titles, results, nb) == (nb - 2U));
+
+    for (uint32_t i = 0U; i < nb; i++)
+    {
+        csm_sec_result single = csm_sec_auth_decrypt(&single_arrays[i], &requests[i], title);
+
+        REQUIRE(results[i] == single);
+        REQUIRE(memcmp(single_buf[i], batch_buf[i], buf_size) == 0);
+        REQUIRE(csm_array_rd_current(&batch_arrays[i]) == &batch_buf[i][16U + 5U]);
+
+        if ((i == 3U) || (i == 5U))
+        {
+            REQUIRE(results[i] == CSM_SEC_AUTH_FAILURE);
+        }
+        else
+        {
+            REQUIRE(results[i] == CSM_SEC_OK);
+            REQUIRE(memcmp(&batch_buf[i][16U + 5U], plain[i], sizes[i]) == 0);
+        }
+    }
+}
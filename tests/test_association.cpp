@@ -11,6 +11,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdint>
+#include <vector>
 
 
 static const uint8_t expected_aarq[] = {  0x60U,  0x36U, 0xA1U,   0x09U,   0x06U,   0x07U,  0x60U,  0x85U,
@@ -373,6 +374,25 @@ TEST_CASE("AARQ-DLMS-Cosem-Python-Library", "[AARQ-Decoder]" )
     AARQDecoder(aarq_python_lib, sizeof(aarq_python_lib));
 }
 
+TEST_CASE("AARQ-Conformance", "[AARQ-Decoder]" )
+{
+    csm_asso_state state;
+    csm_array array;
+    uint32_t size = strlen(aarq_python_lib);
+    uint8_t *packet = HexToBin(aarq_python_lib, size);
+
+    csm_sys_init();
+    state.auth_level = CSM_AUTH_LOW_LEVEL;
+    state.ref = LN_REF;
+    csm_array_init(&array, packet, size / 2U, size / 2U, 0U);
+
+    // The three bytes of the bit string follow its unused bits
+    REQUIRE(csm_asso_decoder(&state, &array, CSM_ASSO_AARQ) == TRUE);
+    REQUIRE(state.handshake.proposed_conformance == 0x20525FU);
+    REQUIRE(state.handshake.client_max_receive_pdu_size == 0xFFFFU);
+    free(packet);
+}
+
 static const char aarq_icube_ezreader[] = "6031A1090607608574050801018A0207808B0760857405080201AC058003AAAAAABE10040E01000000065F1F040060FEDFFFFF";
 // LLS with password AAAAAA
 // ICube: https://icube.ch/ezreader/ezreader.html
@@ -387,7 +407,7 @@ TEST_CASE("AARQ-ICube-EZReader", "[AARQ-Decoder]" )
 TEST_CASE("ObjectList", "[OBJECT-ASSOCIATION]" )
 {
     meter_initialize();
-    int8_t channel_id = meter_connect();
+    int32_t channel_id = meter_connect();
 
     REQUIRE(channel_id >= 0);
     // AARQ (association connection) with TCP wrapper
@@ -415,4 +435,94 @@ TEST_CASE("ObjectList", "[OBJECT-ASSOCIATION]" )
 
 }
 
+// Event loop of the TCP server, faked: values posted and replies sent
+static std::vector<std::pair<int32_t, int>> posted;
+static std::vector<std::vector<uint8_t>> sent;
+
+static int FakePost(int32_t channel_id, int value)
+{
+    posted.push_back({ channel_id, value });
+    return 0;
+}
+
+static int FakeSend(int32_t channel_id, const csm_chain *data)
+{
+    (void) channel_id;
+    std::vector<uint8_t> packet(data->size);
+    REQUIRE(csm_chain_copy(data, packet.data(), data->size) == data->size);
+    sent.push_back(packet);
+    return (int)data->size;
+}
+
+// Passes a WPDU to the chain handler then runs the values posted, returns the APDUs sent
+static std::vector<std::vector<uint8_t>> LoopRequest(int32_t channel_id, const std::string &wpdu)
+{
+    uint8_t buffer[2048];
+    uint8_t *packet = HexToBin(wpdu.c_str(), wpdu.size());
+    csm_chain reply;
+
+    memcpy(buffer, packet, wpdu.size() / 2U);
+    free(packet);
+    sent.clear();
+
+    // Queued for the scheduler: nothing to reply at once
+    REQUIRE(meter_tcp_chain_handler(channel_id, buffer, wpdu.size() / 2U, sizeof(buffer), &reply) == 0);
+    while (!posted.empty())
+    {
+        std::pair<int32_t, int> item = posted.front();
+        posted.erase(posted.begin());
+        meter_posted(item.first, item.second);
+    }
+
+    for (std::vector<uint8_t> &apdu : sent)
+    {
+        apdu.erase(apdu.begin(), apdu.begin() + 8);
+    }
+    return sent;
+}
+
+TEST_CASE("ObjectListScheduled", "[OBJECT-ASSOCIATION]" )
+{
+    meter_initialize();
+    meter_set_poster(FakePost);
+    meter_set_sender(FakeSend);
+    int32_t channel_id = meter_connect();
+    REQUIRE(channel_id >= 0);
+
+    // Client receiving 64 bytes at most, without general block transfer: the object list is read by block
+    std::vector<std::vector<uint8_t>> replies = LoopRequest(channel_id, "000100100001001F601DA109060760857405080101BE10040E01000000065F1F040042FEDF0040");
+    REQUIRE(replies.size() == 1U);
+    REQUIRE(replies[0][0] == 0x61U);
+
+    replies = LoopRequest(channel_id, "000100100001000DC001C1000F0000280000FF0200");
+    uint32_t nb_blocks = 1U;
+    uint32_t nb_prefetched = 0U;
+    while ((replies.size() == 1U) && (replies[0][1] == 0x02U) && (replies[0][3] == 0x00U))
+    {
+        // The last block of a loop is sent by the scheduler: the next loop is read while the client gets it
+        const csm_server_context_t *ctx = meter_context(channel_id);
+        REQUIRE(ctx != NULL);
+        if (ctx->asso.state == CSM_RESPONSE_STATE_NEXT_LOOP)
+        {
+            REQUIRE(ctx->asso.prefetched == TRUE);
+            nb_prefetched++;
+        }
+
+        char next[64];
+        snprintf(next, sizeof(next), "0001001000010007C002C1%02X%02X%02X%02X", replies[0][4], replies[0][5], replies[0][6], replies[0][7]);
+        replies = LoopRequest(channel_id, next);
+        nb_blocks++;
+    }
+
+    // Last block
+    REQUIRE(replies.size() == 1U);
+    REQUIRE(replies[0][1] == 0x02U);
+    REQUIRE(replies[0][3] == 0x01U);
+    REQUIRE(nb_blocks > 1U);
+    REQUIRE(nb_prefetched > 0U);
+    REQUIRE(meter_context(channel_id)->asso.prefetched == FALSE);
 
+    meter_disconnect(channel_id);
+    meter_set_sender(NULL);
+    meter_set_poster(NULL);
+}
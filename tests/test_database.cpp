@@ -0,0 +1,131 @@
+extern "C" {
+#include "app_database.h"
+}
+
+#include "catch.hpp"
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+static const db_attr_descr test_attributes[] = {
+    {DB_ACCESS_GET, DB_TYPE_OCTET_STRING},
+};
+
+// Synthetic logical device with a generated list of data objects
+class TestDatabase
+{
+public:
+    explicit TestDatabase(uint32_t nb_objects)
+        : objects(nb_objects)
+        , index(IndexSize(nb_objects))
+    {
+        for (uint32_t i = 0U; i < nb_objects; i++)
+        {
+            db_object_descr &obj = objects[i];
+            obj.attr_list = test_attributes;
+            obj.meth_list = nullptr;
+            obj.class_id = 1U + (i % 3U);
+            obj.obis_code = { 0U, 0U, 96U, (uint8_t)(i >> 16U), (uint8_t)(i >> 8U), (uint8_t)i };
+            obj.version = 0U;
+            obj.nb_attr = 1U;
+            obj.nb_meth = 0U;
+        }
+
+        element.objects = objects.data();
+        element.handler = nullptr;
+        element.nb_objects = nb_objects;
+
+        db.el = &element;
+        db.size = 1U;
+        db.logical_device = 1U;
+        db.index = nullptr;
+        db.index_size = 0U;
+    }
+
+    static uint32_t IndexSize(uint32_t nb_objects)
+    {
+        uint32_t size = 1U;
+        while (size < (2U * nb_objects))
+        {
+            size <<= 1U;
+        }
+        return size;
+    }
+
+    csm_object_t Name(uint32_t i) const
+    {
+        csm_object_t ln = {};
+        ln.class_id = objects[i].class_id;
+        ln.obis = objects[i].obis_code;
+        ln.id = 2;
+        return ln;
+    }
+
+    std::vector<db_object_descr> objects;
+    std::vector<db_index_entry> index;
+    struct db_element element;
+    csm_db_t db;
+};
+
+TEST_CASE("DatabaseIndex", "[database]")
+{
+    TestDatabase test(1000U);
+
+    REQUIRE(csm_db_index_build(&test.db, test.index.data(), test.index.size()) == TRUE);
+
+    for (uint32_t i = 0U; i < test.objects.size(); i++)
+    {
+        db_obj_handle handle;
+        csm_object_t ln = test.Name(i);
+        REQUIRE(csm_db_find_object(&test.db, &ln, &handle) == TRUE);
+        REQUIRE(handle.object == &test.objects[i]);
+        REQUIRE(handle.db_index == 0U);
+        REQUIRE(handle.obj_index == i);
+    }
+
+    // Same OBIS code, other class id
+    csm_object_t ln = test.Name(10U);
+    ln.class_id = 8U;
+    db_obj_handle handle;
+    REQUIRE(csm_db_find_object(&test.db, &ln, &handle) == FALSE);
+
+    // The index needs at least one free slot
+    REQUIRE(csm_db_index_build(&test.db, test.index.data(), 512U) == FALSE);
+    REQUIRE(test.db.index == nullptr);
+    // Not a power of two
+    REQUIRE(csm_db_index_build(&test.db, test.index.data(), 1500U) == FALSE);
+
+    // Linear search fallback gives the same results
+    ln = test.Name(999U);
+    REQUIRE(csm_db_find_object(&test.db, &ln, &handle) == TRUE);
+    REQUIRE(handle.obj_index == 999U);
+}
+
+static double MeasureLookup(TestDatabase &test, uint32_t loops)
+{
+    uint32_t found = 0U;
+    db_obj_handle handle;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t l = 0U; l < loops; l++)
+    {
+        csm_object_t ln = test.Name(l % test.objects.size());
+        found += csm_db_find_object(&test.db, &ln, &handle);
+    }
+    auto stop = std::chrono::steady_clock::now();
+    REQUIRE(found == loops);
+    return std::chrono::duration<double, std::nano>(stop - start).count() / loops;
+}
+
+TEST_CASE("DatabaseLookupBenchmark", "[.benchmark][database]")
+{
+    for (uint32_t nb_objects : {10U, 100U, 1000U, 10000U})
+    {
+        TestDatabase test(nb_objects);
+        double linear = MeasureLookup(test, 20000U);
+
+        REQUIRE(csm_db_index_build(&test.db, test.index.data(), test.index.size()) == TRUE);
+        double hashed = MeasureLookup(test, 20000U);
+
+        std::cout << nb_objects << " objects: linear " << linear << " ns/lookup, hashed " << hashed << " ns/lookup" << std::endl;
+    }
+}
@@ -1,11 +1,14 @@
 
 #include "os_util.h"
 #include "hdlc.h"
+#include "hdlc_server.h"
 
 #include "catch.hpp"
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
+#include <algorithm>
 
 
 // Quick simple tests to checks that the clock is working in nominal way
@@ -244,6 +247,452 @@ void InformationDecoder()
 }
 
 
+static uint8_t reply_apdu[1000];
+static uint32_t reply_size = 300U;
+static const uint8_t *request_apdu = NULL;
+static uint32_t request_size = 0U;
+
+// Echoes the size of the request in a long reply, to be segmented
+static int LinkHandler(int32_t channel_id, uint8_t *apdu, uint32_t size, uint32_t buffer_size, csm_chain *reply)
+{
+    (void) channel_id;
+    (void) buffer_size;
+    int ret = 0;
+
+    if (apdu != NULL)
+    {
+        request_apdu = apdu;
+        request_size = size;
+        for (uint32_t i = 0U; i < reply_size; i++)
+        {
+            reply_apdu[i] = (uint8_t)(i + size);
+        }
+        csm_chain_append(reply, reply_apdu, reply_size);
+        ret = (int)reply->size;
+    }
+    return ret;
+}
+
+void ServerLink()
+{
+    static const uint8_t request[] = { 0xE6U, 0xE6U, 0x00U, 0xC0U, 0x01U, 0xC1U, 0x00U, 0x08U };
+    uint8_t link_buffer[512];
+    uint8_t frame[256];
+    uint8_t out[256];
+    std::string received;
+
+    hdlc_server srv;
+    hdlc_server_init(&srv, 0, 17U, link_buffer, sizeof(link_buffer), LinkHandler);
+
+    hdlc_t client;
+    hdlc_init(&client);
+    client.sender = HDLC_CLIENT;
+    client.client_addr = 16U;
+    client.addr_len = 4U;
+    client.logical_device = 1U;
+    client.phy_address = 17U;
+
+    // I frame before the connection: DM
+    int size = hdlc_encode_data(&client, frame, sizeof(frame), request, sizeof(request));
+    int ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(ret > 0);
+    hdlc_t rx = client;
+    rx.sender = HDLC_SERVER;
+    REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+    REQUIRE(rx.type == HDLC_PACKET_TYPE_DM);
+
+    // Frames for another physical address are ignored
+    client.phy_address = 18U;
+    size = hdlc_encode_snrm(&client, frame, sizeof(frame));
+    REQUIRE(hdlc_server_input(&srv, frame, size, out, sizeof(out)) == 0);
+    client.phy_address = 17U;
+
+    // SNRM: UA with the parameters of the server
+    size = hdlc_encode_snrm(&client, frame, sizeof(frame));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(ret > 0);
+    REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+    REQUIRE(rx.type == HDLC_PACKET_TYPE_UA);
+    REQUIRE(rx.client_addr == 16U);
+    REQUIRE(hdlc_decode_info_field(&rx, &out[rx.data_index], rx.data_size) == HDLC_OK);
+    REQUIRE(rx.max_info_field_tx == 128U);
+    REQUIRE(rx.max_info_field_rx == 128U);
+    REQUIRE(rx.window_tx == 1U);
+    REQUIRE(srv.state == HDLC_STATE_NRM);
+
+    // Request: the reply comes in 3 I frames, the next one on each RR
+    client.sss = 0U;
+    client.rrr = 0U;
+    size = hdlc_encode_data(&client, frame, sizeof(frame), request, sizeof(request));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+
+    uint32_t frames = 0U;
+    bool last = false;
+    while (!last)
+    {
+        REQUIRE(ret > 0);
+        REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+        REQUIRE(rx.type == HDLC_PACKET_TYPE_I);
+        REQUIRE(rx.sss == (frames & 7U));
+        REQUIRE(rx.rrr == 1U);
+        REQUIRE(rx.poll_final == 1U);
+        REQUIRE(rx.data_size <= 128U);
+        received.append((const char *)&out[rx.data_index], rx.data_size);
+        frames++;
+        last = (rx.segmentation == 0U);
+
+        if (!last)
+        {
+            if (frames == 2U)
+            {
+                // Lost frame: the RR does not acknowledge it, the server sends it again
+                client.rrr = 1U;
+                size = hdlc_encode_rr(&client, frame, sizeof(frame));
+                ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+                REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+                REQUIRE(rx.sss == 1U);
+            }
+            client.rrr = (rx.sss + 1U) & 7U;
+            size = hdlc_encode_rr(&client, frame, sizeof(frame));
+            ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+        }
+    }
+
+    REQUIRE(frames == 3U);
+    REQUIRE(received.size() == (reply_size + 3U));
+    REQUIRE((uint8_t)received[0] == 0xE6U);
+    REQUIRE((uint8_t)received[1] == 0xE7U);
+    REQUIRE((uint8_t)received[2] == 0x00U);
+    REQUIRE((uint8_t)received[3] == (uint8_t)(sizeof(request) - 3U));
+    REQUIRE(memcmp(&received[3], reply_apdu, reply_size) == 0);
+
+    // Nothing left: RR
+    client.rrr = 3U;
+    size = hdlc_encode_rr(&client, frame, sizeof(frame));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+    REQUIRE(rx.type == HDLC_PACKET_TYPE_RR);
+    REQUIRE(rx.rrr == 1U);
+
+    // DISC: UA, then back to the disconnected mode
+    size = hdlc_encode(&client, frame, sizeof(frame), 0x53U, NULL, 0U);
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+    REQUIRE(rx.type == HDLC_PACKET_TYPE_UA);
+    REQUIRE(srv.state == HDLC_STATE_NDM);
+}
+
+// Splits the frames sent in one window
+static std::vector<hdlc_t> DecodeWindow(const uint8_t *out, int size)
+{
+    std::vector<hdlc_t> frames;
+    int pos = 0;
+
+    while (pos < size)
+    {
+        hdlc_t rx;
+        hdlc_init(&rx);
+        rx.sender = HDLC_SERVER;
+        REQUIRE(hdlc_decode(&rx, &out[pos], size - pos) == HDLC_OK);
+        rx.data_index += pos;
+        frames.push_back(rx);
+        pos += rx.frame_size;
+    }
+    return frames;
+}
+
+void ServerWindow()
+{
+    static const uint8_t request[] = { 0xE6U, 0xE6U, 0x00U, 0xC0U, 0x01U, 0xC1U, 0x00U, 0x08U };
+    uint8_t link_buffer[1024];
+    uint8_t frame[256];
+    uint8_t out[7U * (128U + HDLC_FRAME_OVERHEAD)];
+    std::string received;
+
+    hdlc_server srv;
+    hdlc_server_init(&srv, 0, 17U, link_buffer, sizeof(link_buffer), LinkHandler);
+    srv.max_window = 7U;
+    reply_size = 900U; // 8 frames with the LLC
+
+    hdlc_t client;
+    hdlc_init(&client);
+    client.sender = HDLC_CLIENT;
+    client.client_addr = 16U;
+    client.addr_len = 4U;
+    client.logical_device = 1U;
+    client.phy_address = 17U;
+
+    // The SNRM of the client proposes to receive 7 frames
+    int size = hdlc_encode_snrm(&client, frame, sizeof(frame));
+    int ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(ret > 0);
+    REQUIRE(srv.hdlc.window_tx == 7U);
+    REQUIRE(srv.hdlc.window_rx == 1U);
+
+    size = hdlc_encode_data(&client, frame, sizeof(frame), request, sizeof(request));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+
+    // First window: 7 frames, the F bit on the last one
+    std::vector<hdlc_t> frames = DecodeWindow(out, ret);
+    REQUIRE(frames.size() == 7U);
+    for (uint32_t i = 0U; i < frames.size(); i++)
+    {
+        REQUIRE(frames[i].type == HDLC_PACKET_TYPE_I);
+        REQUIRE(frames[i].sss == i);
+        REQUIRE(frames[i].segmentation == 1U);
+        REQUIRE(frames[i].poll_final == ((i == 6U) ? 1U : 0U));
+    }
+
+    // Frame 2 lost: the frames 0 and 1 are kept, the RR asks again from 2
+    received.append((const char *)&out[frames[0].data_index], frames[0].data_size);
+    received.append((const char *)&out[frames[1].data_index], frames[1].data_size);
+    client.rrr = 2U;
+    size = hdlc_encode_rr(&client, frame, sizeof(frame));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+
+    frames = DecodeWindow(out, ret);
+    REQUIRE(frames.size() == 6U);
+    for (uint32_t i = 0U; i < frames.size(); i++)
+    {
+        REQUIRE(frames[i].sss == ((2U + i) & 7U));
+        received.append((const char *)&out[frames[i].data_index], frames[i].data_size);
+    }
+    REQUIRE(frames.back().segmentation == 0U);
+    REQUIRE(frames.back().poll_final == 1U);
+
+    REQUIRE(received.size() == (reply_size + 3U));
+    REQUIRE(memcmp(&received[3], reply_apdu, reply_size) == 0);
+
+    // The whole reply is acknowledged: nothing left
+    client.rrr = 0U;
+    size = hdlc_encode_rr(&client, frame, sizeof(frame));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    frames = DecodeWindow(out, ret);
+    REQUIRE(frames.size() == 1U);
+    REQUIRE(frames[0].type == HDLC_PACKET_TYPE_RR);
+
+    // Next request, N(S) continues from 0
+    client.sss = 1U;
+    size = hdlc_encode_data(&client, frame, sizeof(frame), request, sizeof(request));
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    frames = DecodeWindow(out, ret);
+    REQUIRE(frames.size() == 7U);
+    REQUIRE(frames[0].sss == 0U);
+    REQUIRE(frames[0].rrr == 2U);
+
+    reply_size = 300U;
+}
+
+void ServerLargeFrames()
+{
+    uint8_t request[700];
+    uint8_t link_buffer[1024];
+    uint8_t frame[2100];
+    uint8_t out[2100];
+
+    hdlc_server srv;
+    hdlc_server_init(&srv, 0, 17U, link_buffer, sizeof(link_buffer), LinkHandler);
+    srv.max_info_field = HDLC_MAX_INFO_SIZE;
+    reply_size = 1000U;
+
+    hdlc_t client;
+    hdlc_init(&client);
+    client.sender = HDLC_CLIENT;
+    client.client_addr = 16U;
+    client.addr_len = 4U;
+    client.logical_device = 1U;
+    client.phy_address = 17U;
+    client.max_info_field_tx = 512U;
+    client.max_info_field_rx = 4000U; // more than the frame can hold
+
+    // SNRM generated from the parameters, lengths on 2 bytes
+    int size = hdlc_encode_snrm(&client, frame, sizeof(frame));
+    hdlc_t rx;
+    hdlc_init(&rx);
+    rx.sender = HDLC_CLIENT;
+    REQUIRE(hdlc_decode(&rx, frame, size) == HDLC_OK);
+    REQUIRE(hdlc_decode_info_field(&rx, &frame[rx.data_index], rx.data_size) == HDLC_OK);
+    REQUIRE(rx.max_info_field_tx == 512U);
+    REQUIRE(rx.max_info_field_rx == 4000U);
+    REQUIRE(rx.window_rx == 7U);
+
+    int ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(ret > 0);
+    REQUIRE(srv.hdlc.max_info_field_rx == 512U);
+    REQUIRE(srv.hdlc.max_info_field_tx == HDLC_MAX_INFO_SIZE);
+
+    // Request of 700 bytes with its LLC: 2 segments, gathered in the buffer of the link
+    request[0] = 0xE6U;
+    request[1] = 0xE6U;
+    request[2] = 0x00U;
+    for (uint32_t i = 3U; i < sizeof(request); i++)
+    {
+        request[i] = (uint8_t)i;
+    }
+
+    client.segmentation = 1U;
+    size = hdlc_encode_data(&client, frame, sizeof(frame), request, 512U);
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    hdlc_init(&rx);
+    rx.sender = HDLC_SERVER;
+    REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+    REQUIRE(rx.type == HDLC_PACKET_TYPE_RR);
+    REQUIRE(rx.rrr == 1U);
+
+    client.sss = 1U;
+    client.segmentation = 0U;
+    size = hdlc_encode_data(&client, frame, sizeof(frame), &request[512], sizeof(request) - 512U);
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(request_size == (sizeof(request) - 3U));
+    REQUIRE(request_apdu == &link_buffer[3]);
+    REQUIRE(memcmp(request_apdu, &request[3], request_size) == 0);
+
+    // The reply of 1003 bytes fits in one frame, length over 8 bits
+    REQUIRE(ret == (int)hdlc_frame_length(&srv.hdlc, 1003U));
+    REQUIRE(hdlc_frame_size(out, ret) == ret);
+    REQUIRE(hdlc_decode(&rx, out, ret) == HDLC_OK);
+    REQUIRE(rx.type == HDLC_PACKET_TYPE_I);
+    REQUIRE(rx.segmentation == 0U);
+    REQUIRE(rx.data_size == 1003U);
+    REQUIRE(memcmp(&out[rx.data_index + 3U], reply_apdu, reply_size) == 0);
+
+    // Short request in one frame: executed in place
+    client.sss = 2U;
+    client.rrr = 1U;
+    size = hdlc_encode_data(&client, frame, sizeof(frame), request, 20U);
+    ret = hdlc_server_input(&srv, frame, size, out, sizeof(out));
+    REQUIRE(ret > 0);
+    REQUIRE(request_size == 17U);
+    REQUIRE(request_apdu == &frame[size - 3 - 17]);
+
+    reply_size = 300U;
+}
+
+void FrameFinder()
+{
+    static const uint8_t rr[] = { 0x7EU, 0xA0U, 0x0AU, 0x00U, 0x02U, 0x00U, 0x25U, 0x07U, 0xB1U, 0x32U, 0xD2U, 0x7EU };
+
+    REQUIRE(hdlc_frame_size(rr, 2U) == 0);
+    REQUIRE(hdlc_frame_size(rr, sizeof(rr) - 1U) == 0);
+    REQUIRE(hdlc_frame_size(rr, sizeof(rr)) == (int)sizeof(rr));
+    REQUIRE(hdlc_frame_size(&rr[1], sizeof(rr) - 1U) == -1);
+
+    // Length on 11 bits
+    static const uint8_t big[] = { 0x7EU, 0xA1U, 0x02U };
+    REQUIRE(hdlc_frame_size(big, sizeof(big)) == 0);
+}
+
+
+// Bit by bit CRC-16/X.25, reference of the table driven one
+static uint16_t BitwiseFcs(uint16_t fcs, const uint8_t *data, uint32_t size)
+{
+    for (uint32_t i = 0U; i < size; i++)
+    {
+        fcs ^= data[i];
+        for (uint32_t bit = 0U; bit < 8U; bit++)
+        {
+            fcs = (fcs & 1U) ? ((fcs >> 1U) ^ 0x8408U) : (fcs >> 1U);
+        }
+    }
+    return fcs;
+}
+
+// Feeds the stream by chunks of chunk_size bytes, returns the frames found
+static std::vector<std::vector<uint8_t>> Deframe(hdlc_deframer *def, const std::vector<uint8_t> &stream, uint32_t chunk_size)
+{
+    std::vector<std::vector<uint8_t>> frames;
+    uint32_t index = 0U;
+
+    while (index < stream.size())
+    {
+        uint32_t size = std::min<uint32_t>(chunk_size, (uint32_t)stream.size() - index);
+        while (size > 0U)
+        {
+            uint32_t used = 0U;
+            int frame = hdlc_deframer_push(def, &stream[index], size, &used);
+            REQUIRE(used <= size);
+            if (frame > 0)
+            {
+                frames.push_back(std::vector<uint8_t>(def->buffer, def->buffer + frame));
+            }
+            index += used;
+            size -= used;
+        }
+    }
+    return frames;
+}
+
+void Deframer()
+{
+    // Slicing-by-8 against the bit by bit computation, all the tails
+    uint8_t random[256];
+    srand(42);
+    for (uint32_t i = 0U; i < sizeof(random); i++)
+    {
+        random[i] = (uint8_t)rand();
+    }
+    for (uint32_t size = 0U; size <= 40U; size++)
+    {
+        REQUIRE(pppfcs16(PPPINITFCS16, &random[size], size) == BitwiseFcs(PPPINITFCS16, &random[size], size));
+    }
+    REQUIRE(pppfcs16(0x1234U, random, sizeof(random)) == BitwiseFcs(0x1234U, random, sizeof(random)));
+
+    static const char multi_frames[] = "7EA88C0300020023421CB9E6E700C401C10001010205020209060000600100FF0A08736E303030303030020509060100628601FF1224D502020F001604020211001101090C07E10A19030D1813FF8000FF01010206020309060101020800FF060000000002020F03161E020309060101010800FF060000000002020F03161E020309060101050800FF060096CC7E7EA88C0300020023442ADC00000002020F001620020309060101060800FF060000000002020F001620020309060101070800FF060000000002020F001620020309060101080800FF060000000002020F00162001010201020509060101010801FF060000000002020F00161E0000010102020906000062853DFF0105020312000002020F00161B090C07E1EED87E7EA07A030002002356990D0A19FF0D1813FF8000FF020312000002020F00161B090C07E10A19FF0D1503FF8000FF020312000002020F00161B090C07C80106FF161E00FF8000FF020312000002020F00161B090C07C80106FF160F00FF8000FF020312000002020F00161B090C07C80106FF160000FF8000FF05B47E";
+    static const uint8_t rr[] = { 0x7EU, 0xA0U, 0x0AU, 0x00U, 0x02U, 0x00U, 0x25U, 0x07U, 0xB1U, 0x32U, 0xD2U, 0x7EU };
+    static const uint8_t noise[] = { 0x00U, 0xFFU, 0x12U };
+
+    std::vector<uint8_t> frames_bin(sizeof(multi_frames) / 2U);
+    hex2bin(multi_frames, (char *)frames_bin.data(), sizeof(multi_frames));
+    std::vector<uint8_t> first(frames_bin.begin(), frames_bin.begin() + 142);
+
+    // Noise, three frames (the third one shares its flag with an RR), a corrupted frame, a good one
+    std::vector<uint8_t> stream(noise, noise + sizeof(noise));
+    stream.insert(stream.end(), frames_bin.begin(), frames_bin.end() - 1);
+    stream.insert(stream.end(), rr, rr + sizeof(rr));
+    std::vector<uint8_t> corrupted = first;
+    corrupted[100] ^= 0x01U;
+    stream.insert(stream.end(), corrupted.begin(), corrupted.end());
+    stream.insert(stream.end(), first.begin(), first.end());
+
+    uint8_t buffer[256];
+    static const uint32_t chunks[] = { 1U, 2U, 5U, 8U, 13U, 64U, 1000U };
+
+    for (uint32_t c = 0U; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+    {
+        hdlc_deframer def;
+        hdlc_deframer_init(&def, buffer, sizeof(buffer));
+
+        std::vector<std::vector<uint8_t>> frames = Deframe(&def, stream, chunks[c]);
+
+        REQUIRE(frames.size() == 5U);
+        REQUIRE(frames[0] == first);
+        REQUIRE(frames[1] == std::vector<uint8_t>(frames_bin.begin() + 142, frames_bin.begin() + 284));
+        REQUIRE(frames[2] == std::vector<uint8_t>(frames_bin.begin() + 284, frames_bin.end()));
+        REQUIRE(frames[3] == std::vector<uint8_t>(rr, rr + sizeof(rr)));
+        REQUIRE(frames[4] == first);
+        REQUIRE(def.errors == 1U);
+
+        // The frames given are those accepted by the decoder
+        hdlc_t hdlc;
+        hdlc_init(&hdlc);
+        REQUIRE(hdlc_decode(&hdlc, frames[2].data(), (uint16_t)frames[2].size()) == HDLC_OK);
+    }
+
+    // Bad HCS: the frame is dropped before its end
+    hdlc_deframer def;
+    hdlc_deframer_init(&def, buffer, sizeof(buffer));
+    std::vector<uint8_t> bad_hcs = first;
+    bad_hcs[9] ^= 0x80U;
+    uint32_t used = 0U;
+    REQUIRE(hdlc_deframer_push(&def, bad_hcs.data(), 12U, &used) == 0);
+    REQUIRE(def.errors == 1U);
+    REQUIRE(def.state == HDLC_DEFRAMER_HUNT);
+
+    // Frame larger than the buffer
+    hdlc_deframer_init(&def, buffer, 100U);
+    REQUIRE(Deframe(&def, first, 1000U).empty());
+    REQUIRE(def.errors == 1U);
+}
 
 TEST_CASE( "HDLC1", "[Streaming]" )
 {
@@ -275,5 +724,32 @@ TEST_CASE( "HDLC5", "[INFO]" )
     InformationDecoder();
 }
 
+TEST_CASE( "HDLC6", "[SERVER]" )
+{
+    puts("\r\n--------------------------  HDLC TEST 6  --------------------------\r\n");
+    ServerLink();
+}
 
+TEST_CASE( "HDLC7", "[FRAMES]" )
+{
+    puts("\r\n--------------------------  HDLC TEST 7  --------------------------\r\n");
+    FrameFinder();
+}
+
+TEST_CASE( "HDLC8", "[WINDOW]" )
+{
+    puts("\r\n--------------------------  HDLC TEST 8  --------------------------\r\n");
+    ServerWindow();
+}
 
+TEST_CASE( "HDLC9", "[INFO FIELD]" )
+{
+    puts("\r\n--------------------------  HDLC TEST 9  --------------------------\r\n");
+    ServerLargeFrames();
+}
+
+TEST_CASE( "HDLC10", "[DEFRAMER]" )
+{
+    puts("\r\n--------------------------  HDLC TEST 10  --------------------------\r\n");
+    Deframer();
+}
@@ -0,0 +1,99 @@
+extern "C" {
+#include "csm_ic.h"
+#include "csm_definitions.h"
+
+// Test HAL: persistent memory of the invocation counters
+extern uint32_t csm_sys_ic_writes;
+void csm_sys_erase_ic(void);
+}
+
+#include "catch.hpp"
+
+static const uint8_t cSap = 0x20U;
+
+TEST_CASE("IcWindows", "[ic]")
+{
+    csm_sys_erase_ic();
+    csm_ic_init();
+
+    // One write per window of values given
+    uint32_t value = 0xFFFFFFFFU;
+    for (uint32_t i = 0U; i < ((2U * CSM_IC_WINDOW) + 1U); i++)
+    {
+        REQUIRE(csm_ic_next(cSap, CSM_SEC_GUEK, CSM_SEC_IC_SERVER, &value) == TRUE);
+        REQUIRE(value == i);
+    }
+    REQUIRE(csm_sys_ic_writes == 3U);
+
+    // After a reset, the counter resumes at the end of the window
+    csm_ic_init();
+    REQUIRE(csm_ic_next(cSap, CSM_SEC_GUEK, CSM_SEC_IC_SERVER, &value) == TRUE);
+    REQUIRE(value == (3U * CSM_IC_WINDOW));
+    REQUIRE(csm_sys_ic_writes == 4U);
+
+    // The counters of the other keys and SAPs are independent
+    REQUIRE(csm_ic_next(cSap, CSM_SEC_DEK, CSM_SEC_IC_SERVER, &value) == TRUE);
+    REQUIRE(value == 0U);
+    REQUIRE(csm_ic_next(cSap + 1U, CSM_SEC_GUEK, CSM_SEC_IC_SERVER, &value) == TRUE);
+    REQUIRE(value == 0U);
+}
+
+TEST_CASE("IcReplay", "[ic]")
+{
+    csm_sys_erase_ic();
+    csm_ic_init();
+
+    // Increasing values are accepted, gaps included
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 0U) == TRUE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 1U) == TRUE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 10U) == TRUE);
+    REQUIRE(csm_sys_ic_writes == 1U);
+
+    // Replays
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 10U) == FALSE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 5U) == FALSE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 11U) == TRUE);
+
+    // A jump beyond the window reserves a new one from there
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 5000U) == TRUE);
+    REQUIRE(csm_sys_ic_writes == 2U);
+
+    // After a reset, the values of the window that may have been received are refused
+    csm_ic_init();
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 5001U) == FALSE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 5001U + CSM_IC_WINDOW - 1U) == FALSE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GUEK, CSM_SEC_IC_CLIENT, 5001U + CSM_IC_WINDOW) == TRUE);
+
+    // The counter of the server is another one
+    uint32_t value = 0U;
+    REQUIRE(csm_ic_next(cSap, CSM_SEC_GUEK, CSM_SEC_IC_SERVER, &value) == TRUE);
+    REQUIRE(value == 0U);
+}
+
+TEST_CASE("IcExhausted", "[ic]")
+{
+    csm_sys_erase_ic();
+    csm_ic_init();
+
+    // The last value is never used
+    uint32_t value = 0U;
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GAK, CSM_SEC_IC_CLIENT, 0xFFFFFFFEU) == TRUE);
+    REQUIRE(csm_ic_check(cSap, CSM_SEC_GAK, CSM_SEC_IC_CLIENT, 0xFFFFFFFFU) == FALSE);
+
+    // Reset at the end of the last window
+    REQUIRE(csm_sys_store_ic(cSap, CSM_SEC_GAK, CSM_SEC_IC_SERVER, 0xFFFFFFFEU) == TRUE);
+    csm_ic_init();
+    REQUIRE(csm_ic_next(cSap, CSM_SEC_GAK, CSM_SEC_IC_SERVER, &value) == TRUE);
+    REQUIRE(value == 0xFFFFFFFEU);
+    REQUIRE(csm_ic_next(cSap, CSM_SEC_GAK, CSM_SEC_IC_SERVER, &value) == FALSE);
+
+    // No more counters in RAM
+    for (uint8_t sap = 0U; sap < CSM_IC_MAX_COUNTERS; sap++)
+    {
+        csm_ic_next(sap, CSM_SEC_GBEK, CSM_SEC_IC_SERVER, &value);
+    }
+    REQUIRE(csm_ic_next(CSM_IC_MAX_COUNTERS, CSM_SEC_GBEK, CSM_SEC_IC_SERVER, &value) == FALSE);
+
+    csm_sys_erase_ic();
+    csm_ic_init();
+}
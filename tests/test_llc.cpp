@@ -0,0 +1,41 @@
+extern "C" {
+#include "csm_llc.h"
+#include "csm_definitions.h"
+}
+
+#include "catch.hpp"
+#include <vector>
+
+TEST_CASE("WpduFrameSize", "[llc]")
+{
+    // Two pipelined WPDUs: client 16 to logical device 1, 13 and 2 bytes of APDU
+    std::vector<uint8_t> stream = {
+        0x00, 0x01, 0x00, 0x10, 0x00, 0x01, 0x00, 0x0D,
+        0xC0, 0x01, 0xC1, 0x00, 0x08, 0x00, 0x00, 0x01, 0x00, 0x00, 0xFF, 0x02, 0x00,
+        0x00, 0x01, 0x00, 0x10, 0x00, 0x01, 0x00, 0x02,
+        0x62, 0x00,
+    };
+
+    // Wrapper not fully received
+    for (uint32_t size = 0U; size < COSEM_WRAPPER_SIZE; size++)
+    {
+        REQUIRE(csm_llc_wpdu_frame_size(stream.data(), size) == 0);
+    }
+
+    // The size is known as soon as the wrapper is received, whatever follows
+    REQUIRE(csm_llc_wpdu_frame_size(stream.data(), COSEM_WRAPPER_SIZE) == 21);
+    REQUIRE(csm_llc_wpdu_frame_size(stream.data(), stream.size()) == 21);
+    REQUIRE(csm_llc_wpdu_frame_size(&stream[21], stream.size() - 21U) == 10);
+
+    // Each frame found is accepted by the decoder
+    uint16_t ssap = 0U;
+    uint16_t dsap = 0U;
+    REQUIRE(csm_llc_wpdu_decode(stream.data(), 21U, &ssap, &dsap) == 13);
+    REQUIRE(ssap == 16U);
+    REQUIRE(dsap == 1U);
+    REQUIRE(csm_llc_wpdu_decode(&stream[21], 10U, &ssap, &dsap) == 2);
+
+    // Not a wrapper stream
+    stream[0] = 0x7EU;
+    REQUIRE(csm_llc_wpdu_frame_size(stream.data(), stream.size()) == -1);
+}
@@ -0,0 +1,1381 @@
+extern "C" {
+#include "csm_server.h"
+#include "csm_client.h"
+#include "csm_axdr_codec.h"
+#include "csm_ber.h"
+#include "csm_gbt.h"
+#include "csm_scheduler.h"
+#include "csm_security.h"
+#include "os_util.h"
+#include "app_database.h"
+#include "db_cosem_associations.h"
+}
+
+#include "catch.hpp"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C" void csm_sys_set_key(uint8_t sap, csm_sec_key key_id, const uint8_t *key);
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes FromHex(const std::string &hex)
+{
+    Bytes bytes;
+    std::string digits;
+    for (char c : hex)
+    {
+        if (c != ' ')
+        {
+            digits.push_back(c);
+        }
+    }
+    for (size_t i = 0U; (i + 1U) < digits.size(); i += 2U)
+    {
+        bytes.push_back((uint8_t)std::stoul(digits.substr(i, 2U), nullptr, 16));
+    }
+    return bytes;
+}
+
+static Bytes operator+(const Bytes &a, const Bytes &b)
+{
+    Bytes r = a;
+    r.insert(r.end(), b.begin(), b.end());
+    return r;
+}
+
+static const db_attr_descr test_asso_attributes[] = {
+    {DB_ACCESS_GET, DB_TYPE_ARRAY},
+    {DB_ACCESS_GET, DB_TYPE_STRUCTURE},
+};
+
+static const db_attr_descr test_data_attributes[] = {
+    {DB_ACCESS_GETSET, DB_TYPE_OCTET_STRING},
+};
+
+static const db_attr_descr test_data_methods[] = {
+    {DB_ACCESS_EXECUTE, DB_TYPE_OCTET_STRING},
+};
+
+static const uint32_t cNbDataObjects = 40U;
+
+// Values written by the SET service, by object
+static std::map<uint8_t, Bytes> gWritten;
+// Value received by blocks, written at the last block
+static Bytes gStream;
+// When enabled, the data handler answers later: the output array is kept for the test
+static bool gPending = false;
+static csm_array *gPendingOut = nullptr;
+
+/**
+ * Data objects of the test database: attribute 2 is an octet-string of (F + 1) bytes,
+ * set/action are recorded to be checked by the test
+ */
+static csm_db_code test_data_func(csm_server_context_t *ctx, csm_array *in, csm_array *out);
+
+// Test server: one association, one logical device with an association object and data objects
+class TestServer
+{
+public:
+    static const uint32_t cBufSize = 1024U + 89U;
+    static const uint32_t cOffset = 89U;
+
+    explicit TestServer(uint32_t conformance = 0xFFFFFFU)
+    {
+        for (uint32_t i = 0U; i < cNbDataObjects; i++)
+        {
+            db_object_descr &obj = data_objects[i];
+            obj.attr_list = test_data_attributes;
+            obj.meth_list = test_data_methods;
+            obj.class_id = 1U;
+            obj.obis_code = { 0U, 0U, 96U, 1U, (uint8_t)i, 255U };
+            obj.version = 0U;
+            obj.nb_attr = 1U;
+            obj.nb_meth = 1U;
+        }
+
+        asso_object.attr_list = test_asso_attributes;
+        asso_object.meth_list = nullptr;
+        asso_object.class_id = 15U;
+        asso_object.obis_code = { 0U, 0U, 40U, 0U, 0U, 255U };
+        asso_object.version = 1U;
+        asso_object.nb_attr = 2U;
+        asso_object.nb_meth = 0U;
+
+        elements[0] = { &asso_object, db_cosem_associations_func, 1U };
+        elements[1] = { data_objects, test_data_func, cNbDataObjects, TRUE };
+
+        memset(&db, 0, sizeof(db));
+        db.el = elements;
+        db.size = 2U;
+        db.logical_device = 1U;
+        (void) db_cosem_associations_prepare(&db, object_list_cache, sizeof(object_list_cache));
+
+        config.llc.ssap = 1U;
+        config.llc.dsap = 1U;
+        config.conformance = conformance;
+        config.is_auto_connected = 0U;
+        config.security_policy = CSM_SEC_POLICY_NONE;
+
+        memset(&ctx, 0, sizeof(ctx));
+        csm_array_init(&ctx.asso.rx, rx, sizeof(rx), 0U, cOffset);
+        csm_array_init(&ctx.asso.tx, tx, sizeof(tx), 0U, cOffset);
+        csm_array_init(&ctx.asso.scratch, scratch, sizeof(scratch), 0U, cOffset);
+        ctx.db_access_func = csm_db_access_func;
+        ctx.asso.channel_id = 3;
+        csm_asso_init(&ctx.asso);
+        ctx.asso.state_cf = CF_ASSOCIATED;
+        ctx.asso.handshake.proposed_conformance = 0xFFFFFFFFU; // As CosemClient
+        ctx.asso.handshake.client_max_receive_pdu_size = 1024U;
+        ctx.request.llc.ssap = 1U;
+        ctx.request.llc.dsap = 1U;
+    }
+
+    ~TestServer()
+    {
+        db_cosem_associations_invalidate(&db);
+    }
+
+    void Load(const Bytes &apdu)
+    {
+        csm_array_reset(&ctx.asso.rx);
+        csm_array_reset(&ctx.asso.tx);
+        REQUIRE(csm_array_write_buff(&ctx.asso.rx, apdu.data(), apdu.size()) == TRUE);
+    }
+
+    int Execute()
+    {
+        return csm_server_execute(&ctx, &config, 1U, &db, 1U);
+    }
+
+    Bytes Request(const Bytes &apdu)
+    {
+        Load(apdu);
+        return Reply(Execute());
+    }
+
+    Bytes Complete(csm_db_code code)
+    {
+        return Reply(csm_server_complete(&ctx, code));
+    }
+
+    Bytes Reply(int size)
+    {
+        Bytes reply;
+        if (size > 0)
+        {
+            // With zero copy, the payload follows the content of tx
+            csm_chain chain;
+            csm_chain_init(&chain);
+            REQUIRE(csm_chain_append_array(&chain, &ctx.asso.tx) == TRUE);
+            REQUIRE(csm_chain_append(&chain, ctx.asso.payload.data, ctx.asso.payload.size) == TRUE);
+            REQUIRE(chain.size == (uint32_t)size);
+            reply.resize(size);
+            REQUIRE(csm_chain_copy(&chain, reply.data(), reply.size()) == (uint32_t)size);
+        }
+        return reply;
+    }
+
+    Bytes Request(const std::string &hex)
+    {
+        return Request(FromHex(hex));
+    }
+
+    void EnableGbt(uint32_t size)
+    {
+        csm_array_init(&ctx.asso.gbt.retention, gbt, size, 0U, 0U);
+    }
+
+    // Next block of the general block transfer window
+    Bytes Next()
+    {
+        int size = csm_server_gbt_next(&ctx);
+        Bytes reply;
+        if (size > 0)
+        {
+            reply.assign(csm_array_start(&ctx.asso.tx), csm_array_start(&ctx.asso.tx) + size);
+        }
+        return reply;
+    }
+
+    // Reads an attribute with GET-Request-Normal then GET-Request-Next until the last block
+    Bytes GetByBlock(const std::string &get_request, uint32_t &nb_blocks)
+    {
+        Bytes data;
+        Bytes reply = Request(get_request);
+        nb_blocks = 0U;
+
+        while ((reply.size() > 8U) && (reply[0] == AXDR_GET_RESPONSE) && (reply[1] == SVC_GET_RESPONSE_WITH_DATABLOCK))
+        {
+            nb_blocks++;
+            REQUIRE(nb_blocks < 1000U);
+            uint32_t block_number = (reply[4] << 24U) | (reply[5] << 16U) | (reply[6] << 8U) | reply[7];
+            REQUIRE(block_number == nb_blocks);
+            REQUIRE(reply[8] == 0U); // raw-data
+
+            csm_array array;
+            csm_array_init(&array, reply.data(), reply.size(), reply.size() - 9U, 9U);
+            ber_length size;
+            REQUIRE(csm_ber_read_len(&array, &size) == TRUE);
+            REQUIRE(csm_array_unread(&array) == size.length);
+            data.insert(data.end(), csm_array_rd_current(&array), csm_array_rd_current(&array) + size.length);
+
+            if (reply[3] == 1U)
+            {
+                break; // last block
+            }
+            // No-op without prefetch buffer
+            nb_prefetch += csm_server_prefetch(&ctx);
+            reply = Request(FromHex("C002C1") + Bytes{reply[4], reply[5], reply[6], reply[7]});
+        }
+        return data;
+    }
+
+    void EnablePrefetch()
+    {
+        csm_array_init(&ctx.asso.prefetch, prefetch, sizeof(prefetch), 0U, cOffset);
+    }
+
+    uint8_t rx[cBufSize];
+    uint8_t tx[cBufSize];
+    uint8_t scratch[cBufSize];
+    uint8_t gbt[4096];
+    uint8_t prefetch[cBufSize];
+    uint8_t object_list_cache[2048];
+    uint32_t nb_prefetch = 0U;
+    db_object_descr data_objects[cNbDataObjects];
+    db_object_descr asso_object;
+    struct db_element elements[2];
+    csm_db_t db;
+    csm_asso_config config;
+    csm_server_context_t ctx;
+};
+
+static csm_db_code test_data_func(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    (void) in;
+    csm_db_code code = CSM_ERR_OBJECT_ERROR;
+    uint8_t value[256];
+    uint8_t size = ctx->request.db_request.logical_name.obis.E + 1U;
+
+    memset(value, ctx->request.db_request.logical_name.obis.E, size);
+
+    if (gPending)
+    {
+        gPendingOut = out;
+        return CSM_PENDING;
+    }
+
+    if (ctx->request.db_request.service == SVC_GET)
+    {
+        if (csm_axdr_wr_octetstring(out, value, size, AXDR_TAG_OCTETSTRING))
+        {
+            code = CSM_OK;
+        }
+    }
+    else if ((ctx->request.db_request.service == SVC_SET) && (ctx->request.db_request.block_number > 0U))
+    {
+        // Chunk of a value received by blocks
+        if (ctx->request.db_request.block_number == 1U)
+        {
+            gStream.clear();
+        }
+        REQUIRE(ctx->request.db_request.block_offset == gStream.size());
+        gStream.insert(gStream.end(), csm_array_rd_current(in), csm_array_rd_current(in) + csm_array_unread(in));
+        code = CSM_OK;
+
+        if (ctx->request.db_request.last_block)
+        {
+            csm_array value;
+            uint32_t length = 0U;
+            csm_array_init(&value, gStream.data(), gStream.size(), gStream.size(), 0U);
+            if (csm_axdr_rd_octetstring(&value, &length) && (length == csm_array_unread(&value)))
+            {
+                gWritten[ctx->request.db_request.logical_name.obis.E] = Bytes(csm_array_rd_current(&value), csm_array_rd_current(&value) + length);
+            }
+            else
+            {
+                code = CSM_ERR_DATA_CONTENT_NOT_OK;
+            }
+        }
+    }
+    else if (ctx->request.db_request.service == SVC_SET)
+    {
+        uint32_t length = 0U;
+        // The value must be exactly one octet-string
+        if (csm_axdr_rd_octetstring(in, &length) && (length == csm_array_unread(in)))
+        {
+            gWritten[ctx->request.db_request.logical_name.obis.E] = Bytes(csm_array_rd_current(in), csm_array_rd_current(in) + length);
+            code = CSM_OK;
+        }
+        else
+        {
+            code = CSM_ERR_DATA_CONTENT_NOT_OK;
+        }
+    }
+    else
+    {
+        // Action: adds the unsigned parameter to E, no return parameter for odd objects
+        uint8_t tag = 0U;
+        uint8_t param = 0U;
+        if (csm_array_read_u8(in, &tag) && (tag == AXDR_TAG_UNSIGNED8) && csm_array_read_u8(in, &param))
+        {
+            code = CSM_OK;
+            if ((ctx->request.db_request.logical_name.obis.E % 2U) == 0U)
+            {
+                code = csm_axdr_wr_u8(out, param + ctx->request.db_request.logical_name.obis.E) ? CSM_OK : CSM_ERR_OBJECT_ERROR;
+            }
+        }
+    }
+
+    return code;
+}
+
+TEST_CASE("GetNormal", "[services]")
+{
+    TestServer server;
+
+    // Attribute 2 of 0.0.96.1.4.255
+    Bytes reply = server.Request("C001C100010000600104FF0200");
+    REQUIRE(reply == FromHex("C401C10009050404040404"));
+
+    // Unknown object
+    reply = server.Request("C001C100010000600199FF0200");
+    REQUIRE(reply[0] == AXDR_EXCEPTION_RESPONSE);
+}
+
+TEST_CASE("ObjectListByBlock", "[services]")
+{
+    for (uint16_t pdu_size : {1024U, 200U, 64U})
+    {
+        TestServer server;
+        server.ctx.asso.handshake.client_max_receive_pdu_size = pdu_size;
+
+        uint32_t nb_blocks = 0U;
+        Bytes data = server.GetByBlock("C001C1000F0000280000FF0200", nb_blocks);
+        REQUIRE(nb_blocks > 0U);
+
+        // The list is encoded once; a second reading serves the same buffer
+        uint32_t nb_blocks2 = 0U;
+        REQUIRE(server.GetByBlock("C001C1000F0000280000FF0200", nb_blocks2) == data);
+        REQUIRE(nb_blocks2 == nb_blocks);
+
+        // array of (1 + cNbDataObjects) object_list_element
+        REQUIRE(data.size() > 4U);
+        REQUIRE(data[0] == AXDR_TAG_ARRAY);
+        REQUIRE(data[1] == (1U + cNbDataObjects));
+
+        // Walk through the elements
+        uint32_t pos = 2U;
+        for (uint32_t i = 0U; i < (1U + cNbDataObjects); i++)
+        {
+            REQUIRE(data[pos] == AXDR_TAG_STRUCTURE);
+            REQUIRE(data[pos + 1U] == 4U);
+            uint16_t class_id = (data[pos + 3U] << 8U) | data[pos + 4U];
+            REQUIRE(class_id == ((i == 0U) ? 15U : 1U));
+            // structure(2) {array(attributes), array(methods)}
+            pos += 2U + 3U + 2U + 8U;
+            REQUIRE(data[pos] == AXDR_TAG_STRUCTURE);
+            uint8_t nb_attr = data[pos + 3U]; // including the logical name
+            pos += 4U + (nb_attr * 7U);
+            REQUIRE(data[pos] == AXDR_TAG_ARRAY);
+            uint8_t nb_meth = data[pos + 1U];
+            pos += 2U + (nb_meth * 6U);
+        }
+        REQUIRE(pos == data.size());
+        REQUIRE(db_cosem_associations_list_size(&server.db) == data.size());
+    }
+
+    // Cache too small: the list is encoded one object per loop
+    TestServer cached;
+    TestServer per_object;
+    uint8_t small[64];
+    REQUIRE(db_cosem_associations_prepare(&per_object.db, small, sizeof(small)) == FALSE);
+    uint32_t nb_blocks = 0U;
+    REQUIRE(per_object.GetByBlock("C001C1000F0000280000FF0200", nb_blocks) == cached.GetByBlock("C001C1000F0000280000FF0200", nb_blocks));
+}
+
+static std::string Hex(uint32_t value, uint32_t nb_bytes)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%0*X", (int)(nb_bytes * 2U), value);
+    return buf;
+}
+
+TEST_CASE("GetWithList", "[services]")
+{
+    TestServer server;
+
+    // 0.0.96.1.2.255 attr 2, unknown object, 0.0.96.1.5.255 attr 1 (logical name)
+    Bytes reply = server.Request("C003C103"
+                                 "00010000600102FF0200"
+                                 "00010000600199FF0200"
+                                 "00010000600105FF0100");
+    REQUIRE(reply == FromHex("C403C103"
+                             "0009030202 02"
+                             "0104"
+                             "0009060000600105FF"));
+
+    // Not allowed by the association conformance
+    TestServer restricted(CSM_CBLOCK_GET);
+    reply = restricted.Request("C003C10100010000600102FF0200");
+    REQUIRE(reply[0] == AXDR_EXCEPTION_RESPONSE);
+}
+
+TEST_CASE("GetWithListByBlock", "[services]")
+{
+    TestServer server;
+    server.ctx.asso.handshake.client_max_receive_pdu_size = 256U;
+
+    std::string request = "C003C1" + Hex(cNbDataObjects, 1U);
+    Bytes expected = { (uint8_t)cNbDataObjects };
+    for (uint32_t i = 0U; i < cNbDataObjects; i++)
+    {
+        request += "0001000060 01" + Hex(i, 1U) + "FF0200";
+        expected.push_back(0U);
+        expected.push_back(AXDR_TAG_OCTETSTRING);
+        expected.push_back(i + 1U);
+        expected.insert(expected.end(), i + 1U, (uint8_t)i);
+    }
+
+    // The whole Get-Data-Result list is sliced into blocks
+    uint32_t nb_blocks = 0U;
+    Bytes data = server.GetByBlock(request, nb_blocks);
+    REQUIRE(nb_blocks == ((expected.size() + 243U) / 244U));
+    REQUIRE(data == expected);
+
+    // Back to normal requests
+    REQUIRE(server.Request("C001C100010000600104FF0200") == FromHex("C401C10009050404040404"));
+}
+
+TEST_CASE("SkipData", "[services]")
+{
+    // structure {array {u8, octet-string}, bit-string(10 bits), date-time}, then one extra byte
+    Bytes data = FromHex("0203 01021105 090300 0102 040A FFC0 19 000102030405060708090A0B 42");
+    csm_array array;
+    csm_array_init(&array, data.data(), data.size(), data.size(), 0U);
+    REQUIRE(csm_axdr_skip_data(&array) == TRUE);
+    REQUIRE(csm_array_unread(&array) == 1U);
+
+    // Truncated
+    csm_array_init(&array, data.data(), data.size() - 3U, data.size() - 3U, 0U);
+    REQUIRE(csm_axdr_skip_data(&array) == FALSE);
+}
+
+TEST_CASE("SetWithList", "[services]")
+{
+    TestServer server;
+    gWritten.clear();
+
+    // Three attributes: 0.0.96.1.1.255, 0.0.96.1.2.255 (not an octet-string), 0.0.96.1.3.255
+    Bytes reply = server.Request("C104C103"
+                                 "00010000600101FF0200"
+                                 "00010000600102FF0200"
+                                 "00010000600103FF0200"
+                                 "03"
+                                 "0902AABB"
+                                 "110A"
+                                 "0903010203");
+    REQUIRE(reply == FromHex("C505C103000C00"));
+    REQUIRE(gWritten[1] == FromHex("AABB"));
+    REQUIRE(gWritten.count(2) == 0U);
+    REQUIRE(gWritten[3] == FromHex("010203"));
+
+    // Number of values differs from the number of descriptors
+    reply = server.Request("C104C102"
+                           "00010000600101FF0200"
+                           "00010000600102FF0200"
+                           "01"
+                           "0902AABB");
+    REQUIRE(reply[0] == AXDR_EXCEPTION_RESPONSE);
+
+    // Normal response keeps its choice
+    reply = server.Request("C101C100010000600105FF0200 0901 33");
+    REQUIRE(reply == FromHex("C501C100"));
+    REQUIRE(gWritten[5] == FromHex("33"));
+}
+
+TEST_CASE("ActionWithList", "[services]")
+{
+    TestServer server;
+
+    // Method 1 of 0.0.96.1.2.255, 0.0.96.1.3.255 and unknown 0.0.96.1.99.255
+    Bytes reply = server.Request("C303C103"
+                                 "00010000600102FF01"
+                                 "00010000600103FF01"
+                                 "00010000600163FF01"
+                                 "03"
+                                 "1110"
+                                 "1120"
+                                 "1130");
+    REQUIRE(reply == FromHex("C703C103"
+                             "00 01 00 1112"
+                             "00 00"
+                             "04 00"));
+
+    reply = server.Request("C301C100010000600104FF01011101");
+    REQUIRE(reply == FromHex("C701C100010011 05"));
+}
+
+// Sends a value with Set-Request-With-First-Datablock then Set-Request-With-Datablock
+static Bytes SetByBlock(TestServer &server, const std::string &descriptor, const Bytes &value, uint32_t block_size)
+{
+    Bytes reply;
+    uint32_t block_number = 1U;
+    for (uint32_t pos = 0U; pos < value.size(); pos += block_size)
+    {
+        uint32_t size = ((value.size() - pos) < block_size) ? (value.size() - pos) : block_size;
+        bool last = (pos + size) == value.size();
+
+        Bytes request = FromHex((block_number == 1U) ? ("C102C1" + descriptor) : "C103C1");
+        request.push_back(last ? 1U : 0U);
+        request = request + FromHex(Hex(block_number, 4U));
+        request = request + ((size < 128U) ? FromHex(Hex(size, 1U)) : FromHex("82" + Hex(size, 2U)));
+        request.insert(request.end(), value.begin() + pos, value.begin() + pos + size);
+
+        reply = server.Request(request);
+        if (!last)
+        {
+            REQUIRE(reply == FromHex("C502C1" + Hex(block_number, 4U)));
+        }
+        block_number++;
+    }
+    return reply;
+}
+
+TEST_CASE("SetByBlock", "[services]")
+{
+    TestServer server;
+    gWritten.clear();
+
+    // 3000 bytes octet-string written through a 1024 bytes receive buffer
+    Bytes data(3000U);
+    for (uint32_t i = 0U; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)(i * 7U);
+    }
+    Bytes value = FromHex("09820BB8") + data;
+    Bytes reply = SetByBlock(server, "00010000600106FF0200", value, 700U);
+    REQUIRE(reply == FromHex("C503C10000000005"));
+    REQUIRE(gWritten[6] == data);
+
+    // The application refuses the value at the last block
+    reply = SetByBlock(server, "00010000600107FF0200", FromHex("1100") + data, 700U);
+    REQUIRE(reply == FromHex("C503C10C00000005"));
+    REQUIRE(gWritten.count(7) == 0U);
+
+    // Requests between the blocks do not change the object written
+    gWritten.clear();
+    reply = server.Request("C102C1 00010000600106FF0200 00 00000001 03 0903AA");
+    REQUIRE(reply == FromHex("C502C100000001"));
+    REQUIRE(server.Request("C001C100010000600104FF0200") == FromHex("C401C10009050404040404"));
+    REQUIRE(server.Request("C301C100010000600104FF01011101") == FromHex("C701C100010011 05"));
+    reply = server.Request("C103C1 01 00000002 02 BBCC");
+    REQUIRE(reply == FromHex("C503C10000000002"));
+    REQUIRE(gWritten[6] == FromHex("AABBCC"));
+    REQUIRE(gWritten.count(4) == 0U);
+
+    // No long SET in progress
+    reply = server.Request("C103C1 00 00000002 02AABB");
+    REQUIRE(reply == FromHex("C503C11200000002"));
+
+    // Wrong block number: the long SET is aborted
+    reply = server.Request("C102C1 00010000600106FF0200 00 00000001 020902");
+    REQUIRE(reply == FromHex("C502C100000001"));
+    reply = server.Request("C103C1 01 00000003 02AABB");
+    REQUIRE(reply == FromHex("C503C11300000003"));
+    reply = server.Request("C103C1 01 00000002 02AABB");
+    REQUIRE(reply == FromHex("C503C11200000002"));
+
+    // Not allowed by the association conformance
+    TestServer restricted(CSM_CBLOCK_SET);
+    reply = restricted.Request("C102C1 00010000600106FF0200 01 00000001 020901");
+    REQUIRE(reply[0] == AXDR_EXCEPTION_RESPONSE);
+}
+
+TEST_CASE("SetByBlockReassembled", "[services]")
+{
+    TestServer server;
+    server.elements[1].streaming = FALSE;
+    gWritten.clear();
+
+    Bytes data(1500U);
+    for (uint32_t i = 0U; i < data.size(); i++)
+    {
+        data[i] = (uint8_t)(i * 3U);
+    }
+    Bytes value = FromHex("098205DC") + data;
+
+    // Without reassembly buffer, only the streaming handlers accept a SET by block
+    Bytes reply = SetByBlock(server, "00010000600106FF0200", Bytes(value.begin(), value.begin() + 300U), 300U);
+    REQUIRE(reply == FromHex("C503C10200000001"));
+    REQUIRE(gWritten.count(6) == 0U);
+
+    // The handler is called once, with the whole value as a normal SET
+    uint8_t set_value[2048];
+    csm_array_init(&server.ctx.asso.set_value, set_value, sizeof(set_value), 0U, 0U);
+    reply = SetByBlock(server, "00010000600106FF0200", value, 400U);
+    REQUIRE(reply == FromHex("C503C10000000004"));
+    REQUIRE(gWritten[6] == data);
+
+    // The value is checked by the handler at the last block
+    reply = SetByBlock(server, "00010000600107FF0200", FromHex("1100") + data, 400U);
+    REQUIRE(reply == FromHex("C503C10C00000004"));
+    REQUIRE(gWritten.count(7) == 0U);
+
+    // Longer than the reassembly buffer
+    csm_array_init(&server.ctx.asso.set_value, set_value, 1000U, 0U, 0U);
+    reply = SetByBlock(server, "00010000600108FF0200", Bytes(value.begin(), value.begin() + 1200U), 400U);
+    REQUIRE(reply == FromHex("C503C10200000003"));
+    REQUIRE(gWritten.count(8) == 0U);
+}
+
+// Reads a response sent with general block transfer, the blocks in the drop list are lost once
+// Without room to keep the blocks out of sequence, the windows are sent again from the lost block
+static Bytes GbtReceive(TestServer &server, const Bytes &request, uint8_t window, std::vector<uint16_t> drop, uint32_t &nb_sent, uint32_t kept_size = 4096U)
+{
+    Bytes apdu_buffer(16384U);
+    Bytes kept(kept_size);
+    csm_array apdu;
+    csm_array_init(&apdu, apdu_buffer.data(), apdu_buffer.size(), 0U, 0U);
+    csm_gbt_receiver rx;
+    csm_gbt_receiver_init(&rx, window, (kept_size > 0U) ? kept.data() : nullptr, kept_size);
+
+    Bytes reply = server.Request(request);
+    uint32_t nb_windows = 0U;
+    nb_sent = 0U;
+    while (!reply.empty())
+    {
+        nb_windows++;
+        REQUIRE(nb_windows < 200U);
+        uint32_t nb_blocks = 0U;
+        while (!reply.empty())
+        {
+            nb_blocks++;
+            nb_sent++;
+            uint16_t block_number = (reply[2] << 8U) | reply[3];
+            auto lost = std::find(drop.begin(), drop.end(), block_number);
+            if (lost != drop.end())
+            {
+                drop.erase(lost);
+            }
+            else
+            {
+                csm_array array;
+                csm_array_init(&array, reply.data(), reply.size(), reply.size(), 0U);
+                REQUIRE(csm_gbt_receive(&rx, &array, &apdu) == TRUE);
+            }
+            reply = server.Next();
+        }
+        REQUIRE(nb_blocks <= window);
+
+        if (rx.complete)
+        {
+            break;
+        }
+        // Acknowledge, also when the block ending the window has been lost (timeout)
+        Bytes ack(16U);
+        csm_array array;
+        csm_array_init(&array, ack.data(), ack.size(), 0U, 0U);
+        REQUIRE(csm_gbt_encode_ack(&rx, &array) == TRUE);
+        ack.resize(csm_array_written(&array));
+        reply = server.Request(ack);
+    }
+
+    REQUIRE(rx.complete == TRUE);
+    return Bytes(apdu_buffer.begin(), apdu_buffer.begin() + csm_array_written(&apdu));
+}
+
+TEST_CASE("GeneralBlockTransfer", "[services]")
+{
+    // Reference object list, read with the GET blocks
+    TestServer reference;
+    uint32_t nb_blocks = 0U;
+    Bytes object_list = reference.GetByBlock("C001C1000F0000280000FF0200", nb_blocks);
+
+    TestServer server;
+    server.ctx.asso.handshake.client_max_receive_pdu_size = 200U;
+    server.EnableGbt(1024U);
+
+    // Request sent in one block with a window of 3, blocks 5 and 9 are lost once: only them are sent again
+    uint32_t nb_sent = 0U;
+    Bytes request = FromHex("E083 0001 0000 0D C001C1000F0000280000FF0200");
+    Bytes apdu = GbtReceive(server, request, 3U, {5U, 9U}, nb_sent);
+    REQUIRE(apdu == FromHex("C401C100") + object_list);
+    uint32_t nb_gbt_blocks = (apdu.size() + 190U) / 191U;
+    REQUIRE(nb_sent == (nb_gbt_blocks + 2U));
+
+    // Several blocks lost in the same window
+    REQUIRE(GbtReceive(server, request, 5U, {2U, 3U, 5U}, nb_sent) == apdu);
+    REQUIRE(nb_sent == (nb_gbt_blocks + 3U));
+
+    // The blocks out of sequence are dropped: the blocks following a lost one are sent again
+    REQUIRE(GbtReceive(server, request, 3U, {5U}, nb_sent, 0U) == apdu);
+    REQUIRE(nb_sent == (nb_gbt_blocks + 2U));
+
+    // Normal request: the client window is known after the first acknowledge
+    apdu = GbtReceive(server, FromHex("C001C1000F0000280000FF0200"), 5U, {}, nb_sent);
+    REQUIRE(apdu == FromHex("C401C100") + object_list);
+
+    // A short response to a request sent with GBT is sent in one block
+    Bytes reply = server.Request("E081 0001 0000 0D C001C100010000600104FF0200");
+    REQUIRE(reply == FromHex("E0 85 0001 0001 0B C401C10009050404040404"));
+    REQUIRE(server.Next().empty());
+
+    // Acknowledge of the last block ends the transfer
+    REQUIRE(server.Request("E081 0002 0001 00").empty());
+
+    // Request sent in three blocks, the server acknowledges the end of the window of the client
+    REQUIRE(server.Request("E042 0001 0000 05 C001C1000F").empty());
+    reply = server.Request("E002 0002 0000 05 0000280000");
+    REQUIRE(reply[0] == AXDR_GENERAL_BLOCK_TRANSFER);
+    REQUIRE((reply[1] & 0x80U) == 0x80U);
+    REQUIRE(reply[3] == 0x01U);
+    REQUIRE(reply[5] == 0x02U);
+    REQUIRE(reply[6] == 0x00U);
+    REQUIRE(GbtReceive(server, FromHex("E083 0003 0001 03 FF0200"), 3U, {}, nb_sent) == apdu);
+
+    // Block lost in the request: the blocks following it are kept until it is sent again
+    REQUIRE(server.Request("E042 0001 0000 05 C001C1000F").empty());
+    reply = server.Request("E082 0003 0000 03 FF0200");
+    REQUIRE(reply[5] == 0x01U);
+    REQUIRE(GbtReceive(server, FromHex("E002 0002 0001 05 0000280000"), 3U, {}, nb_sent) == apdu);
+
+    // Request longer than the retention buffer
+    TestServer small;
+    small.EnableGbt(256U);
+    small.ctx.asso.handshake.client_max_receive_pdu_size = 64U;
+    reply = small.Request("E041 0001 0000 05 C001C1000F");
+    for (uint16_t i = 2U; reply.empty() && (i < 100U); i++)
+    {
+        char block[32];
+        snprintf(block, sizeof(block), "E041 %04X 0000 05 0000000000", i);
+        reply = small.Request(block);
+    }
+    REQUIRE(reply == FromHex("D80104"));
+
+    // Not allowed by the association conformance
+    TestServer restricted(CSM_CBLOCK_GET);
+    restricted.EnableGbt(1024U);
+    reply = restricted.Request("E081 0001 0000 0D C001C100010000600104FF0200");
+    REQUIRE(reply == FromHex("D80102"));
+
+    // Allowed by the association but not proposed by the client: the GET blocks are used
+    TestServer not_proposed;
+    not_proposed.ctx.asso.handshake.proposed_conformance = 0x007E1FU;
+    not_proposed.ctx.asso.handshake.client_max_receive_pdu_size = 200U;
+    not_proposed.EnableGbt(1024U);
+    REQUIRE(not_proposed.GetByBlock("C001C1000F0000280000FF0200", nb_blocks) == object_list);
+    REQUIRE(nb_blocks > 1U);
+    REQUIRE(not_proposed.Request("E081 0001 0000 0D C001C100010000600104FF0200") == FromHex("D80102"));
+}
+
+TEST_CASE("ClientGbt", "[services]")
+{
+    TestServer server;
+    server.EnableGbt(1024U);
+    server.ctx.asso.handshake.client_max_receive_pdu_size = 64U;
+    uint32_t nb_blocks = 0U;
+    TestServer reference;
+    Bytes object_list = reference.GetByBlock("C001C1000F0000280000FF0200", nb_blocks);
+
+    Bytes apdu_buffer(4096U);
+    csm_array apdu;
+    csm_array_init(&apdu, apdu_buffer.data(), apdu_buffer.size(), 0U, 0U);
+    Bytes kept(1024U);
+    csm_gbt_receiver rx;
+    csm_gbt_receiver_init(&rx, 4U, kept.data(), kept.size());
+    csm_response response;
+    csm_client_init(nullptr, &response);
+
+    // The blocks are appended by the client, the response is decoded with the last one
+    Bytes reply = server.Request("E084 0001 0000 0D C001C1000F0000280000FF0200");
+    uint32_t nb_windows = 1U;
+    while (!rx.complete)
+    {
+        REQUIRE(!reply.empty());
+        csm_array array;
+        csm_array_init(&array, reply.data(), reply.size(), reply.size(), 0U);
+        REQUIRE(csm_client_decode_gbt(&rx, &response, &array, &apdu) == TRUE);
+        reply = server.Next();
+
+        if (reply.empty() && rx.ack_required)
+        {
+            Bytes ack(16U);
+            csm_array_init(&array, ack.data(), ack.size(), 0U, 0U);
+            REQUIRE(csm_gbt_encode_ack(&rx, &array) == TRUE);
+            ack.resize(csm_array_written(&array));
+            reply = server.Request(ack);
+            nb_windows++;
+        }
+    }
+    REQUIRE(nb_windows > 1U);
+    REQUIRE(response.service == SVC_GET);
+    REQUIRE(response.type == SVC_RESPONSE_NORMAL);
+    REQUIRE(response.access_result == CSM_ACCESS_RESULT_SUCCESS);
+    REQUIRE(Bytes(csm_array_rd_current(&apdu), csm_array_rd_current(&apdu) + csm_array_unread(&apdu)) == object_list);
+
+    // A block out of sequence is not appended
+    reply = FromHex("E0 84 0009 0001 02 0102");
+    csm_array array;
+    csm_array_init(&array, reply.data(), reply.size(), reply.size(), 0U);
+    rx.complete = FALSE;
+    uint32_t written = csm_array_written(&apdu);
+    REQUIRE(csm_client_decode_gbt(&rx, &response, &array, &apdu) == TRUE);
+    REQUIRE(csm_array_written(&apdu) == written);
+}
+
+TEST_CASE("ZeroCopyResponse", "[services]")
+{
+    for (uint16_t pdu_size : {1024U, 64U})
+    {
+        TestServer copy;
+        TestServer zero_copy;
+        copy.ctx.asso.handshake.client_max_receive_pdu_size = pdu_size;
+        zero_copy.ctx.asso.handshake.client_max_receive_pdu_size = pdu_size;
+        zero_copy.ctx.asso.zero_copy = TRUE;
+
+        // The payload stays in the scratch buffer, only the header is in tx
+        Bytes reply = zero_copy.Request("C001C100010000600104FF0200");
+        REQUIRE(reply == copy.Request("C001C100010000600104FF0200"));
+        REQUIRE(csm_array_written(&zero_copy.ctx.asso.tx) == 4U);
+        REQUIRE(zero_copy.ctx.asso.payload.size == 7U);
+
+        uint32_t nb_blocks = 0U;
+        Bytes object_list = copy.GetByBlock("C001C1000F0000280000FF0200", nb_blocks);
+        REQUIRE(zero_copy.GetByBlock("C001C1000F0000280000FF0200", nb_blocks) == object_list);
+
+        // Errors are encoded in tx only
+        reply = zero_copy.Request("C001C100010000600199FF0200");
+        REQUIRE(reply[0] == AXDR_EXCEPTION_RESPONSE);
+        REQUIRE(zero_copy.ctx.asso.payload.size == 0U);
+    }
+
+    // Bounded chains
+    uint8_t data[8] = {1U, 2U, 3U, 4U, 5U, 6U, 7U, 8U};
+    uint8_t flat[8];
+    csm_chain chain;
+    csm_chain_init(&chain);
+    for (uint32_t i = 0U; i < CSM_CHAIN_MAX_SEGMENTS; i++)
+    {
+        REQUIRE(csm_chain_append(&chain, &data[i * 2U], 2U) == TRUE);
+    }
+    REQUIRE(csm_chain_append(&chain, data, 1U) == FALSE);
+    REQUIRE(csm_chain_append(&chain, data, 0U) == TRUE);
+    REQUIRE(chain.size == 8U);
+    REQUIRE(csm_chain_copy(&chain, flat, 7U) == 0U);
+    REQUIRE(csm_chain_copy(&chain, flat, sizeof(flat)) == 8U);
+    REQUIRE(memcmp(flat, data, sizeof(data)) == 0);
+}
+
+TEST_CASE("PendingResponse", "[services]")
+{
+    TestServer server;
+    uint8_t value[5] = {4U, 4U, 4U, 4U, 4U};
+
+    // GET answered later
+    gPending = true;
+    REQUIRE(server.Request("C001C100010000600104FF0200").empty());
+    REQUIRE(server.ctx.asso.pending == TRUE);
+
+    // Other requests are refused until the completion
+    REQUIRE(server.Request("C001C100010000600102FF0200") == FromHex("D80101"));
+    REQUIRE(server.Request("C101C100010000600105FF0200 0901 33") == FromHex("D80101"));
+    REQUIRE(server.ctx.asso.pending == TRUE);
+
+    REQUIRE(csm_axdr_wr_octetstring(gPendingOut, value, sizeof(value), AXDR_TAG_OCTETSTRING) == TRUE);
+    REQUIRE(server.Complete(CSM_OK) == FromHex("C401C10009050404040404"));
+    REQUIRE(server.ctx.asso.pending == FALSE);
+    REQUIRE(server.Complete(CSM_OK).empty());
+
+    // Error on completion
+    REQUIRE(server.Request("C001C100010000600104FF0200").empty());
+    Bytes reply = server.Complete(CSM_ERR_OBJECT_ERROR);
+    REQUIRE(reply[0] == AXDR_EXCEPTION_RESPONSE);
+
+    // ACTION with return parameters, written in the tx array
+    REQUIRE(server.Request("C301C100010000600104FF01011101").empty());
+    REQUIRE(server.Request("C001C100010000600102FF0200") == FromHex("D80101"));
+    REQUIRE(csm_axdr_wr_u8(gPendingOut, 5U) == TRUE);
+    REQUIRE(server.Complete(CSM_OK) == FromHex("C701C100010011 05"));
+
+    // SET
+    REQUIRE(server.Request("C101C100010000600105FF0200 0901 33").empty());
+    REQUIRE(server.Complete(CSM_ERR_TEMPORARY_FAILURE) == FromHex("C501C1") + Bytes{CSM_ACCESS_RESULT_TEMPORARY_FAILURE});
+
+    // Not allowed in lists, the item fails
+    reply = server.Request("C003C102"
+                           "000100006001 04FF0200"
+                           "000100006001 05FF0200");
+    REQUIRE(reply == FromHex("C403C102") + Bytes{1U, CSM_ACCESS_RESULT_TEMPORARY_FAILURE, 1U, CSM_ACCESS_RESULT_TEMPORARY_FAILURE});
+    REQUIRE(server.ctx.asso.pending == FALSE);
+
+    // A request wrapped in a GBT block is answered with GBT on completion
+    server.EnableGbt(1024U);
+    REQUIRE(server.Request("E081 0001 0000 0D C001C100010000600104FF0200").empty());
+    REQUIRE(csm_axdr_wr_octetstring(gPendingOut, value, sizeof(value), AXDR_TAG_OCTETSTRING) == TRUE);
+    REQUIRE(server.Complete(CSM_OK) == FromHex("E0 81 0001 0001 0B C401C10009050404040404"));
+    gPending = false;
+}
+
+static uint32_t gAccessCalls = 0U;
+
+static csm_db_code counting_access_func(csm_server_context_t *ctx, csm_array *in, csm_array *out)
+{
+    gAccessCalls++;
+    return csm_db_access_func(ctx, in, out);
+}
+
+TEST_CASE("PrefetchNextLoop", "[services]")
+{
+    TestServer server;
+    TestServer prefetch;
+    prefetch.EnablePrefetch();
+    // Object list encoded one object per loop, several loops per reply
+    db_cosem_associations_invalidate(&prefetch.db);
+    server.ctx.asso.handshake.client_max_receive_pdu_size = 64U;
+    prefetch.ctx.asso.handshake.client_max_receive_pdu_size = 64U;
+
+    uint32_t nb_blocks = 0U;
+    uint32_t nb_blocks_prefetch = 0U;
+    Bytes object_list = server.GetByBlock("C001C1000F0000280000FF0200", nb_blocks);
+    REQUIRE(prefetch.GetByBlock("C001C1000F0000280000FF0200", nb_blocks_prefetch) == object_list);
+    REQUIRE(server.nb_prefetch == 0U);
+    REQUIRE(prefetch.nb_prefetch > 0U);
+
+    // Answered from the prepared loop: the handler is not called by the Get-Request-Next
+    prefetch.ctx.db_access_func = counting_access_func;
+    prefetch.ctx.asso.handshake.client_max_receive_pdu_size = 1024U;
+    Bytes reply = prefetch.Request("C001C1000F0000280000FF0200");
+    REQUIRE(reply[1] == SVC_GET_RESPONSE_WITH_DATABLOCK);
+    REQUIRE(csm_server_prefetch(&prefetch.ctx) == TRUE);
+    REQUIRE(csm_server_prefetch(&prefetch.ctx) == FALSE);
+    gAccessCalls = 0U;
+    reply = prefetch.Request(FromHex("C002C1") + Bytes{reply[4], reply[5], reply[6], reply[7]});
+    REQUIRE(gAccessCalls == 0U);
+    REQUIRE(reply[1] == SVC_GET_RESPONSE_WITH_DATABLOCK);
+
+    // A new request drops the prepared loop
+    REQUIRE(csm_server_prefetch(&prefetch.ctx) == (reply[3] == 0U));
+    REQUIRE(prefetch.Request("C001C100010000600104FF0200") == FromHex("C401C10009050404040404"));
+    REQUIRE(prefetch.ctx.asso.prefetched == FALSE);
+    REQUIRE(csm_server_prefetch(&prefetch.ctx) == FALSE);
+}
+
+// Servers of the scheduler test, and the APDUs sent in order
+static std::vector<TestServer *> gSchedServers;
+static std::vector<std::pair<TestServer *, Bytes>> gSchedSent;
+
+static TestServer *SchedServer(csm_server_context_t *ctx)
+{
+    for (TestServer *server : gSchedServers)
+    {
+        if (&server->ctx == ctx)
+        {
+            return server;
+        }
+    }
+    return nullptr;
+}
+
+static int sched_execute(csm_server_context_t *ctx)
+{
+    return SchedServer(ctx)->Execute();
+}
+
+static void sched_send(csm_server_context_t *ctx, int size)
+{
+    TestServer *server = SchedServer(ctx);
+    gSchedSent.push_back({server, server->Reply(size)});
+}
+
+TEST_CASE("FairScheduler", "[services]")
+{
+    TestServer bulk;
+    TestServer other;
+    bulk.EnableGbt(4096U);
+    bulk.ctx.asso.handshake.client_max_receive_pdu_size = 64U;
+    gSchedServers = {&bulk, &other};
+    gSchedSent.clear();
+
+    csm_scheduler sched;
+    csm_sched_channel channels[2];
+    csm_sched_init(&sched, channels, 2U, 128U, sched_execute, sched_send);
+    REQUIRE(csm_sched_add(&sched, &bulk.ctx) == 0);
+    REQUIRE(csm_sched_add(&sched, &other.ctx) == 1);
+    REQUIRE(csm_sched_add(&sched, &other.ctx) == -1);
+    REQUIRE(csm_sched_run(&sched) == 0U);
+
+    // Object list with GBT, window of 10 blocks, and a short GET on the other channel
+    bulk.Load(FromHex("E08A 0001 0000 0D C001C1000F0000280000FF0200"));
+    other.Load(FromHex("C001C100010000600104FF0200"));
+    REQUIRE(csm_sched_ready(&sched, 0) == TRUE);
+    REQUIRE(csm_sched_ready(&sched, 1) == TRUE);
+    REQUIRE(csm_sched_ready(&sched, 1) == FALSE);
+
+    // The short response is sent during the first round, between the blocks of the window
+    REQUIRE(csm_sched_run(&sched) < 10U);
+    REQUIRE(gSchedSent.back().first == &other);
+    REQUIRE(gSchedSent.back().second == FromHex("C401C10009050404040404"));
+    REQUIRE(csm_sched_is_busy(&sched, 0));
+    REQUIRE(!csm_sched_is_busy(&sched, 1));
+
+    uint32_t rounds = 1U;
+    while (csm_sched_run(&sched) > 0U)
+    {
+        rounds++;
+    }
+    REQUIRE(rounds > 2U);
+    REQUIRE(!csm_sched_is_busy(&sched, 0));
+
+    // All the blocks of the window are sent in sequence
+    uint16_t block_number = 1U;
+    for (const auto &sent : gSchedSent)
+    {
+        if (sent.first == &bulk)
+        {
+            REQUIRE(sent.second[0] == AXDR_GENERAL_BLOCK_TRANSFER);
+            REQUIRE(sent.second.size() <= 64U);
+            REQUIRE(((sent.second[2] << 8U) | sent.second[3]) == block_number);
+            block_number++;
+        }
+    }
+    REQUIRE(block_number == 11U);
+    REQUIRE(sched.channels[0].deficit <= 0);
+    gSchedServers.clear();
+}
+
+// The server keeps the invocation counters of the client across the tests
+static uint32_t gClientIc = 1U;
+
+// Client side of the ciphered services (as csm_client_encode/decode_ciphered), with the same headroom as the server
+class TestCipher
+{
+public:
+    static const uint32_t cOffset = 89U;
+
+    explicit TestCipher(csm_sec_key key_id = CSM_SEC_GUEK, uint8_t sc = 0x30U)
+        : key_id(key_id)
+    {
+        this->sc.sh_byte = sc;
+        memset(&request, 0, sizeof(request));
+        request.channel_id = 1; // the server deciphers on channel 0
+        request.llc.ssap = 1U;
+        request.llc.dsap = 1U;
+    }
+
+    Bytes Cipher(const std::string &hex)
+    {
+        Bytes plain = FromHex(hex);
+        csm_array array;
+        csm_array_init(&array, buf, sizeof(buf), 0U, cOffset);
+        REQUIRE(csm_array_write_buff(&array, plain.data(), plain.size()) == TRUE);
+        REQUIRE(csm_sec_wrap_apdu(&array, &request, key_id, csm_sys_get_system_title(), sc, gClientIc++) == CSM_SEC_OK);
+        return Bytes(csm_array_start(&array), csm_array_start(&array) + csm_array_written(&array));
+    }
+
+    // Plain response, empty if it cannot be deciphered
+    Bytes Decipher(const Bytes &apdu)
+    {
+        Bytes plain;
+        csm_array array;
+        csm_array_init(&array, buf, sizeof(buf), 0U, cOffset);
+        REQUIRE(csm_array_write_buff(&array, apdu.data(), apdu.size()) == TRUE);
+
+        uint8_t tag = 0U;
+        csm_sec_key key = CSM_SEC_GUEK;
+        csm_sec_control_byte response_sc;
+        uint32_t response_ic = 0U;
+        REQUIRE(csm_array_read_u8(&array, &tag) == TRUE);
+        REQUIRE(csm_sec_plain_tag(tag, &key) != 0U);
+        REQUIRE(key == key_id);
+        if (csm_sec_unwrap_apdu(&array, &request, key, csm_sys_get_system_title(), &response_sc, &response_ic) == CSM_SEC_OK)
+        {
+            plain.assign(csm_array_start(&array), csm_array_start(&array) + csm_array_written(&array));
+            REQUIRE(plain[0] == csm_sec_plain_tag(tag, &key));
+        }
+        return plain;
+    }
+
+    // Reads an attribute by block with glo-/ded- requests and responses
+    Bytes GetByBlock(TestServer &server, const std::string &get_request, uint32_t &nb_blocks)
+    {
+        Bytes data;
+        Bytes reply = Decipher(server.Request(Cipher(get_request)));
+        nb_blocks = 0U;
+
+        while ((reply.size() > 8U) && (reply[1] == SVC_GET_RESPONSE_WITH_DATABLOCK))
+        {
+            nb_blocks++;
+            REQUIRE(nb_blocks < 1000U);
+            csm_array array;
+            csm_array_init(&array, reply.data(), reply.size(), reply.size() - 9U, 9U);
+            ber_length size;
+            REQUIRE(csm_ber_read_len(&array, &size) == TRUE);
+            data.insert(data.end(), csm_array_rd_current(&array), csm_array_rd_current(&array) + size.length);
+
+            if (reply[3] == 1U)
+            {
+                break; // last block
+            }
+            char next[32];
+            snprintf(next, sizeof(next), "C002C1%02X%02X%02X%02X", reply[4], reply[5], reply[6], reply[7]);
+            Bytes ciphered = server.Request(Cipher(next));
+            REQUIRE(ciphered.size() <= server.ctx.asso.handshake.client_max_receive_pdu_size);
+            reply = Decipher(ciphered);
+        }
+        return data;
+    }
+
+    csm_sec_key key_id;
+    csm_sec_control_byte sc;
+    csm_request request;
+    uint8_t buf[2048];
+};
+
+static void SetCipheringKeys(TestServer &server)
+{
+    static const uint8_t guek[16] = { 0x00U,0x01U,0x02U,0x03U,0x04U,0x05U,0x06U,0x07U,0x08U,0x09U,0x0AU,0x0BU,0x0CU,0x0DU,0x0EU,0x0FU };
+    static const uint8_t gak[16] = { 0xD0U,0xD1U,0xD2U,0xD3U,0xD4U,0xD5U,0xD6U,0xD7U,0xD8U,0xD9U,0xDAU,0xDBU,0xDCU,0xDDU,0xDEU,0xDFU };
+    static const uint8_t dek[16] = { 0xA0U,0xA1U,0xA2U,0xA3U,0xA4U,0xA5U,0xA6U,0xA7U,0xA8U,0xA9U,0xAAU,0xABU,0xACU,0xADU,0xAEU,0xAFU };
+
+    csm_sys_set_key(1U, CSM_SEC_GUEK, guek);
+    csm_sys_set_key(1U, CSM_SEC_GAK, gak);
+    csm_sys_set_key(1U, CSM_SEC_DEK, dek);
+
+    server.ctx.asso.ref = LN_REF_WITH_CYPHERING;
+    memcpy(server.ctx.asso.client_app_title, csm_sys_get_system_title(), CSM_DEF_APP_TITLE_SIZE);
+}
+
+TEST_CASE("CipheredServices", "[services]")
+{
+    TestServer server;
+    SetCipheringKeys(server);
+    gWritten.clear();
+
+    // glo-get-request, E + A
+    TestCipher glo;
+    Bytes reply = server.Request(glo.Cipher("C001C100010000600104FF0200"));
+    REQUIRE(reply[0] == AXDR_GLO_GET_RESPONSE);
+    REQUIRE(reply[2] == 0x30U);
+    REQUIRE(reply.size() == (2U + CSM_DEF_SEC_HDR_SIZE + 11U + 12U));
+    REQUIRE(glo.Decipher(reply) == FromHex("C401C10009050404040404"));
+
+    // glo-set-request, authentication only: same protection for the response
+    TestCipher auth(CSM_SEC_GUEK, 0x10U);
+    reply = server.Request(auth.Cipher("C101C100010000600105FF0200 0901 33"));
+    REQUIRE(reply[0] == AXDR_GLO_SET_RESPONSE);
+    REQUIRE(reply[2] == 0x10U);
+    REQUIRE(auth.Decipher(reply) == FromHex("C501C100"));
+    REQUIRE(gWritten[5] == FromHex("33"));
+
+    // glo-action-request, encryption only
+    TestCipher enc(CSM_SEC_GUEK, 0x20U);
+    reply = server.Request(enc.Cipher("C301C100010000600104FF01011101"));
+    REQUIRE(reply[0] == AXDR_GLO_ACTION_RESPONSE);
+    REQUIRE(reply[2] == 0x20U);
+    REQUIRE(enc.Decipher(reply) == FromHex("C701C100010011 05"));
+
+    // ded-get-request with the dedicated key
+    TestCipher ded(CSM_SEC_DEK);
+    reply = server.Request(ded.Cipher("C001C100010000600104FF0200"));
+    REQUIRE(reply[0] == AXDR_DED_GET_RESPONSE);
+    REQUIRE(ded.Decipher(reply) == FromHex("C401C10009050404040404"));
+
+    // The clear requests are still accepted without security policy
+    REQUIRE(server.Request("C001C100010000600104FF0200") == FromHex("C401C10009050404040404"));
+
+    // Bad tag
+    Bytes request = glo.Cipher("C001C100010000600104FF0200");
+    request.back() ^= 0x01U;
+    REQUIRE(server.Request(request) == FromHex("D80105"));
+
+    // Ciphered APDU of another service
+    REQUIRE(server.Request(glo.Cipher("C101C100010000600105FF0200 0901 33")).size() > 0U);
+    request = glo.Cipher("C001C100010000600104FF0200");
+    request[0] = AXDR_GLO_SET_REQUEST;
+    REQUIRE(server.Request(request) == FromHex("D80101"));
+
+    // No dedicated key
+    request = ded.Cipher("C001C100010000600104FF0200");
+    csm_sys_set_key(1U, CSM_SEC_DEK, nullptr);
+    REQUIRE(server.Request(request) == FromHex("D80105"));
+
+    // No ciphering context
+    server.ctx.asso.ref = LN_REF;
+    REQUIRE(server.Request(glo.Cipher("C001C100010000600104FF0200")) == FromHex("D80101"));
+}
+
+TEST_CASE("ClientCiphered", "[services]")
+{
+    TestServer server;
+    SetCipheringKeys(server);
+
+    // The server and the client share the invocation counters of this HAL: the client checks the
+    // counter of the server under another SAP
+    csm_request request;
+    memset(&request, 0, sizeof(request));
+    request.channel_id = 1;
+    request.llc.ssap = 1U;
+    request.llc.dsap = 0x7FU;
+    csm_sec_control_byte sc;
+    sc.sh_byte = 0x30U;
+
+    for (csm_sec_key key_id : {CSM_SEC_GUEK, CSM_SEC_DEK})
+    {
+        uint8_t buf[1024];
+        csm_array array;
+        csm_array_init(&array, buf, sizeof(buf), 0U, TestCipher::cOffset);
+        Bytes plain = FromHex("C001C100010000600104FF0200");
+        REQUIRE(csm_array_write_buff(&array, plain.data(), plain.size()) == TRUE);
+        REQUIRE(csm_client_encode_ciphered(&request, &array, key_id, sc, gClientIc++) == TRUE);
+
+        Bytes ciphered(csm_array_start(&array), csm_array_start(&array) + csm_array_written(&array));
+        REQUIRE(ciphered[0] == ((key_id == CSM_SEC_GUEK) ? AXDR_GLO_GET_REQUEST : AXDR_DED_GET_REQUEST));
+        Bytes reply = server.Request(ciphered);
+        REQUIRE(reply[0] == ((key_id == CSM_SEC_GUEK) ? AXDR_GLO_GET_RESPONSE : AXDR_DED_GET_RESPONSE));
+
+        csm_response response;
+        csm_client_init(&request, &response);
+        csm_array_init(&array, buf, sizeof(buf), 0U, TestCipher::cOffset);
+        REQUIRE(csm_array_write_buff(&array, reply.data(), reply.size()) == TRUE);
+        REQUIRE(csm_client_decode_ciphered(&response, &request, &array, csm_sys_get_system_title()) == TRUE);
+        REQUIRE(response.service == SVC_GET);
+        REQUIRE(response.access_result == CSM_ACCESS_RESULT_SUCCESS);
+        REQUIRE(Bytes(csm_array_rd_current(&array), csm_array_rd_current(&array) + csm_array_unread(&array)) == FromHex("09050404040404"));
+
+        // Replay of the response
+        csm_array_init(&array, buf, sizeof(buf), 0U, TestCipher::cOffset);
+        REQUIRE(csm_array_write_buff(&array, reply.data(), reply.size()) == TRUE);
+        REQUIRE(csm_client_decode_ciphered(&response, &request, &array, csm_sys_get_system_title()) == FALSE);
+    }
+
+    // Tampered response
+    uint8_t buf[1024];
+    csm_array array;
+    csm_array_init(&array, buf, sizeof(buf), 0U, TestCipher::cOffset);
+    Bytes plain = FromHex("C001C100010000600104FF0200");
+    REQUIRE(csm_array_write_buff(&array, plain.data(), plain.size()) == TRUE);
+    REQUIRE(csm_client_encode_ciphered(&request, &array, CSM_SEC_GUEK, sc, gClientIc++) == TRUE);
+    Bytes reply = server.Request(Bytes(csm_array_start(&array), csm_array_start(&array) + csm_array_written(&array)));
+    reply.back() ^= 0x01U;
+    csm_response response;
+    csm_array_init(&array, buf, sizeof(buf), 0U, TestCipher::cOffset);
+    REQUIRE(csm_array_write_buff(&array, reply.data(), reply.size()) == TRUE);
+    REQUIRE(csm_client_decode_ciphered(&response, &request, &array, csm_sys_get_system_title()) == FALSE);
+
+    // A clear response is decoded as is
+    reply = server.Request("C001C100010000600104FF0200");
+    csm_array_init(&array, reply.data(), reply.size(), reply.size(), 0U);
+    REQUIRE(csm_client_decode_ciphered(&response, &request, &array, csm_sys_get_system_title()) == TRUE);
+    REQUIRE(response.service == SVC_GET);
+}
+
+TEST_CASE("DedicatedKey", "[services]")
+{
+    TestServer server;
+    SetCipheringKeys(server);
+    csm_sys_set_key(1U, CSM_SEC_DEK, nullptr);
+
+    // AARQ with the dedicated key A0..AF in the InitiateRequest
+    server.ctx.asso.state_cf = CF_IDLE;
+    Bytes reply = server.Request("602EA109060760857405080101 BE21041F 01 01 10 A0A1A2A3A4A5A6A7A8A9AAABACADAEAF 00 00 06 5F1F0400FFFFFF FFFF");
+    REQUIRE(reply[0] == 0x61U);
+    REQUIRE(server.ctx.asso.state_cf == CF_ASSOCIATED);
+    REQUIRE(server.ctx.asso.has_dedicated_key == TRUE);
+
+    server.ctx.asso.ref = LN_REF_WITH_CYPHERING;
+    memcpy(server.ctx.asso.client_app_title, csm_sys_get_system_title(), CSM_DEF_APP_TITLE_SIZE);
+
+    TestCipher ded(CSM_SEC_DEK);
+    reply = server.Request(ded.Cipher("C001C100010000600104FF0200"));
+    REQUIRE(reply[0] == AXDR_DED_GET_RESPONSE);
+    REQUIRE(ded.Decipher(reply) == FromHex("C401C10009050404040404"));
+
+    // Released with the association
+    Bytes request = ded.Cipher("C001C100010000600104FF0200");
+    REQUIRE(server.Request("6200").size() > 0U);
+    REQUIRE(server.ctx.asso.state_cf == CF_IDLE);
+    server.ctx.asso.state_cf = CF_ASSOCIATED;
+    REQUIRE(server.Request(request) == FromHex("D80105"));
+}
+
+TEST_CASE("CipheredSecurityPolicy", "[services]")
+{
+    TestServer server;
+    SetCipheringKeys(server);
+    server.config.security_policy = CSM_SEC_POLICY_AUTHENTICATED_REQUEST | CSM_SEC_POLICY_ENCRYPTED_RESPONSE;
+
+    // Requests in clear or not authenticated are refused
+    REQUIRE(server.Request("C001C100010000600104FF0200") == FromHex("D80101"));
+    TestCipher enc(CSM_SEC_GUEK, 0x20U);
+    REQUIRE(server.Request(enc.Cipher("C001C100010000600104FF0200")) == FromHex("D80101"));
+
+    // The response is encrypted too
+    TestCipher auth(CSM_SEC_GUEK, 0x10U);
+    Bytes reply = server.Request(auth.Cipher("C001C100010000600104FF0200"));
+    REQUIRE(reply[0] == AXDR_GLO_GET_RESPONSE);
+    REQUIRE(reply[2] == 0x30U);
+    REQUIRE(auth.Decipher(reply) == FromHex("C401C10009050404040404"));
+}
+
+TEST_CASE("CipheredGetByBlock", "[services]")
+{
+    for (uint16_t pdu_size : {1024U, 200U, 64U})
+    {
+        TestServer clear;
+        TestServer server;
+        SetCipheringKeys(server);
+        clear.ctx.asso.handshake.client_max_receive_pdu_size = pdu_size;
+        server.ctx.asso.handshake.client_max_receive_pdu_size = pdu_size;
+        // The ciphered responses use the blocks of the service, even with GBT and zero copy
+        server.EnableGbt(4096U);
+        server.ctx.asso.zero_copy = TRUE;
+
+        uint32_t nb_blocks = 0U;
+        Bytes object_list = clear.GetByBlock("C001C1000F0000280000FF0200", nb_blocks);
+
+        TestCipher glo;
+        uint32_t nb_ciphered = 0U;
+        REQUIRE(glo.GetByBlock(server, "C001C1000F0000280000FF0200", nb_ciphered) == object_list);
+        REQUIRE(nb_ciphered >= nb_blocks);
+        REQUIRE(server.ctx.asso.payload.size == 0U);
+    }
+}
+
+TEST_CASE("CipheredReplay", "[services]")
+{
+    TestServer server;
+    SetCipheringKeys(server);
+
+    TestCipher glo;
+    Bytes request = glo.Cipher("C001C100010000600104FF0200");
+    Bytes reply = server.Request(request);
+    REQUIRE(glo.Decipher(reply) == FromHex("C401C10009050404040404"));
+    uint32_t server_ic = GET_BE32(&reply[3]);
+
+    // The same APDU, then an older invocation counter
+    REQUIRE(server.Request(request) == FromHex("D80106"));
+    gClientIc -= 2U;
+    REQUIRE(server.Request(glo.Cipher("C001C100010000600104FF0200")) == FromHex("D80106"));
+    gClientIc += 2U;
+
+    // A forged APDU does not move the counter of the client
+    request = glo.Cipher("C001C100010000600104FF0200");
+    request.back() ^= 0x01U;
+    REQUIRE(server.Request(request) == FromHex("D80105"));
+    gClientIc--;
+
+    // The counters of the keys are independent, the ones of the server always increase
+    TestCipher ded(CSM_SEC_DEK);
+    reply = server.Request(glo.Cipher("C001C100010000600104FF0200"));
+    REQUIRE(glo.Decipher(reply) == FromHex("C401C10009050404040404"));
+    REQUIRE(GET_BE32(&reply[3]) == (server_ic + 1U));
+    gClientIc--;
+    reply = server.Request(ded.Cipher("C001C100010000600104FF0200"));
+    REQUIRE(ded.Decipher(reply) == FromHex("C401C10009050404040404"));
+}